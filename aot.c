@@ -0,0 +1,47 @@
+#include "aot.h"
+#include <stdio.h>
+#include <dlfcn.h>
+
+void aot_execute(const AotModule *module, CPU *cpu, uint64_t max_cycles) {
+    if (cpu->model != module->model || cpu->coverage) {
+        cpu_execute(cpu, max_cycles);
+        return;
+    }
+    uint64_t limit = max_cycles > UINT64_MAX - cpu->cycles ? UINT64_MAX : cpu->cycles + max_cycles;
+    while (cpu->cycles < limit && !cpu->halted) {
+        uint64_t before = cpu->instructions;
+        module->run(cpu, limit);
+        // Nothing compiled here, or not enough cycles left for a whole block
+        if (cpu->instructions == before) cpu_step(cpu);
+    }
+}
+
+const AotModule *aot_load(const char *path, const char *symbol) {
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "Error: Cannot load compiled module: %s\n", dlerror());
+        return NULL;
+    }
+    const AotModule *module = dlsym(handle, symbol);
+    if (!module) {
+        fprintf(stderr, "Error: '%s' has no symbol '%s'\n", path, symbol);
+        dlclose(handle);
+        return NULL;
+    }
+    if (module->abi != AOT_ABI || module->cpu_size != sizeof(CPU)) {
+        fprintf(stderr, "Error: '%s' was generated for another build of the emulator; run 6502recomp again\n", path);
+        dlclose(handle);
+        return NULL;
+    }
+    return module;
+}
+
+int aot_page_intact(const AotPage *page, uint64_t *checked) {
+    uint8_t bytes[MEMORY_PAGE_SIZE];
+    memory_copy_out((uint16_t)(page->page * MEMORY_PAGE_SIZE), bytes, sizeof(bytes));
+    for (int i = 0; i < MEMORY_PAGE_SIZE; i++) {
+        if ((page->mask[i >> 3] >> (i & 7) & 1) && bytes[i] != page->bytes[i]) return 0;
+    }
+    *checked = memory_page_hash(page->page);
+    return 1;
+}
@@ -0,0 +1,113 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+#include "cpu.h"
+#include "memory.h"
+
+// Ahead-of-time compiled code: 6502recomp turns the routines of an image
+// into C, one function per routine, which is compiled into a module that
+// runs in place of the interpreter wherever the PC is in code it covers.
+// Everything else goes through cpu_step: instructions the module does not
+// compile (BRK, RTI, indirect jumps, undocumented and illegal opcodes, ADC
+// and SBC in decimal mode), code it never found, and code that no longer
+// holds the bytes it was compiled from. Either way the CPU and memory end
+// up exactly as cpu_execute would leave them, cycle for cycle.
+//
+// This header is the interface between the emulator and generated modules:
+// the module description, and the helpers the generated code calls.
+
+// Changed whenever the module layout or the CPU struct changes, so that a
+// stale module is refused rather than run
+#define AOT_ABI 1
+
+// One page holding compiled code
+typedef struct {
+    uint8_t page;
+    uint8_t mask[MEMORY_PAGE_SIZE / 8];     // Which bytes are code
+    uint8_t bytes[MEMORY_PAGE_SIZE];        // What those hold in the image
+} AotPage;
+
+typedef struct {
+    uint32_t abi;           // AOT_ABI
+    uint32_t cpu_size;      // sizeof(CPU)
+    uint8_t model;          // CpuModel compiled for
+    const char *image;      // File compiled from
+    int routines;
+    // Run compiled code from cpu->PC for as long as it covers the PC and
+    // whole blocks fit below the cycle limit; may run nothing at all
+    void (*run)(CPU *cpu, uint64_t limit);
+} AotModule;
+
+// cpu_execute through module. Idle loops are stepped, never fast-forwarded.
+// Without compiled code for the CPU's model, or with coverage on, it is
+// plain cpu_execute.
+void aot_execute(const AotModule *module, CPU *cpu, uint64_t max_cycles);
+
+// Load the module symbol of a shared object built from 6502recomp output.
+// Prints an error and returns NULL on failure.
+const AotModule *aot_load(const char *path, const char *symbol);
+
+// Whether page's code bytes in the bound address space still hold the
+// image's; *checked is the page hash they were last found to in
+int aot_page_intact(const AotPage *page, uint64_t *checked);
+
+// Helpers for generated code
+
+static inline int aot_page_ok(const AotPage *page, uint64_t *checked) {
+    return memory_page_hash(page->page) == *checked || aot_page_intact(page, checked);
+}
+
+// Whether a write to address hits compiled code; index maps pages to their
+// entries in pages (-1: none)
+static inline int aot_is_code(const AotPage *pages, const int16_t *index, uint16_t address) {
+    int i = index[address >> 8];
+    return i >= 0 && pages[i].mask[(address & 0xFF) >> 3] >> (address & 7) & 1;
+}
+
+// Memory accesses bring the CPU's cycle count up to date first, as devices
+// such as the timer read it
+static inline uint8_t aot_read(CPU *cpu, uint64_t cycles, uint16_t address) {
+    cpu->cycles = cycles;
+    return memory_read(address);
+}
+
+static inline void aot_write(CPU *cpu, uint64_t cycles, uint16_t address, uint8_t value) {
+    cpu->cycles = cycles;
+    memory_write(address, value);
+}
+
+static inline uint8_t aot_zn(uint8_t status, uint8_t value) {
+    return (uint8_t)((status & ~(FLAG_N | FLAG_Z)) | (value & FLAG_N) | (value ? 0 : FLAG_Z));
+}
+
+// Binary ADC and SBC (decimal mode is left to the interpreter); return A
+static inline uint8_t aot_adc(uint8_t *status, uint8_t a, uint8_t value) {
+    unsigned sum = a + value + (*status & FLAG_C);
+    uint8_t p = *status & ~(FLAG_C | FLAG_V);
+    if (sum > 0xFF) p |= FLAG_C;
+    if ((a ^ sum) & (value ^ sum) & 0x80) p |= FLAG_V;
+    *status = aot_zn(p, (uint8_t)sum);
+    return (uint8_t)sum;
+}
+
+static inline uint8_t aot_sbc(uint8_t *status, uint8_t a, uint8_t value) {
+    unsigned diff = a - value - !(*status & FLAG_C);
+    uint8_t p = *status & ~(FLAG_C | FLAG_V);
+    if (diff < 0x100) p |= FLAG_C;
+    if ((a ^ value) & (a ^ diff) & 0x80) p |= FLAG_V;
+    *status = aot_zn(p, (uint8_t)diff);
+    return (uint8_t)diff;
+}
+
+static inline uint8_t aot_compare(uint8_t status, uint8_t reg, uint8_t value) {
+    status = aot_zn(status, (uint8_t)(reg - value));
+    return reg >= value ? status | FLAG_C : status & ~FLAG_C;
+}
+
+static inline uint8_t aot_bit(uint8_t status, uint8_t a, uint8_t value) {
+    status = (uint8_t)((status & ~(FLAG_N | FLAG_V | FLAG_Z)) | (value & (FLAG_N | FLAG_V)));
+    return (a & value) ? status : status | FLAG_Z;
+}
+
+#endif
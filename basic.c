@@ -1,33 +1,79 @@
+#define _DEFAULT_SOURCE
 #include "basic.h"
-#include "cpu.h"
 #include "memory.h"
+#include "journal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define PROGRAM_START 0x0800
 #define VARIABLES_START 0x0200
 #define STACK_START 0x0100
 #define MAX_LINE_LEN 256
-#define MAX_LINES 256
+#define MAX_LINES 65536
+#define MAX_TOKENS 64
+#define VAR_COUNT 78            // A-Z, then A%-Z%, then A$-Z$
+#define IS_PLAIN_VAR(v) ((v) < 26)
+#define IS_INT16_VAR(v) ((v) >= 26 && (v) < 52)
+#define IS_STRING_VAR(v) ((v) >= 52)
+#define STACK_DEPTH (MAX_TOKENS + 2)
 
+// Strings are slices of the literal pool (at has IN_POOL set) or of the
+// string heap, a bump-allocated arena. The slicing functions share the bytes
+// they slice; only concatenation, STR$ and INPUT copy into the heap. The
+// heap is compacted between lines, when the only live strings are the ones
+// held in variables.
+#define IN_POOL 0x80000000u
+#define HEAP_INITIAL 16384
+#define HEAP_MAX (16u << 20)
+
+// A value on the evaluation stack or in a variable. Which member is live is
+// known when the program is compiled, so values carry no tag. All-zero bits
+// are 0, 0.0 and the empty string.
+typedef union {
+    int32_t i;
+    double f;
+    struct {
+        uint32_t at, len;
+    } s;
+} Value;
+
+// A compiled line, as the interpreter runs it and as images store it
 typedef struct {
+    uint32_t code;          // Offset of the compiled line
+    uint32_t for_limit;     // Offset of the limit of the FOR the line starts with
     uint16_t line_num;
-    char text[MAX_LINE_LEN];
-    uint16_t addr;
-} BasicLine;
+    int8_t for_var;         // That FOR's variable, or -1
+    uint8_t for_real;       // Its NEXT compares as reals
+} LineEntry;
+
+// A compiled program: buffers the compiler filled, or sections of a mapped
+// image. Nothing writes to it after it is built, so interpreters on any
+// number of threads can run the same one.
+struct BasicProgram {
+    const LineEntry *lines;
+    const int32_t *code;
+    const double *constants;
+    const char *strings;    // Literals and messages; CHR$ table at 0
+    uint32_t line_count, code_len, constant_count, strings_len;
+    BasicMode mode;
+    uint32_t real_vars;     // Classic mode: bit v set if variable v (A-Z) is real
+    void *image;            // Mapping the above point into, or NULL if they are heap buffers
+    size_t image_size;
+};
 
-static BasicLine program[MAX_LINES];
-static int program_size = 0;
-static CPU cpu;
-static int32_t variables[26]; // A-Z variables
-static uint16_t current_line = 0;
-static char input_buffer[MAX_LINE_LEN];
 
 // Token types
 typedef enum {
     TOK_NUMBER,
+    TOK_REAL,               // Classic mode literal that is not a 32-bit integer
     TOK_VARIABLE,
     TOK_PLUS,
     TOK_MINUS,
@@ -51,42 +97,225 @@ typedef enum {
 typedef struct {
     TokenType type;
     int32_t value;
+    double real;
     char str[MAX_LINE_LEN];
 } Token;
 
-static Token tokens[64];
-static int token_count = 0;
-static int token_pos = 0;
+// Lines are compiled once, when loaded, into a stream of int32 words: a
+// sequence of statements (S_*) with their operands, ending in S_EOL. Each
+// expression inside one is postfix code (X_*) for a stack of Values,
+// ending in X_END. Every operation is specific to integers or reals.
+// Images hold this code as it is: changing these numbers or LineEntry
+// changes the image format, and needs a new IMAGE_VERSION.
+enum {
+    S_EOL,
+    S_PRINT,                // expr: print an integer
+    S_PRINT_REAL,           // expr
+    S_PRINT_STRING,         // expr
+    S_TEXT,                 // k: print strings + k (literals and syntax errors)
+    S_TAB,
+    S_NEWLINE,
+    S_LET,                  // v, expr
+    S_INPUT,                // v, kind
+    S_GOTO,                 // Index of the target line
+    S_GOTO_EXPR,            // expr: target looked up at run time
+    S_IF,                   // expr: end the line unless nonzero
+    S_FOR,                  // n: skip the limit expression that follows
+    S_NEXT,                 // v, kind, index of the FOR line or -1
+    S_POKE,                 // expr, expr
+    S_END,
+    S_MISMATCH              // Stop with a type mismatch
+};
+
+enum {
+    X_END,
+    X_INT,                  // n: push n
+    X_REAL,                 // k: push constants[k]
+    X_VAR,                  // v: push variable v
+    X_ADD, X_SUB, X_MUL, X_DIV, X_NEG,
+    X_ADDK,                 // n: add n
+    X_MULK,                 // n: multiply by n
+    X_SHL,                  // s: multiply by 2^s
+    X_DIVP,                 // s: divide by 2^s, truncating toward zero
+    X_DIVM,                 // m, s, neg: divide by a constant using a reciprocal
+    X_FADD, X_FSUB, X_FMUL, X_FDIV, X_FNEG,
+    X_FMULK,                // k: multiply by constants[k]
+    X_ITOF,
+    X_FTOI,                 // Round down to an integer; overflow outside 32 bits
+    X_FINT,                 // Round down, staying real
+    X_CHK16,                // Overflow unless the integer fits 16 bits
+    X_EQ, X_NE, X_LT, X_GT, X_LE, X_GE,
+    X_FEQ, X_FNE, X_FLT, X_FGT, X_FLE, X_FGE,
+    X_FTRUE,                // Real to truth value
+    X_PEEK,
+    X_ERROR,                // k: print strings + k
+    X_MISMATCH,             // Stop with a type mismatch, leaving a zero Value
+    X_STRING,               // k, n: push the n bytes at strings + k
+    X_CONCAT,
+    X_SEQ, X_SNE, X_SLT, X_SGT, X_SLE, X_SGE,
+    X_LEN, X_LEFT, X_RIGHT,
+    X_MID,                  // String, start, length
+    X_CHR,
+    X_STR, X_FSTR,          // STR$ of an integer, of a real
+    X_VAL, X_FVAL           // VAL to an integer, to a real
+};
+
+// How INPUT and NEXT treat a variable
+enum {
+    KIND_INT,               // 32-bit integer, wrapping
+    KIND_INT16,             // A%-Z%: overflow outside 16 bits
+    KIND_REAL,
+    KIND_STRING
+};
+
+// What the compiler knows about an expression whose code starts at start.
+// Constants are always the two words X_INT n or X_REAL k.
+typedef struct {
+    int real;
+    int string;
+    int64_t lo, hi;         // Integers: bounds on the value
+    int constant;
+    Value value;
+    uint32_t start;
+} Expr;
+
+// One run of a program: variables, position, strings and I/O. The program
+// itself is shared and only read.
+struct BasicInterp {
+    const BasicProgram *prog;
+    BasicProgram *own_prog;     // Compiled or mapped by basic_load/basic_map_image
+    BasicMode mode;             // For basic_load
+    Value vars[VAR_COUNT];
+    uint32_t current_line;
+    int failed;             // A run-time error stopped the program
+    int waiting;            // INPUT found no line yet
+    int resuming;           // The next run of resume_line starts at the INPUT
+    uint32_t resume_line;   // that waited, at resume_code, not at the line's
+    uint32_t resume_code;   // first statement
+    char input_buffer[MAX_LINE_LEN];
+    uint64_t lines_executed;
+    BasicOutputFn output;   // NULL: stdout
+    void *output_ctx;
+    BasicInputFn input;     // NULL: read through journal
+    void *input_ctx;
+    Journal *journal;       // Source of INPUT lines (NULL: stdin)
+    char *heap;             // String heap
+    uint32_t heap_used, heap_size;
+};
+
+// Scratch state of basic_compile
+typedef struct {
+    const char **line_text;         // Each line after its number
+    int program_size;
+    BasicMode mode;
+    uint32_t real_seed;             // Classic mode: A-Z that start out real
+
+    // Compiled program
+    LineEntry *line_table;          // Line numbers filled in by the caller
+    int32_t *code;
+    uint32_t code_len, code_cap;
+    double *constants;
+    uint32_t constant_count, constant_cap;
+    char *strings;
+    uint32_t strings_len, strings_cap;
+    int out_of_memory;
+
+    Token tokens[MAX_TOKENS + 1];
+    int token_count;
+    int token_pos;
+    uint8_t var_real[VAR_COUNT];    // Classic mode: A-Z that may hold non-integers
+    int64_t var_lo[VAR_COUNT], var_hi[VAR_COUNT];
+    uint8_t var_widened[VAR_COUNT];
+    int inferring;                  // Collecting variable ranges, not generating code
+    int inference_changed;
+} Compiler;
+
+
+static void out_bytes(BasicInterp *bi, const char *text, uint32_t len) {
+    if (bi->output) {
+        bi->output(bi->output_ctx, text, (int)len);
+    } else {
+        fwrite(text, 1, len, stdout);
+    }
+}
+
+static void out_text(BasicInterp *bi, const char *text) {
+    out_bytes(bi, text, (uint32_t)strlen(text));
+}
+
+static void out_printf(BasicInterp *bi, const char *fmt, ...) {
+    char buf[MAX_LINE_LEN + 64];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    out_text(bi, buf);
+}
+
+// Stop the program, naming the line it stopped in
+static void runtime_error(BasicInterp *bi, const char *what) {
+    if (!bi->failed) {
+        const BasicProgram *prog = bi->prog;
+        if (bi->current_line < prog->line_count &&
+            prog->lines[bi->current_line].line_num != BASIC_DIRECT_LINE) {
+            out_printf(bi, "%s in line %d\n", what, prog->lines[bi->current_line].line_num);
+        } else {
+            out_printf(bi, "%s\n", what);
+        }
+    }
+    bi->failed = 1;
+}
+
+// Round toward minus infinity without libm; larger magnitudes are integral
+static double round_down(double f) {
+    if (!(f > -4503599627370496.0 && f < 4503599627370496.0)) return f;
+    double t = (double)(int64_t)f;
+    return t > f ? t - 1 : t;
+}
 
 // Tokenizer
 static void skip_spaces(const char **p) {
     while (**p == ' ' || **p == '\t') (*p)++;
 }
 
-static int is_keyword(const char *p, const char *keyword) {
-    int len = strlen(keyword);
-    if (strncmp(p, keyword, len) == 0 && !isalnum(p[len])) {
-        return len;
-    }
-    return 0;
+static int is_keyword(const Token *tok, const char *keyword) {
+    return tok->type == TOK_UNKNOWN && strcmp(tok->str, keyword) == 0;
 }
 
-static void tokenize(const char *line) {
-    token_count = 0;
+static void tokenize(Compiler *comp, const char *line) {
+    comp->token_count = 0;
     const char *p = line;
-    
-    while (*p && token_count < 64) {
+
+    while (*p && comp->token_count < MAX_TOKENS) {
         skip_spaces(&p);
         if (*p == 0) break;
-        
-        Token *tok = &tokens[token_count++];
-        
-        if (isdigit(*p)) {
+
+        Token *tok = &comp->tokens[comp->token_count++];
+
+        if (comp->mode == BASIC_MODE_CLASSIC && (isdigit(*p) || (*p == '.' && isdigit(p[1])))) {
+            char *end;
+            tok->real = strtod(p, &end);
+            p = end;
+            if (tok->real <= INT32_MAX && tok->real == (double)(int32_t)tok->real) {
+                tok->type = TOK_NUMBER;
+                tok->value = (int32_t)tok->real;
+            } else {
+                tok->type = TOK_REAL;
+            }
+        } else if (isdigit(*p)) {
             tok->type = TOK_NUMBER;
             tok->value = atoi(p);
             while (isdigit(*p)) p++;
         } else if (isalpha(*p)) {
-            if (isupper(*p) && (!p[1] || !isalnum(p[1]))) {
+            if (isupper(*p) && p[1] == '%') {
+                tok->type = TOK_VARIABLE;
+                tok->value = 26 + (*p - 'A');
+                p += 2;
+            } else if (isupper(*p) && p[1] == '$') {
+                tok->type = TOK_VARIABLE;
+                tok->value = 52 + (*p - 'A');
+                p += 2;
+            } else if (isupper(*p) && (!p[1] || !isalnum(p[1]))) {
                 tok->type = TOK_VARIABLE;
                 tok->value = *p - 'A';
                 p++;
@@ -96,6 +325,7 @@ static void tokenize(const char *line) {
                 while (isalnum(*p) && i < MAX_LINE_LEN - 1) {
                     tok->str[i++] = toupper(*p++);
                 }
+                if (*p == '$' && i < MAX_LINE_LEN - 1) tok->str[i++] = *p++; // LEFT$
                 tok->str[i] = 0;
             }
         } else if (*p == '"') {
@@ -159,387 +389,2077 @@ static void tokenize(const char *line) {
             tok->str[1] = 0;
         }
     }
-    
-    tokens[token_count].type = TOK_EOL;
+
+    comp->tokens[comp->token_count].type = TOK_EOL;
 }
 
-// Expression evaluator
-static int32_t eval_expression();
+static int next_is(Compiler *comp, TokenType type) {
+    return comp->token_pos < comp->token_count && comp->tokens[comp->token_pos].type == type;
+}
 
-static int32_t eval_primary() {
-    if (token_pos >= token_count) return 0;
-    
-    Token *tok = &tokens[token_pos];
-    
-    if (tok->type == TOK_NUMBER) {
-        token_pos++;
-        return tok->value;
-    } else if (tok->type == TOK_VARIABLE) {
-        token_pos++;
-        return variables[tok->value];
-    } else if (tok->type == TOK_UNKNOWN && strcmp(tok->str, "PEEK") == 0) {
-        // PEEK function
-        token_pos++;
-        if (token_pos < token_count && tokens[token_pos].type == TOK_LPAREN) {
-            token_pos++;
-            int32_t address = eval_expression();
-            if (token_pos < token_count && tokens[token_pos].type == TOK_RPAREN) {
-                token_pos++;
+static int next_is_keyword(Compiler *comp, const char *keyword) {
+    return comp->token_pos < comp->token_count && is_keyword(&comp->tokens[comp->token_pos], keyword);
+}
+
+// Code generation
+static void emit(Compiler *comp, int32_t word) {
+    if (comp->code_len == comp->code_cap) {
+        uint32_t cap = comp->code_cap ? comp->code_cap * 2 : 1024;
+        int32_t *code = realloc(comp->code, cap * sizeof(int32_t));
+        if (!code) {
+            comp->out_of_memory = 1;
+            return;
+        }
+        comp->code = code;
+        comp->code_cap = cap;
+    }
+    comp->code[comp->code_len++] = word;
+}
+
+// Put word at offset at, moving later code up
+static void insert_word(Compiler *comp, uint32_t at, int32_t word) {
+    emit(comp, 0);
+    if (comp->out_of_memory) return;
+    memmove(&comp->code[at + 1], &comp->code[at], (comp->code_len - 1 - at) * sizeof(int32_t));
+    comp->code[at] = word;
+}
+
+static void remove_words(Compiler *comp, uint32_t at, uint32_t count) {
+    memmove(&comp->code[at], &comp->code[at + count], (comp->code_len - at - count) * sizeof(int32_t));
+    comp->code_len -= count;
+}
+
+static int32_t add_constant(Compiler *comp, double f) {
+    for (uint32_t i = 0; i < comp->constant_count; i++) {
+        if (comp->constants[i] == f) return (int32_t)i;
+    }
+    if (comp->constant_count == comp->constant_cap) {
+        uint32_t cap = comp->constant_cap ? comp->constant_cap * 2 : 64;
+        double *constants = realloc(comp->constants, cap * sizeof(double));
+        if (!constants) {
+            comp->out_of_memory = 1;
+            return 0;
+        }
+        comp->constants = constants;
+        comp->constant_cap = cap;
+    }
+    comp->constants[comp->constant_count] = f;
+    return (int32_t)comp->constant_count++;
+}
+
+static int32_t add_bytes(Compiler *comp, const char *bytes, uint32_t len) {
+    if (comp->strings_len + len > comp->strings_cap) {
+        uint32_t cap = comp->strings_cap ? comp->strings_cap * 2 : 4096;
+        while (cap < comp->strings_len + len) cap *= 2;
+        char *strings = realloc(comp->strings, cap);
+        if (!strings) {
+            comp->out_of_memory = 1;
+            return 0;
+        }
+        comp->strings = strings;
+        comp->strings_cap = cap;
+    }
+    memcpy(comp->strings + comp->strings_len, bytes, len);
+    comp->strings_len += len;
+    return (int32_t)(comp->strings_len - len);
+}
+
+static int32_t add_string(Compiler *comp, const char *text) {
+    return add_bytes(comp, text, (uint32_t)strlen(text) + 1);
+}
+
+// Emit op followed by the pool offset of the formatted text
+static void emit_text(Compiler *comp, int op, const char *fmt, ...) {
+    char buf[MAX_LINE_LEN + 64];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    emit(comp, op);
+    emit(comp, add_string(comp, buf));
+}
+
+// Expression compiler. Integer results are tracked as ranges: in classic
+// mode an integer operation whose result could leave 32 bits is done in
+// reals instead, and stores to 16-bit variables skip the overflow check
+// when the range already fits. In integer mode arithmetic wraps at 32 bits,
+// as it always has.
+static Expr int_expr(uint32_t start, int64_t lo, int64_t hi) {
+    Expr e;
+    memset(&e, 0, sizeof(e));
+    e.start = start;
+    e.lo = lo;
+    e.hi = hi;
+    return e;
+}
+
+static Expr real_expr(uint32_t start) {
+    Expr e = int_expr(start, 0, 0);
+    e.real = 1;
+    return e;
+}
+
+static Expr full_int_expr(uint32_t start) {
+    return int_expr(start, INT32_MIN, INT32_MAX);
+}
+
+static Expr constant_int(Compiler *comp, uint32_t start, int32_t n) {
+    comp->code_len = start;
+    emit(comp, X_INT);
+    emit(comp, n);
+    Expr e = int_expr(start, n, n);
+    e.constant = 1;
+    e.value.i = n;
+    return e;
+}
+
+static Expr constant_real(Compiler *comp, uint32_t start, double f) {
+    comp->code_len = start;
+    emit(comp, X_REAL);
+    emit(comp, add_constant(comp, f));
+    Expr e = real_expr(start);
+    e.constant = 1;
+    e.value.f = f;
+    return e;
+}
+
+static int fits_int32(int64_t lo, int64_t hi) {
+    return lo >= INT32_MIN && hi <= INT32_MAX;
+}
+
+static Expr string_expr(uint32_t start) {
+    Expr e = int_expr(start, 0, 0);
+    e.string = 1;
+    return e;
+}
+
+// A string where a number is wanted, or the other way round: the code
+// stops the program there, and compiling goes on with the type wanted
+static void mismatch(Compiler *comp, Expr *e, uint32_t end, int string) {
+    insert_word(comp, end, X_MISMATCH);
+    *e = string ? string_expr(e->start) : int_expr(e->start, 0, 0);
+}
+
+static void make_numeric(Compiler *comp, Expr *e, uint32_t end) {
+    if (e->string) mismatch(comp, e, end, 0);
+}
+
+static void make_string(Compiler *comp, Expr *e, uint32_t end) {
+    if (!e->string) mismatch(comp, e, end, 1);
+}
+
+// Make e, whose code ends at end, a real
+static void make_real(Compiler *comp, Expr *e, uint32_t end) {
+    make_numeric(comp, e, end);
+    if (e->real || comp->out_of_memory) return;
+    if (e->constant) {
+        e->value.f = (double)e->value.i;
+        comp->code[e->start] = X_REAL;
+        comp->code[e->start + 1] = add_constant(comp, e->value.f);
+    } else {
+        insert_word(comp, end, X_ITOF);
+    }
+    e->real = 1;
+}
+
+// Make e, the last code emitted, an integer
+static void make_int(Compiler *comp, Expr *e) {
+    make_numeric(comp, e, comp->code_len);
+    if (!e->real) return;
+    if (e->constant) {
+        double f = round_down(e->value.f);
+        if (f >= INT32_MIN && f <= INT32_MAX) {
+            *e = constant_int(comp, e->start, (int32_t)f);
+            return;
+        }
+    }
+    emit(comp, X_FTOI);
+    *e = full_int_expr(e->start);
+}
+
+static Expr variable(Compiler *comp, uint32_t start, int v) {
+    emit(comp, X_VAR);
+    emit(comp, v);
+    if (IS_STRING_VAR(v)) return string_expr(start);
+    if (comp->var_real[v]) return real_expr(start);
+    return int_expr(start, comp->var_lo[v], comp->var_hi[v]);
+}
+
+static int32_t wrap_add(int32_t a, int32_t b) {
+    return (int32_t)((uint32_t)a + (uint32_t)b);
+}
+
+static int32_t wrap_mul(int32_t a, int32_t b) {
+    return (int32_t)((uint32_t)a * (uint32_t)b);
+}
+
+static int32_t wrap_neg(int32_t a) {
+    return (int32_t)(0u - (uint32_t)a);
+}
+
+static int power_of_two(int64_t n) {
+    if (n < 2 || (n & (n - 1))) return -1;
+    int shift = 0;
+    while ((1LL << shift) < n) shift++;
+    return shift;
+}
+
+// Division of a 32-bit magnitude by a constant d that is not a power of two:
+// with l = ceil(log2 d), s = 31 + l and m = floor(2^s / d) + 1, (n * m) >> s
+// equals n / d for every n <= 2^31, and m fits in 32 bits
+static void divide_magic(uint32_t d, uint32_t *m, int *s) {
+    int l = 0;
+    while ((1ULL << l) < d) l++;
+    *s = 31 + l;
+    *m = (uint32_t)((1ULL << *s) / d + 1);
+}
+
+static Expr negate(Compiler *comp, Expr e) {
+    make_numeric(comp, &e, comp->code_len);
+    if (e.constant) {
+        if (e.real) return constant_real(comp, e.start, -e.value.f);
+        if (comp->mode == BASIC_MODE_INTEGER || e.value.i != INT32_MIN) {
+            return constant_int(comp, e.start, wrap_neg(e.value.i));
+        }
+    }
+    if (!e.real && comp->mode == BASIC_MODE_CLASSIC && -e.lo > INT32_MAX) {
+        make_real(comp, &e, comp->code_len);
+    }
+    if (e.real) {
+        emit(comp, X_FNEG);
+        return real_expr(e.start);
+    }
+    emit(comp, X_NEG);
+    if (comp->mode == BASIC_MODE_INTEGER) return full_int_expr(e.start);
+    return int_expr(e.start, -e.hi, -e.lo);
+}
+
+// Integer a op constant c, a's code already emitted
+static void emit_int_constant_op(Compiler *comp, int op, int32_t c) {
+    int shift;
+    switch (op) {
+        case TOK_PLUS:
+        case TOK_MINUS:
+            if (op == TOK_MINUS) c = wrap_neg(c);
+            if (c != 0) {
+                emit(comp, X_ADDK);
+                emit(comp, c);
+            }
+            break;
+        case TOK_MULT:
+            if (c == 1) break;
+            if (c == -1) {
+                emit(comp, X_NEG);
+            } else if ((shift = power_of_two(c)) > 0) {
+                emit(comp, X_SHL);
+                emit(comp, shift);
             } else {
-                printf("Syntax error: expected ) in PEEK\n");
+                emit(comp, X_MULK);
+                emit(comp, c);
+            }
+            break;
+        case TOK_DIV: {
+            int64_t d = c < 0 ? -(int64_t)c : c;
+            if (c == 1) break;
+            if (c == -1) {
+                emit(comp, X_NEG);
+            } else if (c == 0 || c == INT32_MIN) {
+                emit(comp, X_INT);
+                emit(comp, c);
+                emit(comp, X_DIV);
+            } else if ((shift = power_of_two(d)) > 0) {
+                emit(comp, X_DIVP);
+                emit(comp, shift);
+                if (c < 0) emit(comp, X_NEG);
+            } else {
+                uint32_t m;
+                int s;
+                divide_magic((uint32_t)d, &m, &s);
+                emit(comp, X_DIVM);
+                emit(comp, (int32_t)m);
+                emit(comp, s);
+                emit(comp, c < 0);
+            }
+            break;
+        }
+    }
+}
+
+static Expr binary(Compiler *comp, Expr a, Expr b, int op) {
+    int classic = comp->mode == BASIC_MODE_CLASSIC;
+
+    if (op == TOK_PLUS && (a.string || b.string)) {
+        make_string(comp, &b, comp->code_len);
+        make_string(comp, &a, b.start);
+        emit(comp, X_CONCAT);
+        return string_expr(a.start);
+    }
+    if (b.string) make_numeric(comp, &b, comp->code_len);
+    if (a.string) {
+        make_numeric(comp, &a, b.start);
+        b.start++;
+    }
+
+    int64_t lo = INT32_MIN, hi = INT32_MAX;
+    int real = a.real || b.real || (classic && op == TOK_DIV);
+
+    if (!real && classic) {
+        if (op == TOK_PLUS) {
+            lo = a.lo + b.lo;
+            hi = a.hi + b.hi;
+        } else if (op == TOK_MINUS) {
+            lo = a.lo - b.hi;
+            hi = a.hi - b.lo;
+        } else {
+            int64_t p[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+            lo = hi = p[0];
+            for (int i = 1; i < 4; i++) {
+                if (p[i] < lo) lo = p[i];
+                if (p[i] > hi) hi = p[i];
             }
-            return memory_read((uint16_t)address);
+        }
+        real = !fits_int32(lo, hi);
+    }
+
+    if (real) {
+        // Converting a non-constant a inserts a word in front of b
+        int b_moves = !a.real && !a.constant;
+        make_real(comp, &b, comp->code_len);
+        make_real(comp, &a, b.start);
+        if (b_moves) b.start++;
+        if (a.constant && b.constant && !(op == TOK_DIV && b.value.f == 0)) {
+            double x = a.value.f, y = b.value.f;
+            double r = op == TOK_PLUS ? x + y : op == TOK_MINUS ? x - y : op == TOK_MULT ? x * y : x / y;
+            return constant_real(comp, a.start, r);
+        }
+        int shift = -1;
+        if (op == TOK_DIV && b.constant && b.value.f == (double)(int64_t)b.value.f) {
+            shift = power_of_two((int64_t)b.value.f);
+        }
+        if (shift > 0) {
+            // Exact: the reciprocal of a power of two is representable
+            comp->code_len = b.start;
+            emit(comp, X_FMULK);
+            emit(comp, add_constant(comp, 1.0 / (double)(1LL << shift)));
         } else {
-            printf("Syntax error: expected ( after PEEK\n");
+            emit(comp, op == TOK_PLUS ? X_FADD : op == TOK_MINUS ? X_FSUB : op == TOK_MULT ? X_FMUL : X_FDIV);
         }
-        return 0;
-    } else if (tok->type == TOK_LPAREN) {
-        token_pos++;
-        int32_t val = eval_expression();
-        if (token_pos < token_count && tokens[token_pos].type == TOK_RPAREN) {
-            token_pos++;
+        return real_expr(a.start);
+    }
+
+    if (a.constant && b.constant && !(op == TOK_DIV && b.value.i == 0)) {
+        int32_t x = a.value.i, y = b.value.i, r;
+        switch (op) {
+            case TOK_PLUS: r = wrap_add(x, y); break;
+            case TOK_MINUS: r = wrap_add(x, wrap_neg(y)); break;
+            case TOK_MULT: r = wrap_mul(x, y); break;
+            default: r = y == -1 ? wrap_neg(x) : x / y; break;
         }
-        return val;
-    } else if (tok->type == TOK_MINUS) {
-        token_pos++;
-        return -eval_primary();
+        return constant_int(comp, a.start, r);
+    }
+
+    if (a.constant && (op == TOK_PLUS || op == TOK_MULT)) {
+        // Commutative: move the constant to the right
+        int32_t c = a.value.i;
+        remove_words(comp, a.start, 2);
+        emit_int_constant_op(comp, op, c);
+    } else if (b.constant) {
+        comp->code_len = b.start;
+        emit_int_constant_op(comp, op, b.value.i);
+    } else {
+        emit(comp, op == TOK_PLUS ? X_ADD : op == TOK_MINUS ? X_SUB : op == TOK_MULT ? X_MUL : X_DIV);
+    }
+    return int_expr(a.start, lo, hi);
+}
+
+static Expr compile_expression(Compiler *comp);
+
+// PEEK( and INT(: the argument, or a syntax error when ( is missing
+static int function_argument(Compiler *comp, const char *name, Expr *arg) {
+    comp->token_pos++;
+    if (!next_is(comp, TOK_LPAREN)) {
+        emit_text(comp, X_ERROR, "Syntax error: expected ( after %s\n", name);
+        return 0;
+    }
+    comp->token_pos++;
+    *arg = compile_expression(comp);
+    return 1;
+}
+
+static void next_argument(Compiler *comp, const char *name) {
+    if (!next_is(comp, TOK_COMMA)) {
+        emit_text(comp, X_ERROR, "Syntax error: expected , in %s\n", name);
+        emit(comp, X_INT);
+        emit(comp, 0);
+        return;
+    }
+    comp->token_pos++;
+    Expr e = compile_expression(comp);
+    make_int(comp, &e);
+}
+
+static int is_string_function(const Token *tok) {
+    static const char *names[] = { "LEN", "LEFT$", "RIGHT$", "MID$", "CHR$", "STR$", "VAL" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (is_keyword(tok, names[i])) return 1;
     }
-    
     return 0;
 }
 
-static int32_t eval_term() {
-    int32_t val = eval_primary();
-    
-    while (token_pos < token_count) {
-        Token *tok = &tokens[token_pos];
-        if (tok->type == TOK_MULT) {
-            token_pos++;
-            val *= eval_primary();
-        } else if (tok->type == TOK_DIV) {
-            token_pos++;
-            int32_t divisor = eval_primary();
-            if (divisor != 0) val /= divisor;
+static Expr compile_string_function(Compiler *comp, uint32_t start) {
+    char name[8];
+    snprintf(name, sizeof(name), "%s", comp->tokens[comp->token_pos].str);
+    int returns_string = name[strlen(name) - 1] == '$';
+    Expr arg, result;
+
+    if (!function_argument(comp, name, &arg)) {
+        if (returns_string) {
+            emit(comp, X_STRING);
+            emit(comp, 0);
+            emit(comp, 0);
+            return string_expr(start);
+        }
+        emit(comp, X_INT);
+        emit(comp, 0);
+        return int_expr(start, 0, 0);
+    }
+
+    if (strcmp(name, "CHR$") == 0) {
+        make_int(comp, &arg);
+        emit(comp, X_CHR);
+        result = string_expr(start);
+    } else if (strcmp(name, "STR$") == 0) {
+        make_numeric(comp, &arg, comp->code_len);
+        emit(comp, arg.real ? X_FSTR : X_STR);
+        result = string_expr(start);
+    } else {
+        make_string(comp, &arg, comp->code_len);
+        if (strcmp(name, "LEN") == 0) {
+            emit(comp, X_LEN);
+            result = int_expr(start, 0, INT32_MAX);
+        } else if (strcmp(name, "VAL") == 0) {
+            int real = comp->mode == BASIC_MODE_CLASSIC;
+            emit(comp, real ? X_FVAL : X_VAL);
+            result = real ? real_expr(start) : full_int_expr(start);
         } else {
-            break;
+            next_argument(comp, name);
+            if (strcmp(name, "MID$") == 0) {
+                if (next_is(comp, TOK_COMMA)) {
+                    next_argument(comp, name);
+                } else {
+                    emit(comp, X_INT); // To the end
+                    emit(comp, INT32_MAX);
+                }
+                emit(comp, X_MID);
+            } else {
+                emit(comp, strcmp(name, "LEFT$") == 0 ? X_LEFT : X_RIGHT);
+            }
+            result = string_expr(start);
         }
     }
-    
-    return val;
+
+    if (next_is(comp, TOK_RPAREN)) comp->token_pos++;
+    return result;
 }
 
-static int32_t eval_expression() {
-    int32_t val = eval_term();
-    
-    while (token_pos < token_count) {
-        Token *tok = &tokens[token_pos];
-        if (tok->type == TOK_PLUS) {
-            token_pos++;
-            val += eval_term();
-        } else if (tok->type == TOK_MINUS) {
-            token_pos++;
-            val -= eval_term();
+static Expr compile_primary(Compiler *comp) {
+    uint32_t start = comp->code_len;
+    if (comp->token_pos >= comp->token_count) return constant_int(comp, start, 0);
+
+    Token *tok = &comp->tokens[comp->token_pos];
+    Expr e;
+
+    if (tok->type == TOK_NUMBER) {
+        comp->token_pos++;
+        return constant_int(comp, start, tok->value);
+    } else if (tok->type == TOK_REAL) {
+        comp->token_pos++;
+        return constant_real(comp, start, tok->real);
+    } else if (tok->type == TOK_VARIABLE) {
+        comp->token_pos++;
+        return variable(comp, start, tok->value);
+    } else if (tok->type == TOK_STRING) {
+        comp->token_pos++;
+        emit(comp, X_STRING);
+        emit(comp, add_string(comp, tok->str));
+        emit(comp, (int32_t)strlen(tok->str));
+        return string_expr(start);
+    } else if (is_string_function(tok)) {
+        return compile_string_function(comp, start);
+    } else if (is_keyword(tok, "PEEK")) {
+        if (!function_argument(comp, "PEEK", &e)) {
+            emit(comp, X_INT);
+            emit(comp, 0);
+            return int_expr(start, 0, 0);
+        }
+        make_int(comp, &e);
+        if (next_is(comp, TOK_RPAREN)) {
+            comp->token_pos++;
         } else {
-            break;
+            emit_text(comp, X_ERROR, "Syntax error: expected ) in PEEK\n");
         }
+        emit(comp, X_PEEK);
+        return int_expr(start, 0, 255);
+    } else if (is_keyword(tok, "INT")) {
+        if (!function_argument(comp, "INT", &e)) {
+            emit(comp, X_INT);
+            emit(comp, 0);
+            return int_expr(start, 0, 0);
+        }
+        if (next_is(comp, TOK_RPAREN)) comp->token_pos++;
+        make_numeric(comp, &e, comp->code_len);
+        if (!e.real) return e;
+        if (e.constant) return constant_real(comp, start, round_down(e.value.f));
+        emit(comp, X_FINT);
+        return real_expr(start);
+    } else if (tok->type == TOK_LPAREN) {
+        comp->token_pos++;
+        e = compile_expression(comp);
+        if (next_is(comp, TOK_RPAREN)) comp->token_pos++;
+        return e;
+    } else if (tok->type == TOK_MINUS) {
+        comp->token_pos++;
+        return negate(comp, compile_primary(comp));
     }
-    
-    return val;
+
+    return constant_int(comp, start, 0);
 }
 
-static int eval_condition() {
-    int32_t left = eval_expression();
-    
-    if (token_pos >= token_count) return left != 0;
-    
-    Token *tok = &tokens[token_pos];
-    TokenType op = tok->type;
-    
-    if (op == TOK_EQUALS || op == TOK_LT || op == TOK_GT || 
-        op == TOK_LE || op == TOK_GE || op == TOK_NE) {
-        token_pos++;
-        int32_t right = eval_expression();
-        
-        switch (op) {
-            case TOK_EQUALS: return left == right;
-            case TOK_LT: return left < right;
-            case TOK_GT: return left > right;
-            case TOK_LE: return left <= right;
-            case TOK_GE: return left >= right;
-            case TOK_NE: return left != right;
-            default: return 0;
+static Expr compile_term(Compiler *comp) {
+    Expr e = compile_primary(comp);
+
+    while (next_is(comp, TOK_MULT) || next_is(comp, TOK_DIV)) {
+        int op = comp->tokens[comp->token_pos++].type;
+        e = binary(comp, e, compile_primary(comp), op);
+    }
+
+    return e;
+}
+
+static Expr compile_expression(Compiler *comp) {
+    Expr e = compile_term(comp);
+
+    while (next_is(comp, TOK_PLUS) || next_is(comp, TOK_MINUS)) {
+        int op = comp->tokens[comp->token_pos++].type;
+        e = binary(comp, e, compile_term(comp), op);
+    }
+
+    return e;
+}
+
+// An integer truth value
+static void compile_condition(Compiler *comp) {
+    Expr left = compile_expression(comp);
+
+    if (comp->token_pos < comp->token_count) {
+        TokenType op = comp->tokens[comp->token_pos].type;
+        if (op == TOK_EQUALS || op == TOK_LT || op == TOK_GT ||
+            op == TOK_LE || op == TOK_GE || op == TOK_NE) {
+            comp->token_pos++;
+            Expr right = compile_expression(comp);
+            if (left.string && right.string) {
+                switch (op) {
+                    case TOK_EQUALS: emit(comp, X_SEQ); break;
+                    case TOK_LT: emit(comp, X_SLT); break;
+                    case TOK_GT: emit(comp, X_SGT); break;
+                    case TOK_LE: emit(comp, X_SLE); break;
+                    case TOK_GE: emit(comp, X_SGE); break;
+                    default: emit(comp, X_SNE); break;
+                }
+                return;
+            }
+            int left_moves = left.string;
+            make_numeric(comp, &right, comp->code_len);
+            make_numeric(comp, &left, right.start);
+            if (left_moves) right.start++;
+            int real = left.real || right.real;
+            if (real) {
+                make_real(comp, &right, comp->code_len);
+                make_real(comp, &left, right.start);
+            }
+            switch (op) {
+                case TOK_EQUALS: emit(comp, real ? X_FEQ : X_EQ); break;
+                case TOK_LT: emit(comp, real ? X_FLT : X_LT); break;
+                case TOK_GT: emit(comp, real ? X_FGT : X_GT); break;
+                case TOK_LE: emit(comp, real ? X_FLE : X_LE); break;
+                case TOK_GE: emit(comp, real ? X_FGE : X_GE); break;
+                default: emit(comp, real ? X_FNE : X_NE); break;
+            }
+            return;
         }
     }
-    
-    return left != 0;
+
+    make_numeric(comp, &left, comp->code_len);
+    if (left.real) emit(comp, X_FTRUE);
+}
+
+// Classic mode variable inference: A-Z start as integers holding 0 and stay
+// integers while every value assigned to them is an integer whose range
+// settles within 32 bits. A range still growing after a few passes (a
+// counter) makes the variable real.
+#define MAX_WIDENINGS 4
+
+static void make_var_real(Compiler *comp, int v) {
+    if (!comp->var_real[v]) {
+        comp->var_real[v] = 1;
+        comp->inference_changed = 1;
+    }
 }
 
-// Statement executors
-static void exec_print() {
+static void infer_assignment(Compiler *comp, int v, const Expr *e) {
+    if (!comp->inferring || !IS_PLAIN_VAR(v) || comp->var_real[v]) return;
+    if (e->real) {
+        make_var_real(comp, v);
+        return;
+    }
+    if (e->lo >= comp->var_lo[v] && e->hi <= comp->var_hi[v]) return;
+    if (++comp->var_widened[v] > MAX_WIDENINGS) {
+        make_var_real(comp, v);
+        return;
+    }
+    if (e->lo < comp->var_lo[v]) comp->var_lo[v] = e->lo;
+    if (e->hi > comp->var_hi[v]) comp->var_hi[v] = e->hi;
+    comp->inference_changed = 1;
+}
+
+static int var_kind(Compiler *comp, int v) {
+    if (IS_STRING_VAR(v)) return KIND_STRING;
+    if (IS_INT16_VAR(v)) return KIND_INT16;
+    return comp->var_real[v] ? KIND_REAL : KIND_INT;
+}
+
+// Convert e, the last code emitted, for storing in v and end the expression
+static void store_expression(Compiler *comp, int v, Expr *e) {
+    if (IS_STRING_VAR(v)) {
+        make_string(comp, e, comp->code_len);
+        emit(comp, X_END);
+        return;
+    }
+    make_numeric(comp, e, comp->code_len);
+    infer_assignment(comp, v, e);
+    if (comp->var_real[v]) {
+        make_real(comp, e, comp->code_len);
+    } else {
+        make_int(comp, e);
+        if (IS_INT16_VAR(v) && (e->lo < INT16_MIN || e->hi > INT16_MAX)) emit(comp, X_CHK16);
+    }
+    emit(comp, X_END);
+}
+
+// Statement compilers. Syntax errors become text printed when the statement
+// runs, in the order the original line-at-a-time interpreter printed them.
+static void compile_print(Compiler *comp) {
     int newline = 1;
-    
-    while (token_pos < token_count && tokens[token_pos].type != TOK_EOL) {
-        if (tokens[token_pos].type == TOK_STRING) {
-            printf("%s", tokens[token_pos].str);
-            token_pos++;
+
+    while (comp->token_pos < comp->token_count) {
+        Token *tok = &comp->tokens[comp->token_pos];
+        if (tok->type == TOK_STRING && tok[1].type != TOK_PLUS) {
+            emit_text(comp, S_TEXT, "%s", tok->str);
+            comp->token_pos++;
             newline = 1;
-        } else if (tokens[token_pos].type == TOK_SEMICOLON) {
-            token_pos++;
+        } else if (tok->type == TOK_SEMICOLON) {
+            comp->token_pos++;
             newline = 0;
-        } else if (tokens[token_pos].type == TOK_COMMA) {
-            printf("\t");
-            token_pos++;
+        } else if (tok->type == TOK_COMMA) {
+            emit(comp, S_TAB);
+            comp->token_pos++;
             newline = 1;
         } else {
-            printf("%d", eval_expression());
+            int pos = comp->token_pos;
+            uint32_t start = comp->code_len;
+            emit(comp, S_PRINT);
+            Expr e = compile_expression(comp);
+            if (comp->token_pos == pos) {
+                // Nothing an expression can start with
+                comp->code_len = start;
+                comp->token_pos++;
+                continue;
+            }
+            if (e.real) comp->code[start] = S_PRINT_REAL;
+            if (e.string) comp->code[start] = S_PRINT_STRING;
+            emit(comp, X_END);
             newline = 1;
         }
     }
-    
-    if (newline) printf("\n");
+
+    if (newline) emit(comp, S_NEWLINE);
 }
 
-static void exec_let() {
-    if (token_pos >= token_count || tokens[token_pos].type != TOK_VARIABLE) {
-        printf("Syntax error in LET\n");
+static void compile_let(Compiler *comp) {
+    if (!next_is(comp, TOK_VARIABLE)) {
+        emit_text(comp, S_TEXT, "Syntax error in LET\n");
         return;
     }
-    
-    int var_idx = tokens[token_pos].value;
-    token_pos++;
-    
-    if (token_pos >= token_count || tokens[token_pos].type != TOK_EQUALS) {
-        printf("Syntax error: expected =\n");
+    int v = comp->tokens[comp->token_pos++].value;
+
+    if (!next_is(comp, TOK_EQUALS)) {
+        emit_text(comp, S_TEXT, "Syntax error: expected =\n");
         return;
     }
-    token_pos++;
-    
-    variables[var_idx] = eval_expression();
-}
-
-static void exec_input() {
-    while (token_pos < token_count && tokens[token_pos].type != TOK_EOL) {
-        if (tokens[token_pos].type == TOK_STRING) {
-            printf("%s", tokens[token_pos].str);
-            token_pos++;
-        } else if (tokens[token_pos].type == TOK_VARIABLE) {
-            int var_idx = tokens[token_pos].value;
-            token_pos++;
-            
-            if (fgets(input_buffer, MAX_LINE_LEN, stdin)) {
-                variables[var_idx] = atoi(input_buffer);
-            }
-        } else if (tokens[token_pos].type == TOK_COMMA || 
-                   tokens[token_pos].type == TOK_SEMICOLON) {
-            token_pos++;
-        } else {
-            token_pos++;
+    comp->token_pos++;
+
+    emit(comp, S_LET);
+    emit(comp, v);
+    Expr e = compile_expression(comp);
+    store_expression(comp, v, &e);
+}
+
+static void compile_input(Compiler *comp) {
+    while (comp->token_pos < comp->token_count) {
+        Token *tok = &comp->tokens[comp->token_pos++];
+        if (tok->type == TOK_STRING) {
+            emit_text(comp, S_TEXT, "%s", tok->str);
+        } else if (tok->type == TOK_VARIABLE) {
+            if (comp->inferring && IS_PLAIN_VAR(tok->value)) make_var_real(comp, tok->value);
+            emit(comp, S_INPUT);
+            emit(comp, tok->value);
+            emit(comp, var_kind(comp, tok->value));
         }
     }
 }
 
-static int exec_goto() {
-    int target = eval_expression();
-    
-    for (int i = 0; i < program_size; i++) {
-        if (program[i].line_num == target) {
-            current_line = i;
-            return 1;
-        }
+static int find_line(const LineEntry *lines, int count, int32_t line_num) {
+    for (int i = 0; i < count; i++) {
+        if (lines[i].line_num == line_num) return i;
     }
-    
-    printf("Line %d not found\n", target);
-    return 0;
+    return -1;
 }
 
-static int exec_if() {
-    int condition = eval_condition();
-    
-    // Look for THEN
-    if (token_pos < token_count && tokens[token_pos].type == TOK_UNKNOWN &&
-        strcmp(tokens[token_pos].str, "THEN") == 0) {
-        token_pos++;
+// Returns 1 when the rest of the line can never run
+static int compile_goto(Compiler *comp) {
+    uint32_t start = comp->code_len;
+    emit(comp, S_GOTO_EXPR);
+    Expr e = compile_expression(comp);
+    make_int(comp, &e);
+    if (!e.constant || comp->out_of_memory) {
+        emit(comp, X_END);
+        return 0;
     }
-    
-    if (condition) {
-        // Execute the rest of the line
-        return 1;
-    } else {
-        // Skip to next line
+
+    // The usual case: resolved now
+    comp->code_len = start;
+    int target = find_line(comp->line_table, comp->program_size, e.value.i);
+    if (target < 0) {
+        emit_text(comp, S_TEXT, "Line %d not found\n", e.value.i);
         return 0;
     }
+    emit(comp, S_GOTO);
+    emit(comp, target);
+    return 1;
+}
+
+static void compile_if(Compiler *comp) {
+    emit(comp, S_IF);
+    compile_condition(comp);
+    emit(comp, X_END);
+    if (next_is_keyword(comp, "THEN")) comp->token_pos++;
 }
 
-static void exec_for() {
-    if (token_pos >= token_count || tokens[token_pos].type != TOK_VARIABLE) {
-        printf("Syntax error in FOR\n");
+static void compile_for(Compiler *comp, LineEntry *line, int first) {
+    if (!next_is(comp, TOK_VARIABLE)) {
+        emit_text(comp, S_TEXT, "Syntax error in FOR\n");
         return;
     }
-    
-    int var_idx = tokens[token_pos].value;
-    token_pos++;
-    
-    if (token_pos >= token_count || tokens[token_pos].type != TOK_EQUALS) {
-        printf("Syntax error: expected =\n");
+    int v = comp->tokens[comp->token_pos++].value;
+    if (IS_STRING_VAR(v)) {
+        emit(comp, S_MISMATCH);
         return;
     }
-    token_pos++;
-    
-    variables[var_idx] = eval_expression();
-    
-    // Skip TO keyword
-    if (token_pos < token_count && tokens[token_pos].type == TOK_UNKNOWN &&
-        strcmp(tokens[token_pos].str, "TO") == 0) {
-        token_pos++;
+
+    if (!next_is(comp, TOK_EQUALS)) {
+        emit_text(comp, S_TEXT, "Syntax error: expected =\n");
+        return;
+    }
+    comp->token_pos++;
+
+    emit(comp, S_LET);
+    emit(comp, v);
+    Expr init = compile_expression(comp);
+    store_expression(comp, v, &init);
+
+    if (!next_is_keyword(comp, "TO")) return;
+    comp->token_pos++;
+
+    // NEXT evaluates the limit each time round
+    emit(comp, S_FOR);
+    uint32_t length_at = comp->code_len;
+    emit(comp, 0);
+    uint32_t limit_start = comp->code_len;
+    Expr limit = compile_expression(comp);
+    make_numeric(comp, &limit, comp->code_len);
+    if (comp->var_real[v]) make_real(comp, &limit, comp->code_len);
+    emit(comp, X_END);
+    if (comp->out_of_memory) return;
+    comp->code[length_at] = (int32_t)(comp->code_len - limit_start);
+
+    if (first) {
+        line->for_var = (int8_t)v;
+        line->for_real = (uint8_t)limit.real;
+        line->for_limit = limit_start;
     }
 }
 
-static void exec_next() {
-    if (token_pos >= token_count || tokens[token_pos].type != TOK_VARIABLE) {
-        printf("Syntax error in NEXT\n");
+static void compile_next(Compiler *comp, int index) {
+    if (!next_is(comp, TOK_VARIABLE)) {
+        emit_text(comp, S_TEXT, "Syntax error in NEXT\n");
         return;
     }
-    
-    int var_idx = tokens[token_pos].value;
-    token_pos++;
-    
-    variables[var_idx]++;
-    
-    // Find matching FOR
-    for (int i = current_line - 1; i >= 0; i--) {
-        tokenize(program[i].text);
-        token_pos = 0;
-        
-        if (token_pos < token_count && tokens[token_pos].type == TOK_UNKNOWN &&
-            strcmp(tokens[token_pos].str, "FOR") == 0) {
-            token_pos++;
-            
-            if (token_pos < token_count && tokens[token_pos].type == TOK_VARIABLE &&
-                tokens[token_pos].value == var_idx) {
-                
-                // Parse FOR line to get limit
-                token_pos++;
-                if (token_pos < token_count && tokens[token_pos].type == TOK_EQUALS) {
-                    token_pos++;
-                    eval_expression(); // Skip initial value
-                    
-                    if (token_pos < token_count && tokens[token_pos].type == TOK_UNKNOWN &&
-                        strcmp(tokens[token_pos].str, "TO") == 0) {
-                        token_pos++;
-                        int32_t limit = eval_expression();
-                        
-                        if (variables[var_idx] <= limit) {
-                            current_line = i;
-                            return;
-                        }
-                    }
-                }
-            }
-        }
+    int v = comp->tokens[comp->token_pos++].value;
+    if (IS_STRING_VAR(v)) {
+        emit(comp, S_MISMATCH);
+        return;
     }
+
+    // The nearest earlier line starting with FOR v, found once
+    int target = index - 1;
+    while (target >= 0 && comp->line_table[target].for_var != v) target--;
+
+    if (comp->inferring && IS_PLAIN_VAR(v) && !comp->var_real[v]) {
+        Expr next = int_expr(0, comp->var_lo[v] + 1, comp->var_hi[v] + 1);
+        infer_assignment(comp, v, &next);
+    }
+    emit(comp, S_NEXT);
+    emit(comp, v);
+    emit(comp, var_kind(comp, v));
+    emit(comp, target);
 }
 
-static void exec_poke() {
-    // POKE address, value
-    int32_t address = eval_expression();
-    
-    if (token_pos >= token_count || tokens[token_pos].type != TOK_COMMA) {
-        printf("Syntax error: expected comma in POKE\n");
+static void compile_poke(Compiler *comp) {
+    uint32_t start = comp->code_len;
+    emit(comp, S_POKE);
+    Expr address = compile_expression(comp);
+    make_int(comp, &address);
+    emit(comp, X_END);
+
+    if (!next_is(comp, TOK_COMMA)) {
+        comp->code_len = start;
+        emit_text(comp, S_TEXT, "Syntax error: expected comma in POKE\n");
         return;
     }
-    token_pos++;
-    
-    int32_t value = eval_expression();
-    
-    memory_write((uint16_t)address, (uint8_t)value);
-}
-
-static void execute_line(const char *line) {
-    tokenize(line);
-    token_pos = 0;
-    
-    while (token_pos < token_count && tokens[token_pos].type != TOK_EOL) {
-        if (tokens[token_pos].type == TOK_UNKNOWN) {
-            char *cmd = tokens[token_pos].str;
-            token_pos++;
-            
+    comp->token_pos++;
+
+    Expr value = compile_expression(comp);
+    make_int(comp, &value);
+    emit(comp, X_END);
+}
+
+static void compile_line(Compiler *comp, int index) {
+    LineEntry *line = &comp->line_table[index];
+    tokenize(comp, comp->line_text[index]);
+    comp->token_pos = 0;
+    line->code = comp->code_len;
+    line->for_var = -1;
+    line->for_real = 0;
+    line->for_limit = 0;
+
+    while (comp->token_pos < comp->token_count) {
+        Token *tok = &comp->tokens[comp->token_pos];
+        if (tok->type == TOK_UNKNOWN) {
+            int first = comp->token_pos == 0;
+            char *cmd = tok->str;
+            comp->token_pos++;
+
             if (strcmp(cmd, "PRINT") == 0) {
-                exec_print();
+                compile_print(comp);
             } else if (strcmp(cmd, "LET") == 0) {
-                exec_let();
+                compile_let(comp);
             } else if (strcmp(cmd, "INPUT") == 0) {
-                exec_input();
+                compile_input(comp);
             } else if (strcmp(cmd, "GOTO") == 0) {
-                if (exec_goto()) return;
+                if (compile_goto(comp)) break;
             } else if (strcmp(cmd, "IF") == 0) {
-                if (!exec_if()) return;
+                compile_if(comp);
             } else if (strcmp(cmd, "FOR") == 0) {
-                exec_for();
+                compile_for(comp, line, first);
             } else if (strcmp(cmd, "NEXT") == 0) {
-                exec_next();
+                compile_next(comp, index);
             } else if (strcmp(cmd, "POKE") == 0) {
-                exec_poke();
+                compile_poke(comp);
             } else if (strcmp(cmd, "END") == 0) {
-                current_line = program_size;
-                return;
+                emit(comp, S_END);
+                break;
             } else if (strcmp(cmd, "REM") == 0) {
-                return; // Ignore rest of line
+                break; // Ignore rest of line
             } else {
-                printf("Unknown command: %s\n", cmd);
+                emit_text(comp, S_TEXT, "Unknown command: %s\n", cmd);
             }
-        } else if (tokens[token_pos].type == TOK_VARIABLE) {
+        } else if (tok->type == TOK_VARIABLE) {
             // Implicit LET
-            exec_let();
+            compile_let(comp);
+        } else {
+            comp->token_pos++;
+        }
+    }
+
+    emit(comp, S_EOL);
+}
+
+static void compile_program(Compiler *comp) {
+    comp->code_len = 0;
+    comp->constant_count = 0;
+    comp->strings_len = 0;
+
+    // CHR$ results are slices of this
+    char table[256];
+    for (int i = 0; i < 256; i++) table[i] = (char)i;
+    add_bytes(comp, table, sizeof(table));
+
+    for (int i = 0; i < comp->program_size; i++) compile_line(comp, i);
+}
+
+static void compile(Compiler *comp) {
+    for (int v = 0; v < VAR_COUNT; v++) {
+        comp->var_real[v] = comp->mode == BASIC_MODE_CLASSIC && IS_PLAIN_VAR(v) && (comp->real_seed >> v & 1);
+        comp->var_widened[v] = 0;
+        if (IS_INT16_VAR(v)) {
+            comp->var_lo[v] = INT16_MIN;
+            comp->var_hi[v] = INT16_MAX;
+        } else if (comp->mode == BASIC_MODE_CLASSIC) {
+            comp->var_lo[v] = comp->var_hi[v] = 0;
         } else {
-            token_pos++;
+            comp->var_lo[v] = INT32_MIN;
+            comp->var_hi[v] = INT32_MAX;
+        }
+    }
+
+    if (comp->mode == BASIC_MODE_CLASSIC) {
+        comp->inferring = 1;
+        do {
+            comp->inference_changed = 0;
+            compile_program(comp);
+        } while (comp->inference_changed && !comp->out_of_memory);
+        comp->inferring = 0;
+    }
+    compile_program(comp);
+
+}
+
+// Nine significant digits, as the 6502 BASICs print
+static int format_real(char *buf, size_t size, double f) {
+    if (f == 0) f = 0; // Never "-0"
+    return snprintf(buf, size, "%.9G", f);
+}
+
+// String heap
+static const char *string_bytes(const BasicInterp *bi, Value v) {
+    if (v.s.len == 0) return "";
+    if (v.s.at & IN_POOL) return bi->prog->strings + (v.s.at & ~IN_POOL);
+    return bi->heap + v.s.at;
+}
+
+// Room for n more bytes on the heap, growing it if need be
+static int reserve_string(BasicInterp *bi, uint64_t n) {
+    if (bi->heap_used + n <= bi->heap_size) return 1;
+    uint64_t size = bi->heap_size ? bi->heap_size : HEAP_INITIAL;
+    while (size < bi->heap_used + n) size *= 2;
+    char *heap = size <= HEAP_MAX ? realloc(bi->heap, size) : NULL;
+    if (!heap) {
+        runtime_error(bi, "Out of string space");
+        return 0;
+    }
+    bi->heap = heap;
+    bi->heap_size = (uint32_t)size;
+    return 1;
+}
+
+static Value new_string(BasicInterp *bi, const char *bytes, uint32_t len) {
+    Value v;
+    memset(&v, 0, sizeof(v));
+    if (len == 0 || !reserve_string(bi, len)) return v;
+    v.s.at = bi->heap_used;
+    v.s.len = len;
+    memcpy(bi->heap + bi->heap_used, bytes, len);
+    bi->heap_used += len;
+    return v;
+}
+
+static Value concat(BasicInterp *bi, Value a, Value b) {
+    if (b.s.len == 0) return a;
+    if (a.s.len == 0) return b;
+
+    // A string on top of the heap (A$ = A$ + ...) is extended where it is
+    int in_place = !(a.s.at & IN_POOL) && a.s.at + a.s.len == bi->heap_used;
+    if (!reserve_string(bi, (uint64_t)b.s.len + (in_place ? 0 : a.s.len))) {
+        memset(&a, 0, sizeof(a));
+        return a;
+    }
+    Value r;
+    r.s.at = in_place ? a.s.at : bi->heap_used;
+    r.s.len = a.s.len + b.s.len;
+    if (!in_place) {
+        memcpy(bi->heap + bi->heap_used, string_bytes(bi, a), a.s.len);
+        bi->heap_used += a.s.len;
+    }
+    memcpy(bi->heap + bi->heap_used, string_bytes(bi, b), b.s.len);
+    bi->heap_used += b.s.len;
+    return r;
+}
+
+static int compare_strings(const BasicInterp *bi, Value a, Value b) {
+    uint32_t n = a.s.len < b.s.len ? a.s.len : b.s.len;
+    int c = n ? memcmp(string_bytes(bi, a), string_bytes(bi, b), n) : 0;
+    if (c) return c;
+    return (a.s.len > b.s.len) - (a.s.len < b.s.len);
+}
+
+// Slide the strings variables hold to the bottom of the heap. Variables are
+// visited in address order and overlapping slices move together, so strings
+// sharing bytes still share them afterwards.
+static void collect_strings(BasicInterp *bi) {
+    int roots[26];
+    int count = 0;
+    for (int v = 52; v < VAR_COUNT; v++) {
+        Value *s = &bi->vars[v];
+        if (s->s.len == 0 || (s->s.at & IN_POOL)) continue;
+        int i = count++;
+        while (i > 0 && bi->vars[roots[i - 1]].s.at > s->s.at) {
+            roots[i] = roots[i - 1];
+            i--;
+        }
+        roots[i] = v;
+    }
+
+    uint32_t used = 0;
+    for (int i = 0; i < count; ) {
+        uint32_t start = bi->vars[roots[i]].s.at;
+        uint32_t end = start + bi->vars[roots[i]].s.len;
+        int j = i + 1;
+        while (j < count && bi->vars[roots[j]].s.at <= end) {
+            uint32_t e = bi->vars[roots[j]].s.at + bi->vars[roots[j]].s.len;
+            if (e > end) end = e;
+            j++;
+        }
+        memmove(bi->heap + used, bi->heap + start, end - start);
+        for (; i < j; i++) bi->vars[roots[i]].s.at -= start - used;
+        used += end - start;
+    }
+    bi->heap_used = used;
+
+    // Keep at least three quarters free, so collections stay rare
+    if (used > bi->heap_size / 4 && bi->heap_size < HEAP_MAX) {
+        char *heap = realloc(bi->heap, bi->heap_size * 2);
+        if (heap) {
+            bi->heap = heap;
+            bi->heap_size *= 2;
+        }
+    }
+}
+
+// Parse a string as VAL does, up to the first character that cannot belong
+// to a number
+static double string_number(const BasicInterp *bi, Value v, int real) {
+    char buf[64];
+    uint32_t n = v.s.len < sizeof(buf) - 1 ? v.s.len : sizeof(buf) - 1;
+    if (n) memcpy(buf, string_bytes(bi, v), n);
+    buf[n] = 0;
+    return real ? strtod(buf, NULL) : atoi(buf);
+}
+
+static void illegal_quantity(BasicInterp *bi, Value *v) {
+    runtime_error(bi, "Illegal quantity");
+    memset(v, 0, sizeof(*v));
+}
+
+// Evaluator: runs the expression at *pc and leaves *pc after its X_END
+static Value eval(BasicInterp *bi, const int32_t **pcp) {
+    Value stack[STACK_DEPTH];
+    Value *sp = stack;
+    const int32_t *pc = *pcp;
+
+    for (;;) {
+        switch (*pc++) {
+            case X_END:
+                *pcp = pc;
+                return sp[-1];
+            case X_INT: sp->i = *pc++; sp++; break;
+            case X_REAL: sp->f = bi->prog->constants[*pc++]; sp++; break;
+            case X_VAR: *sp++ = bi->vars[*pc++]; break;
+            case X_ADD: sp--; sp[-1].i = wrap_add(sp[-1].i, sp[0].i); break;
+            case X_SUB: sp--; sp[-1].i = wrap_add(sp[-1].i, wrap_neg(sp[0].i)); break;
+            case X_MUL: sp--; sp[-1].i = wrap_mul(sp[-1].i, sp[0].i); break;
+            case X_DIV:
+                sp--;
+                if (sp[0].i == 0) {
+                    runtime_error(bi, "Division by zero");
+                    sp[-1].i = 0;
+                } else if (sp[0].i == -1) {
+                    sp[-1].i = wrap_neg(sp[-1].i);
+                } else {
+                    sp[-1].i /= sp[0].i;
+                }
+                break;
+            case X_NEG: sp[-1].i = wrap_neg(sp[-1].i); break;
+            case X_ADDK: sp[-1].i = wrap_add(sp[-1].i, *pc++); break;
+            case X_MULK: sp[-1].i = wrap_mul(sp[-1].i, *pc++); break;
+            case X_SHL: sp[-1].i = (int32_t)((uint32_t)sp[-1].i << *pc++); break;
+            case X_DIVP: {
+                int64_t x = sp[-1].i;
+                int shift = *pc++;
+                if (x < 0) x += ((int64_t)1 << shift) - 1;
+                sp[-1].i = (int32_t)(x >> shift);
+                break;
+            }
+            case X_DIVM: {
+                int32_t x = sp[-1].i;
+                uint32_t n = x < 0 ? 0u - (uint32_t)x : (uint32_t)x;
+                uint32_t q = (uint32_t)(((uint64_t)n * (uint32_t)pc[0]) >> pc[1]);
+                sp[-1].i = (int32_t)((x < 0) != pc[2] ? 0u - q : q);
+                pc += 3;
+                break;
+            }
+            case X_FADD: sp--; sp[-1].f += sp[0].f; break;
+            case X_FSUB: sp--; sp[-1].f -= sp[0].f; break;
+            case X_FMUL: sp--; sp[-1].f *= sp[0].f; break;
+            case X_FDIV:
+                sp--;
+                if (sp[0].f == 0) {
+                    runtime_error(bi, "Division by zero");
+                    sp[-1].f = 0;
+                } else {
+                    sp[-1].f /= sp[0].f;
+                }
+                break;
+            case X_FNEG: sp[-1].f = -sp[-1].f; break;
+            case X_FMULK: sp[-1].f *= bi->prog->constants[*pc++]; break;
+            case X_ITOF: sp[-1].f = (double)sp[-1].i; break;
+            case X_FTOI: {
+                double f = round_down(sp[-1].f);
+                if (!(f >= INT32_MIN && f <= INT32_MAX)) {
+                    runtime_error(bi, "Overflow");
+                    f = 0;
+                }
+                sp[-1].i = (int32_t)f;
+                break;
+            }
+            case X_FINT: sp[-1].f = round_down(sp[-1].f); break;
+            case X_CHK16:
+                if (sp[-1].i < INT16_MIN || sp[-1].i > INT16_MAX) {
+                    runtime_error(bi, "Overflow");
+                    sp[-1].i = 0;
+                }
+                break;
+            case X_EQ: sp--; sp[-1].i = sp[-1].i == sp[0].i; break;
+            case X_NE: sp--; sp[-1].i = sp[-1].i != sp[0].i; break;
+            case X_LT: sp--; sp[-1].i = sp[-1].i < sp[0].i; break;
+            case X_GT: sp--; sp[-1].i = sp[-1].i > sp[0].i; break;
+            case X_LE: sp--; sp[-1].i = sp[-1].i <= sp[0].i; break;
+            case X_GE: sp--; sp[-1].i = sp[-1].i >= sp[0].i; break;
+            case X_FEQ: sp--; sp[-1].i = sp[-1].f == sp[0].f; break;
+            case X_FNE: sp--; sp[-1].i = sp[-1].f != sp[0].f; break;
+            case X_FLT: sp--; sp[-1].i = sp[-1].f < sp[0].f; break;
+            case X_FGT: sp--; sp[-1].i = sp[-1].f > sp[0].f; break;
+            case X_FLE: sp--; sp[-1].i = sp[-1].f <= sp[0].f; break;
+            case X_FGE: sp--; sp[-1].i = sp[-1].f >= sp[0].f; break;
+            case X_FTRUE: sp[-1].i = sp[-1].f != 0; break;
+            case X_PEEK: sp[-1].i = memory_read((uint16_t)sp[-1].i); break;
+            case X_ERROR: out_text(bi, bi->prog->strings + *pc++); break;
+            case X_MISMATCH:
+                runtime_error(bi, "Type mismatch");
+                memset(&sp[-1], 0, sizeof(Value));
+                break;
+            case X_STRING:
+                sp->s.at = IN_POOL | (uint32_t)pc[0];
+                sp->s.len = (uint32_t)pc[1];
+                sp++;
+                pc += 2;
+                break;
+            case X_CONCAT: sp--; sp[-1] = concat(bi, sp[-1], sp[0]); break;
+            case X_SEQ: sp--; sp[-1].i = compare_strings(bi, sp[-1], sp[0]) == 0; break;
+            case X_SNE: sp--; sp[-1].i = compare_strings(bi, sp[-1], sp[0]) != 0; break;
+            case X_SLT: sp--; sp[-1].i = compare_strings(bi, sp[-1], sp[0]) < 0; break;
+            case X_SGT: sp--; sp[-1].i = compare_strings(bi, sp[-1], sp[0]) > 0; break;
+            case X_SLE: sp--; sp[-1].i = compare_strings(bi, sp[-1], sp[0]) <= 0; break;
+            case X_SGE: sp--; sp[-1].i = compare_strings(bi, sp[-1], sp[0]) >= 0; break;
+            case X_LEN: sp[-1].i = (int32_t)sp[-1].s.len; break;
+            case X_LEFT:
+                sp--;
+                if (sp[0].i < 0) {
+                    illegal_quantity(bi, &sp[-1]);
+                } else if ((uint32_t)sp[0].i < sp[-1].s.len) {
+                    sp[-1].s.len = (uint32_t)sp[0].i;
+                }
+                break;
+            case X_RIGHT:
+                sp--;
+                if (sp[0].i < 0) {
+                    illegal_quantity(bi, &sp[-1]);
+                } else if ((uint32_t)sp[0].i < sp[-1].s.len) {
+                    sp[-1].s.at += sp[-1].s.len - (uint32_t)sp[0].i;
+                    sp[-1].s.len = (uint32_t)sp[0].i;
+                }
+                break;
+            case X_MID: {
+                sp -= 2;
+                int32_t first = sp[0].i, count = sp[1].i;
+                Value *str = &sp[-1];
+                if (first < 1 || count < 0) {
+                    illegal_quantity(bi, str);
+                } else if ((uint32_t)first > str->s.len) {
+                    str->s.len = 0;
+                } else {
+                    uint32_t left = str->s.len - (uint32_t)(first - 1);
+                    str->s.at += (uint32_t)(first - 1);
+                    str->s.len = (uint32_t)count < left ? (uint32_t)count : left;
+                }
+                break;
+            }
+            case X_CHR:
+                if (sp[-1].i < 0 || sp[-1].i > 255) {
+                    illegal_quantity(bi, &sp[-1]);
+                } else {
+                    sp[-1].s.at = IN_POOL | (uint32_t)sp[-1].i;
+                    sp[-1].s.len = 1;
+                }
+                break;
+            case X_STR: {
+                char buf[32];
+                int n = snprintf(buf, sizeof(buf), "%d", sp[-1].i);
+                sp[-1] = new_string(bi, buf, (uint32_t)n);
+                break;
+            }
+            case X_FSTR: {
+                char buf[32];
+                int n = format_real(buf, sizeof(buf), sp[-1].f);
+                sp[-1] = new_string(bi, buf, (uint32_t)n);
+                break;
+            }
+            case X_VAL: sp[-1].i = (int32_t)string_number(bi, sp[-1], 0); break;
+            case X_FVAL: sp[-1].f = string_number(bi, sp[-1], 1); break;
+        }
+    }
+}
+
+static void print_real(BasicInterp *bi, double f) {
+    char buf[32];
+    format_real(buf, sizeof(buf), f);
+    out_text(bi, buf);
+}
+
+static void run_input(BasicInterp *bi, int v, int kind) {
+    uint16_t line_num = bi->prog->lines[bi->current_line].line_num;
+    int got = bi->input
+        ? bi->input(bi->input_ctx, line_num, bi->input_buffer, MAX_LINE_LEN)
+        : journal_read_line(bi->journal, "INPUT", line_num, bi->input_buffer, MAX_LINE_LEN);
+    if (got == BASIC_INPUT_WAIT) bi->waiting = 1;
+    if (got <= 0) return;
+
+    if (kind == KIND_STRING) {
+        bi->vars[v] = new_string(bi, bi->input_buffer, (uint32_t)strlen(bi->input_buffer));
+    } else if (kind == KIND_REAL) {
+        bi->vars[v].f = strtod(bi->input_buffer, NULL);
+    } else if (kind == KIND_INT16) {
+        long n = strtol(bi->input_buffer, NULL, 10);
+        if (n < INT16_MIN || n > INT16_MAX) {
+            runtime_error(bi, "Overflow");
+        } else {
+            bi->vars[v].i = (int32_t)n;
+        }
+    } else {
+        bi->vars[v].i = atoi(bi->input_buffer);
+    }
+}
+
+// Returns 1 to go round the loop again
+static int run_next(BasicInterp *bi, int v, int kind, int target) {
+    Value *var = &bi->vars[v];
+    if (kind == KIND_REAL) {
+        var->f += 1;
+    } else if (kind == KIND_INT16 && var->i == INT16_MAX) {
+        runtime_error(bi, "Overflow");
+        return 0;
+    } else {
+        var->i = wrap_add(var->i, 1);
+    }
+    if (target < 0) return 0;
+
+    const LineEntry *line = &bi->prog->lines[target];
+    const int32_t *pc = bi->prog->code + line->for_limit;
+    Value limit = eval(bi, &pc);
+    if (bi->failed) return 0;
+    if (line->for_real) {
+        return (kind == KIND_REAL ? var->f : (double)var->i) <= limit.f;
+    }
+    return var->i <= limit.i;
+}
+
+// Run program line index; returns the index of the line to run next
+static int run_line(BasicInterp *bi, int index) {
+    const int32_t *pc = bi->prog->code + bi->prog->lines[index].code;
+    Value value;
+    int v;
+
+    if (bi->resuming) {
+        bi->resuming = 0;
+        if (bi->resume_line == (uint32_t)index) pc = bi->prog->code + bi->resume_code;
+    }
+
+    for (;;) {
+        switch (*pc++) {
+            case S_EOL:
+                return index + 1;
+            case S_PRINT:
+                value = eval(bi, &pc);
+                if (bi->failed) return bi->prog->line_count;
+                out_printf(bi, "%d", value.i);
+                break;
+            case S_PRINT_REAL:
+                value = eval(bi, &pc);
+                if (bi->failed) return bi->prog->line_count;
+                print_real(bi, value.f);
+                break;
+            case S_PRINT_STRING:
+                value = eval(bi, &pc);
+                if (bi->failed) return bi->prog->line_count;
+                out_bytes(bi, string_bytes(bi, value), value.s.len);
+                break;
+            case S_TEXT:
+                out_text(bi, bi->prog->strings + *pc++);
+                break;
+            case S_TAB:
+                out_text(bi, "\t");
+                break;
+            case S_NEWLINE:
+                out_text(bi, "\n");
+                break;
+            case S_LET:
+                v = *pc++;
+                value = eval(bi, &pc);
+                if (bi->failed) return bi->prog->line_count;
+                bi->vars[v] = value;
+                break;
+            case S_INPUT:
+                run_input(bi, pc[0], pc[1]);
+                if (bi->failed) return bi->prog->line_count;
+                if (bi->waiting) {
+                    // The statements before it on the line have run
+                    bi->resuming = 1;
+                    bi->resume_line = (uint32_t)index;
+                    bi->resume_code = (uint32_t)(pc - 1 - bi->prog->code);
+                    return index;
+                }
+                pc += 2;
+                break;
+            case S_GOTO:
+                return *pc;
+            case S_GOTO_EXPR: {
+                value = eval(bi, &pc);
+                if (bi->failed) return bi->prog->line_count;
+                int target = find_line(bi->prog->lines, bi->prog->line_count, value.i);
+                if (target >= 0) return target;
+                out_printf(bi, "Line %d not found\n", value.i);
+                break;
+            }
+            case S_IF:
+                value = eval(bi, &pc);
+                if (bi->failed) return bi->prog->line_count;
+                if (!value.i) return index + 1;
+                break;
+            case S_FOR:
+                pc += *pc + 1;
+                break;
+            case S_NEXT:
+                if (run_next(bi, pc[0], pc[1], pc[2])) return pc[2] + 1;
+                if (bi->failed) return bi->prog->line_count;
+                pc += 3;
+                break;
+            case S_POKE: {
+                int32_t address = eval(bi, &pc).i;
+                value = eval(bi, &pc);
+                if (bi->failed) return bi->prog->line_count;
+                memory_write((uint16_t)address, (uint8_t)value.i);
+                break;
+            }
+            case S_END:
+                return bi->prog->line_count;
+            case S_MISMATCH:
+                runtime_error(bi, "Type mismatch");
+                return bi->prog->line_count;
+        }
+    }
+}
+
+// Compiled images: a header, then the line table, constants, code and
+// literal pool as the interpreter uses them, each 8-byte aligned and in the
+// byte order of the machine that wrote them. An image is external input:
+// mapping one checks the header and section bounds, then walks all of the
+// code once (verify_line) so that a corrupt image is refused, not run.
+#define IMAGE_VERSION 2
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];              // BASIC_IMAGE_MAGIC
+    uint32_t version;           // IMAGE_VERSION
+    uint32_t byte_order;        // IMAGE_BYTE_ORDER as written
+    uint32_t mode;              // BasicMode the program was compiled for
+    uint32_t real_vars;
+    uint32_t line_count;
+    uint32_t lines_at;          // Section offsets from the start of the image
+    uint32_t constants_at;
+    uint32_t constant_count;
+    uint32_t code_at;
+    uint32_t code_len;          // In words
+    uint32_t strings_at;
+    uint32_t strings_len;
+    uint32_t size;
+} ImageHeader;
+
+static uint32_t align8(uint32_t at) {
+    return (at + 7) & ~7u;
+}
+
+static int image_fits(const ImageHeader *h, uint64_t size) {
+    if (h->size != size || h->line_count > MAX_LINES) return 0;
+    if (h->mode != BASIC_MODE_INTEGER && h->mode != BASIC_MODE_CLASSIC) return 0;
+    if ((h->lines_at | h->constants_at) & 7) return 0;
+    if (h->strings_len < 256) return 0;  // CHR$ table
+    return h->lines_at >= sizeof(ImageHeader) &&
+           h->lines_at + (uint64_t)h->line_count * sizeof(LineEntry) <= size &&
+           h->constants_at + (uint64_t)h->constant_count * sizeof(double) <= size &&
+           h->code_at % sizeof(int32_t) == 0 &&
+           h->code_at + (uint64_t)h->code_len * sizeof(int32_t) <= size &&
+           h->strings_at + (uint64_t)h->strings_len <= size;
+}
+
+// The values on the evaluation stack, as verification tracks them. Reals
+// and integers share a type: reading one as the other is wrong but harmless,
+// while a number read as a string slice is not.
+enum {
+    T_NUMBER,
+    T_STRING,
+    T_ANY                   // The zero Value X_MISMATCH leaves, valid as anything
+};
+
+// Each expression operation's operand words, the types it pops ('n' number,
+// 's' string, 'x' anything; deepest first) and the type it pushes (0: none)
+typedef struct {
+    uint8_t operands;
+    const char *pops;
+    char pushes;
+} Signature;
+
+static const Signature signatures[] = {
+    [X_INT] = { 1, "", 'n' }, [X_REAL] = { 1, "", 'n' }, [X_VAR] = { 1, "", 0 },
+    [X_ADD] = { 0, "nn", 'n' }, [X_SUB] = { 0, "nn", 'n' }, [X_MUL] = { 0, "nn", 'n' },
+    [X_DIV] = { 0, "nn", 'n' }, [X_NEG] = { 0, "n", 'n' },
+    [X_ADDK] = { 1, "n", 'n' }, [X_MULK] = { 1, "n", 'n' }, [X_SHL] = { 1, "n", 'n' },
+    [X_DIVP] = { 1, "n", 'n' }, [X_DIVM] = { 3, "n", 'n' },
+    [X_FADD] = { 0, "nn", 'n' }, [X_FSUB] = { 0, "nn", 'n' }, [X_FMUL] = { 0, "nn", 'n' },
+    [X_FDIV] = { 0, "nn", 'n' }, [X_FNEG] = { 0, "n", 'n' }, [X_FMULK] = { 1, "n", 'n' },
+    [X_ITOF] = { 0, "n", 'n' }, [X_FTOI] = { 0, "n", 'n' }, [X_FINT] = { 0, "n", 'n' },
+    [X_CHK16] = { 0, "n", 'n' },
+    [X_EQ] = { 0, "nn", 'n' }, [X_NE] = { 0, "nn", 'n' }, [X_LT] = { 0, "nn", 'n' },
+    [X_GT] = { 0, "nn", 'n' }, [X_LE] = { 0, "nn", 'n' }, [X_GE] = { 0, "nn", 'n' },
+    [X_FEQ] = { 0, "nn", 'n' }, [X_FNE] = { 0, "nn", 'n' }, [X_FLT] = { 0, "nn", 'n' },
+    [X_FGT] = { 0, "nn", 'n' }, [X_FLE] = { 0, "nn", 'n' }, [X_FGE] = { 0, "nn", 'n' },
+    [X_FTRUE] = { 0, "n", 'n' }, [X_PEEK] = { 0, "n", 'n' },
+    [X_ERROR] = { 1, "", 0 }, [X_MISMATCH] = { 0, "x", 'x' },
+    [X_STRING] = { 2, "", 's' }, [X_CONCAT] = { 0, "ss", 's' },
+    [X_SEQ] = { 0, "ss", 'n' }, [X_SNE] = { 0, "ss", 'n' }, [X_SLT] = { 0, "ss", 'n' },
+    [X_SGT] = { 0, "ss", 'n' }, [X_SLE] = { 0, "ss", 'n' }, [X_SGE] = { 0, "ss", 'n' },
+    [X_LEN] = { 0, "s", 'n' }, [X_LEFT] = { 0, "sn", 's' }, [X_RIGHT] = { 0, "sn", 's' },
+    [X_MID] = { 0, "snn", 's' }, [X_CHR] = { 0, "n", 's' },
+    [X_STR] = { 0, "n", 's' }, [X_FSTR] = { 0, "n", 's' },
+    [X_VAL] = { 0, "s", 'n' }, [X_FVAL] = { 0, "s", 'n' }
+};
+
+// Whether the n words after the one at pc are in the code section
+static int has_operands(const BasicProgram *prog, uint32_t pc, uint32_t n) {
+    return (uint64_t)pc + 1 + n <= prog->code_len;
+}
+
+// Whether k is a NUL-terminated message in the literal pool
+static int is_text(const BasicProgram *prog, int32_t k) {
+    return k >= 0 && (uint32_t)k < prog->strings_len &&
+           memchr(prog->strings + k, 0, prog->strings_len - (uint32_t)k) != NULL;
+}
+
+static int matches(int type, char wanted) {
+    return wanted == 'x' || type == T_ANY || type == (wanted == 's' ? T_STRING : T_NUMBER);
+}
+
+// Verify the expression at *at, leaving *at after its X_END; 0 if eval
+// could read outside the image, overflow its stack or take a number for a
+// string. wanted is the type of its value.
+static int verify_expression(const BasicProgram *prog, uint32_t *at, char wanted) {
+    uint8_t stack[STACK_DEPTH];
+    int depth = 0;
+    uint32_t pc = *at;
+    for (;;) {
+        if (pc >= prog->code_len) return 0;
+        int32_t op = prog->code[pc];
+        const int32_t *operand = prog->code + pc + 1;
+        if (op == X_END) {
+            *at = pc + 1;
+            return depth == 1 && matches(stack[0], wanted);
+        }
+        if (op < 0 || op >= (int32_t)(sizeof(signatures) / sizeof(signatures[0]))) return 0;
+        const Signature *sig = &signatures[op];
+        if (!sig->pops || !has_operands(prog, pc, sig->operands)) return 0;
+
+        int pushes = sig->pushes == 's' ? T_STRING : sig->pushes == 'x' ? T_ANY : T_NUMBER;
+        int valid = 1;
+        switch (op) {
+            case X_REAL: case X_FMULK:
+                valid = operand[0] >= 0 && (uint32_t)operand[0] < prog->constant_count;
+                break;
+            case X_VAR:
+                valid = operand[0] >= 0 && operand[0] < VAR_COUNT;
+                pushes = IS_STRING_VAR(operand[0]) ? T_STRING : T_NUMBER;
+                break;
+            case X_SHL: case X_DIVP:
+                valid = operand[0] >= 0 && operand[0] < 32;
+                break;
+            case X_DIVM:
+                valid = operand[1] >= 0 && operand[1] < 64;
+                break;
+            case X_ERROR:
+                valid = is_text(prog, operand[0]);
+                break;
+            case X_STRING:
+                valid = operand[0] >= 0 && operand[1] >= 0 &&
+                        (uint64_t)operand[0] + (uint32_t)operand[1] <= prog->strings_len;
+                break;
+        }
+        int pops = (int)strlen(sig->pops);
+        if (!valid || depth < pops) return 0;
+        for (int i = 0; i < pops; i++) {
+            if (!matches(stack[depth - pops + i], sig->pops[i])) return 0;
+        }
+        depth -= pops;
+        if (op != X_ERROR) {
+            if (depth == STACK_DEPTH) return 0;
+            stack[depth++] = (uint8_t)pushes;
         }
+        pc += 1 + sig->operands;
     }
 }
 
-void basic_init() {
-    memory_init();
-    cpu_init(&cpu);
-    program_size = 0;
-    memset(variables, 0, sizeof(variables));
+// Verify line index of a mapped image: everything run_line can reach in it
+static int verify_line(const BasicProgram *prog, uint32_t index) {
+    const LineEntry *line = &prog->lines[index];
+    if (line->for_var >= 52) return 0;
+    if (line->for_var >= 0) {
+        uint32_t at = line->for_limit;
+        if (!verify_expression(prog, &at, 'n')) return 0;
+    }
+    uint32_t pc = line->code;
+    for (;;) {
+        if (pc >= prog->code_len) return 0;
+        int32_t op = prog->code[pc];
+        const int32_t *operand = prog->code + pc + 1;
+        uint32_t at = pc + 1;
+        switch (op) {
+            case S_EOL: case S_END: case S_MISMATCH:
+                return 1;
+            case S_GOTO:
+                return has_operands(prog, pc, 1) && operand[0] >= 0 && (uint32_t)operand[0] < prog->line_count;
+            case S_PRINT: case S_PRINT_REAL: case S_GOTO_EXPR: case S_IF:
+                if (!verify_expression(prog, &at, 'n')) return 0;
+                break;
+            case S_PRINT_STRING:
+                if (!verify_expression(prog, &at, 's')) return 0;
+                break;
+            case S_TEXT:
+                if (!has_operands(prog, pc, 1) || !is_text(prog, operand[0])) return 0;
+                at++;
+                break;
+            case S_TAB: case S_NEWLINE:
+                break;
+            case S_LET:
+                if (!has_operands(prog, pc, 1) || operand[0] < 0 || operand[0] >= VAR_COUNT) return 0;
+                at++;
+                if (!verify_expression(prog, &at, IS_STRING_VAR(operand[0]) ? 's' : 'n')) return 0;
+                break;
+            case S_INPUT:
+                // Only a string variable may take a string, and it only a string
+                if (!has_operands(prog, pc, 2) || operand[0] < 0 || operand[0] >= VAR_COUNT ||
+                    operand[1] < KIND_INT || operand[1] > KIND_STRING ||
+                    (operand[1] == KIND_STRING) != IS_STRING_VAR(operand[0])) return 0;
+                at += 2;
+                break;
+            case S_FOR: {
+                if (!has_operands(prog, pc, 1) || operand[0] < 0) return 0;
+                at++;
+                uint64_t end = (uint64_t)at + (uint32_t)operand[0];
+                if (!verify_expression(prog, &at, 'n') || at != end) return 0;
+                break;
+            }
+            case S_NEXT: {
+                if (!has_operands(prog, pc, 3) || operand[0] < 0 || operand[0] >= 52 ||
+                    operand[1] < KIND_INT || operand[1] > KIND_REAL) return 0;
+                int32_t target = operand[2];
+                if (target < -1 || (target >= 0 && ((uint32_t)target >= prog->line_count ||
+                                                    prog->lines[target].for_var != operand[0]))) return 0;
+                at += 3;
+                break;
+            }
+            case S_POKE:
+                if (!verify_expression(prog, &at, 'n') || !verify_expression(prog, &at, 'n')) return 0;
+                break;
+            default:
+                return 0;
+        }
+        pc = at;
+    }
+}
+
+// Run by interpreters with no program loaded
+static const BasicProgram no_program;
+
+// Compile the lines comp has been given; NULL if out of memory
+static BasicProgram *compile_lines(Compiler *comp) {
+    BasicProgram *prog = calloc(1, sizeof(BasicProgram));
+    LineEntry *lines = malloc(comp->program_size * sizeof(LineEntry) + 1);
+    // GOTO targets and FOR lines are resolved across the whole program
+    if (prog && lines) compile(comp);
+    if (!prog || !lines || comp->out_of_memory) {
+        free(comp->code);
+        free(comp->constants);
+        free(comp->strings);
+        free(lines);
+        free(prog);
+        return NULL;
+    }
+    memcpy(lines, comp->line_table, comp->program_size * sizeof(LineEntry));
+
+    prog->lines = lines;
+    prog->code = comp->code;
+    prog->constants = comp->constants;
+    prog->strings = comp->strings;
+    prog->line_count = comp->program_size;
+    prog->code_len = comp->code_len;
+    prog->constant_count = comp->constant_count;
+    prog->strings_len = comp->strings_len;
+    prog->mode = comp->mode;
+    for (int v = 0; v < 26; v++) {
+        if (comp->var_real[v]) prog->real_vars |= 1u << v;
+    }
+    return prog;
 }
 
-void basic_load_program(const char *source) {
+BasicProgram *basic_compile(const char *source, BasicMode mode) {
+    int max_lines = 1;
+    for (const char *p = source; *p; p++) max_lines += *p == '\n';
+    if (max_lines > MAX_LINES) max_lines = MAX_LINES;
+
+    // Lines are split in a copy of source and compiled in the order given
+    Compiler *comp = calloc(1, sizeof(Compiler));
+    char *text = strdup(source);
+    const char **line_text = malloc(max_lines * sizeof(char *));
+    LineEntry *line_table = malloc(max_lines * sizeof(LineEntry));
+    BasicProgram *prog = NULL;
+    if (comp && text && line_text && line_table) {
+        comp->mode = mode;
+        comp->line_text = line_text;
+        comp->line_table = line_table;
+        char *p = text;
+        while (*p && comp->program_size < max_lines) {
+            char *line = p;
+            p += strcspn(p, "\n");
+            if (*p) *p++ = 0;
+            if (strlen(line) >= MAX_LINE_LEN) line[MAX_LINE_LEN - 1] = 0;
+
+            // Lines without a number are skipped
+            if (!isdigit((unsigned char)line[0])) continue;
+            line_table[comp->program_size].line_num = atoi(line);
+            while (isdigit((unsigned char)*line)) line++;
+            while (*line == ' ') line++;
+            line_text[comp->program_size++] = line;
+        }
+        prog = compile_lines(comp);
+    }
+    free(line_table);
+    free(line_text);
+    free(text);
+    free(comp);
+    return prog;
+}
+
+static int write_section(FILE *f, uint32_t *at, uint32_t to, const void *data, size_t len) {
+    static const char zeros[8];
+    if (to > *at && fwrite(zeros, 1, to - *at, f) != to - *at) return 0;
+    if (len && fwrite(data, 1, len, f) != len) return 0;
+    *at = to + (uint32_t)len;
+    return 1;
+}
+
+int basic_program_save(const BasicProgram *prog, const char *path) {
+    ImageHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BASIC_IMAGE_MAGIC, sizeof(h.magic));
+    h.version = IMAGE_VERSION;
+    h.byte_order = IMAGE_BYTE_ORDER;
+    h.mode = prog->mode;
+    h.real_vars = prog->real_vars;
+    h.line_count = prog->line_count;
+    h.constant_count = prog->constant_count;
+    h.code_len = prog->code_len;
+    h.strings_len = prog->strings_len;
+
+    h.lines_at = align8(sizeof(h));
+    h.constants_at = align8(h.lines_at + h.line_count * sizeof(LineEntry));
+    h.code_at = h.constants_at + h.constant_count * sizeof(double);
+    h.strings_at = h.code_at + h.code_len * sizeof(int32_t);
+    h.size = h.strings_at + h.strings_len;
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot create image '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    uint32_t at = 0;
+    int ok = write_section(f, &at, 0, &h, sizeof(h)) &&
+             write_section(f, &at, h.lines_at, prog->lines, h.line_count * sizeof(LineEntry)) &&
+             write_section(f, &at, h.constants_at, prog->constants, h.constant_count * sizeof(double)) &&
+             write_section(f, &at, h.code_at, prog->code, h.code_len * sizeof(int32_t)) &&
+             write_section(f, &at, h.strings_at, prog->strings, h.strings_len);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Cannot write image '%s': %s\n", path, strerror(errno));
+        remove(path);
+    }
+    return ok;
+}
+
+BasicProgram *basic_program_map(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open image '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ImageHeader)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: '%s' is not a BASIC image\n", path);
+        return NULL;
+    }
+
+    const ImageHeader *h = map;
+    const char *problem = NULL;
+    if (memcmp(h->magic, BASIC_IMAGE_MAGIC, sizeof(h->magic)) != 0) {
+        problem = "is not a BASIC image";
+    } else if (h->byte_order != IMAGE_BYTE_ORDER) {
+        problem = "was compiled on a machine of the other byte order";
+    } else if (h->version != IMAGE_VERSION) {
+        problem = "was compiled by a different version of 6502basic";
+    } else if (!image_fits(h, st.st_size)) {
+        problem = "is truncated or corrupt";
+    }
+    BasicProgram *prog = problem ? NULL : malloc(sizeof(BasicProgram));
+    if (!prog) {
+        fprintf(stderr, "Error: '%s' %s\n", path, problem ? problem : "cannot be loaded: out of memory");
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    const char *base = map;
+    prog->lines = (const LineEntry *)(base + h->lines_at);
+    prog->constants = (const double *)(base + h->constants_at);
+    prog->code = (const int32_t *)(base + h->code_at);
+    prog->strings = base + h->strings_at;
+    prog->line_count = h->line_count;
+    prog->code_len = h->code_len;
+    prog->constant_count = h->constant_count;
+    prog->strings_len = h->strings_len;
+    prog->mode = h->mode;
+    prog->real_vars = h->real_vars;
+    prog->image = map;
+    prog->image_size = st.st_size;
+    for (uint32_t i = 0; i < prog->line_count; i++) {
+        if (!verify_line(prog, i)) {
+            fprintf(stderr, "Error: '%s' is corrupt: line %u holds invalid code\n", path, prog->lines[i].line_num);
+            basic_program_free(prog);
+            return NULL;
+        }
+    }
+    return prog;
+}
+
+void basic_program_free(BasicProgram *prog) {
+    if (!prog) return;
+    if (prog->image) {
+        munmap(prog->image, prog->image_size);
+    } else {
+        free((void *)prog->lines);
+        free((void *)prog->code);
+        free((void *)prog->constants);
+        free((void *)prog->strings);
+    }
+    free(prog);
+}
+
+// Editable programs: lines kept sorted by number in one array, each with
+// its own copy of its text. Editing a line finds it by binary search and
+// touches nothing else; lines are compiled only when the program is run.
+typedef struct {
+    uint16_t line_num;
+    char *text;
+} SourceLine;
+
+struct BasicSource {
+    SourceLine *lines;
+    uint32_t count, cap;
+    BasicMode mode;
+    uint32_t real_vars;     // Made real by an earlier compile; they stay real
+};
+
+BasicSource *basic_source_create(BasicMode mode) {
+    BasicSource *src = calloc(1, sizeof(BasicSource));
+    if (src) src->mode = mode;
+    return src;
+}
+
+void basic_source_clear(BasicSource *src) {
+    for (uint32_t i = 0; i < src->count; i++) free(src->lines[i].text);
+    src->count = 0;
+    src->real_vars = 0;
+}
+
+void basic_source_free(BasicSource *src) {
+    if (!src) return;
+    basic_source_clear(src);
+    free(src->lines);
+    free(src);
+}
+
+uint32_t basic_source_find(const BasicSource *src, int line_num) {
+    uint32_t lo = 0, hi = src->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (src->lines[mid].line_num < line_num) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int basic_source_set_line(BasicSource *src, int line_num, const char *text) {
+    if (line_num < 0 || line_num > BASIC_MAX_LINE_NUM) return -1;
+    uint32_t i = basic_source_find(src, line_num);
+    int found = i < src->count && src->lines[i].line_num == line_num;
+
+    while (*text == ' ') text++;
+    if (!*text) {
+        if (found) {
+            free(src->lines[i].text);
+            memmove(&src->lines[i], &src->lines[i + 1], (src->count - i - 1) * sizeof(SourceLine));
+            src->count--;
+        }
+        return 0;
+    }
+
+    char *copy = strndup(text, MAX_LINE_LEN - 1);
+    if (!copy) return -1;
+    if (found) {
+        free(src->lines[i].text);
+        src->lines[i].text = copy;
+        return 0;
+    }
+    if (src->count == src->cap) {
+        uint32_t cap = src->cap ? src->cap * 2 : 64;
+        SourceLine *lines = realloc(src->lines, cap * sizeof(SourceLine));
+        if (!lines) {
+            free(copy);
+            return -1;
+        }
+        src->lines = lines;
+        src->cap = cap;
+    }
+    memmove(&src->lines[i + 1], &src->lines[i], (src->count - i) * sizeof(SourceLine));
+    src->lines[i].line_num = (uint16_t)line_num;
+    src->lines[i].text = copy;
+    src->count++;
+    return 0;
+}
+
+int basic_source_merge(BasicSource *src, const char *text) {
     char line[MAX_LINE_LEN];
-    const char *p = source;
-    program_size = 0;
-    
-    while (*p && program_size < MAX_LINES) {
-        // Read one line
-        int i = 0;
-        while (*p && *p != '\n' && i < MAX_LINE_LEN - 1) {
-            line[i++] = *p++;
-        }
-        line[i] = 0;
-        if (*p == '\n') p++;
-        
-        // Skip empty lines
-        if (line[0] == 0) continue;
-        
-        // Parse line number
-        if (isdigit(line[0])) {
-            int line_num = atoi(line);
-            const char *text = line;
-            while (*text && isdigit(*text)) text++;
-            while (*text == ' ') text++;
-            
-            program[program_size].line_num = line_num;
-            strncpy(program[program_size].text, text, MAX_LINE_LEN - 1);
-            program[program_size].text[MAX_LINE_LEN - 1] = 0;
-            program_size++;
-        }
-    }
-}
-
-void basic_run() {
-    current_line = 0;
-    
-    while (current_line < program_size) {
-        execute_line(program[current_line].text);
-        current_line++;
+    while (*text) {
+        size_t len = strcspn(text, "\r\n");
+        snprintf(line, sizeof(line), "%.*s", (int)len, text);
+        text += len;
+        if (*text == '\r') text++;
+        if (*text == '\n') text++;
+
+        if (!isdigit((unsigned char)line[0])) continue;
+        char *rest;
+        long line_num = strtol(line, &rest, 10);
+        if (basic_source_set_line(src, line_num > BASIC_MAX_LINE_NUM ? -1 : (int)line_num, rest) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint32_t basic_source_count(const BasicSource *src) {
+    return src->count;
+}
+
+const char *basic_source_line(const BasicSource *src, uint32_t index, int *line_num) {
+    if (index >= src->count) return NULL;
+    *line_num = src->lines[index].line_num;
+    return src->lines[index].text;
+}
+
+BasicProgram *basic_source_compile(BasicSource *src, const char *direct) {
+    uint32_t count = src->count + (direct ? 2 : 0);
+    Compiler *comp = calloc(1, sizeof(Compiler));
+    const char **line_text = malloc(count * sizeof(char *) + 1);
+    LineEntry *line_table = malloc(count * sizeof(LineEntry) + 1);
+    BasicProgram *prog = NULL;
+    if (comp && line_text && line_table) {
+        for (uint32_t i = 0; i < src->count; i++) {
+            line_text[i] = src->lines[i].text;
+            line_table[i].line_num = src->lines[i].line_num;
+        }
+        if (direct) {
+            // A program run from the direct statement ends at its last line
+            line_text[src->count] = "END";
+            line_table[src->count].line_num = BASIC_DIRECT_LINE - 1;
+            line_text[src->count + 1] = direct;
+            line_table[src->count + 1].line_num = BASIC_DIRECT_LINE;
+        }
+        comp->line_text = line_text;
+        comp->line_table = line_table;
+        comp->program_size = count;
+        comp->mode = src->mode;
+        comp->real_seed = src->real_vars;
+        prog = compile_lines(comp);
+        if (prog) src->real_vars = prog->real_vars;
+    }
+    free(line_table);
+    free(line_text);
+    free(comp);
+    return prog;
+}
+
+BasicInterp *basic_create(void) {
+    BasicInterp *bi = calloc(1, sizeof(BasicInterp));
+    if (bi) bi->prog = &no_program;
+    return bi;
+}
+
+void basic_destroy(BasicInterp *bi) {
+    if (!bi) return;
+    basic_program_free(bi->own_prog);
+    free(bi->heap);
+    free(bi);
+}
+
+void basic_reset(BasicInterp *bi) {
+    basic_program_free(bi->own_prog);
+    bi->own_prog = NULL;
+    bi->prog = &no_program;
+    bi->current_line = 0;
+    bi->lines_executed = 0;
+    bi->failed = 0;
+    bi->resuming = 0;
+    memset(bi->vars, 0, sizeof(bi->vars));
+    bi->heap_used = 0;
+}
+
+void basic_set_numeric_mode(BasicInterp *bi, BasicMode mode) {
+    bi->mode = mode;
+}
+
+void basic_set_output(BasicInterp *bi, BasicOutputFn fn, void *ctx) {
+    bi->output = fn;
+    bi->output_ctx = ctx;
+}
+
+void basic_set_input(BasicInterp *bi, BasicInputFn fn, void *ctx) {
+    bi->input = fn;
+    bi->input_ctx = ctx;
+}
+
+void basic_set_input_journal(BasicInterp *bi, Journal *journal) {
+    bi->journal = journal;
+}
+
+void basic_attach(BasicInterp *bi, const BasicProgram *prog) {
+    if (!prog) prog = &no_program;
+
+    // Strings that are slices of the old program's literals move to the heap
+    for (int v = 52; v < VAR_COUNT; v++) {
+        Value *s = &bi->vars[v];
+        if (s->s.at & IN_POOL) *s = new_string(bi, string_bytes(bi, *s), s->s.len);
+    }
+
+    // A-Z that the new program holds in the other representation
+    uint32_t changed = bi->prog->real_vars ^ prog->real_vars;
+    for (int v = 0; v < 26; v++) {
+        if (!(changed >> v & 1)) continue;
+        if (prog->real_vars >> v & 1) {
+            int32_t i = bi->vars[v].i;
+            bi->vars[v].f = i;
+        } else {
+            double f = round_down(bi->vars[v].f);
+            bi->vars[v].i = f >= INT32_MAX ? INT32_MAX : f <= INT32_MIN ? INT32_MIN : (int32_t)f;
+        }
+    }
+
+    bi->prog = prog;
+    bi->current_line = 0;
+}
+
+// Make prog, which bi then owns, the program bi runs
+static void own_program(BasicInterp *bi, BasicProgram *prog) {
+    basic_attach(bi, prog);
+    basic_program_free(bi->own_prog);
+    bi->own_prog = prog;
+}
+
+void basic_load(BasicInterp *bi, const char *source) {
+    BasicProgram *prog = basic_compile(source, bi->mode);
+    if (!prog) out_text(bi, "Out of memory\n");
+    own_program(bi, prog);
+}
+
+int basic_map_image(BasicInterp *bi, const char *path) {
+    BasicProgram *prog = basic_program_map(path);
+    if (!prog) return 0;
+    own_program(bi, prog);
+    return 1;
+}
+
+int basic_save_image(BasicInterp *bi, const char *path) {
+    return basic_program_save(bi->prog, path);
+}
+
+void basic_start(BasicInterp *bi) {
+    bi->current_line = 0;
+    bi->failed = 0;
+    bi->resuming = 0;
+}
+
+int basic_start_at(BasicInterp *bi, int line_num) {
+    int index = find_line(bi->prog->lines, bi->prog->line_count, line_num);
+    if (index < 0) return 0;
+    bi->current_line = index;
+    bi->failed = 0;
+    bi->resuming = 0;
+    return 1;
+}
+
+BasicStatus basic_continue(BasicInterp *bi, uint64_t max_lines) {
+    uint64_t start = bi->lines_executed;
+
+    while (bi->current_line < bi->prog->line_count) {
+        if (max_lines && bi->lines_executed - start >= max_lines) return BASIC_RUNNING;
+        if (bi->heap_used > bi->heap_size / 2) collect_strings(bi);
+        bi->current_line = run_line(bi, bi->current_line);
+        if (bi->waiting) {
+            bi->waiting = 0;
+            return BASIC_WAITING;
+        }
+        bi->lines_executed++;
     }
+    return BASIC_DONE;
+}
+
+uint64_t basic_lines_executed(const BasicInterp *bi) {
+    return bi->lines_executed;
 }
@@ -2,9 +2,119 @@
 #define BASIC_H
 
 #include <stdint.h>
+#include "journal.h"
 
-void basic_init(void);
-void basic_run(void);
-void basic_load_program(const char *source);
+// A compiled program. Programs are never modified once built, so one can be
+// run by any number of interpreters at a time, on any threads.
+typedef struct BasicProgram BasicProgram;
+
+// One run of a program: variables, position, strings and I/O hooks. Instances
+// are independent, so several can run on different threads as long as each
+// thread binds its own Memory for PEEK/POKE.
+typedef struct BasicInterp BasicInterp;
+
+// Receives PRINT output and error messages; text is not NUL terminated
+typedef void (*BasicOutputFn)(void *ctx, const char *text, int len);
+
+// Supplies one line for INPUT at program line line_num. Returns 1, 0 at end
+// of input, or BASIC_INPUT_WAIT if no line is available yet: basic_continue
+// then returns BASIC_WAITING and runs the INPUT's line again when next called.
+#define BASIC_INPUT_WAIT (-1)
+typedef int (*BasicInputFn)(void *ctx, uint16_t line_num, char *buf, int size);
+
+typedef enum {
+    BASIC_DONE,     // Ran off the end of the program or hit END
+    BASIC_RUNNING,  // Stopped by the line budget; basic_continue resumes
+    BASIC_WAITING   // INPUT is waiting for a line; basic_continue retries it
+} BasicStatus;
+
+typedef enum {
+    BASIC_MODE_INTEGER, // 32-bit integers that wrap, integer division (the default)
+    BASIC_MODE_CLASSIC  // As 6502 BASICs: A-Z are reals, A%-Z% 16-bit integers, / divides exactly
+} BasicMode;
+
+// Compile source; NULL if out of memory. In both modes A%-Z% are 16-bit
+// integers; a value that does not fit stops the program with an overflow
+// error, as does division by zero.
+BasicProgram *basic_compile(const char *source, BasicMode mode);
+void basic_program_free(BasicProgram *prog);
+
+// Compiled images start with this magic. basic_program_save writes a program
+// as one; basic_program_map maps one read-only, to be run in place in the
+// mode it was compiled for. Images only load on builds with the same image
+// version and byte order. Both print an error on failure.
+#define BASIC_IMAGE_MAGIC "6502BASC"
+int basic_program_save(const BasicProgram *prog, const char *path);
+BasicProgram *basic_program_map(const char *path);
+
+// A program being edited, as in immediate mode: numbered lines in order,
+// added, replaced and deleted one at a time. Edits cost a binary search
+// over the line numbers; nothing is compiled until basic_source_compile.
+typedef struct BasicSource BasicSource;
+
+// Highest line number that can be entered
+#define BASIC_MAX_LINE_NUM 63999
+
+// Line number of the direct-mode statement basic_source_compile appends
+#define BASIC_DIRECT_LINE 65535
+
+BasicSource *basic_source_create(BasicMode mode);
+void basic_source_free(BasicSource *src);
+
+// Delete every line (NEW)
+void basic_source_clear(BasicSource *src);
+
+// Set line line_num to text, replacing it if it exists; text that is empty
+// or only spaces deletes it. Returns -1 for a bad line number or if out of
+// memory.
+int basic_source_set_line(BasicSource *src, int line_num, const char *text);
+
+// Set each numbered line of a program text, as if typed in order
+int basic_source_merge(BasicSource *src, const char *text);
+
+uint32_t basic_source_count(const BasicSource *src);
+
+// Index of the first line numbered line_num or higher (count if none)
+uint32_t basic_source_find(const BasicSource *src, int line_num);
+
+// Text of the line at index, NULL past the end; sets *line_num
+const char *basic_source_line(const BasicSource *src, uint32_t index, int *line_num);
+
+// Compile the lines, followed by direct (if not NULL) as line
+// BASIC_DIRECT_LINE, for running with basic_attach. In classic mode a
+// variable one compile made real stays real in later ones, so values carried
+// over between direct statements keep their meaning. NULL if out of memory.
+BasicProgram *basic_source_compile(BasicSource *src, const char *direct);
+
+BasicInterp *basic_create(void);
+void basic_destroy(BasicInterp *bi);
+void basic_reset(BasicInterp *bi);
+
+// Run prog, which must outlive its use by bi, from its first line. NULL
+// detaches. Variables keep their values; strings that were literals of the
+// old program are copied to bi's string heap first.
+void basic_attach(BasicInterp *bi, const BasicProgram *prog);
+
+// Compile source or map an image into a program bi owns and runs
+void basic_load(BasicInterp *bi, const char *source);
+int basic_map_image(BasicInterp *bi, const char *path);
+int basic_save_image(BasicInterp *bi, const char *path);
+
+// Numbers and arithmetic for programs basic_load compiles after the call
+void basic_set_numeric_mode(BasicInterp *bi, BasicMode mode);
+void basic_start(BasicInterp *bi);
+
+// Start at line line_num instead of the first line, keeping variables as
+// they are; 0 if the program has no such line
+int basic_start_at(BasicInterp *bi, int line_num);
+
+// Execute up to max_lines program lines (0: no limit)
+BasicStatus basic_continue(BasicInterp *bi, uint64_t max_lines);
+uint64_t basic_lines_executed(const BasicInterp *bi);
+
+// NULL output writes to stdout; NULL input reads through the journal
+void basic_set_output(BasicInterp *bi, BasicOutputFn fn, void *ctx);
+void basic_set_input(BasicInterp *bi, BasicInputFn fn, void *ctx);
+void basic_set_input_journal(BasicInterp *bi, Journal *journal);
 
 #endif
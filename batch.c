@@ -0,0 +1,744 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include "opcodes.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Registers of BATCH_CHUNK lanes, processed with GCC vector extensions.
+// The hot loop is built for AVX2 and for plain SSE2 and picked at load time.
+typedef uint8_t u8v __attribute__((vector_size(BATCH_CHUNK)));
+
+
+#define INLINE static inline __attribute__((always_inline))
+
+// What the vector path does for an opcode. Only documented opcodes whose
+// behaviour and timing are the same on every model are covered; anything
+// else, and ADC/SBC in decimal mode, goes through cpu_step. Lengths and
+// cycles come from the opcode table.
+typedef enum {
+    V_NONE,
+    V_LDA, V_LDX, V_LDY, V_STA, V_STX, V_STY,
+    V_ADC, V_SBC, V_AND, V_ORA, V_EOR, V_CMP, V_CPX, V_CPY, V_BIT,
+    V_INC, V_DEC,
+    V_ASL, V_LSR, V_ROL, V_ROR,     // M_IMP: the accumulator
+    V_INX, V_INY, V_DEX, V_DEY,
+    V_TAX, V_TAY, V_TXA, V_TYA, V_TSX, V_TXS,
+    V_CLEAR, V_SET,         // Flag in the operand field
+    V_PHA, V_PLA,
+    V_BRANCH, V_JMP, V_JSR, V_RTS, V_NOP
+} VecKind;
+
+typedef enum {
+    M_IMP, M_IMM, M_ZP, M_ZPX, M_ZPY, M_ABS, M_ABX, M_ABY, M_INX, M_INY, M_REL
+} VecMode;
+
+typedef struct {
+    uint8_t kind;           // VecKind
+    uint8_t mode;           // VecMode
+    uint8_t flag;           // V_CLEAR/V_SET: the flag
+} VecOp;
+
+#define READ_OPS(K, imm, zp, zpx, abs, abx, aby, inx, iny) \
+    [imm] = { K, M_IMM }, [zp] = { K, M_ZP }, [zpx] = { K, M_ZPX }, \
+    [abs] = { K, M_ABS }, [abx] = { K, M_ABX }, [aby] = { K, M_ABY }, \
+    [inx] = { K, M_INX }, [iny] = { K, M_INY }
+
+static const VecOp vec_ops[256] = {
+    READ_OPS(V_LDA, 0xA9, 0xA5, 0xB5, 0xAD, 0xBD, 0xB9, 0xA1, 0xB1),
+    READ_OPS(V_ADC, 0x69, 0x65, 0x75, 0x6D, 0x7D, 0x79, 0x61, 0x71),
+    READ_OPS(V_SBC, 0xE9, 0xE5, 0xF5, 0xED, 0xFD, 0xF9, 0xE1, 0xF1),
+    READ_OPS(V_AND, 0x29, 0x25, 0x35, 0x2D, 0x3D, 0x39, 0x21, 0x31),
+    READ_OPS(V_ORA, 0x09, 0x05, 0x15, 0x0D, 0x1D, 0x19, 0x01, 0x11),
+    READ_OPS(V_EOR, 0x49, 0x45, 0x55, 0x4D, 0x5D, 0x59, 0x41, 0x51),
+    READ_OPS(V_CMP, 0xC9, 0xC5, 0xD5, 0xCD, 0xDD, 0xD9, 0xC1, 0xD1),
+
+    [0xA2] = { V_LDX, M_IMM }, [0xA6] = { V_LDX, M_ZP }, [0xB6] = { V_LDX, M_ZPY },
+    [0xAE] = { V_LDX, M_ABS }, [0xBE] = { V_LDX, M_ABY },
+    [0xA0] = { V_LDY, M_IMM }, [0xA4] = { V_LDY, M_ZP }, [0xB4] = { V_LDY, M_ZPX },
+    [0xAC] = { V_LDY, M_ABS }, [0xBC] = { V_LDY, M_ABX },
+
+    [0x85] = { V_STA, M_ZP }, [0x95] = { V_STA, M_ZPX }, [0x8D] = { V_STA, M_ABS },
+    [0x9D] = { V_STA, M_ABX }, [0x99] = { V_STA, M_ABY }, [0x81] = { V_STA, M_INX },
+    [0x91] = { V_STA, M_INY },
+    [0x86] = { V_STX, M_ZP }, [0x96] = { V_STX, M_ZPY }, [0x8E] = { V_STX, M_ABS },
+    [0x84] = { V_STY, M_ZP }, [0x94] = { V_STY, M_ZPX }, [0x8C] = { V_STY, M_ABS },
+
+    [0xE0] = { V_CPX, M_IMM }, [0xE4] = { V_CPX, M_ZP }, [0xEC] = { V_CPX, M_ABS },
+    [0xC0] = { V_CPY, M_IMM }, [0xC4] = { V_CPY, M_ZP }, [0xCC] = { V_CPY, M_ABS },
+    [0x24] = { V_BIT, M_ZP }, [0x2C] = { V_BIT, M_ABS },
+
+    [0xE6] = { V_INC, M_ZP }, [0xF6] = { V_INC, M_ZPX },
+    [0xEE] = { V_INC, M_ABS }, [0xFE] = { V_INC, M_ABX },
+    [0xC6] = { V_DEC, M_ZP }, [0xD6] = { V_DEC, M_ZPX },
+    [0xCE] = { V_DEC, M_ABS }, [0xDE] = { V_DEC, M_ABX },
+
+    // abs,X is left out: the 65C02 saves a cycle when no page is crossed
+    [0x0A] = { V_ASL, M_IMP }, [0x06] = { V_ASL, M_ZP },
+    [0x16] = { V_ASL, M_ZPX }, [0x0E] = { V_ASL, M_ABS },
+    [0x4A] = { V_LSR, M_IMP }, [0x46] = { V_LSR, M_ZP },
+    [0x56] = { V_LSR, M_ZPX }, [0x4E] = { V_LSR, M_ABS },
+    [0x2A] = { V_ROL, M_IMP }, [0x26] = { V_ROL, M_ZP },
+    [0x36] = { V_ROL, M_ZPX }, [0x2E] = { V_ROL, M_ABS },
+    [0x6A] = { V_ROR, M_IMP }, [0x66] = { V_ROR, M_ZP },
+    [0x76] = { V_ROR, M_ZPX }, [0x6E] = { V_ROR, M_ABS },
+    [0xE8] = { V_INX, M_IMP }, [0xC8] = { V_INY, M_IMP },
+    [0xCA] = { V_DEX, M_IMP }, [0x88] = { V_DEY, M_IMP },
+    [0xAA] = { V_TAX, M_IMP }, [0xA8] = { V_TAY, M_IMP },
+    [0x8A] = { V_TXA, M_IMP }, [0x98] = { V_TYA, M_IMP },
+    [0xBA] = { V_TSX, M_IMP }, [0x9A] = { V_TXS, M_IMP },
+    [0x18] = { V_CLEAR, M_IMP, FLAG_C }, [0x38] = { V_SET, M_IMP, FLAG_C },
+    [0x58] = { V_CLEAR, M_IMP, FLAG_I }, [0x78] = { V_SET, M_IMP, FLAG_I },
+    [0xB8] = { V_CLEAR, M_IMP, FLAG_V },
+    [0xD8] = { V_CLEAR, M_IMP, FLAG_D }, [0xF8] = { V_SET, M_IMP, FLAG_D },
+    [0x48] = { V_PHA, M_IMP }, [0x68] = { V_PLA, M_IMP },
+
+    [0x10] = { V_BRANCH, M_REL }, [0x30] = { V_BRANCH, M_REL },
+    [0x50] = { V_BRANCH, M_REL }, [0x70] = { V_BRANCH, M_REL },
+    [0x90] = { V_BRANCH, M_REL }, [0xB0] = { V_BRANCH, M_REL },
+    [0xD0] = { V_BRANCH, M_REL }, [0xF0] = { V_BRANCH, M_REL },
+    [0x4C] = { V_JMP, M_ABS }, [0x20] = { V_JSR, M_ABS }, [0x60] = { V_RTS, M_IMP },
+    [0xEA] = { V_NOP, M_IMP },
+};
+
+static void *alloc_lanes(size_t size) {
+    void *p;
+    return posix_memalign(&p, BATCH_CHUNK, size) == 0 ? p : NULL;
+}
+
+CpuBatch *batch_create(int lanes, CpuModel model) {
+    if (lanes <= 0) return NULL;
+    CpuBatch *b = calloc(1, sizeof(CpuBatch));
+    if (!b) return NULL;
+    b->lanes = lanes;
+    b->capacity = (lanes + BATCH_CHUNK - 1) / BATCH_CHUNK * BATCH_CHUNK;
+
+    size_t n = b->capacity;
+    b->A = alloc_lanes(n);
+    b->X = alloc_lanes(n);
+    b->Y = alloc_lanes(n);
+    b->SP = alloc_lanes(n);
+    b->status = alloc_lanes(n);
+    b->halted = alloc_lanes(n);
+    b->live = alloc_lanes(n);
+    b->group = alloc_lanes(n);
+    b->PC = alloc_lanes(n * sizeof(uint16_t));
+    b->cycles = alloc_lanes(n * sizeof(uint64_t));
+    b->end = alloc_lanes(n * sizeof(uint64_t));
+    b->pending = calloc(n, sizeof(uint16_t));
+    b->mem = calloc(n, sizeof(Memory *));
+    if (!b->A || !b->X || !b->Y || !b->SP || !b->status || !b->halted || !b->live ||
+        !b->group || !b->PC || !b->cycles || !b->end || !b->pending || !b->mem) {
+        batch_destroy(b);
+        return NULL;
+    }
+
+    cpu_init(&b->config);
+    cpu_set_model(&b->config, model);
+    for (int i = 0; i < b->capacity; i++) {
+        batch_set_lane(b, i, &b->config);
+        if (i >= lanes) {
+            b->halted[i] = 1;
+            continue;
+        }
+        // Dense: the vector path reads ram[] directly
+        b->mem[i] = memory_create(0);
+        if (!b->mem[i]) {
+            batch_destroy(b);
+            return NULL;
+        }
+    }
+    return b;
+}
+
+void batch_destroy(CpuBatch *b) {
+    if (!b) return;
+    if (b->mem) {
+        for (int i = 0; i < b->capacity; i++) memory_free(b->mem[i]);
+    }
+    free(b->mem);
+    free(b->A);
+    free(b->X);
+    free(b->Y);
+    free(b->SP);
+    free(b->status);
+    free(b->halted);
+    free(b->live);
+    free(b->group);
+    free(b->PC);
+    free(b->cycles);
+    free(b->end);
+    free(b->pending);
+    free(b);
+}
+
+void batch_get_lane(const CpuBatch *b, int lane, CPU *cpu) {
+    cpu->A = b->A[lane];
+    cpu->X = b->X[lane];
+    cpu->Y = b->Y[lane];
+    cpu->SP = b->SP[lane];
+    cpu->status = b->status[lane];
+    cpu->PC = b->PC[lane];
+    cpu->cycles = b->cycles[lane];
+    cpu->halted = b->halted[lane];
+}
+
+void batch_set_lane(CpuBatch *b, int lane, const CPU *cpu) {
+    b->A[lane] = cpu->A;
+    b->X[lane] = cpu->X;
+    b->Y[lane] = cpu->Y;
+    b->SP[lane] = cpu->SP;
+    b->status[lane] = cpu->status;
+    b->PC[lane] = cpu->PC;
+    b->cycles[lane] = cpu->cycles;
+    b->halted[lane] = cpu->halted;
+}
+
+INLINE u8v load8(const uint8_t *p) {
+    u8v v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+INLINE void store8(uint8_t *p, u8v v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+INLINE u8v blend(u8v mask, u8v new_value, u8v old_value) {
+    return (new_value & mask) | (old_value & ~mask);
+}
+
+INLINE u8v set_zn(u8v p, u8v v) {
+    return (p & (uint8_t)~(FLAG_Z | FLAG_N)) | ((u8v)(v == 0) & FLAG_Z) | (v & FLAG_N);
+}
+
+INLINE u8v set_flag(u8v p, uint8_t flag, u8v condition) {
+    return (p & (uint8_t)~flag) | (condition & flag);
+}
+
+INLINE int any_set(const uint8_t *lanes) {
+    uint64_t words[BATCH_CHUNK / 8];
+    memcpy(words, lanes, sizeof(words));
+    uint64_t any = 0;
+    for (int i = 0; i < BATCH_CHUNK / 8; i++) any |= words[i];
+    return any != 0;
+}
+
+// What batch_execute knows about a page of code in every lane of the group.
+// Instructions on PAGE_SAME pages need no per-lane check of their bytes.
+enum { PAGE_UNKNOWN, PAGE_SAME, PAGE_CHECK };
+
+// memory_write_to for a group lane; a store into a matching code page means
+// the copies may differ from now on
+INLINE void lane_write(CpuBatch *b, Memory *mem, uint16_t address, uint8_t value) {
+    memory_write_to(mem, address, value);
+    if (b->code_pages[address >> 8] == PAGE_SAME) b->code_pages[address >> 8] = PAGE_CHECK;
+}
+
+// Compare a page of every group lane with the leader's copy
+static int compare_page(CpuBatch *b, int page, int leader, int stop) {
+    const uint8_t *code = &b->mem[leader]->ram[page * MEMORY_PAGE_SIZE];
+    for (int i = leader + 1; i < stop; i++) {
+        if (b->group[i] && memcmp(&b->mem[i]->ram[page * MEMORY_PAGE_SIZE], code, MEMORY_PAGE_SIZE) != 0) {
+            return PAGE_CHECK;
+        }
+    }
+    return PAGE_SAME;
+}
+
+// Number of lanes set in a chunk's mask; *first gets the first of them
+// unless it is already set
+INLINE int count_set(const uint8_t *lanes, int *first) {
+    uint64_t words[BATCH_CHUNK / 8];
+    memcpy(words, lanes, sizeof(words));
+    int count = 0;
+    for (int i = 0; i < BATCH_CHUNK / 8; i++) {
+        uint64_t bits = words[i] & 0x0101010101010101ULL;
+        if (*first < 0 && bits) *first = i * 8 + __builtin_ctzll(bits) / 8;
+        count += __builtin_popcountll(bits);
+    }
+    return count;
+}
+
+// The three bytes at pc, little-endian
+INLINE uint32_t lane_code(const uint8_t *ram, uint16_t pc) {
+    if (pc > MEMORY_SIZE - 4) {
+        return ram[pc] | ram[(uint16_t)(pc + 1)] << 8 | ram[(uint16_t)(pc + 2)] << 16;
+    }
+    uint32_t bytes;
+    memcpy(&bytes, ram + pc, sizeof(bytes));
+    return bytes & 0xFFFFFF;
+}
+
+// Run one lane through cpu_step
+static void step_lane(CpuBatch *b, int lane) {
+    b->cycles[lane] += b->pending[lane];
+    b->pending[lane] = 0;
+    CPU cpu = b->config;
+    batch_get_lane(b, lane, &cpu);
+    memory_bind(b->mem[lane]);
+    cpu_step(&cpu);
+    batch_set_lane(b, lane, &cpu);
+    b->live[lane] = !cpu.halted && cpu.cycles < b->end[lane] ? 0xFF : 0;
+    b->scalar_steps++;
+}
+
+// Run one lane through up to steps calls of cpu_step, for groups too small
+// to be worth a vector operation per chunk
+static void run_lane(CpuBatch *b, int lane, int steps) {
+    b->cycles[lane] += b->pending[lane];
+    b->pending[lane] = 0;
+    CPU cpu = b->config;
+    batch_get_lane(b, lane, &cpu);
+    memory_bind(b->mem[lane]);
+    uint64_t end = b->end[lane];
+    int k = 0;
+    while (k < steps && !cpu.halted && cpu.cycles < end) {
+        cpu_step(&cpu);
+        k++;
+    }
+    batch_set_lane(b, lane, &cpu);
+    b->live[lane] = !cpu.halted && cpu.cycles < end ? 0xFF : 0;
+    b->scalar_steps += k;
+}
+
+// Mark in b->group the live lanes of [start, stop) at the PC of the lane
+// with the deepest stack, the lowest PC breaking ties. Lanes inside a
+// subroutine run first so that they return to where the others wait, and
+// the lowest PC lets lanes that took different paths through a loop or an
+// IF meet up again where the paths rejoin. Returns the number of lanes in
+// the group (0 when none is live) and the first one in *leader.
+INLINE int select_group(CpuBatch *b, int start, int stop, int *leader) {
+    uint32_t best = UINT32_MAX;
+    for (int base = start; base < stop; base += BATCH_CHUNK) {
+        const uint8_t *live = b->live + base;
+        const uint8_t *SP = b->SP + base;
+        const uint16_t *PC = b->PC + base;
+        for (int j = 0; j < BATCH_CHUNK; j++) {
+            uint32_t candidate = live[j] ? (uint32_t)SP[j] << 16 | PC[j] : UINT32_MAX;
+            best = candidate < best ? candidate : best;
+        }
+    }
+    if (best == UINT32_MAX) return 0;
+    uint16_t pc = best & 0xFFFF;
+
+    int count = 0;
+    *leader = -1;
+    for (int base = start; base < stop; base += BATCH_CHUNK) {
+        for (int j = 0; j < BATCH_CHUNK; j++) {
+            b->group[base + j] = b->live[base + j] & (b->PC[base + j] == pc ? 0xFF : 0);
+        }
+        int first = -1;
+        count += count_set(b->group + base, &first);
+        if (*leader < 0 && first >= 0) *leader = base + first;
+    }
+    return count;
+}
+
+// Execute the group's instruction for the lanes of one chunk. All of them
+// are at pc with the same instruction bytes; only memory differs. Lanes that
+// run out of cycles, or end up somewhere other than *join_pc (set by the
+// first lane to finish), leave the group. Cycles go to b->pending unless
+// exact is set, when some lane might reach its end. Returns the lanes executed.
+INLINE int exec_chunk(CpuBatch *b, int base, const VecOp *op, const OpcodeInfo *info, uint8_t opcode,
+                       uint8_t b1, uint8_t b2, uint16_t pc, int exact, int *join_pc) {
+    u8v m = load8(b->group + base);
+    u8v A = load8(b->A + base);
+    u8v X = load8(b->X + base);
+    u8v Y = load8(b->Y + base);
+    u8v S = load8(b->SP + base);
+    u8v P = load8(b->status + base);
+    Memory **mem = b->mem + base;
+    uint16_t abs = b1 | b2 << 8;
+    uint16_t next_pc = pc + info->length;
+
+    uint16_t addr[BATCH_CHUNK];
+    uint8_t operand[BATCH_CHUNK];
+    u8v extra = { 0 };              // Cycles on top of info->cycles
+
+    // Effective addresses; only the indirect modes need the lanes' memory
+    switch (op->mode) {
+        case M_ZP:
+        case M_ABS:
+            for (int j = 0; j < BATCH_CHUNK; j++) addr[j] = op->mode == M_ZP ? b1 : abs;
+            break;
+        case M_ZPX:
+        case M_ZPY: {
+            uint8_t zp[BATCH_CHUNK];
+            store8(zp, (op->mode == M_ZPX ? X : Y) + b1);
+            for (int j = 0; j < BATCH_CHUNK; j++) addr[j] = zp[j];
+            break;
+        }
+        case M_ABX:
+        case M_ABY: {
+            uint8_t index[BATCH_CHUNK];
+            u8v reg = op->mode == M_ABX ? X : Y;
+            store8(index, reg);
+            for (int j = 0; j < BATCH_CHUNK; j++) addr[j] = abs + index[j];
+            // The low byte carries into the high one: a page crossing
+            if (info->effects & OP_PAGE_CYCLE) extra = (u8v)(reg + b1 < reg) & 1;
+            break;
+        }
+        case M_INX:
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                if (!m[j]) continue;
+                const uint8_t *ram = mem[j]->ram;
+                uint8_t ptr = b1 + X[j];
+                addr[j] = ram[ptr] | ram[(uint8_t)(ptr + 1)] << 8;
+            }
+            break;
+        case M_INY:
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                if (!m[j]) continue;
+                const uint8_t *ram = mem[j]->ram;
+                uint16_t pointer = ram[b1] | ram[(uint8_t)(b1 + 1)] << 8;
+                addr[j] = pointer + Y[j];
+                extra[j] = (info->effects & OP_PAGE_CYCLE) && ((pointer ^ addr[j]) & 0xFF00);
+            }
+            break;
+        default:
+            break;
+    }
+
+    // Operands of the instructions that read memory
+    switch (op->kind) {
+        case V_LDA: case V_LDX: case V_LDY: case V_ADC: case V_SBC: case V_AND: case V_ORA:
+        case V_EOR: case V_CMP: case V_CPX: case V_CPY: case V_BIT: case V_INC: case V_DEC:
+        case V_ASL: case V_LSR: case V_ROL: case V_ROR:
+            if (op->mode == M_IMM) {
+                memset(operand, b1, sizeof(operand));
+            } else if (op->mode != M_IMP) {
+                for (int j = 0; j < BATCH_CHUNK; j++) {
+                    operand[j] = m[j] ? mem[j]->ram[addr[j]] : 0;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    u8v M = load8(operand);
+    u8v carry = P & FLAG_C;
+    u8v has_carry = (u8v)(carry != 0);
+    u8v r;
+
+    uint16_t target = next_pc;      // PC for every lane, unless set per lane below
+    uint16_t lane_pc[BATCH_CHUNK];
+    int per_lane_pc = 0;
+
+    switch (op->kind) {
+        case V_LDA: A = blend(m, M, A); P = blend(m, set_zn(P, M), P); break;
+        case V_LDX: X = blend(m, M, X); P = blend(m, set_zn(P, M), P); break;
+        case V_LDY: Y = blend(m, M, Y); P = blend(m, set_zn(P, M), P); break;
+
+        case V_STA: case V_STX: case V_STY: {
+            u8v v = op->kind == V_STA ? A : op->kind == V_STX ? X : Y;
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                if (m[j]) lane_write(b, mem[j], addr[j], v[j]);
+            }
+            break;
+        }
+
+        case V_ADC: {
+            r = A + M + carry;
+            u8v carry_out = (u8v)(r < A) | ((u8v)(r == A) & has_carry);
+            u8v overflow = (u8v)(((A ^ r) & (M ^ r) & 0x80) != 0);
+            u8v p = set_flag(P, FLAG_C, carry_out);
+            p = set_flag(p, FLAG_V, overflow);
+            A = blend(m, r, A);
+            P = blend(m, set_zn(p, r), P);
+            break;
+        }
+        case V_SBC: {
+            r = A - M - (carry ^ 1);
+            u8v no_borrow = (u8v)(A > M) | ((u8v)(A == M) & has_carry);
+            u8v overflow = (u8v)(((A ^ M) & (A ^ r) & 0x80) != 0);
+            u8v p = set_flag(P, FLAG_C, no_borrow);
+            p = set_flag(p, FLAG_V, overflow);
+            A = blend(m, r, A);
+            P = blend(m, set_zn(p, r), P);
+            break;
+        }
+        case V_AND: r = A & M; A = blend(m, r, A); P = blend(m, set_zn(P, r), P); break;
+        case V_ORA: r = A | M; A = blend(m, r, A); P = blend(m, set_zn(P, r), P); break;
+        case V_EOR: r = A ^ M; A = blend(m, r, A); P = blend(m, set_zn(P, r), P); break;
+        case V_CMP: case V_CPX: case V_CPY: {
+            u8v reg = op->kind == V_CMP ? A : op->kind == V_CPX ? X : Y;
+            u8v p = set_flag(P, FLAG_C, (u8v)(reg >= M));
+            P = blend(m, set_zn(p, reg - M), P);
+            break;
+        }
+        case V_BIT: {
+            u8v p = (P & (uint8_t)~(FLAG_N | FLAG_V | FLAG_Z)) | (M & (FLAG_N | FLAG_V));
+            p |= (u8v)((A & M) == 0) & FLAG_Z;
+            P = blend(m, p, P);
+            break;
+        }
+        case V_INC: case V_DEC:
+            r = op->kind == V_INC ? M + 1 : M - 1;
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                if (m[j]) lane_write(b, mem[j], addr[j], r[j]);
+            }
+            P = blend(m, set_zn(P, r), P);
+            break;
+
+        case V_ASL: case V_LSR: case V_ROL: case V_ROR: {
+            u8v v = op->mode == M_IMP ? A : M;
+            u8v out;
+            if (op->kind == V_ASL || op->kind == V_ROL) {
+                r = v << 1;
+                if (op->kind == V_ROL) r |= carry;
+                out = (u8v)(v >= 0x80);
+            } else {
+                r = v >> 1;
+                if (op->kind == V_ROR) r |= carry << 7;
+                out = (u8v)((v & 1) != 0);
+            }
+            P = blend(m, set_zn(set_flag(P, FLAG_C, out), r), P);
+            if (op->mode == M_IMP) {
+                A = blend(m, r, A);
+            } else {
+                for (int j = 0; j < BATCH_CHUNK; j++) {
+                    if (m[j]) lane_write(b, mem[j], addr[j], r[j]);
+                }
+            }
+            break;
+        }
+
+        case V_INX: X = blend(m, X + 1, X); P = blend(m, set_zn(P, X), P); break;
+        case V_INY: Y = blend(m, Y + 1, Y); P = blend(m, set_zn(P, Y), P); break;
+        case V_DEX: X = blend(m, X - 1, X); P = blend(m, set_zn(P, X), P); break;
+        case V_DEY: Y = blend(m, Y - 1, Y); P = blend(m, set_zn(P, Y), P); break;
+        case V_TAX: X = blend(m, A, X); P = blend(m, set_zn(P, A), P); break;
+        case V_TAY: Y = blend(m, A, Y); P = blend(m, set_zn(P, A), P); break;
+        case V_TXA: A = blend(m, X, A); P = blend(m, set_zn(P, X), P); break;
+        case V_TYA: A = blend(m, Y, A); P = blend(m, set_zn(P, Y), P); break;
+        case V_TSX: X = blend(m, S, X); P = blend(m, set_zn(P, S), P); break;
+        case V_TXS: S = blend(m, X, S); break;
+        case V_CLEAR: P = blend(m, P & (uint8_t)~op->flag, P); break;
+        case V_SET: P = blend(m, P | op->flag, P); break;
+
+        case V_PHA:
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                if (m[j]) lane_write(b, mem[j], 0x0100 + S[j], A[j]);
+            }
+            S = blend(m, S - 1, S);
+            break;
+        case V_PLA:
+            S = blend(m, S + 1, S);
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                operand[j] = m[j] ? mem[j]->ram[0x0100 + S[j]] : 0;
+            }
+            M = load8(operand);
+            A = blend(m, M, A);
+            P = blend(m, set_zn(P, M), P);
+            break;
+
+        case V_BRANCH: {
+            static const uint8_t branch_flag[4] = { FLAG_N, FLAG_V, FLAG_C, FLAG_Z };
+            u8v taken = (u8v)((P & branch_flag[opcode >> 6]) != 0);
+            if (!(opcode & 0x20)) taken = ~taken;
+            uint16_t dest = next_pc + (int8_t)b1;
+            uint8_t taken_lanes[BATCH_CHUNK];
+            store8(taken_lanes, taken);
+            for (int j = 0; j < BATCH_CHUNK; j++) lane_pc[j] = taken_lanes[j] ? dest : next_pc;
+            extra = taken & (uint8_t)(((next_pc ^ dest) & 0xFF00) ? 2 : 1);
+            per_lane_pc = 1;
+            break;
+        }
+        case V_JMP:
+            target = abs;
+            break;
+        case V_JSR: {
+            uint16_t ret = pc + 2;
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                if (!m[j]) continue;
+                lane_write(b, mem[j], 0x0100 + S[j], ret >> 8);
+                lane_write(b, mem[j], 0x0100 + (uint8_t)(S[j] - 1), ret & 0xFF);
+            }
+            S = blend(m, S - 2, S);
+            target = abs;
+            break;
+        }
+        case V_RTS:
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                if (!m[j]) continue;
+                const uint8_t *ram = mem[j]->ram;
+                uint8_t lo = ram[0x0100 + (uint8_t)(S[j] + 1)];
+                uint8_t hi = ram[0x0100 + (uint8_t)(S[j] + 2)];
+                lane_pc[j] = (uint16_t)((hi << 8 | lo) + 1);
+            }
+            S = blend(m, S + 2, S);
+            per_lane_pc = 1;
+            break;
+        default:
+            break;
+    }
+
+    store8(b->A + base, A);
+    store8(b->X + base, X);
+    store8(b->Y + base, Y);
+    store8(b->SP + base, S);
+    store8(b->status + base, P);
+
+    uint8_t active[BATCH_CHUNK], spent[BATCH_CHUNK], dead[BATCH_CHUNK];
+    store8(active, m);
+    store8(spent, (extra + info->cycles) & m);
+    uint16_t *restrict PC = b->PC + base;
+    uint16_t *restrict pending = b->pending + base;
+    if (!per_lane_pc) {
+        for (int j = 0; j < BATCH_CHUNK; j++) lane_pc[j] = target;
+    }
+    for (int j = 0; j < BATCH_CHUNK; j++) PC[j] = active[j] ? lane_pc[j] : PC[j];
+    if (exact) {
+        uint64_t *restrict cycles = b->cycles + base;
+        const uint64_t *restrict end = b->end + base;
+        for (int j = 0; j < BATCH_CHUNK; j++) {
+            cycles[j] += pending[j] + spent[j];
+            pending[j] = 0;
+            dead[j] = cycles[j] >= end[j] ? 0xFF : 0;
+        }
+    } else {
+        for (int j = 0; j < BATCH_CHUNK; j++) pending[j] += spent[j];
+        memset(dead, 0, sizeof(dead));
+    }
+    u8v gone = load8(dead) & m;
+    store8(b->live + base, load8(b->live + base) & ~gone);
+    u8v group = m & ~gone;
+
+    // Lanes that branched differently from the rest leave the group
+    if (per_lane_pc) {
+        for (int j = 0; j < BATCH_CHUNK; j++) {
+            if (!group[j]) continue;
+            if (*join_pc < 0) *join_pc = lane_pc[j];
+            else if (lane_pc[j] != *join_pc) group[j] = 0;
+        }
+    } else if (*join_pc < 0) {
+        *join_pc = target;
+    }
+    store8(b->group + base, group);
+
+    int first = 0;
+    return count_set(active, &first);
+}
+
+// Run the lanes of [start, stop) until none is live
+// Smaller groups are run lane by lane
+#define BATCH_MIN_GROUP 16
+
+INLINE void execute_tile(CpuBatch *b, int start, int stop) {
+    for (;;) {
+        int leader;
+        int count = select_group(b, start, stop, &leader);
+        if (count == 0) break;
+
+        if (count < BATCH_MIN_GROUP) {
+            // Stragglers: give each a short run of its own so it can catch up
+            for (int i = leader; i < stop; i++) {
+                if (b->group[i]) run_lane(b, i, 256);
+            }
+            continue;
+        }
+
+        // Keep stepping the group for as long as it stays together. Until
+        // the group could have used up the smallest budget left in it, no
+        // lane's cycles need comparing with its end.
+        memset(b->code_pages, PAGE_UNKNOWN, sizeof(b->code_pages));
+        uint64_t headroom = UINT64_MAX;
+        for (int base = leader - leader % BATCH_CHUNK; base < stop; base += BATCH_CHUNK) {
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                uint64_t left = b->group[base + j] ? b->end[base + j] - b->cycles[base + j] : UINT64_MAX;
+                headroom = left < headroom ? left : headroom;
+            }
+        }
+        // Once a quarter of the lanes have left, end the run so that they
+        // can join up again with the lanes waiting elsewhere
+        uint64_t used = 0;
+        int initial = count;
+        for (int run = 0; run < 256 && count >= BATCH_MIN_GROUP && count * 4 > initial * 3; run++) {
+            uint16_t pc = b->PC[leader];
+            const uint8_t *code = b->mem[leader]->ram;
+            uint8_t opcode = code[pc];
+            const VecOp *op = &vec_ops[opcode];
+            const OpcodeInfo *info = opcode_info(b->config.model, opcode);
+            if (op->kind == V_NONE) {
+                for (int i = leader; i < stop; i++) {
+                    if (b->group[i]) step_lane(b, i);
+                }
+                break;
+            }
+
+            // Lanes whose instruction bytes differ from the leader's, or that
+            // would need decimal arithmetic, take the scalar path. The bytes
+            // only need checking lane by lane on pages that may differ.
+            uint8_t b1 = code[(uint16_t)(pc + 1)];
+            uint8_t b2 = code[(uint16_t)(pc + 2)];
+            int length = info->length;
+            uint32_t length_mask = 0xFFFFFFu >> (8 * (3 - length));
+            uint32_t bytes = (opcode | b1 << 8 | b2 << 16) & length_mask;
+            uint8_t decimal_mask = op->kind == V_ADC || op->kind == V_SBC ? FLAG_D : 0;
+            int first_page = pc >> 8;
+            int last_page = (uint16_t)(pc + length - 1) >> 8;
+            if (b->code_pages[first_page] == PAGE_UNKNOWN) {
+                b->code_pages[first_page] = compare_page(b, first_page, leader, stop);
+            }
+            if (b->code_pages[last_page] == PAGE_UNKNOWN) {
+                b->code_pages[last_page] = compare_page(b, last_page, leader, stop);
+            }
+            int check_bytes = b->code_pages[first_page] != PAGE_SAME || b->code_pages[last_page] != PAGE_SAME;
+            int exact = used + info->cycles + 2 >= headroom;   // At most 2 extra cycles
+            used += info->cycles + 2;
+            int join_pc = -1;
+            int first = leader;
+            count = 0;
+            leader = -1;
+            for (int base = first - first % BATCH_CHUNK; base < stop; base += BATCH_CHUNK) {
+                if (!any_set(b->group + base)) continue;
+                uint8_t decimal[BATCH_CHUNK];
+                store8(decimal, load8(b->status + base) & load8(b->group + base) & decimal_mask);
+                for (int i = base; (check_bytes || any_set(decimal)) && i < base + BATCH_CHUNK; i++) {
+                    if (!b->group[i]) continue;
+                    uint32_t lane_bytes = lane_code(b->mem[i]->ram, pc);
+                    if ((lane_bytes & length_mask) != bytes || (b->status[i] & decimal_mask)) {
+                        b->group[i] = 0;
+                        step_lane(b, i);
+                    }
+                }
+                if (!any_set(b->group + base)) continue;
+                b->vector_steps += exec_chunk(b, base, op, info, opcode, b1, b2, pc, exact, &join_pc);
+                int first_left = -1;
+                count += count_set(b->group + base, &first_left);
+                if (leader < 0 && first_left >= 0) leader = base + first_left;
+            }
+        }
+        for (int base = start; base < stop; base += BATCH_CHUNK) {
+            uint64_t *restrict cycles = b->cycles + base;
+            uint16_t *restrict pending = b->pending + base;
+            for (int j = 0; j < BATCH_CHUNK; j++) {
+                cycles[j] += pending[j];
+                pending[j] = 0;
+            }
+        }
+    }
+}
+
+// Lanes are run a tile at a time, so that the memory a group run touches
+// stays in cache
+#define BATCH_TILE 256
+
+__attribute__((target_clones("avx2", "default")))
+void batch_execute(CpuBatch *b, uint64_t max_cycles) {
+    Memory *saved = memory_bind(NULL);
+
+    for (int i = 0; i < b->capacity; i++) {
+        b->end[i] = max_cycles > UINT64_MAX - b->cycles[i] ? UINT64_MAX : b->cycles[i] + max_cycles;
+        b->live[i] = !b->halted[i] && b->cycles[i] < b->end[i] ? 0xFF : 0;
+    }
+    // The vector path reads ram[] directly, so lanes with devices run alone
+    for (int i = 0; i < b->capacity; i++) {
+        while (b->live[i] && b->mem[i]->device_pages) run_lane(b, i, MEMORY_SIZE);
+    }
+    for (int start = 0; start < b->capacity; start += BATCH_TILE) {
+        execute_tile(b, start, start + BATCH_TILE < b->capacity ? start + BATCH_TILE : b->capacity);
+    }
+
+    memory_bind(saved);
+}
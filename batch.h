@@ -0,0 +1,60 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include "cpu.h"
+#include "memory.h"
+
+// Lockstep batch core: runs many machines, each with its own address space,
+// keeping their registers in structure-of-arrays form. Machines that sit at
+// the same PC with the same instruction bytes are stepped together with
+// vector operations; the rest fall back to cpu_step one machine at a time.
+// Every machine ends in exactly the state cpu_execute would leave it in.
+
+#define BATCH_CHUNK 32      // Lanes per vector operation (one AVX2 register of bytes)
+
+typedef struct {
+    int lanes;              // Machines in the batch
+    int capacity;           // lanes rounded up to BATCH_CHUNK; the padding lanes stay halted
+
+    // Registers, one element per lane
+    uint8_t *A;
+    uint8_t *X;
+    uint8_t *Y;
+    uint8_t *SP;
+    uint8_t *status;
+    uint8_t *halted;
+    uint16_t *PC;
+    uint64_t *cycles;
+    Memory **mem;           // Each lane's address space
+
+    // Model, illegal opcode policy and halt_on_brk shared by all lanes.
+    // Its registers are unused.
+    CPU config;
+
+    // Lane-instructions executed by the vector path and by the scalar fallback
+    uint64_t vector_steps;
+    uint64_t scalar_steps;
+
+    // Scratch used by batch_execute
+    uint8_t *live;
+    uint8_t *group;
+    uint64_t *end;
+    uint16_t *pending;      // Cycles from the current group run not yet added to cycles
+    uint8_t code_pages[MEMORY_PAGES];   // Whether the group's copies of each page are known to match
+} CpuBatch;
+
+// Every lane starts in the cpu_init state with zeroed memory. Returns NULL
+// if out of memory.
+CpuBatch *batch_create(int lanes, CpuModel model);
+void batch_destroy(CpuBatch *batch);
+
+// Copy one lane's registers to or from a CPU (only the register fields,
+// cycles and halted are used)
+void batch_get_lane(const CpuBatch *batch, int lane, CPU *cpu);
+void batch_set_lane(CpuBatch *batch, int lane, const CPU *cpu);
+
+// cpu_execute(lane, max_cycles) for every lane
+void batch_execute(CpuBatch *batch, uint64_t max_cycles);
+
+#endif
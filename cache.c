@@ -0,0 +1,237 @@
+#define _DEFAULT_SOURCE
+#include "cache.h"
+#include "emu6502.h"
+#include "counters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INDEX_MAGIC "6502RC1"
+#define INDEX_SLOTS 4096                    // Power of two
+#define MAX_ENTRIES (INDEX_SLOTS * 3 / 4)   // Keep probe sequences short
+
+typedef struct {
+    char magic[8];
+    uint32_t slots;
+    uint32_t count;
+    uint64_t bytes;         // Total size of the stored results
+    uint64_t clock;         // Last-use stamp source
+} IndexHeader;
+
+typedef struct {
+    uint64_t key_lo;
+    uint64_t key_hi;
+    uint64_t last_used;     // 0: slot empty
+    uint64_t size;
+} IndexSlot;
+
+typedef struct {
+    IndexHeader header;
+    IndexSlot slots[INDEX_SLOTS];
+} Index;
+
+struct ResultCache {
+    char *dir;
+    int fd;                 // Index file, also the flock() lock
+    Index *index;
+    uint64_t max_bytes;
+};
+
+static void entry_path(const ResultCache *cache, uint64_t lo, uint64_t hi, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx%016llx", cache->dir, (unsigned long long)hi, (unsigned long long)lo);
+}
+
+ResultCache *cache_open(const char *dir, uint64_t max_bytes) {
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Cannot create cache directory '%s': %s\n", dir, strerror(errno));
+        return NULL;
+    }
+
+    ResultCache *cache = calloc(1, sizeof(ResultCache));
+    size_t len = strlen(dir);
+    char *path = malloc(len + sizeof("/index"));
+    if (!cache || !path) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(cache);
+        free(path);
+        return NULL;
+    }
+    cache->dir = strdup(dir);
+    cache->max_bytes = max_bytes;
+    sprintf(path, "%s/index", dir);
+
+    cache->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (cache->fd < 0) {
+        fprintf(stderr, "Error: Cannot open cache index '%s': %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    // A new, truncated or foreign index is reset to empty. Entry files it
+    // referred to are orphaned but harmless.
+    flock(cache->fd, LOCK_EX);
+    struct stat st;
+    int valid = fstat(cache->fd, &st) == 0 && st.st_size == sizeof(Index);
+    if (!valid && (ftruncate(cache->fd, 0) != 0 || ftruncate(cache->fd, sizeof(Index)) != 0)) {
+        fprintf(stderr, "Error: Cannot size cache index '%s': %s\n", path, strerror(errno));
+        flock(cache->fd, LOCK_UN);
+        goto fail;
+    }
+    cache->index = mmap(NULL, sizeof(Index), PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (cache->index == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map cache index '%s': %s\n", path, strerror(errno));
+        cache->index = NULL;
+        flock(cache->fd, LOCK_UN);
+        goto fail;
+    }
+    IndexHeader *header = &cache->index->header;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header->slots != INDEX_SLOTS) {
+        memset(cache->index, 0, sizeof(Index));
+        memcpy(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        header->slots = INDEX_SLOTS;
+    }
+    flock(cache->fd, LOCK_UN);
+    free(path);
+    return cache;
+
+fail:
+    free(path);
+    cache_close(cache);
+    return NULL;
+}
+
+void cache_close(ResultCache *cache) {
+    if (!cache) return;
+    if (cache->index) munmap(cache->index, sizeof(Index));
+    if (cache->fd >= 0) close(cache->fd);
+    free(cache->dir);
+    free(cache);
+}
+
+// Slot holding key, or the empty slot where it would go
+static uint32_t find_slot(const Index *index, Hash128 key) {
+    uint32_t i = (uint32_t)key.lo & (INDEX_SLOTS - 1);
+    while (index->slots[i].last_used &&
+           (index->slots[i].key_lo != key.lo || index->slots[i].key_hi != key.hi)) {
+        i = (i + 1) & (INDEX_SLOTS - 1);
+    }
+    return i;
+}
+
+// Remove slot i, deleting its file, and shift later members of the probe
+// sequence back so lookups never need tombstones
+static void remove_slot(ResultCache *cache, uint32_t i) {
+    Index *index = cache->index;
+    char path[4096];
+    entry_path(cache, index->slots[i].key_lo, index->slots[i].key_hi, path, sizeof(path));
+    unlink(path);
+    index->header.count--;
+    index->header.bytes -= index->slots[i].size;
+    index->slots[i].last_used = 0;
+
+    uint32_t hole = i;
+    for (uint32_t j = (i + 1) & (INDEX_SLOTS - 1); index->slots[j].last_used; j = (j + 1) & (INDEX_SLOTS - 1)) {
+        uint32_t home = (uint32_t)index->slots[j].key_lo & (INDEX_SLOTS - 1);
+        // Move j into the hole unless its home lies cyclically in (hole, j]
+        int stays = hole <= j ? (hole < home && home <= j) : (hole < home || home <= j);
+        if (!stays) {
+            index->slots[hole] = index->slots[j];
+            index->slots[j].last_used = 0;
+            hole = j;
+        }
+    }
+}
+
+static void evict_oldest(ResultCache *cache) {
+    Index *index = cache->index;
+    uint32_t oldest = INDEX_SLOTS;
+    for (uint32_t i = 0; i < INDEX_SLOTS; i++) {
+        if (index->slots[i].last_used &&
+            (oldest == INDEX_SLOTS || index->slots[i].last_used < index->slots[oldest].last_used)) {
+            oldest = i;
+        }
+    }
+    if (oldest != INDEX_SLOTS) remove_slot(cache, oldest);
+}
+
+void *cache_lookup(ResultCache *cache, Hash128 key, size_t *size) {
+    Index *index = cache->index;
+    void *data = NULL;
+
+    flock(cache->fd, LOCK_EX);
+    uint32_t i = find_slot(index, key);
+    if (index->slots[i].last_used) {
+        char path[4096];
+        entry_path(cache, key.lo, key.hi, path, sizeof(path));
+        uint64_t expected = index->slots[i].size;
+        FILE *f = fopen(path, "rb");
+        data = malloc(expected ? expected : 1);
+        if (f && data && fread(data, 1, expected, f) == expected && fgetc(f) == EOF) {
+            index->slots[i].last_used = ++index->header.clock;
+            *size = expected;
+        } else {
+            // Lost or damaged file: forget the entry
+            free(data);
+            data = NULL;
+            remove_slot(cache, i);
+        }
+        if (f) fclose(f);
+    }
+    flock(cache->fd, LOCK_UN);
+    counters_add(data ? COUNTER_CACHE_HITS : COUNTER_CACHE_MISSES, 1);
+    return data;
+}
+
+void cache_store(ResultCache *cache, Hash128 key, const void *data, size_t size) {
+    Index *index = cache->index;
+    if (size > cache->max_bytes) return;
+
+    flock(cache->fd, LOCK_EX);
+    uint32_t i = find_slot(index, key);
+    if (index->slots[i].last_used) remove_slot(cache, i);
+    while (index->header.count > 0 &&
+           (index->header.count >= MAX_ENTRIES || index->header.bytes + size > cache->max_bytes)) {
+        evict_oldest(cache);
+    }
+
+    // Write under a temporary name and rename, so readers never see a
+    // partial file
+    char path[4096], temp[4096 + 16];
+    entry_path(cache, key.lo, key.hi, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *f = fopen(temp, "wb");
+    int ok = f && fwrite(data, 1, size, f) == size;
+    if (f && fclose(f) != 0) ok = 0;
+    if (ok && rename(temp, path) == 0) {
+        i = find_slot(index, key);
+        index->slots[i].key_lo = key.lo;
+        index->slots[i].key_hi = key.hi;
+        index->slots[i].size = size;
+        index->slots[i].last_used = ++index->header.clock;
+        index->header.count++;
+        index->header.bytes += size;
+    } else {
+        unlink(temp);
+    }
+    flock(cache->fd, LOCK_UN);
+}
+
+void cache_hash_build(Hasher *h) {
+    hash_u64(h, EMU6502_VERSION);
+
+    // The executable itself, so a rebuild with changed behaviour never
+    // picks up results from the old build
+    FILE *f = fopen("/proc/self/exe", "rb");
+    if (!f) return;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        hash_update(h, buf, n);
+    }
+    fclose(f);
+}
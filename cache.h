@@ -0,0 +1,32 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hash.h"
+
+// On-disk cache of run results, keyed by a 128-bit hash of everything that
+// determines the result (program image, initial state, input, emulator
+// build). Several processes may share one cache directory.
+//
+// DIR/index is a memory-mapped open-addressing table of keys, sizes and
+// last-use stamps; each result is stored in its own file DIR/<key>. When the
+// stored results exceed the size limit (or the table fills up) the least
+// recently used ones are evicted.
+
+typedef struct ResultCache ResultCache;
+
+// Creates the directory if needed. Returns NULL (with a message on stderr)
+// on failure.
+ResultCache *cache_open(const char *dir, uint64_t max_bytes);
+void cache_close(ResultCache *cache);
+
+// Returns a malloc'd copy of the result stored under key, or NULL
+void *cache_lookup(ResultCache *cache, Hash128 key, size_t *size);
+void cache_store(ResultCache *cache, Hash128 key, const void *data, size_t size);
+
+// Add the identity of the running emulator build to a key, so results are
+// never reused across versions or rebuilds
+void cache_hash_build(Hasher *h);
+
+#endif
@@ -0,0 +1,77 @@
+#define _POSIX_C_SOURCE 200809L
+#include "counters.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Set once before any run starts and cleared only at exit
+static CountersFile *file;
+
+static const char *const names[COUNTER_COUNT] = {
+    "instructions", "cycles", "idle_cycles", "basic_lines", "input_bytes",
+    "output_bytes", "disk_bytes", "cache_hits", "cache_misses", "jobs"
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int counters_open(const char *path, const char *program) {
+    // A new file each time: a reader still mapping an earlier run's file
+    // keeps seeing that run's final values
+    if (unlink(path) < 0 && errno != ENOENT) {
+        fprintf(stderr, "Error: Cannot replace counters file '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create counters file '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    if (ftruncate(fd, sizeof(CountersFile)) != 0) {
+        fprintf(stderr, "Error: Cannot size counters file '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return 0;
+    }
+    CountersFile *f = mmap(NULL, sizeof(CountersFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (f == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map counters file '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    f->version = COUNTERS_VERSION;
+    f->count = COUNTER_COUNT;
+    f->pid = getpid();
+    f->start_ns = now_ns();
+    snprintf(f->program, sizeof(f->program), "%s", program);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(f->magic, COUNTERS_MAGIC, sizeof(COUNTERS_MAGIC));
+    file = f;
+    return 1;
+}
+
+void counters_close(void) {
+    if (!file) return;
+    __atomic_store_n(&file->end_ns, now_ns(), __ATOMIC_RELEASE);
+    munmap(file, sizeof(CountersFile));
+    file = NULL;
+}
+
+int counters_active(void) {
+    return file != NULL;
+}
+
+void counters_add(Counter counter, uint64_t n) {
+    if (file && n) __atomic_fetch_add(&file->value[counter], n, __ATOMIC_RELAXED);
+}
+
+const char *counters_name(Counter counter) {
+    return counter < COUNTER_COUNT ? names[counter] : "?";
+}
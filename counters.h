@@ -0,0 +1,64 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+
+// Live statistics of a running emulator, published in a memory-mapped file
+// (--stats FILE) that other processes read while it runs, as 6502stat does.
+// Every counter only grows; readers sample them twice and divide by the time
+// between. Writers add with relaxed atomics and readers load them the same
+// way, so neither side ever waits for the other. Counters are added to at
+// coarse points (a slice of a run, a job, a console character or disk
+// transfer), never per instruction.
+
+#define COUNTERS_MAGIC "6502CNT"
+#define COUNTERS_VERSION 1
+
+// Runs update the counters about this often
+#define COUNTERS_UPDATE_CYCLES (1u << 24)
+#define COUNTERS_UPDATE_LINES (1u << 18)
+
+typedef enum {
+    COUNTER_INSTRUCTIONS,   // Instructions executed
+    COUNTER_CYCLES,         // CPU cycles, including fast-forwarded ones
+    COUNTER_IDLE_CYCLES,    // Cycles of idle loops fast-forwarded
+    COUNTER_BASIC_LINES,    // BASIC program lines executed
+    COUNTER_INPUT_BYTES,    // Console and INPUT text read
+    COUNTER_OUTPUT_BYTES,   // Console and PRINT text written
+    COUNTER_DISK_BYTES,     // Block device transfers
+    COUNTER_CACHE_HITS,     // Result cache lookups that found a result
+    COUNTER_CACHE_MISSES,
+    COUNTER_JOBS,           // Job server jobs finished
+    COUNTER_COUNT
+} Counter;
+
+// The file's layout. magic is written last, so a reader that finds it sees
+// the rest of the header.
+typedef struct {
+    char magic[8];              // COUNTERS_MAGIC
+    uint32_t version;           // COUNTERS_VERSION
+    uint32_t count;             // Entries of value
+    int64_t pid;                // Writing process
+    uint64_t start_ns;          // CLOCK_MONOTONIC when the file was created
+    uint64_t end_ns;            // The same at counters_close; 0 until then
+    char program[32];           // Name of the writing program
+    uint64_t value[COUNTER_COUNT];
+} CountersFile;
+
+// Create (or replace) the counters file at path for program, for the rest
+// of the process. Returns 0 (with a message on stderr) on failure.
+int counters_open(const char *path, const char *program);
+
+// Stamp the file's end time; it keeps the final values. Suits atexit.
+void counters_close(void);
+
+// Whether a counters file is open; runs only update the counters if so
+int counters_active(void);
+
+// Add n to counter, from any thread; nothing without a counters file
+void counters_add(Counter counter, uint64_t n);
+
+// Short name of counter, for display
+const char *counters_name(Counter counter);
+
+#endif
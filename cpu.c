@@ -1,6 +1,7 @@
 #include "cpu.h"
 #include "memory.h"
-#include <stdio.h>
+#include "opcodes.h"
+#include <stddef.h>
 
 // Helper macros
 #define SET_FLAG(cpu, flag) ((cpu)->status |= (flag))
@@ -24,6 +25,18 @@ void cpu_init(CPU *cpu) {
     cpu->PC = 0;
     cpu->status = FLAG_U | FLAG_I;
     cpu->cycles = 0;
+    cpu->instructions = 0;
+    cpu->halted = 0;
+    cpu->halt_on_brk = 0;
+    cpu->model = CPU_6502;
+    cpu->illegal_policy = ILLEGAL_HALT;
+    cpu->illegal_trap = NULL;
+    cpu->illegal_ctx = NULL;
+    cpu->idle_skip = 1;
+    cpu->next_event = UINT64_MAX;
+    cpu->idle_skips = 0;
+    cpu->idle_cycles = 0;
+    cpu->coverage = NULL;
 }
 
 void cpu_reset(CPU *cpu) {
@@ -31,6 +44,19 @@ void cpu_reset(CPU *cpu) {
     cpu->status = FLAG_U | FLAG_I;
     cpu->PC = memory_read_word(0xFFFC);
     cpu->cycles = 0;
+    cpu->instructions = 0;
+    cpu->halted = 0;
+}
+
+void cpu_set_model(CPU *cpu, CpuModel model) {
+    cpu->model = model;
+}
+
+void cpu_set_illegal_policy(CPU *cpu, IllegalPolicy policy,
+                            int (*trap)(CPU *cpu, uint8_t opcode, void *ctx), void *ctx) {
+    cpu->illegal_policy = policy;
+    cpu->illegal_trap = trap;
+    cpu->illegal_ctx = ctx;
 }
 
 // Addressing modes
@@ -51,6 +77,27 @@ static uint16_t addr_indirect_y(CPU *cpu) {
     return addr + cpu->Y;
 }
 
+// Read forms of the indexed modes take an extra cycle when indexing crosses a page
+static uint16_t addr_absolute_x_rd(CPU *cpu) {
+    uint16_t base = memory_read_word(cpu->PC); cpu->PC += 2;
+    uint16_t addr = base + cpu->X;
+    if ((base ^ addr) & 0xFF00) cpu->cycles++;
+    return addr;
+}
+static uint16_t addr_absolute_y_rd(CPU *cpu) {
+    uint16_t base = memory_read_word(cpu->PC); cpu->PC += 2;
+    uint16_t addr = base + cpu->Y;
+    if ((base ^ addr) & 0xFF00) cpu->cycles++;
+    return addr;
+}
+static uint16_t addr_indirect_y_rd(CPU *cpu) {
+    uint8_t zp = memory_read(cpu->PC++);
+    uint16_t base = memory_read(zp) | (memory_read((zp + 1) & 0xFF) << 8);
+    uint16_t addr = base + cpu->Y;
+    if ((base ^ addr) & 0xFF00) cpu->cycles++;
+    return addr;
+}
+
 // Instructions
 static void LDA(CPU *cpu, uint16_t addr) { cpu->A = memory_read(addr); SET_ZN(cpu, cpu->A); }
 static void LDX(CPU *cpu, uint16_t addr) { cpu->X = memory_read(addr); SET_ZN(cpu, cpu->X); }
@@ -59,24 +106,65 @@ static void STA(CPU *cpu, uint16_t addr) { memory_write(addr, cpu->A); }
 static void STX(CPU *cpu, uint16_t addr) { memory_write(addr, cpu->X); }
 static void STY(CPU *cpu, uint16_t addr) { memory_write(addr, cpu->Y); }
 
-static void ADC(CPU *cpu, uint16_t addr) {
-    uint8_t val = memory_read(addr);
-    uint16_t sum = cpu->A + val + (GET_FLAG(cpu, FLAG_C) ? 1 : 0);
+static void adc(CPU *cpu, uint8_t val, int cmos) {
+    uint8_t carry = GET_FLAG(cpu, FLAG_C) ? 1 : 0;
+    uint16_t sum = cpu->A + val + carry;
+    if (GET_FLAG(cpu, FLAG_D)) {
+        // NMOS decimal mode: Z comes from the binary sum, N and V from the
+        // intermediate result after the low nibble adjustment
+        uint16_t tmp = (cpu->A & 0x0F) + (val & 0x0F) + carry;
+        if (tmp > 0x09) tmp += 0x06;
+        tmp = (tmp & 0x0F) + (cpu->A & 0xF0) + (val & 0xF0) + (tmp > 0x0F ? 0x10 : 0);
+        if ((sum & 0xFF) == 0) SET_FLAG(cpu, FLAG_Z); else CLR_FLAG(cpu, FLAG_Z);
+        if (tmp & 0x80) SET_FLAG(cpu, FLAG_N); else CLR_FLAG(cpu, FLAG_N);
+        if (((cpu->A ^ tmp) & 0x80) && !((cpu->A ^ val) & 0x80)) SET_FLAG(cpu, FLAG_V); else CLR_FLAG(cpu, FLAG_V);
+        if ((tmp & 0x1F0) > 0x90) tmp += 0x60;
+        if ((tmp & 0xFF0) > 0xF0) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
+        cpu->A = tmp & 0xFF;
+        if (cmos) {
+            // The 65C02 spends a cycle to make N and Z valid for the BCD result
+            SET_ZN(cpu, cpu->A);
+            cpu->cycles++;
+        }
+        return;
+    }
     if (sum > 0xFF) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
     if (((cpu->A ^ sum) & (val ^ sum) & 0x80)) SET_FLAG(cpu, FLAG_V); else CLR_FLAG(cpu, FLAG_V);
     cpu->A = sum & 0xFF;
     SET_ZN(cpu, cpu->A);
 }
 
-static void SBC(CPU *cpu, uint16_t addr) {
-    uint8_t val = memory_read(addr);
-    uint16_t diff = cpu->A - val - (GET_FLAG(cpu, FLAG_C) ? 0 : 1);
+static void sbc(CPU *cpu, uint8_t val, int cmos) {
+    uint8_t borrow = GET_FLAG(cpu, FLAG_C) ? 0 : 1;
+    uint16_t diff = cpu->A - val - borrow;
+    // Flags always come from the binary result, even in decimal mode
     if (diff < 0x100) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
     if (((cpu->A ^ val) & (cpu->A ^ diff) & 0x80)) SET_FLAG(cpu, FLAG_V); else CLR_FLAG(cpu, FLAG_V);
+    SET_ZN(cpu, diff & 0xFF);
+    if (GET_FLAG(cpu, FLAG_D) && cmos) {
+        int16_t lo = (cpu->A & 0x0F) - (val & 0x0F) - borrow;
+        int16_t tmp = cpu->A - val - borrow;
+        if (tmp < 0) tmp -= 0x60;
+        if (lo < 0) tmp -= 0x06;
+        cpu->A = tmp & 0xFF;
+        SET_ZN(cpu, cpu->A);
+        cpu->cycles++;
+        return;
+    }
+    if (GET_FLAG(cpu, FLAG_D)) {
+        uint16_t tmp = (cpu->A & 0x0F) - (val & 0x0F) - borrow;
+        if (tmp & 0x10) tmp = ((tmp - 0x06) & 0x0F) | ((cpu->A & 0xF0) - (val & 0xF0) - 0x10);
+        else tmp = (tmp & 0x0F) | ((cpu->A & 0xF0) - (val & 0xF0));
+        if (tmp & 0x100) tmp -= 0x60;
+        cpu->A = tmp & 0xFF;
+        return;
+    }
     cpu->A = diff & 0xFF;
-    SET_ZN(cpu, cpu->A);
 }
 
+static void ADC(CPU *cpu, uint16_t addr, int cmos) { adc(cpu, memory_read(addr), cmos); }
+static void SBC(CPU *cpu, uint16_t addr, int cmos) { sbc(cpu, memory_read(addr), cmos); }
+
 static void AND(CPU *cpu, uint16_t addr) { cpu->A &= memory_read(addr); SET_ZN(cpu, cpu->A); }
 static void ORA(CPU *cpu, uint16_t addr) { cpu->A |= memory_read(addr); SET_ZN(cpu, cpu->A); }
 static void EOR(CPU *cpu, uint16_t addr) { cpu->A ^= memory_read(addr); SET_ZN(cpu, cpu->A); }
@@ -155,260 +243,662 @@ static void BIT(CPU *cpu, uint16_t addr) {
     if ((cpu->A & val) == 0) SET_FLAG(cpu, FLAG_Z); else CLR_FLAG(cpu, FLAG_Z);
 }
 
+// Undocumented NMOS instructions: read-modify-write combined with an ALU op
+static void SLO(CPU *cpu, uint16_t addr) { ASL(cpu, addr); ORA(cpu, addr); }
+static void RLA(CPU *cpu, uint16_t addr) { ROL(cpu, addr); AND(cpu, addr); }
+static void SRE(CPU *cpu, uint16_t addr) { LSR(cpu, addr); EOR(cpu, addr); }
+static void RRA(CPU *cpu, uint16_t addr) { ROR(cpu, addr); ADC(cpu, addr, 0); }
+static void DCP(CPU *cpu, uint16_t addr) { uint8_t val = memory_read(addr) - 1; memory_write(addr, val); CMP(cpu, addr); }
+static void ISC(CPU *cpu, uint16_t addr) { uint8_t val = memory_read(addr) + 1; memory_write(addr, val); SBC(cpu, addr, 0); }
+static void SAX(CPU *cpu, uint16_t addr) { memory_write(addr, cpu->A & cpu->X); }
+static void LAX(CPU *cpu, uint16_t addr) { cpu->A = cpu->X = memory_read(addr); SET_ZN(cpu, cpu->A); }
+static void LAS(CPU *cpu, uint16_t addr) {
+    cpu->A = cpu->X = cpu->SP = memory_read(addr) & cpu->SP;
+    SET_ZN(cpu, cpu->A);
+}
+static void NOP(CPU *cpu, uint16_t addr) { (void)cpu; (void)addr; }
+
+static void ANC(CPU *cpu, uint16_t addr) {
+    AND(cpu, addr);
+    if (cpu->A & 0x80) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
+}
+
+static void ALR(CPU *cpu, uint16_t addr) {
+    cpu->A &= memory_read(addr);
+    if (cpu->A & 0x01) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
+    cpu->A >>= 1;
+    SET_ZN(cpu, cpu->A);
+}
+
+static void ARR(CPU *cpu, uint16_t addr) {
+    uint8_t t = cpu->A & memory_read(addr);
+    uint8_t carry = GET_FLAG(cpu, FLAG_C) ? 0x80 : 0;
+    cpu->A = (t >> 1) | carry;
+    SET_ZN(cpu, cpu->A);
+    if (GET_FLAG(cpu, FLAG_D)) {
+        // Decimal mode: N is the old carry, V from bit 6 changing, then BCD fixup
+        if (carry) SET_FLAG(cpu, FLAG_N); else CLR_FLAG(cpu, FLAG_N);
+        if ((t ^ cpu->A) & 0x40) SET_FLAG(cpu, FLAG_V); else CLR_FLAG(cpu, FLAG_V);
+        if ((t & 0x0F) + (t & 0x01) > 0x05) cpu->A = (cpu->A & 0xF0) | ((cpu->A + 0x06) & 0x0F);
+        if ((t >> 4) + ((t >> 4) & 0x01) > 0x05) { SET_FLAG(cpu, FLAG_C); cpu->A += 0x60; }
+        else CLR_FLAG(cpu, FLAG_C);
+        return;
+    }
+    if (cpu->A & 0x40) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
+    if (((cpu->A >> 6) ^ (cpu->A >> 5)) & 0x01) SET_FLAG(cpu, FLAG_V); else CLR_FLAG(cpu, FLAG_V);
+}
+
+static void SBX(CPU *cpu, uint16_t addr) {
+    uint8_t val = memory_read(addr);
+    uint8_t ax = cpu->A & cpu->X;
+    if (ax >= val) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
+    cpu->X = ax - val;
+    SET_ZN(cpu, cpu->X);
+}
+
 // Branch instructions
 static void branch(CPU *cpu, int condition) {
     int8_t offset = memory_read(cpu->PC++);
     if (condition) {
-        cpu->PC += offset;
-        cpu->cycles++;
+        uint16_t target = cpu->PC + offset;
+        cpu->cycles += ((cpu->PC ^ target) & 0xFF00) ? 2 : 1;
+        cpu->PC = target;
     }
 }
 
-void cpu_step(CPU *cpu) {
+// 65C02 additions
+static uint16_t addr_zeropage_indirect(CPU *cpu) {
+    uint8_t base = memory_read(cpu->PC++);
+    return memory_read(base) | (memory_read((base + 1) & 0xFF) << 8);
+}
+
+static void STZ(CPU *cpu, uint16_t addr) { (void)cpu; memory_write(addr, 0); }
+
+static void TSB(CPU *cpu, uint16_t addr) {
+    uint8_t val = memory_read(addr);
+    if ((cpu->A & val) == 0) SET_FLAG(cpu, FLAG_Z); else CLR_FLAG(cpu, FLAG_Z);
+    memory_write(addr, val | cpu->A);
+}
+
+static void TRB(CPU *cpu, uint16_t addr) {
+    uint8_t val = memory_read(addr);
+    if ((cpu->A & val) == 0) SET_FLAG(cpu, FLAG_Z); else CLR_FLAG(cpu, FLAG_Z);
+    memory_write(addr, val & ~cpu->A);
+}
+
+// BIT #imm only sets Z
+static void BIT_imm(CPU *cpu, uint16_t addr) {
+    if ((cpu->A & memory_read(addr)) == 0) SET_FLAG(cpu, FLAG_Z); else CLR_FLAG(cpu, FLAG_Z);
+}
+
+static void RMB(CPU *cpu, uint8_t bit) {
+    uint16_t addr = addr_zeropage(cpu);
+    memory_write(addr, memory_read(addr) & ~(1 << bit));
+}
+
+static void SMB(CPU *cpu, uint8_t bit) {
+    uint16_t addr = addr_zeropage(cpu);
+    memory_write(addr, memory_read(addr) | (1 << bit));
+}
+
+// BBR/BBS: test a zero page bit and branch
+static void BBx(CPU *cpu, uint8_t bit, int set) {
+    uint8_t val = memory_read(addr_zeropage(cpu));
+    branch(cpu, ((val >> bit) & 1) == set);
+}
+
+// Kept out of line so the dispatch switch stays tight
+static void __attribute__((noinline, cold)) illegal_opcode(CPU *cpu, uint8_t opcode) {
+    cpu->PC--;
+    switch (cpu->illegal_policy) {
+        case ILLEGAL_NOP:
+            cpu->PC += opcode_table[CPU_6502][opcode].length;
+            cpu->cycles += 2;
+            cpu->instructions++;
+            return;
+        case ILLEGAL_TRAP:
+            if (cpu->illegal_trap && cpu->illegal_trap(cpu, opcode, cpu->illegal_ctx)) {
+                cpu->instructions++;
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    cpu->halted = 1;
+}
+
+// Count the edge an instruction that moves the PC took, and whether it
+// took SP around the stack page (a push or pull moves it at most 3)
+static inline __attribute__((always_inline)) void cover(CPU *cpu, uint16_t from, uint8_t sp, uint16_t effects) {
+    CpuCoverage *coverage = cpu->coverage;
+    if (effects & (OP_BRANCH | OP_JUMP)) {
+        uint32_t edge = ((uint32_t)from << 16 | cpu->PC) * 0x9E3779B1u;
+        coverage->edges[edge >> (32 - COVERAGE_BITS)]++;
+    }
+    if (effects & OP_STACK) {
+        int delta = (int8_t)(cpu->SP - sp);
+        if (sp + delta != cpu->SP) coverage->stack_wrapped = 1;
+    }
+}
+
+// The instruction decoder, instantiated once per CPU model with cmos as a
+// compile-time constant so neither core pays for model checks, and again
+// with covered set for fuzzing. Each case does the work; the base cycles
+// come from the opcode table, with the addressing and branch helpers adding
+// the variable ones.
+static inline __attribute__((always_inline)) void step(CPU *cpu, const int cmos, const int covered) {
+    uint16_t from = cpu->PC;
+    uint8_t sp = cpu->SP;
     uint8_t opcode = memory_read(cpu->PC++);
     
     switch (opcode) {
         // LDA
-        case 0xA9: LDA(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0xA5: LDA(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0xB5: LDA(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0xAD: LDA(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0xBD: LDA(cpu, addr_absolute_x(cpu)); cpu->cycles += 4; break;
-        case 0xB9: LDA(cpu, addr_absolute_y(cpu)); cpu->cycles += 4; break;
-        case 0xA1: LDA(cpu, addr_indirect_x(cpu)); cpu->cycles += 6; break;
-        case 0xB1: LDA(cpu, addr_indirect_y(cpu)); cpu->cycles += 5; break;
+        case 0xA9: LDA(cpu, addr_immediate(cpu)); break;
+        case 0xA5: LDA(cpu, addr_zeropage(cpu)); break;
+        case 0xB5: LDA(cpu, addr_zeropage_x(cpu)); break;
+        case 0xAD: LDA(cpu, addr_absolute(cpu)); break;
+        case 0xBD: LDA(cpu, addr_absolute_x_rd(cpu)); break;
+        case 0xB9: LDA(cpu, addr_absolute_y_rd(cpu)); break;
+        case 0xA1: LDA(cpu, addr_indirect_x(cpu)); break;
+        case 0xB1: LDA(cpu, addr_indirect_y_rd(cpu)); break;
         
         // LDX
-        case 0xA2: LDX(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0xA6: LDX(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0xB6: LDX(cpu, addr_zeropage_y(cpu)); cpu->cycles += 4; break;
-        case 0xAE: LDX(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0xBE: LDX(cpu, addr_absolute_y(cpu)); cpu->cycles += 4; break;
+        case 0xA2: LDX(cpu, addr_immediate(cpu)); break;
+        case 0xA6: LDX(cpu, addr_zeropage(cpu)); break;
+        case 0xB6: LDX(cpu, addr_zeropage_y(cpu)); break;
+        case 0xAE: LDX(cpu, addr_absolute(cpu)); break;
+        case 0xBE: LDX(cpu, addr_absolute_y_rd(cpu)); break;
         
         // LDY
-        case 0xA0: LDY(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0xA4: LDY(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0xB4: LDY(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0xAC: LDY(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0xBC: LDY(cpu, addr_absolute_x(cpu)); cpu->cycles += 4; break;
+        case 0xA0: LDY(cpu, addr_immediate(cpu)); break;
+        case 0xA4: LDY(cpu, addr_zeropage(cpu)); break;
+        case 0xB4: LDY(cpu, addr_zeropage_x(cpu)); break;
+        case 0xAC: LDY(cpu, addr_absolute(cpu)); break;
+        case 0xBC: LDY(cpu, addr_absolute_x_rd(cpu)); break;
         
         // STA
-        case 0x85: STA(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0x95: STA(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0x8D: STA(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0x9D: STA(cpu, addr_absolute_x(cpu)); cpu->cycles += 5; break;
-        case 0x99: STA(cpu, addr_absolute_y(cpu)); cpu->cycles += 5; break;
-        case 0x81: STA(cpu, addr_indirect_x(cpu)); cpu->cycles += 6; break;
-        case 0x91: STA(cpu, addr_indirect_y(cpu)); cpu->cycles += 6; break;
+        case 0x85: STA(cpu, addr_zeropage(cpu)); break;
+        case 0x95: STA(cpu, addr_zeropage_x(cpu)); break;
+        case 0x8D: STA(cpu, addr_absolute(cpu)); break;
+        case 0x9D: STA(cpu, addr_absolute_x(cpu)); break;
+        case 0x99: STA(cpu, addr_absolute_y(cpu)); break;
+        case 0x81: STA(cpu, addr_indirect_x(cpu)); break;
+        case 0x91: STA(cpu, addr_indirect_y(cpu)); break;
         
         // STX
-        case 0x86: STX(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0x96: STX(cpu, addr_zeropage_y(cpu)); cpu->cycles += 4; break;
-        case 0x8E: STX(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
+        case 0x86: STX(cpu, addr_zeropage(cpu)); break;
+        case 0x96: STX(cpu, addr_zeropage_y(cpu)); break;
+        case 0x8E: STX(cpu, addr_absolute(cpu)); break;
         
         // STY
-        case 0x84: STY(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0x94: STY(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0x8C: STY(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
+        case 0x84: STY(cpu, addr_zeropage(cpu)); break;
+        case 0x94: STY(cpu, addr_zeropage_x(cpu)); break;
+        case 0x8C: STY(cpu, addr_absolute(cpu)); break;
         
         // ADC
-        case 0x69: ADC(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0x65: ADC(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0x75: ADC(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0x6D: ADC(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0x7D: ADC(cpu, addr_absolute_x(cpu)); cpu->cycles += 4; break;
-        case 0x79: ADC(cpu, addr_absolute_y(cpu)); cpu->cycles += 4; break;
-        case 0x61: ADC(cpu, addr_indirect_x(cpu)); cpu->cycles += 6; break;
-        case 0x71: ADC(cpu, addr_indirect_y(cpu)); cpu->cycles += 5; break;
+        case 0x69: ADC(cpu, addr_immediate(cpu), cmos); break;
+        case 0x65: ADC(cpu, addr_zeropage(cpu), cmos); break;
+        case 0x75: ADC(cpu, addr_zeropage_x(cpu), cmos); break;
+        case 0x6D: ADC(cpu, addr_absolute(cpu), cmos); break;
+        case 0x7D: ADC(cpu, addr_absolute_x_rd(cpu), cmos); break;
+        case 0x79: ADC(cpu, addr_absolute_y_rd(cpu), cmos); break;
+        case 0x61: ADC(cpu, addr_indirect_x(cpu), cmos); break;
+        case 0x71: ADC(cpu, addr_indirect_y_rd(cpu), cmos); break;
         
         // SBC
-        case 0xE9: SBC(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0xE5: SBC(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0xF5: SBC(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0xED: SBC(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0xFD: SBC(cpu, addr_absolute_x(cpu)); cpu->cycles += 4; break;
-        case 0xF9: SBC(cpu, addr_absolute_y(cpu)); cpu->cycles += 4; break;
-        case 0xE1: SBC(cpu, addr_indirect_x(cpu)); cpu->cycles += 6; break;
-        case 0xF1: SBC(cpu, addr_indirect_y(cpu)); cpu->cycles += 5; break;
+        case 0xE9: SBC(cpu, addr_immediate(cpu), cmos); break;
+        case 0xE5: SBC(cpu, addr_zeropage(cpu), cmos); break;
+        case 0xF5: SBC(cpu, addr_zeropage_x(cpu), cmos); break;
+        case 0xED: SBC(cpu, addr_absolute(cpu), cmos); break;
+        case 0xFD: SBC(cpu, addr_absolute_x_rd(cpu), cmos); break;
+        case 0xF9: SBC(cpu, addr_absolute_y_rd(cpu), cmos); break;
+        case 0xE1: SBC(cpu, addr_indirect_x(cpu), cmos); break;
+        case 0xF1: SBC(cpu, addr_indirect_y_rd(cpu), cmos); break;
         
         // AND
-        case 0x29: AND(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0x25: AND(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0x35: AND(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0x2D: AND(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0x3D: AND(cpu, addr_absolute_x(cpu)); cpu->cycles += 4; break;
-        case 0x39: AND(cpu, addr_absolute_y(cpu)); cpu->cycles += 4; break;
-        case 0x21: AND(cpu, addr_indirect_x(cpu)); cpu->cycles += 6; break;
-        case 0x31: AND(cpu, addr_indirect_y(cpu)); cpu->cycles += 5; break;
+        case 0x29: AND(cpu, addr_immediate(cpu)); break;
+        case 0x25: AND(cpu, addr_zeropage(cpu)); break;
+        case 0x35: AND(cpu, addr_zeropage_x(cpu)); break;
+        case 0x2D: AND(cpu, addr_absolute(cpu)); break;
+        case 0x3D: AND(cpu, addr_absolute_x_rd(cpu)); break;
+        case 0x39: AND(cpu, addr_absolute_y_rd(cpu)); break;
+        case 0x21: AND(cpu, addr_indirect_x(cpu)); break;
+        case 0x31: AND(cpu, addr_indirect_y_rd(cpu)); break;
         
         // ORA
-        case 0x09: ORA(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0x05: ORA(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0x15: ORA(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0x0D: ORA(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0x1D: ORA(cpu, addr_absolute_x(cpu)); cpu->cycles += 4; break;
-        case 0x19: ORA(cpu, addr_absolute_y(cpu)); cpu->cycles += 4; break;
-        case 0x01: ORA(cpu, addr_indirect_x(cpu)); cpu->cycles += 6; break;
-        case 0x11: ORA(cpu, addr_indirect_y(cpu)); cpu->cycles += 5; break;
+        case 0x09: ORA(cpu, addr_immediate(cpu)); break;
+        case 0x05: ORA(cpu, addr_zeropage(cpu)); break;
+        case 0x15: ORA(cpu, addr_zeropage_x(cpu)); break;
+        case 0x0D: ORA(cpu, addr_absolute(cpu)); break;
+        case 0x1D: ORA(cpu, addr_absolute_x_rd(cpu)); break;
+        case 0x19: ORA(cpu, addr_absolute_y_rd(cpu)); break;
+        case 0x01: ORA(cpu, addr_indirect_x(cpu)); break;
+        case 0x11: ORA(cpu, addr_indirect_y_rd(cpu)); break;
         
         // EOR
-        case 0x49: EOR(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0x45: EOR(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0x55: EOR(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0x4D: EOR(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0x5D: EOR(cpu, addr_absolute_x(cpu)); cpu->cycles += 4; break;
-        case 0x59: EOR(cpu, addr_absolute_y(cpu)); cpu->cycles += 4; break;
-        case 0x41: EOR(cpu, addr_indirect_x(cpu)); cpu->cycles += 6; break;
-        case 0x51: EOR(cpu, addr_indirect_y(cpu)); cpu->cycles += 5; break;
+        case 0x49: EOR(cpu, addr_immediate(cpu)); break;
+        case 0x45: EOR(cpu, addr_zeropage(cpu)); break;
+        case 0x55: EOR(cpu, addr_zeropage_x(cpu)); break;
+        case 0x4D: EOR(cpu, addr_absolute(cpu)); break;
+        case 0x5D: EOR(cpu, addr_absolute_x_rd(cpu)); break;
+        case 0x59: EOR(cpu, addr_absolute_y_rd(cpu)); break;
+        case 0x41: EOR(cpu, addr_indirect_x(cpu)); break;
+        case 0x51: EOR(cpu, addr_indirect_y_rd(cpu)); break;
         
         // CMP
-        case 0xC9: CMP(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0xC5: CMP(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0xD5: CMP(cpu, addr_zeropage_x(cpu)); cpu->cycles += 4; break;
-        case 0xCD: CMP(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
-        case 0xDD: CMP(cpu, addr_absolute_x(cpu)); cpu->cycles += 4; break;
-        case 0xD9: CMP(cpu, addr_absolute_y(cpu)); cpu->cycles += 4; break;
-        case 0xC1: CMP(cpu, addr_indirect_x(cpu)); cpu->cycles += 6; break;
-        case 0xD1: CMP(cpu, addr_indirect_y(cpu)); cpu->cycles += 5; break;
+        case 0xC9: CMP(cpu, addr_immediate(cpu)); break;
+        case 0xC5: CMP(cpu, addr_zeropage(cpu)); break;
+        case 0xD5: CMP(cpu, addr_zeropage_x(cpu)); break;
+        case 0xCD: CMP(cpu, addr_absolute(cpu)); break;
+        case 0xDD: CMP(cpu, addr_absolute_x_rd(cpu)); break;
+        case 0xD9: CMP(cpu, addr_absolute_y_rd(cpu)); break;
+        case 0xC1: CMP(cpu, addr_indirect_x(cpu)); break;
+        case 0xD1: CMP(cpu, addr_indirect_y_rd(cpu)); break;
         
         // CPX
-        case 0xE0: CPX(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0xE4: CPX(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0xEC: CPX(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
+        case 0xE0: CPX(cpu, addr_immediate(cpu)); break;
+        case 0xE4: CPX(cpu, addr_zeropage(cpu)); break;
+        case 0xEC: CPX(cpu, addr_absolute(cpu)); break;
         
         // CPY
-        case 0xC0: CPY(cpu, addr_immediate(cpu)); cpu->cycles += 2; break;
-        case 0xC4: CPY(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0xCC: CPY(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
+        case 0xC0: CPY(cpu, addr_immediate(cpu)); break;
+        case 0xC4: CPY(cpu, addr_zeropage(cpu)); break;
+        case 0xCC: CPY(cpu, addr_absolute(cpu)); break;
         
         // INC
-        case 0xE6: INC(cpu, addr_zeropage(cpu)); cpu->cycles += 5; break;
-        case 0xF6: INC(cpu, addr_zeropage_x(cpu)); cpu->cycles += 6; break;
-        case 0xEE: INC(cpu, addr_absolute(cpu)); cpu->cycles += 6; break;
-        case 0xFE: INC(cpu, addr_absolute_x(cpu)); cpu->cycles += 7; break;
+        case 0xE6: INC(cpu, addr_zeropage(cpu)); break;
+        case 0xF6: INC(cpu, addr_zeropage_x(cpu)); break;
+        case 0xEE: INC(cpu, addr_absolute(cpu)); break;
+        case 0xFE: INC(cpu, addr_absolute_x(cpu)); break;
         
         // DEC
-        case 0xC6: DEC(cpu, addr_zeropage(cpu)); cpu->cycles += 5; break;
-        case 0xD6: DEC(cpu, addr_zeropage_x(cpu)); cpu->cycles += 6; break;
-        case 0xCE: DEC(cpu, addr_absolute(cpu)); cpu->cycles += 6; break;
-        case 0xDE: DEC(cpu, addr_absolute_x(cpu)); cpu->cycles += 7; break;
+        case 0xC6: DEC(cpu, addr_zeropage(cpu)); break;
+        case 0xD6: DEC(cpu, addr_zeropage_x(cpu)); break;
+        case 0xCE: DEC(cpu, addr_absolute(cpu)); break;
+        case 0xDE: DEC(cpu, addr_absolute_x(cpu)); break;
         
         // ASL
         case 0x0A: if (cpu->A & 0x80) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
-                   cpu->A <<= 1; SET_ZN(cpu, cpu->A); cpu->cycles += 2; break;
-        case 0x06: ASL(cpu, addr_zeropage(cpu)); cpu->cycles += 5; break;
-        case 0x16: ASL(cpu, addr_zeropage_x(cpu)); cpu->cycles += 6; break;
-        case 0x0E: ASL(cpu, addr_absolute(cpu)); cpu->cycles += 6; break;
-        case 0x1E: ASL(cpu, addr_absolute_x(cpu)); cpu->cycles += 7; break;
+                   cpu->A <<= 1; SET_ZN(cpu, cpu->A); break;
+        case 0x06: ASL(cpu, addr_zeropage(cpu)); break;
+        case 0x16: ASL(cpu, addr_zeropage_x(cpu)); break;
+        case 0x0E: ASL(cpu, addr_absolute(cpu)); break;
+        case 0x1E: if (cmos) { ASL(cpu, addr_absolute_x_rd(cpu)); }
+                   else { ASL(cpu, addr_absolute_x(cpu)); } break;
         
         // LSR
         case 0x4A: if (cpu->A & 0x01) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
-                   cpu->A >>= 1; SET_ZN(cpu, cpu->A); cpu->cycles += 2; break;
-        case 0x46: LSR(cpu, addr_zeropage(cpu)); cpu->cycles += 5; break;
-        case 0x56: LSR(cpu, addr_zeropage_x(cpu)); cpu->cycles += 6; break;
-        case 0x4E: LSR(cpu, addr_absolute(cpu)); cpu->cycles += 6; break;
-        case 0x5E: LSR(cpu, addr_absolute_x(cpu)); cpu->cycles += 7; break;
+                   cpu->A >>= 1; SET_ZN(cpu, cpu->A); break;
+        case 0x46: LSR(cpu, addr_zeropage(cpu)); break;
+        case 0x56: LSR(cpu, addr_zeropage_x(cpu)); break;
+        case 0x4E: LSR(cpu, addr_absolute(cpu)); break;
+        case 0x5E: if (cmos) { LSR(cpu, addr_absolute_x_rd(cpu)); }
+                   else { LSR(cpu, addr_absolute_x(cpu)); } break;
         
         // ROL
         case 0x2A: { uint8_t carry = GET_FLAG(cpu, FLAG_C) ? 1 : 0;
                      if (cpu->A & 0x80) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
-                     cpu->A = (cpu->A << 1) | carry; SET_ZN(cpu, cpu->A); cpu->cycles += 2; } break;
-        case 0x26: ROL(cpu, addr_zeropage(cpu)); cpu->cycles += 5; break;
-        case 0x36: ROL(cpu, addr_zeropage_x(cpu)); cpu->cycles += 6; break;
-        case 0x2E: ROL(cpu, addr_absolute(cpu)); cpu->cycles += 6; break;
-        case 0x3E: ROL(cpu, addr_absolute_x(cpu)); cpu->cycles += 7; break;
+                     cpu->A = (cpu->A << 1) | carry; SET_ZN(cpu, cpu->A); } break;
+        case 0x26: ROL(cpu, addr_zeropage(cpu)); break;
+        case 0x36: ROL(cpu, addr_zeropage_x(cpu)); break;
+        case 0x2E: ROL(cpu, addr_absolute(cpu)); break;
+        case 0x3E: if (cmos) { ROL(cpu, addr_absolute_x_rd(cpu)); }
+                   else { ROL(cpu, addr_absolute_x(cpu)); } break;
         
         // ROR
         case 0x6A: { uint8_t carry = GET_FLAG(cpu, FLAG_C) ? 0x80 : 0;
                      if (cpu->A & 0x01) SET_FLAG(cpu, FLAG_C); else CLR_FLAG(cpu, FLAG_C);
-                     cpu->A = (cpu->A >> 1) | carry; SET_ZN(cpu, cpu->A); cpu->cycles += 2; } break;
-        case 0x66: ROR(cpu, addr_zeropage(cpu)); cpu->cycles += 5; break;
-        case 0x76: ROR(cpu, addr_zeropage_x(cpu)); cpu->cycles += 6; break;
-        case 0x6E: ROR(cpu, addr_absolute(cpu)); cpu->cycles += 6; break;
-        case 0x7E: ROR(cpu, addr_absolute_x(cpu)); cpu->cycles += 7; break;
+                     cpu->A = (cpu->A >> 1) | carry; SET_ZN(cpu, cpu->A); } break;
+        case 0x66: ROR(cpu, addr_zeropage(cpu)); break;
+        case 0x76: ROR(cpu, addr_zeropage_x(cpu)); break;
+        case 0x6E: ROR(cpu, addr_absolute(cpu)); break;
+        case 0x7E: if (cmos) { ROR(cpu, addr_absolute_x_rd(cpu)); }
+                   else { ROR(cpu, addr_absolute_x(cpu)); } break;
         
         // BIT
-        case 0x24: BIT(cpu, addr_zeropage(cpu)); cpu->cycles += 3; break;
-        case 0x2C: BIT(cpu, addr_absolute(cpu)); cpu->cycles += 4; break;
+        case 0x24: BIT(cpu, addr_zeropage(cpu)); break;
+        case 0x2C: BIT(cpu, addr_absolute(cpu)); break;
         
         // Branches
-        case 0x90: branch(cpu, !GET_FLAG(cpu, FLAG_C)); cpu->cycles += 2; break; // BCC
-        case 0xB0: branch(cpu, GET_FLAG(cpu, FLAG_C)); cpu->cycles += 2; break;  // BCS
-        case 0xF0: branch(cpu, GET_FLAG(cpu, FLAG_Z)); cpu->cycles += 2; break;  // BEQ
-        case 0xD0: branch(cpu, !GET_FLAG(cpu, FLAG_Z)); cpu->cycles += 2; break; // BNE
-        case 0x30: branch(cpu, GET_FLAG(cpu, FLAG_N)); cpu->cycles += 2; break;  // BMI
-        case 0x10: branch(cpu, !GET_FLAG(cpu, FLAG_N)); cpu->cycles += 2; break; // BPL
-        case 0x50: branch(cpu, !GET_FLAG(cpu, FLAG_V)); cpu->cycles += 2; break; // BVC
-        case 0x70: branch(cpu, GET_FLAG(cpu, FLAG_V)); cpu->cycles += 2; break;  // BVS
+        case 0x90: branch(cpu, !GET_FLAG(cpu, FLAG_C)); break; // BCC
+        case 0xB0: branch(cpu, GET_FLAG(cpu, FLAG_C)); break;  // BCS
+        case 0xF0: branch(cpu, GET_FLAG(cpu, FLAG_Z)); break;  // BEQ
+        case 0xD0: branch(cpu, !GET_FLAG(cpu, FLAG_Z)); break; // BNE
+        case 0x30: branch(cpu, GET_FLAG(cpu, FLAG_N)); break;  // BMI
+        case 0x10: branch(cpu, !GET_FLAG(cpu, FLAG_N)); break; // BPL
+        case 0x50: branch(cpu, !GET_FLAG(cpu, FLAG_V)); break; // BVC
+        case 0x70: branch(cpu, GET_FLAG(cpu, FLAG_V)); break;  // BVS
         
         // Transfers
-        case 0xAA: cpu->X = cpu->A; SET_ZN(cpu, cpu->X); cpu->cycles += 2; break; // TAX
-        case 0xA8: cpu->Y = cpu->A; SET_ZN(cpu, cpu->Y); cpu->cycles += 2; break; // TAY
-        case 0x8A: cpu->A = cpu->X; SET_ZN(cpu, cpu->A); cpu->cycles += 2; break; // TXA
-        case 0x98: cpu->A = cpu->Y; SET_ZN(cpu, cpu->A); cpu->cycles += 2; break; // TYA
-        case 0xBA: cpu->X = cpu->SP; SET_ZN(cpu, cpu->X); cpu->cycles += 2; break; // TSX
-        case 0x9A: cpu->SP = cpu->X; cpu->cycles += 2; break; // TXS
+        case 0xAA: cpu->X = cpu->A; SET_ZN(cpu, cpu->X); break; // TAX
+        case 0xA8: cpu->Y = cpu->A; SET_ZN(cpu, cpu->Y); break; // TAY
+        case 0x8A: cpu->A = cpu->X; SET_ZN(cpu, cpu->A); break; // TXA
+        case 0x98: cpu->A = cpu->Y; SET_ZN(cpu, cpu->A); break; // TYA
+        case 0xBA: cpu->X = cpu->SP; SET_ZN(cpu, cpu->X); break; // TSX
+        case 0x9A: cpu->SP = cpu->X; break; // TXS
         
         // Stack
-        case 0x48: PUSH(cpu, cpu->A); cpu->cycles += 3; break; // PHA
-        case 0x68: cpu->A = PULL(cpu); SET_ZN(cpu, cpu->A); cpu->cycles += 4; break; // PLA
-        case 0x08: PUSH(cpu, cpu->status | FLAG_B | FLAG_U); cpu->cycles += 3; break; // PHP
-        case 0x28: cpu->status = PULL(cpu) | FLAG_U; cpu->cycles += 4; break; // PLP
+        case 0x48: PUSH(cpu, cpu->A); break; // PHA
+        case 0x68: cpu->A = PULL(cpu); SET_ZN(cpu, cpu->A); break; // PLA
+        case 0x08: PUSH(cpu, cpu->status | FLAG_B | FLAG_U); break; // PHP
+        case 0x28: cpu->status = PULL(cpu) | FLAG_U; break; // PLP
         
         // Increments/Decrements
-        case 0xE8: cpu->X++; SET_ZN(cpu, cpu->X); cpu->cycles += 2; break; // INX
-        case 0xC8: cpu->Y++; SET_ZN(cpu, cpu->Y); cpu->cycles += 2; break; // INY
-        case 0xCA: cpu->X--; SET_ZN(cpu, cpu->X); cpu->cycles += 2; break; // DEX
-        case 0x88: cpu->Y--; SET_ZN(cpu, cpu->Y); cpu->cycles += 2; break; // DEY
+        case 0xE8: cpu->X++; SET_ZN(cpu, cpu->X); break; // INX
+        case 0xC8: cpu->Y++; SET_ZN(cpu, cpu->Y); break; // INY
+        case 0xCA: cpu->X--; SET_ZN(cpu, cpu->X); break; // DEX
+        case 0x88: cpu->Y--; SET_ZN(cpu, cpu->Y); break; // DEY
         
         // Flags
-        case 0x18: CLR_FLAG(cpu, FLAG_C); cpu->cycles += 2; break; // CLC
-        case 0x38: SET_FLAG(cpu, FLAG_C); cpu->cycles += 2; break; // SEC
-        case 0x58: CLR_FLAG(cpu, FLAG_I); cpu->cycles += 2; break; // CLI
-        case 0x78: SET_FLAG(cpu, FLAG_I); cpu->cycles += 2; break; // SEI
-        case 0xB8: CLR_FLAG(cpu, FLAG_V); cpu->cycles += 2; break; // CLV
-        case 0xD8: CLR_FLAG(cpu, FLAG_D); cpu->cycles += 2; break; // CLD
-        case 0xF8: SET_FLAG(cpu, FLAG_D); cpu->cycles += 2; break; // SED
+        case 0x18: CLR_FLAG(cpu, FLAG_C); break; // CLC
+        case 0x38: SET_FLAG(cpu, FLAG_C); break; // SEC
+        case 0x58: CLR_FLAG(cpu, FLAG_I); break; // CLI
+        case 0x78: SET_FLAG(cpu, FLAG_I); break; // SEI
+        case 0xB8: CLR_FLAG(cpu, FLAG_V); break; // CLV
+        case 0xD8: CLR_FLAG(cpu, FLAG_D); break; // CLD
+        case 0xF8: SET_FLAG(cpu, FLAG_D); break; // SED
         
         // Jump/Call
-        case 0x4C: cpu->PC = memory_read_word(cpu->PC); cpu->cycles += 3; break; // JMP abs
+        case 0x4C: cpu->PC = memory_read_word(cpu->PC); break; // JMP abs
         case 0x6C: { uint16_t addr = memory_read_word(cpu->PC);
-                     cpu->PC = memory_read(addr) | (memory_read((addr & 0xFF00) | ((addr + 1) & 0xFF)) << 8);
-                     cpu->cycles += 5; } break; // JMP ind
+                     if (cmos) { cpu->PC = memory_read_word(addr); break; }
+                     // NMOS does not carry into the high byte of the pointer
+                     cpu->PC = memory_read(addr) | (memory_read((addr & 0xFF00) | ((addr + 1) & 0xFF)) << 8); } break; // JMP ind
         case 0x20: { uint16_t addr = memory_read_word(cpu->PC);
                      cpu->PC += 1;
                      PUSH(cpu, (cpu->PC >> 8) & 0xFF);
                      PUSH(cpu, cpu->PC & 0xFF);
-                     cpu->PC = addr;
-                     cpu->cycles += 6; } break; // JSR
+                     cpu->PC = addr; } break; // JSR
         case 0x60: { uint8_t lo = PULL(cpu);
                      uint8_t hi = PULL(cpu);
                      cpu->PC = (hi << 8) | lo;
-                     cpu->PC++;
-                     cpu->cycles += 6; } break; // RTS
+                     cpu->PC++; } break; // RTS
         case 0x40: { cpu->status = PULL(cpu) | FLAG_U;
                      uint8_t lo = PULL(cpu);
                      uint8_t hi = PULL(cpu);
-                     cpu->PC = (hi << 8) | lo;
-                     cpu->cycles += 6; } break; // RTI
+                     cpu->PC = (hi << 8) | lo; } break; // RTI
         
         // System
-        case 0x00: cpu->PC++; PUSH(cpu, (cpu->PC >> 8) & 0xFF); PUSH(cpu, cpu->PC & 0xFF);
+        case 0x00: if (cpu->halt_on_brk) { cpu->PC--; cpu->halted = 1; return; }
+                   cpu->PC++; PUSH(cpu, (cpu->PC >> 8) & 0xFF); PUSH(cpu, cpu->PC & 0xFF);
                    PUSH(cpu, cpu->status | FLAG_B | FLAG_U);
                    SET_FLAG(cpu, FLAG_I);
+                   if (cmos) CLR_FLAG(cpu, FLAG_D);
                    cpu->PC = memory_read_word(0xFFFE);
-                   cpu->cycles += 7; break; // BRK
-        case 0xEA: cpu->cycles += 2; break; // NOP
+                   break; // BRK
+        case 0xEA: break; // NOP
         
-        default:
-            printf("Unknown opcode: 0x%02X at PC=0x%04X\n", opcode, cpu->PC - 1);
-            break;
+        // Opcodes undocumented on the NMOS 6502 that the 65C02 redefines
+        case 0x02: if (cmos) { NOP(cpu, addr_immediate(cpu)); } // NOP #
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x03: if (!cmos) { SLO(cpu, addr_indirect_x(cpu)); } break; // NOP on the 65C02
+        case 0x04: if (cmos) { TSB(cpu, addr_zeropage(cpu)); } // TSB zp
+                   else { NOP(cpu, addr_zeropage(cpu)); } break;
+        case 0x07: if (cmos) { RMB(cpu, 0); } // RMB0
+                   else { SLO(cpu, addr_zeropage(cpu)); } break;
+        case 0x0B: if (!cmos) { ANC(cpu, addr_immediate(cpu)); } break; // NOP on the 65C02
+        case 0x0C: if (cmos) { TSB(cpu, addr_absolute(cpu)); } // TSB abs
+                   else { NOP(cpu, addr_absolute(cpu)); } break;
+        case 0x0F: if (cmos) { BBx(cpu, 0, 0); } // BBR0
+                   else { SLO(cpu, addr_absolute(cpu)); } break;
+        case 0x12: if (cmos) { ORA(cpu, addr_zeropage_indirect(cpu)); } // ORA (zp)
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x13: if (!cmos) { SLO(cpu, addr_indirect_y(cpu)); } break; // NOP on the 65C02
+        case 0x14: if (cmos) { TRB(cpu, addr_zeropage(cpu)); } // TRB zp
+                   else { NOP(cpu, addr_zeropage_x(cpu)); } break;
+        case 0x17: if (cmos) { RMB(cpu, 1); } // RMB1
+                   else { SLO(cpu, addr_zeropage_x(cpu)); } break;
+        case 0x1A: if (cmos) { cpu->A++; SET_ZN(cpu, cpu->A); } break; // INC A
+        case 0x1B: if (!cmos) { SLO(cpu, addr_absolute_y(cpu)); } break; // NOP on the 65C02
+        case 0x1C: if (cmos) { TRB(cpu, addr_absolute(cpu)); } // TRB abs
+                   else { NOP(cpu, addr_absolute_x_rd(cpu)); } break;
+        case 0x1F: if (cmos) { BBx(cpu, 1, 0); } // BBR1
+                   else { SLO(cpu, addr_absolute_x(cpu)); } break;
+        case 0x22: if (cmos) { NOP(cpu, addr_immediate(cpu)); } // NOP #
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x23: if (!cmos) { RLA(cpu, addr_indirect_x(cpu)); } break; // NOP on the 65C02
+        case 0x27: if (cmos) { RMB(cpu, 2); } // RMB2
+                   else { RLA(cpu, addr_zeropage(cpu)); } break;
+        case 0x2B: if (!cmos) { ANC(cpu, addr_immediate(cpu)); } break; // NOP on the 65C02
+        case 0x2F: if (cmos) { BBx(cpu, 2, 0); } // BBR2
+                   else { RLA(cpu, addr_absolute(cpu)); } break;
+        case 0x32: if (cmos) { AND(cpu, addr_zeropage_indirect(cpu)); } // AND (zp)
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x33: if (!cmos) { RLA(cpu, addr_indirect_y(cpu)); } break; // NOP on the 65C02
+        case 0x34: if (cmos) { BIT(cpu, addr_zeropage_x(cpu)); } // BIT zp,X
+                   else { NOP(cpu, addr_zeropage_x(cpu)); } break;
+        case 0x37: if (cmos) { RMB(cpu, 3); } // RMB3
+                   else { RLA(cpu, addr_zeropage_x(cpu)); } break;
+        case 0x3A: if (cmos) { cpu->A--; SET_ZN(cpu, cpu->A); } break; // DEC A
+        case 0x3B: if (!cmos) { RLA(cpu, addr_absolute_y(cpu)); } break; // NOP on the 65C02
+        case 0x3C: if (cmos) { BIT(cpu, addr_absolute_x_rd(cpu)); } // BIT abs,X
+                   else { NOP(cpu, addr_absolute_x_rd(cpu)); } break;
+        case 0x3F: if (cmos) { BBx(cpu, 3, 0); } // BBR3
+                   else { RLA(cpu, addr_absolute_x(cpu)); } break;
+        case 0x42: if (cmos) { NOP(cpu, addr_immediate(cpu)); } // NOP #
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x43: if (!cmos) { SRE(cpu, addr_indirect_x(cpu)); } break; // NOP on the 65C02
+        case 0x44: NOP(cpu, addr_zeropage(cpu)); break; // NOP zp
+        case 0x47: if (cmos) { RMB(cpu, 4); } // RMB4
+                   else { SRE(cpu, addr_zeropage(cpu)); } break;
+        case 0x4B: if (!cmos) { ALR(cpu, addr_immediate(cpu)); } break; // NOP on the 65C02
+        case 0x4F: if (cmos) { BBx(cpu, 4, 0); } // BBR4
+                   else { SRE(cpu, addr_absolute(cpu)); } break;
+        case 0x52: if (cmos) { EOR(cpu, addr_zeropage_indirect(cpu)); } // EOR (zp)
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x53: if (!cmos) { SRE(cpu, addr_indirect_y(cpu)); } break; // NOP on the 65C02
+        case 0x54: NOP(cpu, addr_zeropage_x(cpu)); break; // NOP zp,X
+        case 0x57: if (cmos) { RMB(cpu, 5); } // RMB5
+                   else { SRE(cpu, addr_zeropage_x(cpu)); } break;
+        case 0x5A: if (cmos) { PUSH(cpu, cpu->Y); } break; // PHY
+        case 0x5B: if (!cmos) { SRE(cpu, addr_absolute_y(cpu)); } break; // NOP on the 65C02
+        case 0x5C: if (cmos) { NOP(cpu, addr_absolute(cpu)); } // NOP abs
+                   else { NOP(cpu, addr_absolute_x_rd(cpu)); } break;
+        case 0x5F: if (cmos) { BBx(cpu, 5, 0); } // BBR5
+                   else { SRE(cpu, addr_absolute_x(cpu)); } break;
+        case 0x62: if (cmos) { NOP(cpu, addr_immediate(cpu)); } // NOP #
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x63: if (!cmos) { RRA(cpu, addr_indirect_x(cpu)); } break; // NOP on the 65C02
+        case 0x64: if (cmos) { STZ(cpu, addr_zeropage(cpu)); } // STZ zp
+                   else { NOP(cpu, addr_zeropage(cpu)); } break;
+        case 0x67: if (cmos) { RMB(cpu, 6); } // RMB6
+                   else { RRA(cpu, addr_zeropage(cpu)); } break;
+        case 0x6B: if (!cmos) { ARR(cpu, addr_immediate(cpu)); } break; // NOP on the 65C02
+        case 0x6F: if (cmos) { BBx(cpu, 6, 0); } // BBR6
+                   else { RRA(cpu, addr_absolute(cpu)); } break;
+        case 0x72: if (cmos) { ADC(cpu, addr_zeropage_indirect(cpu), cmos); } // ADC (zp)
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x73: if (!cmos) { RRA(cpu, addr_indirect_y(cpu)); } break; // NOP on the 65C02
+        case 0x74: if (cmos) { STZ(cpu, addr_zeropage_x(cpu)); } // STZ zp,X
+                   else { NOP(cpu, addr_zeropage_x(cpu)); } break;
+        case 0x77: if (cmos) { RMB(cpu, 7); } // RMB7
+                   else { RRA(cpu, addr_zeropage_x(cpu)); } break;
+        case 0x7A: if (cmos) { cpu->Y = PULL(cpu); SET_ZN(cpu, cpu->Y); } break; // PLY
+        case 0x7B: if (!cmos) { RRA(cpu, addr_absolute_y(cpu)); } break; // NOP on the 65C02
+        case 0x7C: if (cmos) { cpu->PC = memory_read_word(memory_read_word(cpu->PC) + cpu->X); } // JMP (abs,X)
+                   else { NOP(cpu, addr_absolute_x_rd(cpu)); } break;
+        case 0x7F: if (cmos) { BBx(cpu, 7, 0); } // BBR7
+                   else { RRA(cpu, addr_absolute_x(cpu)); } break;
+        case 0x80: if (cmos) { branch(cpu, 1); } // BRA
+                   else { NOP(cpu, addr_immediate(cpu)); } break;
+        case 0x82: NOP(cpu, addr_immediate(cpu)); break; // NOP #
+        case 0x83: if (!cmos) { SAX(cpu, addr_indirect_x(cpu)); } break; // NOP on the 65C02
+        case 0x87: if (cmos) { SMB(cpu, 0); } // SMB0
+                   else { SAX(cpu, addr_zeropage(cpu)); } break;
+        case 0x89: if (cmos) { BIT_imm(cpu, addr_immediate(cpu)); } // BIT #
+                   else { NOP(cpu, addr_immediate(cpu)); } break;
+        case 0x8B: if (!cmos) { illegal_opcode(cpu, opcode); return; } break; // NOP on the 65C02
+        case 0x8F: if (cmos) { BBx(cpu, 0, 1); } // BBS0
+                   else { SAX(cpu, addr_absolute(cpu)); } break;
+        case 0x92: if (cmos) { STA(cpu, addr_zeropage_indirect(cpu)); } // STA (zp)
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x93: if (!cmos) { illegal_opcode(cpu, opcode); return; } break; // NOP on the 65C02
+        case 0x97: if (cmos) { SMB(cpu, 1); } // SMB1
+                   else { SAX(cpu, addr_zeropage_y(cpu)); } break;
+        case 0x9B: if (!cmos) { illegal_opcode(cpu, opcode); return; } break; // NOP on the 65C02
+        case 0x9C: if (cmos) { STZ(cpu, addr_absolute(cpu)); } // STZ abs
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x9E: if (cmos) { STZ(cpu, addr_absolute_x(cpu)); } // STZ abs,X
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0x9F: if (cmos) { BBx(cpu, 1, 1); } // BBS1
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0xA3: if (!cmos) { LAX(cpu, addr_indirect_x(cpu)); } break; // NOP on the 65C02
+        case 0xA7: if (cmos) { SMB(cpu, 2); } // SMB2
+                   else { LAX(cpu, addr_zeropage(cpu)); } break;
+        case 0xAB: if (!cmos) { illegal_opcode(cpu, opcode); return; } break; // NOP on the 65C02
+        case 0xAF: if (cmos) { BBx(cpu, 2, 1); } // BBS2
+                   else { LAX(cpu, addr_absolute(cpu)); } break;
+        case 0xB2: if (cmos) { LDA(cpu, addr_zeropage_indirect(cpu)); } // LDA (zp)
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0xB3: if (!cmos) { LAX(cpu, addr_indirect_y_rd(cpu)); } break; // NOP on the 65C02
+        case 0xB7: if (cmos) { SMB(cpu, 3); } // SMB3
+                   else { LAX(cpu, addr_zeropage_y(cpu)); } break;
+        case 0xBB: if (!cmos) { LAS(cpu, addr_absolute_y_rd(cpu)); } break; // NOP on the 65C02
+        case 0xBF: if (cmos) { BBx(cpu, 3, 1); } // BBS3
+                   else { LAX(cpu, addr_absolute_y_rd(cpu)); } break;
+        case 0xC2: NOP(cpu, addr_immediate(cpu)); break; // NOP #
+        case 0xC3: if (!cmos) { DCP(cpu, addr_indirect_x(cpu)); } break; // NOP on the 65C02
+        case 0xC7: if (cmos) { SMB(cpu, 4); } // SMB4
+                   else { DCP(cpu, addr_zeropage(cpu)); } break;
+        case 0xCB: if (cmos) { cpu->PC--; cpu->halted = 1; } // WAI
+                   else { SBX(cpu, addr_immediate(cpu)); } break;
+        case 0xCF: if (cmos) { BBx(cpu, 4, 1); } // BBS4
+                   else { DCP(cpu, addr_absolute(cpu)); } break;
+        case 0xD2: if (cmos) { CMP(cpu, addr_zeropage_indirect(cpu)); } // CMP (zp)
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0xD3: if (!cmos) { DCP(cpu, addr_indirect_y(cpu)); } break; // NOP on the 65C02
+        case 0xD4: NOP(cpu, addr_zeropage_x(cpu)); break; // NOP zp,X
+        case 0xD7: if (cmos) { SMB(cpu, 5); } // SMB5
+                   else { DCP(cpu, addr_zeropage_x(cpu)); } break;
+        case 0xDA: if (cmos) { PUSH(cpu, cpu->X); } break; // PHX
+        case 0xDB: if (cmos) { cpu->PC--; cpu->halted = 1; } // STP
+                   else { DCP(cpu, addr_absolute_y(cpu)); } break;
+        case 0xDC: if (cmos) { NOP(cpu, addr_absolute(cpu)); } // NOP abs
+                   else { NOP(cpu, addr_absolute_x_rd(cpu)); } break;
+        case 0xDF: if (cmos) { BBx(cpu, 5, 1); } // BBS5
+                   else { DCP(cpu, addr_absolute_x(cpu)); } break;
+        case 0xE2: NOP(cpu, addr_immediate(cpu)); break; // NOP #
+        case 0xE3: if (!cmos) { ISC(cpu, addr_indirect_x(cpu)); } break; // NOP on the 65C02
+        case 0xE7: if (cmos) { SMB(cpu, 6); } // SMB6
+                   else { ISC(cpu, addr_zeropage(cpu)); } break;
+        case 0xEB: if (!cmos) { SBC(cpu, addr_immediate(cpu), 0); } break; // NOP on the 65C02
+        case 0xEF: if (cmos) { BBx(cpu, 6, 1); } // BBS6
+                   else { ISC(cpu, addr_absolute(cpu)); } break;
+        case 0xF2: if (cmos) { SBC(cpu, addr_zeropage_indirect(cpu), cmos); } // SBC (zp)
+                   else { illegal_opcode(cpu, opcode); return; } break;
+        case 0xF3: if (!cmos) { ISC(cpu, addr_indirect_y(cpu)); } break; // NOP on the 65C02
+        case 0xF4: NOP(cpu, addr_zeropage_x(cpu)); break; // NOP zp,X
+        case 0xF7: if (cmos) { SMB(cpu, 7); } // SMB7
+                   else { ISC(cpu, addr_zeropage_x(cpu)); } break;
+        case 0xFA: if (cmos) { cpu->X = PULL(cpu); SET_ZN(cpu, cpu->X); } break; // PLX
+        case 0xFB: if (!cmos) { ISC(cpu, addr_absolute_y(cpu)); } break; // NOP on the 65C02
+        case 0xFC: if (cmos) { NOP(cpu, addr_absolute(cpu)); } // NOP abs
+                   else { NOP(cpu, addr_absolute_x_rd(cpu)); } break;
+        case 0xFF: if (cmos) { BBx(cpu, 7, 1); } // BBS7
+                   else { ISC(cpu, addr_absolute_x(cpu)); } break;
+    }
+    cpu->cycles += opcode_table[cmos][opcode].cycles;
+    cpu->instructions++;
+    if (covered) cover(cpu, from, sp, opcode_table[cmos][opcode].effects);
+}
+
+static void step_6502(CPU *cpu) { step(cpu, 0, 0); }
+static void step_65c02(CPU *cpu) { step(cpu, 1, 0); }
+static void step_6502_covered(CPU *cpu) { step(cpu, 0, 1); }
+static void step_65c02_covered(CPU *cpu) { step(cpu, 1, 1); }
+
+// One fully specialised core per model, indexed by whether coverage is
+// counted and CpuModel
+static void (*const step_fns[2][2])(CPU *cpu) = {
+    { step_6502, step_65c02 },
+    { step_6502_covered, step_65c02_covered }
+};
+
+void cpu_step(CPU *cpu) {
+    step_fns[cpu->coverage != NULL][cpu->model](cpu);
+}
+
+// Idle loop detection
+#define IDLE_MAX_LOOP_BYTES 8     // Only loops this short are considered
+#define IDLE_MAX_LOOP_INSNS 4
+#define IDLE_RETRY_DELAY 64       // Back-jumps to ignore after a loop proved busy
+
+// Opcodes allowed in a loop that gets fast-forwarded: nothing that writes
+// memory, touches the stack, jumps indirectly or stops the CPU
+static int idle_safe(const OpcodeInfo *op) {
+    if (op->effects & (OP_WRITE | OP_STACK | OP_HALT | OP_ILLEGAL)) return 0;
+    return !(op->effects & OP_JUMP) || op->mode == MODE_ABSOLUTE;
+}
+
+// Run one more iteration of the loop starting at cpu->PC. If it only used
+// idle-safe opcodes, read no device register that can change by itself and
+// left every register and flag as it found them, the loop is a fixed point
+// that nothing but next_event can end; return the cycles one iteration
+// takes. Otherwise return 0 (the instructions run here still count, exactly
+// as if the caller had stepped them).
+static uint64_t idle_iteration(CPU *cpu, void (*step_fn)(CPU *cpu), uint64_t limit) {
+    CPU start = *cpu;
+    uint32_t unstable_reads = memory_unstable_reads();
+    
+    for (int i = 0; i < IDLE_MAX_LOOP_INSNS; i++) {
+        if (cpu->cycles >= limit || cpu->halted || !idle_safe(opcode_info(cpu->model, memory_read(cpu->PC)))) return 0;
+        step_fn(cpu);
+        if ((uint16_t)(cpu->PC - start.PC) >= IDLE_MAX_LOOP_BYTES) return 0;
+        if (cpu->PC == start.PC) {
+            if (cpu->A != start.A || cpu->X != start.X || cpu->Y != start.Y ||
+                cpu->SP != start.SP || cpu->status != start.status ||
+                memory_unstable_reads() != unstable_reads) return 0;
+            return cpu->cycles - start.cycles;
+        }
+    }
+    return 0;
+}
+
+static void execute_skipping_idle(CPU *cpu, void (*step_fn)(CPU *cpu), uint64_t limit) {
+    uint16_t busy_pc = 0;
+    unsigned busy_wait = 0;
+    
+    while (cpu->cycles < limit && !cpu->halted) {
+        uint16_t pc = cpu->PC;
+        step_fn(cpu);
+        if (cpu->PC > pc || pc - cpu->PC >= IDLE_MAX_LOOP_BYTES) continue;
+        
+        // A short backward jump: check whether the loop can ever end by itself
+        if (busy_wait && pc == busy_pc) {
+            busy_wait--;
+            continue;
+        }
+        uint64_t stop = limit < cpu->next_event ? limit : cpu->next_event;
+        uint64_t iteration = idle_iteration(cpu, step_fn, stop);
+        if (!iteration) {
+            busy_pc = pc;
+            busy_wait = IDLE_RETRY_DELAY;
+            continue;
+        }
+        
+        // Skip whole iterations but stay below the stop cycle, so the last
+        // ones are stepped and the final state matches plain stepping
+        if (cpu->cycles < stop) {
+            uint64_t skip = (stop - cpu->cycles - 1) / iteration * iteration;
+            if (skip) {
+                cpu->cycles += skip;
+                cpu->idle_skips++;
+                cpu->idle_cycles += skip;
+            }
+        }
     }
 }
 
 void cpu_execute(CPU *cpu, uint64_t max_cycles) {
-    uint64_t start_cycles = cpu->cycles;
-    while (cpu->cycles - start_cycles < max_cycles) {
-        cpu_step(cpu);
+    void (*step_fn)(CPU *cpu) = step_fns[cpu->coverage != NULL][cpu->model];
+    uint64_t limit = max_cycles > UINT64_MAX - cpu->cycles ? UINT64_MAX : cpu->cycles + max_cycles;
+    
+    if (cpu->idle_skip) {
+        execute_skipping_idle(cpu, step_fn, limit);
+        return;
+    }
+    while (cpu->cycles < limit && !cpu->halted) {
+        step_fn(cpu);
     }
 }
@@ -13,7 +13,31 @@
 #define FLAG_V 0x40  // Overflow
 #define FLAG_N 0x80  // Negative
 
+// CPU models, each with its own specialised core
+typedef enum {
+    CPU_6502,       // NMOS 6502, including the undocumented opcodes
+    CPU_65C02       // CMOS W65C02S, including the Rockwell bit instructions
+} CpuModel;
+
+// What to do with unstable (ANE, LXA, SHA, SHX, SHY, TAS) and JAM opcodes
+typedef enum {
+    ILLEGAL_HALT,   // Stop with PC at the opcode and set cpu->halted
+    ILLEGAL_TRAP,   // Hand the opcode to the illegal_trap callback
+    ILLEGAL_NOP     // Skip it as a NOP of the same length
+} IllegalPolicy;
+
+// Edge coverage for fuzzing, counted while cpu->coverage is set
+#define COVERAGE_BITS 13
+#define COVERAGE_SIZE (1 << COVERAGE_BITS)
+
 typedef struct {
+    // Hit counts (wrapping) of the edges branches, jumps, calls, returns and
+    // BRK take, indexed by a hash of their (from, to) addresses
+    uint8_t edges[COVERAGE_SIZE];
+    uint8_t stack_wrapped;  // Set when a push or pull takes SP around the stack page
+} CpuCoverage;
+
+typedef struct CPU {
     uint8_t A;      // Accumulator
     uint8_t X;      // X register
     uint8_t Y;      // Y register
@@ -21,11 +45,34 @@ typedef struct {
     uint16_t PC;    // Program counter
     uint8_t status; // Status register
     uint64_t cycles; // Total cycles executed
+    uint64_t instructions; // Total instructions executed (idle loops fast-forwarded not included)
+    uint8_t halted;  // Set when the CPU stops (JAM, STP/WAI, illegal opcode); PC is left at the opcode
+    uint8_t halt_on_brk; // Halt on BRK instead of taking the IRQ/BRK vector
+    uint8_t model;   // CpuModel
+    uint8_t illegal_policy; // IllegalPolicy
+    // Called with PC at the offending opcode. Return nonzero if the
+    // callback handled it (and moved PC on), zero to halt the CPU.
+    int (*illegal_trap)(struct CPU *cpu, uint8_t opcode, void *ctx);
+    void *illegal_ctx;
+    // cpu_execute fast-forwards short loops that only read RAM or stable
+    // device registers and leave all registers unchanged (JMP *, LDA $xxxx /
+    // BEQ ...), up to next_event. The final state is identical to stepping;
+    // clear idle_skip to step every iteration anyway.
+    uint8_t idle_skip;
+    uint64_t next_event;   // Cycle at which a device register changes by itself (UINT64_MAX if none)
+    uint64_t idle_skips;   // Number of idle loops fast-forwarded
+    uint64_t idle_cycles;  // Cycles skipped by them
+    // Edge coverage to count into, or NULL. Runs with coverage take a core
+    // built with the counting; the others do not pay for it.
+    CpuCoverage *coverage;
 } CPU;
 
 void cpu_init(CPU *cpu);
 void cpu_reset(CPU *cpu);
 void cpu_step(CPU *cpu);
 void cpu_execute(CPU *cpu, uint64_t max_cycles);
+void cpu_set_model(CPU *cpu, CpuModel model);
+void cpu_set_illegal_policy(CPU *cpu, IllegalPolicy policy,
+                            int (*trap)(CPU *cpu, uint8_t opcode, void *ctx), void *ctx);
 
 #endif
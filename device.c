@@ -0,0 +1,202 @@
+#define _DEFAULT_SOURCE
+#include "device.h"
+#include "counters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct Devices {
+    MemoryDevice device;    // First, so the callbacks can cast back
+    uint16_t base;          // Address of the I/O page
+    CPU *cpu;
+    Journal *journal;       // Console input, NULL for stdin
+    uint32_t timer_latch;
+    uint32_t alarm_delay;
+    uint64_t alarm_at;      // Cycle the alarm goes off
+    int alarm_armed;
+
+    uint8_t *disk;          // Mapping of the disk file, NULL without a disk
+    size_t disk_bytes;
+    uint16_t disk_blocks;
+    int disk_writable;
+    uint8_t disk_status;
+    uint16_t disk_block;
+    uint16_t disk_address;
+    uint8_t disk_count;
+};
+
+static void disk_transfer(Devices *d, uint8_t command) {
+    size_t count = d->disk_count ? d->disk_count : 256;
+    if (!d->disk || (command != DISK_READ && command != DISK_WRITE) ||
+        (command == DISK_WRITE && !d->disk_writable) ||
+        (size_t)d->disk_block + count > d->disk_blocks) {
+        d->disk_status = DISK_ERROR;
+        return;
+    }
+    uint8_t *blocks = d->disk + (size_t)d->disk_block * DISK_BLOCK_SIZE;
+    if (command == DISK_READ) {
+        memory_copy_in(d->disk_address, blocks, count * DISK_BLOCK_SIZE);
+    } else {
+        memory_copy_out(d->disk_address, blocks, count * DISK_BLOCK_SIZE);
+    }
+    counters_add(COUNTER_DISK_BYTES, count * DISK_BLOCK_SIZE);
+    d->disk_status = DISK_OK;
+}
+
+static void disarm(Devices *d) {
+    if (d->alarm_armed && d->cpu->next_event == d->alarm_at) d->cpu->next_event = UINT64_MAX;
+    d->alarm_armed = 0;
+}
+
+static uint8_t alarm_status(Devices *d) {
+    if (!d->alarm_armed || d->cpu->cycles < d->alarm_at) return 0;
+    // Seen: idle loops no longer need to stop at it
+    if (d->cpu->next_event == d->alarm_at) d->cpu->next_event = UINT64_MAX;
+    return TIMER_ALARM_FIRED;
+}
+
+static uint8_t devices_read(MemoryDevice *device, uint16_t address) {
+    Devices *d = (Devices *)device;
+    int c;
+    switch ((uint8_t)(address - d->base)) {
+        case DEVICE_CONSOLE_DATA:
+            fflush(stdout);
+            c = journal_read_byte(d->journal, "CONSOLE", d->cpu->cycles);
+            if (c == EOF) return 0;
+            counters_add(COUNTER_INPUT_BYTES, 1);
+            return (uint8_t)c;
+        case DEVICE_CONSOLE_STATUS:
+            fflush(stdout);
+            return journal_has_input(d->journal) ? CONSOLE_INPUT_READY : CONSOLE_END_OF_INPUT;
+        case DEVICE_TIMER:
+            d->timer_latch = (uint32_t)d->cpu->cycles;
+            return d->timer_latch & 0xFF;
+        case DEVICE_TIMER + 1: return d->timer_latch >> 8 & 0xFF;
+        case DEVICE_TIMER + 2: return d->timer_latch >> 16 & 0xFF;
+        case DEVICE_TIMER + 3: return d->timer_latch >> 24;
+        case DEVICE_TIMER_ALARM: return d->alarm_delay & 0xFF;
+        case DEVICE_TIMER_ALARM + 1: return d->alarm_delay >> 8 & 0xFF;
+        case DEVICE_TIMER_ALARM + 2: return d->alarm_delay >> 16 & 0xFF;
+        case DEVICE_TIMER_ALARM + 3: return d->alarm_delay >> 24;
+        case DEVICE_TIMER_STATUS: return alarm_status(d);
+        case DEVICE_DISK_STATUS: return d->disk_status;
+        case DEVICE_DISK_BLOCK: return d->disk_block & 0xFF;
+        case DEVICE_DISK_BLOCK + 1: return d->disk_block >> 8;
+        case DEVICE_DISK_ADDRESS: return d->disk_address & 0xFF;
+        case DEVICE_DISK_ADDRESS + 1: return d->disk_address >> 8;
+        case DEVICE_DISK_COUNT: return d->disk_count;
+        case DEVICE_DISK_SIZE: return d->disk_blocks & 0xFF;
+        case DEVICE_DISK_SIZE + 1: return d->disk_blocks >> 8;
+        default: return 0;
+    }
+}
+
+// The console and the running cycle count change by themselves; the alarm
+// status only at next_event, and the rest only when written
+static int devices_stable(MemoryDevice *device, uint16_t address) {
+    Devices *d = (Devices *)device;
+    switch ((uint8_t)(address - d->base)) {
+        case DEVICE_CONSOLE_DATA:
+        case DEVICE_CONSOLE_STATUS:
+        case DEVICE_TIMER:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static void devices_write(MemoryDevice *device, uint16_t address, uint8_t value) {
+    Devices *d = (Devices *)device;
+    switch ((uint8_t)(address - d->base)) {
+        case DEVICE_CONSOLE_DATA:
+            putchar(value);
+            counters_add(COUNTER_OUTPUT_BYTES, 1);
+            break;
+        case DEVICE_TIMER_ALARM: d->alarm_delay = (d->alarm_delay & ~0xFFu) | value; break;
+        case DEVICE_TIMER_ALARM + 1: d->alarm_delay = (d->alarm_delay & ~0xFF00u) | value << 8; break;
+        case DEVICE_TIMER_ALARM + 2: d->alarm_delay = (d->alarm_delay & ~0xFF0000u) | (uint32_t)value << 16; break;
+        case DEVICE_TIMER_ALARM + 3:
+            d->alarm_delay = (d->alarm_delay & 0xFFFFFFu) | (uint32_t)value << 24;
+            disarm(d);
+            d->alarm_armed = 1;
+            d->alarm_at = d->cpu->cycles + d->alarm_delay;
+            if (d->alarm_at < d->cpu->next_event) d->cpu->next_event = d->alarm_at;
+            break;
+        case DEVICE_TIMER_STATUS: disarm(d); break;
+        case DEVICE_DISK_COMMAND: disk_transfer(d, value); break;
+        case DEVICE_DISK_BLOCK: d->disk_block = (d->disk_block & 0xFF00) | value; break;
+        case DEVICE_DISK_BLOCK + 1: d->disk_block = (d->disk_block & 0x00FF) | value << 8; break;
+        case DEVICE_DISK_ADDRESS: d->disk_address = (d->disk_address & 0xFF00) | value; break;
+        case DEVICE_DISK_ADDRESS + 1: d->disk_address = (d->disk_address & 0x00FF) | value << 8; break;
+        case DEVICE_DISK_COUNT: d->disk_count = value; break;
+        default: break;
+    }
+}
+
+Devices *devices_open(CPU *cpu, const char *disk, Journal *journal) {
+    Devices *d = calloc(1, sizeof(Devices));
+    if (!d) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    d->device.read = devices_read;
+    d->device.write = devices_write;
+    d->device.stable = devices_stable;
+    d->cpu = cpu;
+    d->journal = journal;
+    if (!disk) return d;
+
+    d->disk_writable = 1;
+    int fd = open(disk, O_RDWR);
+    if (fd < 0 && (errno == EACCES || errno == EROFS)) {
+        d->disk_writable = 0;
+        fd = open(disk, O_RDONLY);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open disk '%s': %s\n", disk, strerror(errno));
+        free(d);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot read size of disk '%s': %s\n", disk, strerror(errno));
+        close(fd);
+        free(d);
+        return NULL;
+    }
+    // Blocks past the 16-bit block numbers and a partial last block are
+    // not reachable, so they are not mapped
+    size_t blocks = (size_t)st.st_size / DISK_BLOCK_SIZE;
+    if (blocks > 0xFFFF) blocks = 0xFFFF;
+    d->disk_blocks = (uint16_t)blocks;
+    d->disk_bytes = blocks * DISK_BLOCK_SIZE;
+    if (d->disk_bytes > 0) {
+        int prot = PROT_READ | (d->disk_writable ? PROT_WRITE : 0);
+        void *map = mmap(NULL, d->disk_bytes, prot, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Error: Cannot map disk '%s': %s\n", disk, strerror(errno));
+            close(fd);
+            free(d);
+            return NULL;
+        }
+        d->disk = map;
+    }
+    close(fd);
+    return d;
+}
+
+void devices_close(Devices *d) {
+    if (!d) return;
+    if (d->disk) munmap(d->disk, d->disk_bytes);
+    free(d);
+}
+
+void devices_map(Devices *d, uint8_t page) {
+    d->base = page << 8;
+    memory_map(page, 1, &d->device);
+}
@@ -0,0 +1,75 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "cpu.h"
+#include "memory.h"
+#include "journal.h"
+
+// Standard peripherals: a console, a cycle timer and a block device, all in
+// one 256-byte I/O page. Registers, relative to the start of the page:
+//
+//   $00        CONSOLE_DATA    Write: print a character. Read: the next input
+//                              character, waiting for it; 0 at end of input
+//   $01        CONSOLE_STATUS  Bit 7: a character is waiting. Bit 6: the
+//                              input has ended
+//   $10-$13    TIMER           CPU cycle count, little-endian. Reading $10
+//                              latches all four bytes
+//   $14-$17    TIMER_ALARM     Delay in cycles, little-endian. Writing $17
+//                              arms the alarm to go off that many cycles later
+//   $18        TIMER_STATUS    Bit 7: the armed alarm has gone off. Writing
+//                              disarms it
+//   $20        DISK_COMMAND    Write DISK_READ or DISK_WRITE to transfer
+//                              DISK_COUNT blocks between the disk and memory
+//   $21        DISK_STATUS     DISK_OK, or DISK_ERROR if the last command
+//                              failed (no disk, blocks out of range, read-only)
+//   $22-$23    DISK_BLOCK      First block of the transfer
+//   $24-$25    DISK_ADDRESS    Memory address of the transfer
+//   $26        DISK_COUNT      Number of blocks (0 means 256)
+//   $28-$29    DISK_SIZE       Number of blocks on the disk (read-only)
+//
+// The disk is a host file mapped into the emulator's address space; a
+// transfer is a single memcpy between the mapping and the guest's RAM.
+// Other registers read as 0 and ignore writes.
+//
+// The alarm sets the CPU's next_event, so a loop polling TIMER_STATUS is
+// fast-forwarded up to the alarm like one polling RAM; loops reading the
+// console or TIMER are always stepped.
+
+#define DEVICE_CONSOLE_DATA   0x00
+#define DEVICE_CONSOLE_STATUS 0x01
+#define DEVICE_TIMER          0x10
+#define DEVICE_TIMER_ALARM    0x14
+#define DEVICE_TIMER_STATUS   0x18
+#define DEVICE_DISK_COMMAND   0x20
+#define DEVICE_DISK_STATUS    0x21
+#define DEVICE_DISK_BLOCK     0x22
+#define DEVICE_DISK_ADDRESS   0x24
+#define DEVICE_DISK_COUNT     0x26
+#define DEVICE_DISK_SIZE      0x28
+
+#define CONSOLE_INPUT_READY  0x80
+#define CONSOLE_END_OF_INPUT 0x40
+
+#define TIMER_ALARM_FIRED    0x80
+
+#define DISK_READ  1
+#define DISK_WRITE 2
+#define DISK_OK    0
+#define DISK_ERROR 1
+
+#define DISK_BLOCK_SIZE 512
+
+typedef struct Devices Devices;
+
+// Devices reading the cycle count of cpu (and setting its next_event for
+// the alarm), reading console input through journal (NULL: stdin), with
+// each byte stamped with the cycle count it was read at, and, if disk is
+// not NULL, backed by that file (opened read-only if it cannot be
+// written). Returns NULL (with a message on stderr) on failure.
+Devices *devices_open(CPU *cpu, const char *disk, Journal *journal);
+void devices_close(Devices *devices);
+
+// Map the devices over page of the bound address space
+void devices_map(Devices *devices, uint8_t page);
+
+#endif
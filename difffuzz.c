@@ -0,0 +1,326 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu.h"
+#include "memory.h"
+#include "batch.h"
+#include "opcodes.h"
+
+// Differential fuzzer: runs random instruction streams on two interpreter
+// cores in lockstep and reports the first instruction where they disagree.
+
+// A core runs the bound CPU/memory until at least max_cycles have elapsed,
+// stopping on an instruction boundary exactly like cpu_execute. With
+// max_cycles == 1 it executes a single instruction.
+typedef struct {
+    const char *name;
+    void (*run)(CPU *cpu, uint64_t max_cycles);
+} FuzzCore;
+
+static void run_step(CPU *cpu, uint64_t max_cycles) {
+    uint64_t start_cycles = cpu->cycles;
+    while (cpu->cycles - start_cycles < max_cycles && !cpu->halted) {
+        cpu_step(cpu);
+    }
+}
+
+static void run_execute(CPU *cpu, uint64_t max_cycles) {
+    cpu_execute(cpu, max_cycles);
+}
+
+// Runs the state on two lanes of a batch: lane 0 on the bound memory itself
+// and lane 1 on a copy. Both must end up identical; with them at the same PC
+// the vector path does the work.
+static void run_batch(CPU *cpu, uint64_t max_cycles) {
+    static CpuBatch *batch;
+    if (!batch) {
+        batch = batch_create(2, cpu->model);
+        if (!batch) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+    }
+    Memory *mem = memory_bind(NULL);
+    memory_bind(mem);
+    Memory *own = batch->mem[0];
+    batch->mem[0] = mem;
+    memcpy(batch->mem[1], mem, sizeof(Memory));
+    batch->config = *cpu;
+    batch_set_lane(batch, 0, cpu);
+    batch_set_lane(batch, 1, cpu);
+
+    batch_execute(batch, max_cycles);
+
+    batch_get_lane(batch, 0, cpu);
+    batch->mem[0] = own;
+    CPU copy = *cpu;
+    batch_get_lane(batch, 1, &copy);
+    if (copy.A != cpu->A || copy.X != cpu->X || copy.Y != cpu->Y || copy.SP != cpu->SP ||
+        copy.PC != cpu->PC || copy.status != cpu->status || copy.cycles != cpu->cycles ||
+        copy.halted != cpu->halted ||
+        memcmp(mem->ram, batch->mem[1]->ram, MEMORY_SIZE) != 0) {
+        fprintf(stderr, "Error: Batch lanes disagree after running identical states\n");
+        exit(1);
+    }
+}
+
+static const FuzzCore cores[] = {
+    { "step", run_step },       // Reference: the cpu_step switch, one call per instruction
+    { "execute", run_execute }, // cpu_execute's loop
+    { "batch", run_batch },     // batch_execute's vector path
+};
+#define NUM_CORES (sizeof(cores) / sizeof(cores[0]))
+
+// One side of the comparison
+typedef struct {
+    const FuzzCore *core;
+    CPU cpu;
+    Memory mem;
+    CPU saved_cpu;      // State at the last matching checkpoint
+    Memory saved_mem;
+    double seconds;
+} Lane;
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cpu_equal(const CPU *a, const CPU *b) {
+    return a->A == b->A && a->X == b->X && a->Y == b->Y && a->SP == b->SP &&
+           a->PC == b->PC && a->status == b->status && a->cycles == b->cycles &&
+           a->halted == b->halted;
+}
+
+static void print_cpu(const char *label, const CPU *cpu) {
+    printf("  %-10s PC: 0x%04X  A: 0x%02X  X: 0x%02X  Y: 0x%02X  SP: 0x%02X  Status: 0x%02X  Cycles: %lu%s\n",
+           label, cpu->PC, cpu->A, cpu->X, cpu->Y, cpu->SP, cpu->status, cpu->cycles,
+           cpu->halted ? "  (halted)" : "");
+}
+
+static void lane_run(Lane *lane, uint64_t max_cycles) {
+    memory_bind(&lane->mem);
+    double start = now_seconds();
+    lane->core->run(&lane->cpu, max_cycles);
+    lane->seconds += now_seconds() - start;
+}
+
+static uint64_t lane_hash(Lane *lane) {
+    memory_bind(&lane->mem);
+    return memory_hash();
+}
+
+// Checkpoints only copy the pages changed since the previous one
+static void lane_save(Lane *lane) {
+    uint8_t pages[MEMORY_PAGES];
+    memory_bind(&lane->mem);
+    int count = memory_dirty_pages(pages);
+    for (int i = 0; i < count; i++) {
+        memcpy(&lane->saved_mem.ram[pages[i] * MEMORY_PAGE_SIZE],
+               &lane->mem.ram[pages[i] * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+        lane->saved_mem.page_hash[pages[i]] = lane->mem.page_hash[pages[i]];
+    }
+    lane->saved_mem.hash = lane->mem.hash;
+    memory_clear_dirty();
+    lane->saved_cpu = lane->cpu;
+}
+
+static void lane_restore(Lane *lane) {
+    lane->cpu = lane->saved_cpu;
+    memcpy(&lane->mem, &lane->saved_mem, sizeof(Memory));
+    memory_bind(&lane->mem);
+    memory_clear_dirty();
+}
+
+static void random_state(Lane *a, Lane *b, CpuModel model) {
+    for (int i = 0; i < MEMORY_SIZE; i += 8) {
+        uint64_t word = rng_next();
+        memcpy(&a->mem.ram[i], &word, sizeof(word));
+    }
+
+    memory_bind(&a->mem);
+    memory_rehash();
+    memory_clear_dirty();
+
+    uint64_t regs = rng_next();
+    cpu_init(&a->cpu);
+    cpu_set_model(&a->cpu, model);
+    // Random streams hit JAM and unstable opcodes constantly; keep going
+    cpu_set_illegal_policy(&a->cpu, ILLEGAL_NOP, NULL, NULL);
+    a->cpu.A = regs;
+    a->cpu.X = regs >> 8;
+    a->cpu.Y = regs >> 16;
+    a->cpu.SP = regs >> 24;
+    a->cpu.status = (regs >> 32) | FLAG_U;
+    a->cpu.PC = regs >> 40;
+
+    b->cpu = a->cpu;
+    memcpy(&b->mem, &a->mem, sizeof(Memory));
+    memcpy(&a->saved_mem, &a->mem, sizeof(Memory));
+    memcpy(&b->saved_mem, &a->mem, sizeof(Memory));
+}
+
+// Replay from the last checkpoint one instruction at a time and report the
+// first instruction after which the two lanes differ
+static void minimise(Lane *a, Lane *b, uint64_t max_cycles) {
+    lane_restore(a);
+    lane_restore(b);
+
+    for (uint64_t step = 0; a->cpu.cycles - a->saved_cpu.cycles <= max_cycles; step++) {
+        CPU before = a->cpu;
+        uint8_t bytes[3];
+        for (int i = 0; i < 3; i++) bytes[i] = a->mem.ram[(uint16_t)(before.PC + i)];
+
+        lane_run(a, 1);
+        lane_run(b, 1);
+
+        int mem_diff = memcmp(a->mem.ram, b->mem.ram, MEMORY_SIZE) != 0 ||
+                       a->mem.hash != b->mem.hash;
+        if (!cpu_equal(&a->cpu, &b->cpu) || mem_diff) {
+            printf("First divergence %lu instructions after the checkpoint:\n", step);
+            char text[DISASM_MAX];
+            disassemble(before.model, before.PC, bytes, text, sizeof(text));
+            printf("  Instruction at 0x%04X: %02X %02X %02X  %s\n", before.PC, bytes[0], bytes[1], bytes[2], text);
+            print_cpu("before", &before);
+            print_cpu(a->core->name, &a->cpu);
+            print_cpu(b->core->name, &b->cpu);
+            if (mem_diff) {
+                for (int i = 0; i < MEMORY_SIZE; i++) {
+                    if (a->mem.ram[i] != b->mem.ram[i]) {
+                        printf("  Memory differs at 0x%04X: %s=0x%02X %s=0x%02X\n", i,
+                               a->core->name, a->mem.ram[i], b->core->name, b->mem.ram[i]);
+                        break;
+                    }
+                }
+            }
+            return;
+        }
+        if (a->cpu.halted && b->cpu.halted) break;
+    }
+    printf("Divergence did not reproduce when single-stepping (slice boundary dependent)\n");
+}
+
+static const FuzzCore *find_core(const char *name) {
+    for (size_t i = 0; i < NUM_CORES; i++) {
+        if (strcmp(cores[i].name, name) == 0) return &cores[i];
+    }
+    return NULL;
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n", program_name);
+    printf("\nOptions:\n");
+    printf("  --cores A,B       Cores to compare (default: step,execute)\n");
+    printf("  --cpu MODEL       CPU model: 6502 (default) or 65c02\n");
+    printf("  --cases N         Number of random programs to run (default: 1000)\n");
+    printf("  --case-cycles N   Cycles to run each program for (default: 1000000)\n");
+    printf("  --interval N      Compare state every N cycles (default: 10000)\n");
+    printf("  --seed N          PRNG seed (default: time based)\n");
+    printf("  --help            Display this help message\n");
+    printf("\nCores:");
+    for (size_t i = 0; i < NUM_CORES; i++) printf(" %s", cores[i].name);
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *core_names = "step,execute";
+    CpuModel model = CPU_6502;
+    uint64_t cases = 1000;
+    uint64_t case_cycles = 1000000;
+    uint64_t interval = 10000;
+    uint64_t seed = (uint64_t)time(NULL);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (i + 1 >= argc) {
+            fprintf(stderr, "Error: %s requires an argument\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else if (strcmp(argv[i], "--cores") == 0) {
+            core_names = argv[++i];
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            i++;
+            if (strcmp(argv[i], "6502") == 0) {
+                model = CPU_6502;
+            } else if (strcmp(argv[i], "65c02") == 0 || strcmp(argv[i], "65C02") == 0) {
+                model = CPU_65C02;
+            } else {
+                fprintf(stderr, "Error: Invalid CPU model '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cases") == 0) {
+            cases = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--case-cycles") == 0) {
+            case_cycles = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--interval") == 0) {
+            interval = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    char name_a[32], name_b[32];
+    if (sscanf(core_names, "%31[^,],%31s", name_a, name_b) != 2) {
+        fprintf(stderr, "Error: --cores expects two names separated by a comma\n");
+        return 1;
+    }
+
+    static Lane a, b;
+    a.core = find_core(name_a);
+    b.core = find_core(name_b);
+    if (!a.core || !b.core) {
+        fprintf(stderr, "Error: Unknown core '%s'\n", a.core ? name_b : name_a);
+        return 1;
+    }
+    if (interval == 0 || case_cycles == 0) {
+        fprintf(stderr, "Error: --interval and --case-cycles must be positive\n");
+        return 1;
+    }
+
+    printf("Comparing %s against %s, seed %lu\n", a.core->name, b.core->name, seed);
+    rng_state = seed ? seed : 1;
+    uint64_t total_cycles = 0;
+
+    for (uint64_t n = 0; n < cases; n++) {
+        random_state(&a, &b, model);
+        uint64_t start_cycles = a.cpu.cycles;
+
+        while (a.cpu.cycles - start_cycles < case_cycles && !a.cpu.halted) {
+            lane_save(&a);
+            lane_save(&b);
+            lane_run(&a, interval);
+            lane_run(&b, interval);
+
+            if (!cpu_equal(&a.cpu, &b.cpu) || lane_hash(&a) != lane_hash(&b)) {
+                printf("\nMismatch in case %lu (seed %lu)\n", n, seed);
+                minimise(&a, &b, interval);
+                return 1;
+            }
+        }
+        total_cycles += a.cpu.cycles - start_cycles;
+    }
+
+    printf("%lu cases, %lu cycles compared, no differences\n", cases, total_cycles);
+    printf("  %-10s %.1f M cycles/s\n", a.core->name, total_cycles / a.seconds / 1e6);
+    printf("  %-10s %.1f M cycles/s\n", b.core->name, total_cycles / b.seconds / 1e6);
+    return 0;
+}
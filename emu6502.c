@@ -0,0 +1,325 @@
+#include "emu6502.h"
+#include "cpu.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "basic.h"
+#include "device.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct Emu6502Machine {
+    CPU cpu;
+    Memory *mem;
+    BasicInterp *basic;
+    Emu6502OutputFn output;
+    void *output_ctx;
+    char *input;          // Copy of the INPUT text
+    size_t input_len;
+    size_t input_pos;
+    size_t input_cap;
+    int input_open;       // More input may be appended
+    int waiting;          // A console read found no input while it was open
+    MemoryDevice console;
+    int console_page;     // Page the console is mapped at, or -1
+};
+
+// Every entry point runs with the machine's memory bound on the calling
+// thread and restores the caller's binding on the way out
+#define ENTER(m) Memory *saved_mem_ = memory_bind((m)->mem)
+#define LEAVE() memory_bind(saved_mem_)
+
+unsigned emu6502_version(void) {
+    return EMU6502_VERSION;
+}
+
+static void basic_output(void *ctx, const char *text, int len) {
+    Emu6502Machine *m = ctx;
+    if (m->output) m->output(m->output_ctx, text, (size_t)len);
+}
+
+static int basic_input(void *ctx, uint16_t line_num, char *buf, int size) {
+    Emu6502Machine *m = ctx;
+    (void)line_num;
+    // A line is only complete once its newline or the end of input is there
+    if (m->input_open && (m->input_pos >= m->input_len ||
+                          !memchr(m->input + m->input_pos, '\n', m->input_len - m->input_pos))) {
+        return BASIC_INPUT_WAIT;
+    }
+    if (m->input_pos >= m->input_len) return 0;
+
+    int n = 0;
+    while (m->input_pos < m->input_len && m->input[m->input_pos] != '\n') {
+        if (n < size - 1) buf[n++] = m->input[m->input_pos];
+        m->input_pos++;
+    }
+    if (m->input_pos < m->input_len) m->input_pos++; // Skip the newline
+    buf[n] = 0;
+    return 1;
+}
+
+// The console registers of device.h, with input from the machine's input
+// text and output to its output callback. A read that finds the input used
+// up but still open stops emu6502_run with EMU6502_WAITING after the
+// instruction; polling CONSOLE_STATUS then repeats once input arrives.
+static uint8_t console_read(MemoryDevice *device, uint16_t address) {
+    Emu6502Machine *m = (Emu6502Machine *)((char *)device - offsetof(Emu6502Machine, console));
+    int ready = m->input_pos < m->input_len;
+    if (!ready && m->input_open) {
+        m->waiting = 1;
+        m->cpu.halted = 1;
+    }
+    switch (address & 0xFF) {
+        case DEVICE_CONSOLE_DATA:
+            return ready ? (uint8_t)m->input[m->input_pos++] : 0;
+        case DEVICE_CONSOLE_STATUS:
+            if (ready) return CONSOLE_INPUT_READY;
+            return m->input_open ? 0 : CONSOLE_END_OF_INPUT;
+        default:
+            return 0;
+    }
+}
+
+static void console_write(MemoryDevice *device, uint16_t address, uint8_t value) {
+    Emu6502Machine *m = (Emu6502Machine *)((char *)device - offsetof(Emu6502Machine, console));
+    if ((address & 0xFF) == DEVICE_CONSOLE_DATA && m->output) {
+        char c = (char)value;
+        m->output(m->output_ctx, &c, 1);
+    }
+}
+
+static Emu6502Machine *create(Emu6502Model model, int sparse) {
+    Emu6502Machine *m = calloc(1, sizeof(Emu6502Machine));
+    if (!m) return NULL;
+    m->basic = basic_create();
+    m->mem = memory_create(sparse);
+    if (!m->basic || !m->mem) {
+        basic_destroy(m->basic);
+        memory_free(m->mem);
+        free(m);
+        return NULL;
+    }
+    basic_set_output(m->basic, basic_output, m);
+    basic_set_input(m->basic, basic_input, m);
+    m->console.read = console_read;
+    m->console.write = console_write;
+    m->console_page = -1;
+
+    cpu_init(&m->cpu);
+    cpu_set_model(&m->cpu, model == EMU6502_MODEL_65C02 ? CPU_65C02 : CPU_6502);
+    m->cpu.halt_on_brk = 1;
+    return m;
+}
+
+Emu6502Machine *emu6502_create(Emu6502Model model) {
+    return create(model, 0);
+}
+
+Emu6502Machine *emu6502_create_sparse(Emu6502Model model) {
+    return create(model, 1);
+}
+
+void emu6502_destroy(Emu6502Machine *m) {
+    if (!m) return;
+    memory_free(m->mem);
+    basic_destroy(m->basic);
+    free(m->input);
+    free(m);
+}
+
+void emu6502_power_on(Emu6502Machine *m) {
+    CpuModel model = m->cpu.model;
+    uint8_t halt_on_brk = m->cpu.halt_on_brk;
+
+    ENTER(m);
+    memory_init();
+    if (m->console_page >= 0) memory_map((uint8_t)m->console_page, 1, &m->console);
+    LEAVE();
+    cpu_init(&m->cpu);
+    cpu_set_model(&m->cpu, model);
+    m->cpu.halt_on_brk = halt_on_brk;
+
+    basic_reset(m->basic);
+    m->input_len = 0;
+    m->input_pos = 0;
+    m->input_open = 0;
+    m->waiting = 0;
+}
+
+void emu6502_set_model(Emu6502Machine *m, Emu6502Model model) {
+    cpu_set_model(&m->cpu, model == EMU6502_MODEL_65C02 ? CPU_65C02 : CPU_6502);
+}
+
+void emu6502_reset(Emu6502Machine *m) {
+    ENTER(m);
+    cpu_reset(&m->cpu);
+    LEAVE();
+}
+
+int emu6502_write_block(Emu6502Machine *m, uint16_t address, const void *data, size_t size) {
+    if (size > (size_t)MEMORY_SIZE - address) return EMU6502_ERROR;
+    const uint8_t *bytes = data;
+    ENTER(m);
+    for (size_t i = 0; i < size; i++) {
+        memory_write((uint16_t)(address + i), bytes[i]);
+    }
+    LEAVE();
+    return 0;
+}
+
+int emu6502_read_block(Emu6502Machine *m, uint16_t address, void *data, size_t size) {
+    if (size > (size_t)MEMORY_SIZE - address) return EMU6502_ERROR;
+    ENTER(m);
+    memory_copy_out(address, data, size);
+    LEAVE();
+    return 0;
+}
+
+uint8_t emu6502_peek(Emu6502Machine *m, uint16_t address) {
+    uint8_t value;
+    ENTER(m);
+    memory_copy_out(address, &value, 1);
+    LEAVE();
+    return value;
+}
+
+void emu6502_poke(Emu6502Machine *m, uint16_t address, uint8_t value) {
+    ENTER(m);
+    memory_write(address, value);
+    LEAVE();
+}
+
+int emu6502_disassemble(Emu6502Machine *m, uint16_t address, char *buf, size_t size) {
+    uint8_t code[3];
+    ENTER(m);
+    memory_copy_out(address, code, sizeof(code));
+    LEAVE();
+    return disassemble(m->cpu.model, address, code, buf, size);
+}
+
+uint64_t emu6502_memory_hash(Emu6502Machine *m) {
+    ENTER(m);
+    uint64_t hash = memory_hash();
+    LEAVE();
+    return hash;
+}
+
+void emu6502_get_regs(Emu6502Machine *m, Emu6502Regs *regs) {
+    regs->a = m->cpu.A;
+    regs->x = m->cpu.X;
+    regs->y = m->cpu.Y;
+    regs->sp = m->cpu.SP;
+    regs->status = m->cpu.status;
+    regs->pc = m->cpu.PC;
+    regs->cycles = m->cpu.cycles;
+}
+
+void emu6502_set_regs(Emu6502Machine *m, const Emu6502Regs *regs) {
+    m->cpu.A = regs->a;
+    m->cpu.X = regs->x;
+    m->cpu.Y = regs->y;
+    m->cpu.SP = regs->sp;
+    m->cpu.status = regs->status | FLAG_U;
+    m->cpu.PC = regs->pc;
+    m->cpu.cycles = regs->cycles;
+    m->cpu.halted = 0;
+}
+
+void emu6502_set_halt_on_brk(Emu6502Machine *m, int enable) {
+    m->cpu.halt_on_brk = enable != 0;
+}
+
+uint64_t emu6502_instructions(Emu6502Machine *m) {
+    return m->cpu.instructions;
+}
+
+uint64_t emu6502_idle_cycles(Emu6502Machine *m) {
+    return m->cpu.idle_cycles;
+}
+
+int emu6502_run(Emu6502Machine *m, uint64_t max_cycles) {
+    ENTER(m);
+    cpu_execute(&m->cpu, max_cycles);
+    LEAVE();
+
+    if (m->waiting) {
+        m->waiting = 0;
+        m->cpu.halted = 0;
+        return EMU6502_WAITING;
+    }
+    if (!m->cpu.halted) return EMU6502_BUDGET;
+    return emu6502_peek(m, m->cpu.PC) == 0x00 ? EMU6502_BRK : EMU6502_HALTED;
+}
+
+void emu6502_set_output(Emu6502Machine *m, Emu6502OutputFn fn, void *ctx) {
+    m->output = fn;
+    m->output_ctx = ctx;
+}
+
+int emu6502_basic_load(Emu6502Machine *m, const char *source) {
+    if (!source) return EMU6502_ERROR;
+    basic_reset(m->basic);
+    basic_load(m->basic, source);
+    return 0;
+}
+
+int emu6502_basic_set_input(Emu6502Machine *m, const char *text, size_t len) {
+    char *copy = malloc(len ? len : 1);
+    if (!copy) return EMU6502_ERROR;
+    if (len) memcpy(copy, text, len);
+    free(m->input);
+    m->input = copy;
+    m->input_len = len;
+    m->input_cap = len;
+    m->input_pos = 0;
+    m->input_open = 0;
+    return 0;
+}
+
+int emu6502_append_input(Emu6502Machine *m, const char *text, size_t len) {
+    // Drop what has been read before growing
+    if (m->input_pos) {
+        memmove(m->input, m->input + m->input_pos, m->input_len - m->input_pos);
+        m->input_len -= m->input_pos;
+        m->input_pos = 0;
+    }
+    if (m->input_len + len > m->input_cap) {
+        size_t cap = m->input_cap ? m->input_cap : 256;
+        while (cap < m->input_len + len) cap *= 2;
+        char *input = realloc(m->input, cap);
+        if (!input) return EMU6502_ERROR;
+        m->input = input;
+        m->input_cap = cap;
+    }
+    if (len) memcpy(m->input + m->input_len, text, len);
+    m->input_len += len;
+    m->input_open = 1;
+    return 0;
+}
+
+void emu6502_end_input(Emu6502Machine *m) {
+    m->input_open = 0;
+}
+
+void emu6502_map_console(Emu6502Machine *m, int page) {
+    ENTER(m);
+    if (m->console_page >= 0) memory_map((uint8_t)m->console_page, 1, NULL);
+    m->console_page = page >= 0 && page <= 0xFF ? page : -1;
+    if (m->console_page >= 0) memory_map((uint8_t)page, 1, &m->console);
+    LEAVE();
+}
+
+void emu6502_basic_start(Emu6502Machine *m) {
+    basic_start(m->basic);
+}
+
+int emu6502_basic_run(Emu6502Machine *m, uint64_t max_lines) {
+    ENTER(m);
+    BasicStatus status = basic_continue(m->basic, max_lines);
+    LEAVE();
+    if (status == BASIC_WAITING) return EMU6502_WAITING;
+    return status == BASIC_DONE ? EMU6502_DONE : EMU6502_BUDGET;
+}
+
+uint64_t emu6502_basic_lines(Emu6502Machine *m) {
+    return basic_lines_executed(m->basic);
+}
@@ -0,0 +1,156 @@
+#ifndef EMU6502_H
+#define EMU6502_H
+
+// Embedding API for the 6502 emulator and BASIC interpreter.
+//
+// Link against lib6502emu.a or lib6502emu.so. Only this header is part of
+// the stable interface; the internal cpu.h/memory.h/basic.h may change.
+//
+// Every machine owns its CPU, address space and BASIC interpreter, and no
+// function keeps global state, so different machines may be used from
+// different threads at the same time. A single machine must not be used
+// from two threads at once.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EMU6502_VERSION_MAJOR 1
+#define EMU6502_VERSION_MINOR 5
+#define EMU6502_VERSION_PATCH 0
+#define EMU6502_VERSION \
+    ((EMU6502_VERSION_MAJOR << 16) | (EMU6502_VERSION_MINOR << 8) | EMU6502_VERSION_PATCH)
+
+// The shared library is built with hidden visibility; only these are exported
+#if defined(__GNUC__)
+#define EMU6502_API __attribute__((visibility("default")))
+#else
+#define EMU6502_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Emu6502Machine Emu6502Machine;
+
+typedef enum {
+    EMU6502_MODEL_6502,   // NMOS 6502 with undocumented opcodes
+    EMU6502_MODEL_65C02   // CMOS W65C02S
+} Emu6502Model;
+
+typedef enum {
+    EMU6502_ERROR = -1,   // Bad argument or out of memory
+    EMU6502_BUDGET = 0,   // Cycle or line budget used up; call again to continue
+    EMU6502_BRK,          // Stopped at a BRK instruction (PC points at it)
+    EMU6502_HALTED,       // JAM, STP/WAI or an illegal opcode (PC points at it)
+    EMU6502_DONE,         // BASIC program finished
+    EMU6502_WAITING       // Needs input that has not been appended yet (since 1.3)
+} Emu6502Status;
+
+typedef struct {
+    uint8_t a, x, y, sp, status;
+    uint16_t pc;
+    uint64_t cycles;
+} Emu6502Regs;
+
+// Receives program output (BASIC PRINT and error messages). text is not NUL
+// terminated. Without a callback output is discarded.
+typedef void (*Emu6502OutputFn)(void *ctx, const char *text, size_t len);
+
+// Version of the library actually linked, encoded like EMU6502_VERSION.
+// Compare the major number against EMU6502_VERSION_MAJOR at startup.
+EMU6502_API unsigned emu6502_version(void);
+
+// A machine with zeroed memory and the CPU in its power-on state.
+// Returns NULL if out of memory.
+EMU6502_API Emu6502Machine *emu6502_create(Emu6502Model model);
+
+// The same with sparse memory: pages that have never been written share one
+// page of zeros, so an idle machine holds a few KB of RAM instead of 64KB
+// and emu6502_power_on does not clear 64KB. Memory accesses are somewhat
+// slower. Suits many short-lived machines that touch few pages. (Since 1.4)
+EMU6502_API Emu6502Machine *emu6502_create_sparse(Emu6502Model model);
+EMU6502_API void emu6502_destroy(Emu6502Machine *m);
+
+// Back to the state emu6502_create left it in: zeroed memory, power-on
+// registers, no BASIC program or input. Callbacks and options are kept.
+// Lets one machine be reused for many unrelated jobs. (Since 1.1)
+EMU6502_API void emu6502_power_on(Emu6502Machine *m);
+EMU6502_API void emu6502_set_model(Emu6502Machine *m, Emu6502Model model);  // Since 1.1
+
+// Reset the CPU and load PC from the reset vector at $FFFC; memory is kept
+EMU6502_API void emu6502_reset(Emu6502Machine *m);
+
+// Copy size bytes to/from the address space. Fails with EMU6502_ERROR,
+// changing nothing, if the range runs past $FFFF.
+EMU6502_API int emu6502_write_block(Emu6502Machine *m, uint16_t address, const void *data, size_t size);
+EMU6502_API int emu6502_read_block(Emu6502Machine *m, uint16_t address, void *data, size_t size);
+EMU6502_API uint8_t emu6502_peek(Emu6502Machine *m, uint16_t address);
+EMU6502_API void emu6502_poke(Emu6502Machine *m, uint16_t address, uint8_t value);
+
+// Write the instruction at address as assembler text ("LDA ($12),Y") into
+// buf, truncated to size. Returns its length in bytes. (Since 1.2)
+EMU6502_API int emu6502_disassemble(Emu6502Machine *m, uint16_t address, char *buf, size_t size);
+
+// Hash of the whole address space, cheap enough to call after every run
+EMU6502_API uint64_t emu6502_memory_hash(Emu6502Machine *m);
+
+EMU6502_API void emu6502_get_regs(Emu6502Machine *m, Emu6502Regs *regs);
+EMU6502_API void emu6502_set_regs(Emu6502Machine *m, const Emu6502Regs *regs);
+
+// Stop at BRK instead of taking the IRQ vector (default: on)
+EMU6502_API void emu6502_set_halt_on_brk(Emu6502Machine *m, int enable);
+
+// Instructions executed since emu6502_power_on, and the cycles of idle loops
+// that emu6502_run fast-forwarded instead of stepping; both are included in
+// the cycle count of emu6502_get_regs (Since 1.5)
+EMU6502_API uint64_t emu6502_instructions(Emu6502Machine *m);
+EMU6502_API uint64_t emu6502_idle_cycles(Emu6502Machine *m);
+
+// Run machine code for at least max_cycles cycles (stopping on an
+// instruction boundary) or until BRK/halt. Returns an Emu6502Status.
+EMU6502_API int emu6502_run(Emu6502Machine *m, uint64_t max_cycles);
+
+EMU6502_API void emu6502_set_output(Emu6502Machine *m, Emu6502OutputFn fn, void *ctx);
+
+// Map a console at page (-1: none) with the registers of the 6502emu --io
+// console: writing $00 prints a character through the output callback,
+// reading it takes the next character of the input text, and $01 has bit 7
+// set while a character is waiting and bit 6 once the input has ended. A read
+// that finds no input while more may be appended stops emu6502_run with
+// EMU6502_WAITING; the program should poll $01, as a read of $00 gets 0.
+// Kept across emu6502_power_on. (Since 1.3)
+EMU6502_API void emu6502_map_console(Emu6502Machine *m, int page);
+
+// Add text to the input of the console and of BASIC INPUT, which stays open
+// for more until emu6502_end_input. While it is open, running out of input
+// returns EMU6502_WAITING instead of ending it; append more and call
+// emu6502_run or emu6502_basic_run again to continue. (Since 1.3)
+EMU6502_API int emu6502_append_input(Emu6502Machine *m, const char *text, size_t len);
+EMU6502_API void emu6502_end_input(Emu6502Machine *m);
+
+// BASIC. Loading replaces the program and clears variables; memory written
+// by POKE is the machine's address space.
+EMU6502_API int emu6502_basic_load(Emu6502Machine *m, const char *source);
+
+// Text handed to INPUT statements, one line per INPUT; the machine keeps a
+// copy. It replaces any earlier input and is complete: at its end INPUT
+// leaves its variable unchanged.
+EMU6502_API int emu6502_basic_set_input(Emu6502Machine *m, const char *text, size_t len);
+
+// Start the loaded program from its first line
+EMU6502_API void emu6502_basic_start(Emu6502Machine *m);
+
+// Execute at most max_lines program lines (0: no limit). Returns
+// EMU6502_DONE when the program ends, EMU6502_BUDGET if it is still running,
+// EMU6502_WAITING if an INPUT needs a line not yet appended.
+EMU6502_API int emu6502_basic_run(Emu6502Machine *m, uint64_t max_lines);
+
+// Program lines executed since the program was loaded (Since 1.3)
+EMU6502_API uint64_t emu6502_basic_lines(Emu6502Machine *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,7 +10,7 @@
 100 LET P = 1
 110 LET I = 2
 120 IF I * I > N THEN GOTO 200
-130 LET R = N / I
+130 LET R = INT(N / I)
 140 LET T = R * I
 150 IF T = N THEN LET P = 0
 160 IF T = N THEN GOTO 200
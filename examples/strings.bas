@@ -0,0 +1,27 @@
+10 REM STRING FUNCTIONS
+20 PRINT "STRING EXAMPLE"
+30 PRINT "=============="
+40 PRINT
+50 LET A$ = "HELLO"
+60 LET B$ = A$ + ", WORLD"
+70 PRINT B$; " HAS "; LEN(B$); " CHARACTERS"
+80 PRINT "LEFT$: "; LEFT$(B$, 5)
+90 PRINT "RIGHT$: "; RIGHT$(B$, 5)
+100 PRINT "MID$: "; MID$(B$, 8, 3)
+110 REM Build a string one character at a time
+120 LET C$ = ""
+130 FOR I = 0 TO 25
+140 LET C$ = C$ + CHR$(65 + I)
+150 NEXT I
+160 PRINT C$
+170 REM Reverse it
+180 LET R$ = ""
+190 FOR I = 1 TO LEN(C$)
+200 LET R$ = MID$(C$, I, 1) + R$
+210 NEXT I
+220 PRINT R$
+230 REM Numbers and text
+240 LET N$ = STR$(6 * 7)
+250 PRINT "STR$(6 * 7) = "; N$; ", VAL(N$) + 1 = "; VAL(N$) + 1
+260 IF A$ < "WORLD" THEN PRINT A$; " COMES BEFORE WORLD"
+270 END
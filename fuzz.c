@@ -0,0 +1,590 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "cpu.h"
+#include "memory.h"
+#include "loader.h"
+#include "symbols.h"
+
+// Coverage-guided fuzzer: runs a 6502 routine on mutated inputs placed in
+// its memory, keeps the inputs that reach new edges as the corpus to mutate
+// further, and saves those that crash or hang.
+//
+// Every run starts from one snapshot taken after loading: the CPU struct is
+// copied back, and only the RAM pages the previous run dirtied are. The CPU
+// counts edge coverage (cpu->coverage) into a small hashed map, which is
+// bucketed by hit count as AFL does and compared with everything seen so far.
+
+typedef enum {
+    RUN_OK,         // BRK (or a jump to itself) at a --done address
+    RUN_BRK,        // BRK anywhere else
+    RUN_ILLEGAL,    // Halted on a JAM, unstable or STP/WAI opcode
+    RUN_STACK,      // SP wrapped around the stack page
+    RUN_HANG        // Still running when the cycle budget ran out
+} RunResult;
+
+static const char *const result_names[] = { "ok", "brk", "illegal", "stack", "hang" };
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+} Input;
+
+// The target and its snapshot
+static Memory *mem;
+static Memory *snapshot;
+static CPU start_cpu;
+static CPU cpu;
+static CpuCoverage coverage;
+static SymbolTable *symbols;
+static uint16_t input_address;
+static size_t input_size;
+static int length_address = -1;
+static uint64_t budget = 100000;
+static uint64_t done[MEMORY_SIZE / 64];
+static int has_done;
+
+// What the runs found so far
+static uint8_t virgin[COVERAGE_SIZE];        // Hit count buckets seen, per edge
+static uint8_t virgin_hang[COVERAGE_SIZE];   // The same for runs that hung
+static uint8_t bucket[256];
+static uint64_t crashed[4][MEMORY_SIZE / 64]; // PCs already saved, per crash result
+static Input *corpus;
+static size_t corpus_count;
+static size_t corpus_cap;
+static uint64_t crashes;
+static uint64_t hangs;
+
+static volatile sig_atomic_t interrupted;
+
+static void on_interrupt(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t rng_below(uint64_t n) {
+    return rng_next() % n;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int is_set(const uint64_t *bits, uint16_t address) {
+    return bits[address >> 6] >> (address & 63) & 1;
+}
+
+// Hit counts to buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+static void init_buckets(void) {
+    for (int n = 1; n < 256; n++) {
+        bucket[n] = n < 4 ? (uint8_t)(1 << (n - 1)) : n < 8 ? 8 : n < 16 ? 16 : n < 32 ? 32 : n < 128 ? 64 : 128;
+    }
+}
+
+// Copy back the pages the last run changed
+static void restore(void) {
+    uint8_t pages[MEMORY_PAGES];
+    int count = memory_dirty_pages(pages);
+    for (int i = 0; i < count; i++) {
+        memcpy(&mem->ram[pages[i] * MEMORY_PAGE_SIZE], &snapshot->ram[pages[i] * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+        mem->page_hash[pages[i]] = snapshot->page_hash[pages[i]];
+    }
+    mem->hash = snapshot->hash;
+    memory_clear_dirty();
+}
+
+static RunResult run_input(const uint8_t *data, size_t length) {
+    restore();
+    for (size_t i = 0; i < length; i++) memory_write((uint16_t)(input_address + i), data[i]);
+    if (length_address >= 0) {
+        memory_write((uint16_t)length_address, (uint8_t)length);
+        memory_write((uint16_t)(length_address + 1), (uint8_t)(length >> 8));
+    }
+    memset(&coverage, 0, sizeof(coverage));
+    cpu = start_cpu;
+    cpu_execute(&cpu, budget);
+
+    RunResult result;
+    if (cpu.halted) {
+        uint8_t opcode = memory_read(cpu.PC);
+        if (opcode != 0x00) {
+            result = RUN_ILLEGAL;
+        } else {
+            result = !has_done || is_set(done, cpu.PC) ? RUN_OK : RUN_BRK;
+        }
+    } else {
+        // Trapped in a jump to itself at a --done address, or hung
+        result = has_done && is_set(done, cpu.PC) ? RUN_OK : RUN_HANG;
+    }
+    if (coverage.stack_wrapped) result = RUN_STACK;
+    return result;
+}
+
+// Fold the last run's coverage into seen; returns 2 for a new edge, 1 for a
+// new hit count bucket of a known one, else 0
+static int new_coverage(uint8_t *seen) {
+    int found = 0;
+    for (int i = 0; i < COVERAGE_SIZE; i += 8) {
+        uint64_t word;
+        memcpy(&word, &coverage.edges[i], sizeof(word));
+        if (!word) continue;
+        for (int j = i; j < i + 8; j++) {
+            uint8_t b = bucket[coverage.edges[j]];
+            if (b & ~seen[j]) {
+                if (!seen[j]) found = 2;
+                else if (!found) found = 1;
+                seen[j] |= b;
+            }
+        }
+    }
+    return found;
+}
+
+static int count_edges(void) {
+    int count = 0;
+    for (int i = 0; i < COVERAGE_SIZE; i++) count += virgin[i] != 0;
+    return count;
+}
+
+// Write data to dir/name; complains on stderr but carries on if it cannot
+static void save_input(const char *dir, const char *name, const uint8_t *data, size_t length) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(data, 1, length, f) != length || fclose(f) != 0) {
+        fprintf(stderr, "Error: Cannot write '%s': %s\n", path, strerror(errno));
+        if (f) fclose(f);
+    }
+}
+
+static int add_to_corpus(const uint8_t *data, size_t length) {
+    if (corpus_count == corpus_cap) {
+        size_t cap = corpus_cap ? corpus_cap * 2 : 256;
+        Input *grown = realloc(corpus, cap * sizeof(Input));
+        if (!grown) return 0;
+        corpus = grown;
+        corpus_cap = cap;
+    }
+    uint8_t *copy = malloc(length ? length : 1);
+    if (!copy) return 0;
+    memcpy(copy, data, length);
+    corpus[corpus_count].data = copy;
+    corpus[corpus_count].length = length;
+    corpus_count++;
+    return 1;
+}
+
+// Read every file in dir as a seed, cut to the input size. Returns 0 (with
+// a message) if dir cannot be read.
+static int load_seeds(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Error: Cannot read corpus directory '%s': %s\n", dir, strerror(errno));
+        return 0;
+    }
+    uint8_t *buf = malloc(input_size);
+    struct dirent *entry;
+    while (buf && (entry = readdir(d))) {
+        if (entry->d_name[0] == '.') continue;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        FILE *f = fopen(path, "rb");
+        if (!f) continue;
+        size_t length = fread(buf, 1, input_size, f);
+        fclose(f);
+        add_to_corpus(buf, length);
+    }
+    free(buf);
+    closedir(d);
+    return 1;
+}
+
+static int make_dir(const char *dir) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Cannot create directory '%s': %s\n", dir, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+// Stack 1 to 8 random changes on buf; returns the new length
+static size_t mutate(uint8_t *buf, size_t length) {
+    static const uint8_t interesting8[] = { 0x00, 0x01, 0x02, 0x0D, 0x20, 0x30, 0x39, 0x3A, 0x40, 0x41,
+                                            0x7F, 0x80, 0x81, 0xFE, 0xFF };
+    static const uint16_t interesting16[] = { 0x0000, 0x00FF, 0x0100, 0x7FFF, 0x8000, 0xFF00, 0xFFFF };
+    int changes = 1 << rng_below(4);
+    for (int n = 0; n < changes; n++) {
+        int op = (int)rng_below(9);
+        if (length == 0) op = 5;
+        size_t at = length ? rng_below(length) : 0;
+        switch (op) {
+        case 0:
+            buf[at] ^= (uint8_t)(1 << rng_below(8));
+            break;
+        case 1:
+            buf[at] = (uint8_t)rng_next();
+            break;
+        case 2:
+            buf[at] = interesting8[rng_below(sizeof(interesting8))];
+            break;
+        case 3: {
+            uint8_t delta = (uint8_t)(1 + rng_below(16));
+            buf[at] = (uint8_t)(rng_below(2) ? buf[at] + delta : buf[at] - delta);
+            break;
+        }
+        case 4:
+            if (length >= 2) {
+                uint16_t value = interesting16[rng_below(sizeof(interesting16) / sizeof(interesting16[0]))];
+                at = rng_below(length - 1);
+                buf[at] = (uint8_t)value;
+                buf[at + 1] = (uint8_t)(value >> 8);
+            }
+            break;
+        case 5:
+            if (length < input_size) {
+                at = rng_below(length + 1);
+                memmove(buf + at + 1, buf + at, length - at);
+                buf[at] = (uint8_t)rng_next();
+                length++;
+            }
+            break;
+        case 6:
+            if (length > 1) {
+                memmove(buf + at, buf + at + 1, length - at - 1);
+                length--;
+            }
+            break;
+        case 7: {
+            size_t from = rng_below(length);
+            size_t count = 1 + rng_below(length - (from > at ? from : at));
+            memmove(buf + at, buf + from, count);
+            break;
+        }
+        case 8: {
+            // Splice: the tail of another input
+            const Input *other = &corpus[rng_below(corpus_count)];
+            if (other->length > at) {
+                size_t count = other->length - at;
+                if (at + count > input_size) count = input_size - at;
+                memcpy(buf + at, other->data + at, count);
+                length = at + count;
+            }
+            break;
+        }
+        }
+    }
+    return length;
+}
+
+static void print_status(uint64_t runs, double seconds) {
+    printf("%10lu runs  %9.0f runs/s  corpus %6zu  edges %5d  crashes %lu  hangs %lu\n",
+           runs, seconds > 0 ? runs / seconds : 0.0, corpus_count, count_edges(), crashes, hangs);
+    fflush(stdout);
+}
+
+// Save the input of a run that crashed or hung, once per crashing PC or
+// per hang with new coverage
+static void record_failure(RunResult result, const uint8_t *data, size_t length, const char *out_dir) {
+    char name[64];
+    char symbol[300];
+    if (result == RUN_HANG) {
+        if (!new_coverage(virgin_hang)) return;
+        snprintf(name, sizeof(name), "hang-%06lu", hangs);
+        hangs++;
+    } else {
+        if (is_set(crashed[result - RUN_BRK], cpu.PC)) return;
+        crashed[result - RUN_BRK][cpu.PC >> 6] |= 1ULL << (cpu.PC & 63);
+        snprintf(name, sizeof(name), "%s-%04X", result_names[result], cpu.PC);
+        crashes++;
+    }
+    save_input(out_dir, name, data, length);
+    if (!symbols_format(symbols, cpu.PC, symbol, sizeof(symbol))) symbol[0] = '\0';
+    printf("%s at 0x%04X%s%s%s, %lu cycles: saved %s/%s\n", result_names[result], cpu.PC,
+           symbol[0] ? " (" : "", symbol, symbol[0] ? ")" : "", cpu.cycles - start_cpu.cycles, out_dir, name);
+}
+
+static int parse_number(const char *str, uint64_t *value) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(str, &end, 0);
+    if (errno || *end || end == str || n == 0) return 0;
+    *value = n;
+    return 1;
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s --load FILE --input ADDR --input-size N [OPTIONS]\n", program_name);
+    printf("\nRuns the loaded program from its start on mutated inputs stored at ADDR, keeps\n");
+    printf("those that reach new branches and jumps, and saves those that crash or hang.\n");
+    printf("\nOptions:\n");
+    printf("  --load FILE       Program image: raw binary, Intel HEX, PRG or manifest\n");
+    printf("  --format FORMAT   Image format instead of guessing from the extension\n");
+    printf("  --offset OFFSET   Load a raw file at OFFSET (default: 0x0000)\n");
+    printf("  --start ADDR      Start each run at ADDR instead of the image's start address\n");
+    printf("  --labels FILE     Load assembler labels; addresses may then be symbol names\n");
+    printf("  --input ADDR      Where each run's input is stored\n");
+    printf("  --input-size N    Longest input in bytes\n");
+    printf("  --length ADDR     Store each input's length (16-bit) at ADDR\n");
+    printf("  --done ADDR       A run ends normally with BRK or a jump to itself at ADDR\n");
+    printf("                    (repeatable; without it every BRK ends a run normally)\n");
+    printf("  --cycles N        Cycle budget per run; runs over it hang (default: 100000)\n");
+    printf("  --cpu MODEL       CPU model: 6502 (default) or 65c02\n");
+    printf("  --corpus DIR      Seed inputs, and where new interesting inputs are written\n");
+    printf("  --out DIR         Where crashing and hanging inputs are saved (default: fuzz-out)\n");
+    printf("  --runs N          Stop after N runs (default: until Ctrl-C)\n");
+    printf("  --seconds N       Stop after N seconds\n");
+    printf("  --seed N          PRNG seed (default: time based)\n");
+    printf("  --help            Display this help message\n");
+    printf("\nCrashes: BRK at an address other than --done, an illegal opcode halt and the\n");
+    printf("stack pointer wrapping around. Saved inputs are named after the result and PC.\n");
+    printf("\nExample:\n");
+    printf("  %s --load parser.bin --offset 0x0800 --input 0x0300 --input-size 64 \\\n", program_name);
+    printf("      --length 0x00F0 --done 0x0810 --corpus seeds\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *load_file = NULL;
+    ImageFormat format = IMAGE_AUTO;
+    uint16_t offset = 0;
+    const char *start_arg = NULL;
+    const char *input_arg = NULL;
+    const char *length_arg = NULL;
+    const char *done_args[16];
+    int done_count = 0;
+    const char *label_files[16];
+    int label_count = 0;
+    CpuModel model = CPU_6502;
+    const char *corpus_dir = NULL;
+    const char *out_dir = "fuzz-out";
+    uint64_t max_runs = 0;
+    uint64_t max_seconds = 0;
+    uint64_t seed = (uint64_t)time(NULL);
+    uint64_t value;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (i + 1 >= argc) {
+            fprintf(stderr, "Error: %s requires an argument\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else if (strcmp(argv[i], "--load") == 0) {
+            load_file = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0) {
+            if (!image_parse_format(argv[++i], &format)) {
+                fprintf(stderr, "Error: Invalid image format '%s' (must be raw, hex, prg or manifest)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--offset") == 0) {
+            if (!symbols_resolve(NULL, argv[++i], &offset)) {
+                fprintf(stderr, "Error: Invalid offset '%s' (must be 0x0000-0xFFFF)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--start") == 0) {
+            start_arg = argv[++i];
+        } else if (strcmp(argv[i], "--labels") == 0) {
+            if (label_count == (int)(sizeof(label_files) / sizeof(label_files[0]))) {
+                fprintf(stderr, "Error: Too many --labels files\n");
+                return 1;
+            }
+            label_files[label_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0) {
+            input_arg = argv[++i];
+        } else if (strcmp(argv[i], "--input-size") == 0) {
+            if (!parse_number(argv[++i], &value) || value > MEMORY_SIZE) {
+                fprintf(stderr, "Error: Invalid input size '%s'\n", argv[i]);
+                return 1;
+            }
+            input_size = (size_t)value;
+        } else if (strcmp(argv[i], "--length") == 0) {
+            length_arg = argv[++i];
+        } else if (strcmp(argv[i], "--done") == 0) {
+            if (done_count == (int)(sizeof(done_args) / sizeof(done_args[0]))) {
+                fprintf(stderr, "Error: Too many --done addresses\n");
+                return 1;
+            }
+            done_args[done_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--cycles") == 0) {
+            if (!parse_number(argv[++i], &budget)) {
+                fprintf(stderr, "Error: Invalid cycle count '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            i++;
+            if (strcmp(argv[i], "6502") == 0) {
+                model = CPU_6502;
+            } else if (strcmp(argv[i], "65c02") == 0 || strcmp(argv[i], "65C02") == 0) {
+                model = CPU_65C02;
+            } else {
+                fprintf(stderr, "Error: Invalid CPU model '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--corpus") == 0) {
+            corpus_dir = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0) {
+            out_dir = argv[++i];
+        } else if (strcmp(argv[i], "--runs") == 0) {
+            if (!parse_number(argv[++i], &max_runs)) {
+                fprintf(stderr, "Error: Invalid run count '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--seconds") == 0) {
+            if (!parse_number(argv[++i], &max_seconds)) {
+                fprintf(stderr, "Error: Invalid number of seconds '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!load_file || !input_arg || !input_size) {
+        fprintf(stderr, "Error: --load, --input and --input-size are required\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Labels first, so that addresses can be given by name
+    if (label_count) {
+        if (!(symbols = symbols_create())) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        for (int i = 0; i < label_count; i++) {
+            if (!symbols_load(symbols, label_files[i])) return 1;
+        }
+    }
+    if (!symbols_resolve(symbols, input_arg, &input_address) || input_address + input_size > MEMORY_SIZE) {
+        fprintf(stderr, "Error: Invalid input address '%s' (the input must fit below 0x10000)\n", input_arg);
+        return 1;
+    }
+    if (length_arg) {
+        uint16_t address;
+        if (!symbols_resolve(symbols, length_arg, &address) || address == 0xFFFF) {
+            fprintf(stderr, "Error: Invalid length address '%s'\n", length_arg);
+            return 1;
+        }
+        length_address = address;
+    }
+    for (int i = 0; i < done_count; i++) {
+        uint16_t address;
+        if (!symbols_resolve(symbols, done_args[i], &address)) {
+            fprintf(stderr, "Error: Invalid done address '%s' (must be 0x0000-0xFFFF or a label)\n", done_args[i]);
+            return 1;
+        }
+        done[address >> 6] |= 1ULL << (address & 63);
+        has_done = 1;
+    }
+
+    // Load once and snapshot
+    memory_init();
+    uint16_t entry;
+    if (!image_load(load_file, format, offset, &entry)) return 1;
+    uint16_t start = entry;
+    if (start_arg && !symbols_resolve(symbols, start_arg, &start)) {
+        fprintf(stderr, "Error: Invalid start address '%s' (must be 0x0000-0xFFFF or a label)\n", start_arg);
+        return 1;
+    }
+    memory_rehash();
+    memory_clear_dirty();
+    mem = memory_bind(NULL);
+    memory_bind(mem);
+    if (!(snapshot = malloc(sizeof(Memory)))) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    memcpy(snapshot, mem, sizeof(Memory));
+
+    cpu_init(&start_cpu);
+    cpu_set_model(&start_cpu, model);
+    start_cpu.PC = start;
+    start_cpu.halt_on_brk = 1;
+    start_cpu.coverage = &coverage;
+
+    if (corpus_dir && !make_dir(corpus_dir)) return 1;
+    if (!make_dir(out_dir)) return 1;
+    if (corpus_dir && !load_seeds(corpus_dir)) return 1;
+    if (corpus_count == 0) {
+        uint8_t zero = 0;
+        add_to_corpus(&zero, 1);
+    }
+    uint8_t *buf = malloc(input_size);
+    if (!buf || !corpus) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+
+    init_buckets();
+    rng_state = seed ? seed : 1;
+    printf("Fuzzing %s from 0x%04X, %zu-byte inputs at 0x%04X, seed %lu\n", load_file, start, input_size,
+           input_address, seed);
+
+    // The seeds first, then mutations of the corpus
+    size_t seeds = corpus_count;
+    for (size_t i = 0; i < seeds; i++) {
+        RunResult result = run_input(corpus[i].data, corpus[i].length);
+        new_coverage(virgin);
+        if (result != RUN_OK) record_failure(result, corpus[i].data, corpus[i].length, out_dir);
+    }
+    printf("%zu seeds, %d edges\n", seeds, count_edges());
+
+    signal(SIGINT, on_interrupt);
+    double started = now_seconds();
+    double next_status = started + 1;
+    uint64_t runs = 0;
+    while (!interrupted && (!max_runs || runs < max_runs)) {
+        const Input *parent = &corpus[rng_below(corpus_count)];
+        memcpy(buf, parent->data, parent->length);
+        size_t length = mutate(buf, parent->length);
+        RunResult result = run_input(buf, length);
+        runs++;
+        if (result == RUN_HANG) {
+            record_failure(result, buf, length, out_dir);
+        } else if (new_coverage(virgin)) {
+            if (result != RUN_OK) record_failure(result, buf, length, out_dir);
+            // Crashes are kept too: what follows them can still be explored
+            add_to_corpus(buf, length);
+            if (corpus_dir) {
+                char name[32];
+                snprintf(name, sizeof(name), "id-%06zu", corpus_count);
+                save_input(corpus_dir, name, buf, length);
+            }
+        } else if (result != RUN_OK) {
+            record_failure(result, buf, length, out_dir);
+        }
+
+        if ((runs & 1023) == 0) {
+            double now = now_seconds();
+            if (now >= next_status) {
+                print_status(runs, now - started);
+                next_status = now + 1;
+            }
+            if (max_seconds && now - started >= max_seconds) break;
+        }
+    }
+    print_status(runs, now_seconds() - started);
+    free(buf);
+    return crashes || hangs ? 2 : 0;
+}
@@ -0,0 +1,93 @@
+#include "hash.h"
+#include <string.h>
+
+#define C1 0x87C37B91114253D5ULL
+#define C2 0x4CF5AD432745937FULL
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCDULL;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v)); // Little-endian hosts only, like the rest of the emulator
+    return v;
+}
+
+static void block(Hasher *h, const uint8_t *p) {
+    uint64_t k1 = load64(p);
+    uint64_t k2 = load64(p + 8);
+
+    k1 *= C1; k1 = rotl(k1, 31); k1 *= C2; h->h1 ^= k1;
+    h->h1 = rotl(h->h1, 27); h->h1 += h->h2; h->h1 = h->h1 * 5 + 0x52DCE729;
+    k2 *= C2; k2 = rotl(k2, 33); k2 *= C1; h->h2 ^= k2;
+    h->h2 = rotl(h->h2, 31); h->h2 += h->h1; h->h2 = h->h2 * 5 + 0x38495AB5;
+}
+
+void hash_init(Hasher *h, uint64_t seed) {
+    h->h1 = seed;
+    h->h2 = seed;
+    h->tail_len = 0;
+    h->total = 0;
+}
+
+void hash_update(Hasher *h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    h->total += len;
+
+    if (h->tail_len) {
+        size_t n = 16 - h->tail_len;
+        if (n > len) n = len;
+        memcpy(h->tail + h->tail_len, p, n);
+        h->tail_len += n;
+        p += n;
+        len -= n;
+        if (h->tail_len < 16) return;
+        block(h, h->tail);
+        h->tail_len = 0;
+    }
+    for (; len >= 16; p += 16, len -= 16) {
+        block(h, p);
+    }
+    memcpy(h->tail, p, len);
+    h->tail_len = len;
+}
+
+void hash_u64(Hasher *h, uint64_t value) {
+    hash_update(h, &value, sizeof(value));
+}
+
+Hash128 hash_final(Hasher *h) {
+    uint64_t k1 = 0, k2 = 0;
+    const uint8_t *t = h->tail;
+
+    for (int i = (int)h->tail_len - 1; i >= 8; i--) k2 = (k2 << 8) | t[i];
+    for (int i = (h->tail_len < 8 ? (int)h->tail_len : 8) - 1; i >= 0; i--) k1 = (k1 << 8) | t[i];
+    if (h->tail_len > 8) {
+        k2 *= C2; k2 = rotl(k2, 33); k2 *= C1; h->h2 ^= k2;
+    }
+    if (h->tail_len) {
+        k1 *= C1; k1 = rotl(k1, 31); k1 *= C2; h->h1 ^= k1;
+    }
+
+    uint64_t h1 = h->h1 ^ h->total;
+    uint64_t h2 = h->h2 ^ h->total;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+
+    Hash128 result = { h1, h2 };
+    return result;
+}
@@ -0,0 +1,29 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 128-bit MurmurHash3 (x64 variant), fed incrementally. Not cryptographic:
+// good for content-addressed keys, not against deliberate collisions.
+
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} Hash128;
+
+typedef struct {
+    uint64_t h1, h2;
+    uint8_t tail[16];   // Bytes not yet forming a full block
+    size_t tail_len;
+    uint64_t total;
+} Hasher;
+
+void hash_init(Hasher *h, uint64_t seed);
+void hash_update(Hasher *h, const void *data, size_t len);
+Hash128 hash_final(Hasher *h);
+
+// Convenience for fixed-size integers, so keys do not depend on struct padding
+void hash_u64(Hasher *h, uint64_t value);
+
+#endif
@@ -0,0 +1,223 @@
+#include "history.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Most changes to RAM one instruction makes (BRK pushes three bytes)
+#define MAX_WRITES 3
+
+typedef struct {
+    CPU cpu;
+    size_t log_index;       // Length of the log when it was taken
+} Checkpoint;
+
+struct History {
+    CPU *cpu;
+    uint64_t interval;
+    MemoryUndoLog log;      // Allocated once at its full size
+    Checkpoint *checkpoint; // Oldest first; there is always at least one
+    size_t count;
+    size_t cap;
+    int replaying;          // Going over recorded instructions again: no trimming
+    uint64_t due;           // Position of the next checkpoint or check for room
+};
+
+static void add_checkpoint(History *h) {
+    Checkpoint *c = &h->checkpoint[h->count++];
+    c->cpu = *h->cpu;
+    c->log_index = h->log.count;
+}
+
+// Forget everything before the current state
+static void restart(History *h) {
+    h->log.count = 0;
+    h->log.overflow = 0;
+    h->count = 0;
+    h->due = 0;
+    add_checkpoint(h);
+}
+
+// Drop the oldest checkpoints, and the log entries only they needed, until
+// the log and the checkpoints are at most 3/4 full
+static void trim(History *h) {
+    size_t log_goal = h->log.cap / 4 * 3;
+    size_t count_goal = h->cap / 4 * 3;
+    size_t k = 0;
+    while (k + 1 < h->count &&
+           (h->log.count - h->checkpoint[k].log_index > log_goal || h->count - k > count_goal)) {
+        k++;
+    }
+    if (h->log.count - h->checkpoint[k].log_index > log_goal) {
+        // Even the latest checkpoint needs too much of the log
+        restart(h);
+        return;
+    }
+    size_t base = h->checkpoint[k].log_index;
+    memmove(h->log.entries, h->log.entries + base, (h->log.count - base) * sizeof(uint32_t));
+    h->log.count -= base;
+    memmove(h->checkpoint, h->checkpoint + k, (h->count - k) * sizeof(Checkpoint));
+    h->count -= k;
+    for (size_t i = 0; i < h->count; i++) h->checkpoint[i].log_index -= base;
+}
+
+History *history_create(CPU *cpu, uint64_t interval, size_t max_bytes) {
+    History *h = calloc(1, sizeof(History));
+    if (!h) return NULL;
+    h->cpu = cpu;
+    h->interval = interval ? interval : 1;
+    // An eighth for checkpoints, the rest for the log
+    h->cap = max_bytes / 8 / sizeof(Checkpoint);
+    if (h->cap < 4) h->cap = 4;
+    h->log.cap = (max_bytes - max_bytes / 8) / sizeof(uint32_t);
+    if (h->log.cap < 16 * MAX_WRITES) h->log.cap = 16 * MAX_WRITES;
+    h->checkpoint = malloc(h->cap * sizeof(Checkpoint));
+    h->log.entries = malloc(h->log.cap * sizeof(uint32_t));
+    if (!h->checkpoint || !h->log.entries) {
+        free(h->checkpoint);
+        free(h->log.entries);
+        free(h);
+        return NULL;
+    }
+    restart(h);
+    memory_set_undo_log(&h->log);
+    return h;
+}
+
+void history_free(History *h) {
+    if (!h) return;
+    memory_set_undo_log(NULL);
+    free(h->log.entries);
+    free(h->checkpoint);
+    free(h);
+}
+
+// Trim and take a checkpoint as needed, and work out when to look again:
+// at the next checkpoint, or when the log may be about to fill up. Kept out
+// of history_run's loop over the instructions.
+static void __attribute__((noinline, cold)) maintain(History *h) {
+    CPU *cpu = h->cpu;
+    if (h->log.overflow) restart(h);
+    if (!h->replaying && (h->log.count + MAX_WRITES > h->log.cap || h->count == h->cap)) trim(h);
+    uint64_t next = h->checkpoint[h->count - 1].cpu.instructions + h->interval;
+    if (cpu->instructions >= next && h->count < h->cap) {
+        add_checkpoint(h);
+        next = cpu->instructions + h->interval;
+    }
+    uint64_t room = h->log.count < h->log.cap ? (h->log.cap - h->log.count) / MAX_WRITES : 0;
+    h->due = cpu->instructions + room < next ? cpu->instructions + room : next;
+    // Replaying may find no room, as it never trims: check every instruction
+    if (h->due <= cpu->instructions) h->due = cpu->instructions + 1;
+}
+
+static int is_set(const uint64_t *bits, uint16_t address) {
+    return bits[address >> 6] >> (address & 63) & 1;
+}
+
+// The first change to a watched byte in the log from entry first on
+static int find_change(const History *h, const uint64_t *watches, size_t first, uint32_t *change) {
+    for (size_t i = first; i < h->log.count; i++) {
+        if (is_set(watches, (uint16_t)(h->log.entries[i] >> 8))) {
+            *change = h->log.entries[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+HistoryEvent history_run(History *h, uint64_t count, const HistoryStops *stops, uint32_t *change) {
+    CPU *cpu = h->cpu;
+    const uint64_t *breakpoints = stops ? stops->breakpoints : NULL;
+    const uint64_t *watches = stops ? stops->watches : NULL;
+    uint64_t target = count > UINT64_MAX - cpu->instructions ? UINT64_MAX : cpu->instructions + count;
+    while (cpu->instructions < target && !cpu->halted) {
+        if (cpu->instructions >= h->due) maintain(h);
+        uint64_t end = h->due < target ? h->due : target;
+        while (cpu->instructions < end && !cpu->halted) {
+            if (breakpoints && is_set(breakpoints, cpu->PC)) return HISTORY_BREAKPOINT;
+            size_t before = h->log.count;
+            cpu_step(cpu);
+            int watched = watches && h->log.count != before && find_change(h, watches, before, change);
+            // An instruction that changed more bytes than the log had room
+            // for (a DMA copy) cannot be undone: the history starts after it
+            if (h->log.overflow && !h->replaying) {
+                restart(h);
+                if (watched) return HISTORY_WATCH;
+                break;
+            }
+            if (watched) return HISTORY_WATCH;
+        }
+    }
+    return cpu->halted ? HISTORY_HALTED : HISTORY_COUNT;
+}
+
+uint64_t history_start(const History *h) {
+    return h->checkpoint[0].cpu.instructions;
+}
+
+size_t history_bytes(const History *h) {
+    return h->log.count * sizeof(uint32_t) + h->count * sizeof(Checkpoint);
+}
+
+// Return to checkpoint k, dropping the later ones
+static void restore(History *h, size_t k) {
+    memory_undo(&h->log, h->checkpoint[k].log_index);
+    *h->cpu = h->checkpoint[k].cpu;
+    h->count = k + 1;
+    h->due = 0;
+}
+
+// Run on to position; everything up to it was recorded before
+static void replay(History *h, uint64_t position) {
+    h->replaying = 1;
+    if (position > h->cpu->instructions) history_run(h, position - h->cpu->instructions, NULL, NULL);
+    h->replaying = 0;
+}
+
+void history_seek(History *h, uint64_t position) {
+    if (position >= h->cpu->instructions) return;
+    size_t k = h->count - 1;
+    while (k > 0 && h->checkpoint[k].cpu.instructions > position) k--;
+    restore(h, k);
+    replay(h, position);
+}
+
+HistoryEvent history_reverse_continue(History *h, const HistoryStops *stops, uint32_t *change) {
+    // Replay the stretches between checkpoints, latest first, until one has
+    // a position to stop at; go to the last such
+    CPU *cpu = h->cpu;
+    HistoryStops past_breakpoint = { NULL, stops->watches };
+    uint64_t end = cpu->instructions;
+    for (size_t k = h->count; k-- > 0; ) {
+        uint64_t from = h->checkpoint[k].cpu.instructions;
+        if (from >= end) continue;
+        restore(h, k);
+        HistoryEvent found = HISTORY_START;
+        uint64_t position = 0;
+        uint32_t found_change = 0;
+        h->replaying = 1;
+        while (cpu->instructions < end) {
+            uint32_t c;
+            HistoryEvent event = history_run(h, end - cpu->instructions, stops, &c);
+            if (event == HISTORY_BREAKPOINT) {
+                found = event;
+                position = cpu->instructions;
+                // On past it, still watching
+                event = history_run(h, 1, &past_breakpoint, &c);
+                if (event == HISTORY_COUNT) continue;
+            }
+            if (event != HISTORY_WATCH) break;
+            found = event;
+            position = cpu->instructions - 1;
+            found_change = c;
+        }
+        h->replaying = 0;
+        if (found != HISTORY_START) {
+            history_seek(h, position);
+            *change = found_change;
+            return found;
+        }
+        end = from;
+    }
+    restore(h, 0);
+    return HISTORY_START;
+}
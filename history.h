@@ -0,0 +1,65 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+// Execution history of a CPU and the bound address space, for running
+// backwards. Every change to RAM is logged with the value it overwrote
+// (memory_set_undo_log), and every interval instructions a checkpoint saves
+// the CPU and the length of the log. Going back to an earlier instruction
+// undoes the log down to the nearest checkpoint before it, restores the CPU
+// and replays forward from there.
+//
+// The log and the checkpoints stay within the size given: when they fill up,
+// the oldest checkpoints are dropped with the part of the log only they
+// needed, and the history starts later. An instruction that changes more
+// bytes than the whole log holds (a block device transfer) starts it after
+// that instruction.
+//
+// Positions are counts of instructions executed (cpu->instructions). Only
+// the CPU and RAM are recorded, so replaying is exact only for programs that
+// use no devices.
+
+typedef struct History History;
+
+// Addresses to stop at, as bitmaps: bit address & 63 of word address >> 6.
+// Either may be NULL.
+typedef struct {
+    const uint64_t *breakpoints;    // Before running the instruction there
+    const uint64_t *watches;        // At a change to the byte there
+} HistoryStops;
+
+typedef enum {
+    HISTORY_COUNT,          // Ran as many instructions as asked
+    HISTORY_HALTED,         // The CPU is halted
+    HISTORY_BREAKPOINT,
+    HISTORY_WATCH,          // Forwards just after the change, backwards just before
+    HISTORY_START           // Went back as far as the history goes
+} HistoryEvent;
+
+// Start recording cpu, which must stay bound to the active address space,
+// from its current state. Returns NULL when out of memory.
+History *history_create(CPU *cpu, uint64_t interval, size_t max_bytes);
+void history_free(History *h);
+
+// Run up to count instructions, recorded. Stops before an instruction at a
+// breakpoint, even the first, and after one that changes a watched byte;
+// *change is then that change, as address << 8 | old value.
+HistoryEvent history_run(History *h, uint64_t count, const HistoryStops *stops, uint32_t *change);
+
+// Earliest position still recorded
+uint64_t history_start(const History *h);
+
+// Bytes of log and checkpoints in use
+size_t history_bytes(const History *h);
+
+// Go back to position, or to the start of the history if it is older
+void history_seek(History *h, uint64_t position);
+
+// Go back to the latest position before the current one at a breakpoint or
+// just before a change to a watched byte (*change), or else to the start
+HistoryEvent history_reverse_continue(History *h, const HistoryStops *stops, uint32_t *change);
+
+#endif
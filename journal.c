@@ -0,0 +1,180 @@
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define JOURNAL_HEADER "# 6502emu input journal v1"
+#define JOURNAL_KIND_LEN 16
+
+typedef struct {
+    char kind[JOURNAL_KIND_LEN];
+    uint64_t stamp;
+    const char *text;  // Points into Journal.data
+} JournalEntry;
+
+struct Journal {
+    JournalMode mode;
+    FILE *file;             // Record mode
+    char *data;             // Replay mode: the whole file, split into lines in place
+    JournalEntry *entries;
+    int count;
+    int next;
+    int diverged;
+};
+
+static int parse_entries(Journal *journal, const char *path) {
+    int capacity = 0;
+    int line_num = 0;
+    char *p = journal->data;
+    
+    while (*p) {
+        char *line = p;
+        char *end = strchr(p, '\n');
+        if (end) {
+            *end = 0;
+            p = end + 1;
+        } else {
+            p += strlen(p);
+        }
+        line_num++;
+        
+        size_t len = strlen(line);
+        if (len && line[len - 1] == '\r') line[len - 1] = 0;
+        if (line[0] == '#' || line[0] == 0) continue;
+        
+        if (journal->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            JournalEntry *grown = realloc(journal->entries, capacity * sizeof(JournalEntry));
+            if (!grown) {
+                fprintf(stderr, "Error: Out of memory reading journal '%s'\n", path);
+                return 0;
+            }
+            journal->entries = grown;
+        }
+        
+        JournalEntry *entry = &journal->entries[journal->count];
+        int text_offset = 0;
+        unsigned long long stamp;
+        if (sscanf(line, "%15s %llu%n", entry->kind, &stamp, &text_offset) < 2) {
+            fprintf(stderr, "Error: Malformed entry at %s:%d\n", path, line_num);
+            return 0;
+        }
+        entry->stamp = stamp;
+        // The text starts after exactly one separating space
+        if (line[text_offset] == ' ') text_offset++;
+        entry->text = line + text_offset;
+        journal->count++;
+    }
+    return 1;
+}
+
+Journal *journal_open(const char *path, JournalMode mode) {
+    Journal *journal = calloc(1, sizeof(Journal));
+    if (!journal) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    journal->mode = mode;
+    
+    if (mode == JOURNAL_RECORD) {
+        journal->file = fopen(path, "w");
+        if (!journal->file) {
+            fprintf(stderr, "Error: Cannot create journal '%s': %s\n", path, strerror(errno));
+            free(journal);
+            return NULL;
+        }
+        fprintf(journal->file, "%s\n", JOURNAL_HEADER);
+        return journal;
+    }
+    
+    if (mode == JOURNAL_REPLAY) {
+        FILE *f = fopen(path, "rb");
+        if (!f) {
+            fprintf(stderr, "Error: Cannot open journal '%s': %s\n", path, strerror(errno));
+            free(journal);
+            return NULL;
+        }
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        journal->data = malloc(size + 1);
+        if (!journal->data || fread(journal->data, 1, size, f) != (size_t)size) {
+            fprintf(stderr, "Error: Cannot read journal '%s'\n", path);
+            fclose(f);
+            journal_close(journal);
+            return NULL;
+        }
+        journal->data[size] = 0;
+        fclose(f);
+        
+        if (!parse_entries(journal, path)) {
+            journal_close(journal);
+            return NULL;
+        }
+    }
+    return journal;
+}
+
+void journal_close(Journal *journal) {
+    if (!journal) return;
+    if (journal->file) fclose(journal->file);
+    free(journal->entries);
+    free(journal->data);
+    free(journal);
+}
+
+// The next replayed entry, or NULL at the end of the journal
+static const JournalEntry *replay_entry(Journal *journal, const char *kind, uint64_t stamp) {
+    if (journal->next >= journal->count) return NULL;
+    
+    JournalEntry *entry = &journal->entries[journal->next++];
+    if (!journal->diverged && (strcmp(entry->kind, kind) != 0 || entry->stamp != stamp)) {
+        fprintf(stderr, "Warning: Replay diverged at entry %d: journal has %s %llu, program asked for %s %llu\n",
+                journal->next, entry->kind, (unsigned long long)entry->stamp,
+                kind, (unsigned long long)stamp);
+        journal->diverged = 1;
+    }
+    return entry;
+}
+
+int journal_read_line(Journal *journal, const char *kind, uint64_t stamp, char *buf, int size) {
+    if (journal && journal->mode == JOURNAL_REPLAY) {
+        const JournalEntry *entry = replay_entry(journal, kind, stamp);
+        if (!entry) return 0;
+        snprintf(buf, size, "%s", entry->text);
+        return 1;
+    }
+    
+    if (!fgets(buf, size, stdin)) return 0;
+    buf[strcspn(buf, "\r\n")] = 0;
+    
+    if (journal && journal->mode == JOURNAL_RECORD) {
+        fprintf(journal->file, "%s %llu %s\n", kind, (unsigned long long)stamp, buf);
+        fflush(journal->file);
+    }
+    return 1;
+}
+
+int journal_read_byte(Journal *journal, const char *kind, uint64_t stamp) {
+    if (journal && journal->mode == JOURNAL_REPLAY) {
+        const JournalEntry *entry = replay_entry(journal, kind, stamp);
+        return entry ? (uint8_t)strtoul(entry->text, NULL, 10) : EOF;
+    }
+    
+    int c = getchar();
+    if (c != EOF && journal && journal->mode == JOURNAL_RECORD) {
+        fprintf(journal->file, "%s %llu %d\n", kind, (unsigned long long)stamp, c);
+        fflush(journal->file);
+    }
+    return c;
+}
+
+int journal_has_input(Journal *journal) {
+    if (journal && journal->mode == JOURNAL_REPLAY) return journal->next < journal->count;
+    
+    int c = getchar();
+    if (c == EOF) return 0;
+    ungetc(c, stdin);
+    return 1;
+}
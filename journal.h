@@ -0,0 +1,42 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+// Input journal: records every line of input a program consumes, stamped
+// with where it was consumed (BASIC line number, emulated cycle, ...), and
+// feeds the same lines back later without touching stdin.
+//
+// File format, one entry per line:
+//   # 6502emu input journal v1
+//   <KIND> <stamp> <text>
+// e.g. "INPUT 90 42". Lines starting with '#' are comments. Bytes read by
+// character devices are entries of their own, the text being the byte's
+// value in decimal ("CONSOLE 1234 65").
+
+typedef enum {
+    JOURNAL_OFF,     // Read stdin, record nothing
+    JOURNAL_RECORD,  // Read stdin and append every line to the journal file
+    JOURNAL_REPLAY   // Read lines from the journal file only
+} JournalMode;
+
+typedef struct Journal Journal;
+
+// Returns NULL (with a message on stderr) if the file cannot be opened or parsed
+Journal *journal_open(const char *path, JournalMode mode);
+void journal_close(Journal *journal);
+
+// Read one line of input (without the trailing newline) into buf. kind and
+// stamp identify the consumer; on replay a mismatch means the program took a
+// different path than when it was recorded and is reported once on stderr.
+// journal may be NULL, meaning JOURNAL_OFF. Returns 0 at end of input.
+int journal_read_line(Journal *journal, const char *kind, uint64_t stamp, char *buf, int size);
+
+// Read one byte of input the same way; EOF at end of input
+int journal_read_byte(Journal *journal, const char *kind, uint64_t stamp);
+
+// Nonzero if the next read will not hit the end of input, waiting for a
+// byte when reading stdin. Consumes nothing.
+int journal_has_input(Journal *journal);
+
+#endif
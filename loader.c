@@ -0,0 +1,337 @@
+#define _POSIX_C_SOURCE 200809L
+#include "loader.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+// The bytes of one file, gathered before they go into memory
+typedef struct {
+    uint8_t data[MEMORY_SIZE];
+    uint64_t present[MEMORY_SIZE / 64];
+    int lowest;             // Lowest address present, -1 if none
+} Image;
+
+static int is_present(const Image *image, int address) {
+    return image->present[address >> 6] >> (address & 63) & 1;
+}
+
+// The caller has checked that the bytes fit below 64KB
+static void image_put(Image *image, uint16_t address, const uint8_t *bytes, size_t length) {
+    memcpy(image->data + address, bytes, length);
+    for (size_t i = address; i < address + length; i++) {
+        image->present[i >> 6] |= 1ULL << (i & 63);
+    }
+    if (length > 0 && (image->lowest < 0 || address < image->lowest)) image->lowest = address;
+}
+
+// Copy each contiguous run of the image into memory with one bulk copy
+static void image_commit(const Image *image, const char *path) {
+    int address = 0;
+    while (address < MEMORY_SIZE) {
+        if (!is_present(image, address)) {
+            address++;
+            continue;
+        }
+        int end = address;
+        while (end < MEMORY_SIZE && is_present(image, end)) end++;
+        memory_copy_in((uint16_t)address, image->data + address, (size_t)(end - address));
+        printf("Loaded %d bytes from '%s' at address 0x%04X\n", end - address, path, address);
+        address = end;
+    }
+}
+
+static uint8_t *read_file(const char *path, long *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open file '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (*size < 0) {
+        fprintf(stderr, "Error: Cannot determine file size for '%s'\n", path);
+        fclose(f);
+        return NULL;
+    }
+    if (*size == 0) {
+        fprintf(stderr, "Error: File '%s' is empty\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    uint8_t *data = malloc((size_t)*size + 1);
+    if (!data) {
+        fprintf(stderr, "Error: Out of memory\n");
+        fclose(f);
+        return NULL;
+    }
+    if (fread(data, 1, (size_t)*size, f) != (size_t)*size) {
+        fprintf(stderr, "Error: Unexpected end of file while reading '%s'\n", path);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    data[*size] = '\0';     // Lets the text formats be parsed as a string
+    fclose(f);
+    return data;
+}
+
+static int parse_address(const char *str, uint16_t *address) {
+    char *end;
+    errno = 0;
+    long value = strtol(str, &end, 0);
+    if (errno || *end || end == str || value < 0 || value > 0xFFFF) return 0;
+    *address = (uint16_t)value;
+    return 1;
+}
+
+static int load_raw(Image *image, const uint8_t *data, long size, uint16_t offset, uint16_t *entry) {
+    if ((uint32_t)offset + (uint32_t)size > MEMORY_SIZE) {
+        fprintf(stderr, "Error: File size (%ld bytes) at offset 0x%04X exceeds memory bounds\n",
+                size, offset);
+        return 0;
+    }
+    image_put(image, offset, data, (size_t)size);
+    *entry = offset;
+    return 1;
+}
+
+static int load_prg(Image *image, const char *path, const uint8_t *data, long size, uint16_t *entry) {
+    if (size <= 2) {
+        fprintf(stderr, "Error: PRG file '%s' holds no data after its load address\n", path);
+        return 0;
+    }
+    uint16_t address = data[0] | data[1] << 8;
+    if ((uint32_t)address + (uint32_t)(size - 2) > MEMORY_SIZE) {
+        fprintf(stderr, "Error: PRG file '%s' (%ld bytes at 0x%04X) exceeds memory bounds\n",
+                path, size - 2, address);
+        return 0;
+    }
+    image_put(image, address, data + 2, (size_t)(size - 2));
+    *entry = address;
+    return 1;
+}
+
+static int hex_byte(const char *s) {
+    int value = 0;
+    for (int i = 0; i < 2; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (!isxdigit(c)) return -1;
+        value = value << 4 | (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+    }
+    return value;
+}
+
+static int load_hex(Image *image, const char *path, char *text, uint16_t *entry) {
+    uint32_t base = 0;          // From extended segment/linear address records
+    long start = -1;            // From start address records
+    int line_number = 0;
+    char *saved;
+
+    for (char *line = strtok_r(text, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+        line_number++;
+        while (isspace((unsigned char)*line)) line++;
+        size_t length = strlen(line);
+        while (length > 0 && isspace((unsigned char)line[length - 1])) line[--length] = '\0';
+        if (!*line) continue;
+
+        // :LLAAAATT, LL data bytes, checksum
+        uint8_t record[5 + 255];
+        int ok = line[0] == ':' && length >= 11 && (length - 1) % 2 == 0;
+        size_t count = ok ? (length - 1) / 2 : 0;
+        for (size_t i = 0; ok && i < count; i++) {
+            int byte = hex_byte(line + 1 + 2 * i);
+            ok = byte >= 0 && i < sizeof(record);
+            if (ok) record[i] = (uint8_t)byte;
+        }
+        if (!ok || count != 5u + record[0]) {
+            fprintf(stderr, "Error: %s:%d: Malformed Intel HEX record\n", path, line_number);
+            return 0;
+        }
+        uint8_t sum = 0;
+        for (size_t i = 0; i < count; i++) sum += record[i];
+        if (sum != 0) {
+            fprintf(stderr, "Error: %s:%d: Checksum mismatch\n", path, line_number);
+            return 0;
+        }
+
+        uint8_t data_length = record[0];
+        uint16_t offset = record[1] << 8 | record[2];
+        const uint8_t *data = record + 4;
+        switch (record[3]) {
+            case 0x00: {    // Data
+                // In 64 bits: a linear base near 4GB would wrap past the check
+                uint32_t address = base + offset;
+                if ((uint64_t)base + offset + data_length > MEMORY_SIZE) {
+                    fprintf(stderr, "Error: %s:%d: Data at 0x%X is beyond 64KB\n", path, line_number, address);
+                    return 0;
+                }
+                image_put(image, (uint16_t)address, data, data_length);
+                break;
+            }
+            case 0x01:      // End of file
+                if (image->lowest < 0) {
+                    fprintf(stderr, "Error: Intel HEX file '%s' holds no data\n", path);
+                    return 0;
+                }
+                *entry = start >= 0 ? (uint16_t)start : (uint16_t)image->lowest;
+                return 1;
+            case 0x02:      // Extended segment address
+            case 0x04:      // Extended linear address
+                if (data_length != 2) break;
+                base = (uint32_t)(data[0] << 8 | data[1]) << (record[3] == 0x02 ? 4 : 16);
+                break;
+            case 0x03:      // Start segment address (CS:IP)
+            case 0x05: {    // Start linear address
+                if (data_length != 4) break;
+                uint32_t high = data[0] << 8 | data[1], low = data[2] << 8 | data[3];
+                uint32_t address = record[3] == 0x03 ? high * 16 + low : high << 16 | low;
+                if (address >= MEMORY_SIZE) {
+                    fprintf(stderr, "Error: %s:%d: Start address 0x%X is beyond 64KB\n", path, line_number, address);
+                    return 0;
+                }
+                start = address;
+                break;
+            }
+            default:
+                fprintf(stderr, "Error: %s:%d: Unknown record type 0x%02X\n", path, line_number, record[3]);
+                return 0;
+        }
+    }
+    fprintf(stderr, "Error: Intel HEX file '%s' has no end-of-file record\n", path);
+    return 0;
+}
+
+static ImageFormat format_of(const char *path) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    if (!dot || (slash && dot < slash)) return IMAGE_RAW;
+    if (strcmp(dot, ".hex") == 0 || strcmp(dot, ".ihx") == 0) return IMAGE_HEX;
+    if (strcmp(dot, ".prg") == 0) return IMAGE_PRG;
+    if (strcmp(dot, ".manifest") == 0) return IMAGE_MANIFEST;
+    return IMAGE_RAW;
+}
+
+static int load_file(const char *path, ImageFormat format, uint16_t offset, uint16_t *entry);
+
+static int load_manifest(const char *path, char *text, uint16_t *entry) {
+    // Segment paths are relative to the manifest's directory
+    const char *slash = strrchr(path, '/');
+    int dir_length = slash ? (int)(slash - path + 1) : 0;
+    int have_start = 0, segments = 0;
+    int line_number = 0;
+    char *saved;
+
+    for (char *line = strtok_r(text, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *words[3];
+        int count = 0;
+        char *word_saved;
+        for (char *word = strtok_r(line, " \t\r", &word_saved); word; word = strtok_r(NULL, " \t\r", &word_saved)) {
+            if (count == 3) break;
+            words[count++] = word;
+        }
+        if (count == 0) continue;
+        if (count > 2) {
+            fprintf(stderr, "Error: %s:%d: Expected a file and an address\n", path, line_number);
+            return 0;
+        }
+
+        uint16_t address;
+        if (strcmp(words[0], "start") == 0) {
+            if (count != 2 || !parse_address(words[1], &address)) {
+                fprintf(stderr, "Error: %s:%d: Invalid start address\n", path, line_number);
+                return 0;
+            }
+            *entry = address;
+            have_start = 1;
+            continue;
+        }
+
+        if (count == 2 && !parse_address(words[1], &address)) {
+            fprintf(stderr, "Error: %s:%d: Invalid address '%s' (must be 0x0000-0xFFFF)\n",
+                    path, line_number, words[1]);
+            return 0;
+        }
+        char segment[4096];
+        int prefix = words[0][0] == '/' ? 0 : dir_length;
+        snprintf(segment, sizeof(segment), "%.*s%s", prefix, path, words[0]);
+
+        // Raw segments need an address; the others bring their own
+        ImageFormat format = format_of(segment);
+        if (format == IMAGE_MANIFEST) {
+            fprintf(stderr, "Error: %s:%d: Manifests cannot include other manifests\n", path, line_number);
+            return 0;
+        }
+        if ((format == IMAGE_RAW) != (count == 2)) {
+            fprintf(stderr, "Error: %s:%d: %s\n", path, line_number,
+                    format == IMAGE_RAW ? "A raw segment needs an address" : "Only raw segments take an address");
+            return 0;
+        }
+        uint16_t segment_entry;
+        if (!load_file(segment, format, format == IMAGE_RAW ? address : 0, &segment_entry)) return 0;
+        if (segments++ == 0 && !have_start) *entry = segment_entry;
+    }
+    if (segments == 0) {
+        fprintf(stderr, "Error: Manifest '%s' lists no segments\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+static int load_file(const char *path, ImageFormat format, uint16_t offset, uint16_t *entry) {
+    if (format == IMAGE_AUTO) format = format_of(path);
+    long size;
+    uint8_t *data = read_file(path, &size);
+    if (!data) return 0;
+
+    int ok;
+    if (format == IMAGE_MANIFEST) {
+        ok = load_manifest(path, (char *)data, entry);
+        free(data);
+        return ok;
+    }
+
+    Image *image = malloc(sizeof(Image));
+    if (!image) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(data);
+        return 0;
+    }
+    memset(image->present, 0, sizeof(image->present));
+    image->lowest = -1;
+    switch (format) {
+        case IMAGE_HEX: ok = load_hex(image, path, (char *)data, entry); break;
+        case IMAGE_PRG: ok = load_prg(image, path, data, size, entry); break;
+        default: ok = load_raw(image, data, size, offset, entry); break;
+    }
+    if (ok) image_commit(image, path);
+    free(image);
+    free(data);
+    return ok;
+}
+
+int image_parse_format(const char *name, ImageFormat *format) {
+    static const struct { const char *name; ImageFormat format; } formats[] = {
+        { "auto", IMAGE_AUTO }, { "raw", IMAGE_RAW }, { "hex", IMAGE_HEX },
+        { "prg", IMAGE_PRG }, { "manifest", IMAGE_MANIFEST },
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (strcmp(name, formats[i].name) == 0) {
+            *format = formats[i].format;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int image_load(const char *path, ImageFormat format, uint16_t offset, uint16_t *entry) {
+    return load_file(path, format, offset, entry);
+}
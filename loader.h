@@ -0,0 +1,33 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdint.h>
+
+// Program image formats
+typedef enum {
+    IMAGE_AUTO,     // By extension: .hex/.ihx, .prg, .manifest; anything else is raw
+    IMAGE_RAW,      // Plain bytes, loaded at a given offset
+    IMAGE_HEX,      // Intel HEX records (addresses must stay below 64KB)
+    IMAGE_PRG,      // Commodore PRG: a 2-byte little-endian load address, then the bytes
+    IMAGE_MANIFEST  // Text file listing segments, one per line (see below)
+} ImageFormat;
+
+// A manifest names the files that make up an image, with paths relative to
+// the manifest. Blank lines and text after '#' are ignored:
+//
+//   kernal.bin  0xE000     Raw file at an address
+//   basic.prg              HEX and PRG files carry their own addresses
+//   start 0xE000           Optional entry point (default: the first segment's)
+
+// Parse a format name (auto, raw, hex, prg or manifest). Returns 0 if unknown.
+int image_parse_format(const char *name, ImageFormat *format);
+
+// Load path into the bound address space, each contiguous run of bytes with
+// one bulk copy. Raw images go to offset; the other formats carry their own
+// addresses. *entry gets the address the image starts at: the offset of a
+// raw image, the load address of a PRG, the start address record of a HEX
+// file (or its lowest address) and the manifest's start line (or its first
+// segment's entry). Returns 0 (with a message on stderr) on failure.
+int image_load(const char *path, ImageFormat format, uint16_t offset, uint16_t *entry);
+
+#endif
@@ -2,20 +2,73 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <signal.h>
 #include "cpu.h"
 #include "memory.h"
+#include "batch.h"
+#include "server.h"
+#include "cache.h"
+#include "counters.h"
+#include "device.h"
+#include "journal.h"
+#include "loader.h"
+#include "symbols.h"
+#include "history.h"
+#include "opcodes.h"
+#include "aot.h"
 
 void print_usage(const char *program_name) {
     printf("Usage: %s [OPTIONS]\n", program_name);
     printf("\nOptions:\n");
-    printf("  --load FILE       Load binary FILE into emulator memory\n");
-    printf("  --offset OFFSET   Load file at memory OFFSET (hex or decimal)\n");
+    printf("  --load FILE       Load FILE into emulator memory: raw binary, Intel HEX (.hex, .ihx),\n");
+    printf("                    Commodore PRG (.prg) or a segment manifest (.manifest)\n");
+    printf("  --format FORMAT   Image format instead of guessing from the extension:\n");
+    printf("                    raw, hex, prg or manifest\n");
+    printf("  --offset OFFSET   Load a raw file at memory OFFSET (hex or decimal)\n");
     printf("                    Default: 0x0000\n");
     printf("                    Example: --offset 0x2000 or --offset 8192\n");
+    printf("  --start ADDR      Start execution at ADDR instead of the image's start address\n");
+    printf("  --reset           Start through the reset vector at 0xFFFC, as on power-up\n");
+    printf("  --labels FILE     Load assembler labels (VICE format, ld65 -Ln) for traces and profiles;\n");
+    printf("                    addresses given to --start and --break may then be symbol names\n");
+    printf("  --break ADDR      Stop when execution reaches ADDR (repeatable)\n");
+    printf("  --profile         Report where a --cycles run spent its cycles, by symbol\n");
+    printf("  --cycles N        Run untraced for up to N cycles, then print the final state\n");
+    printf("  --cpu MODEL       CPU model: 6502 (default) or 65c02\n");
+    printf("  --no-idle-skip    Step every iteration of idle loops in --cycles runs\n");
+    printf("  --aot MODULE      Run code compiled by 6502recomp from MODULE (.so) in --cycles runs\n");
+    printf("  --illegal POLICY  Unstable/JAM opcodes: halt (default) or nop\n");
+    printf("  --lanes N         Run N copies of the program side by side in --cycles runs\n");
+    printf("  --vary ADDR       Store each lane's number (16-bit) at ADDR before a --lanes run\n");
+    printf("  --io ADDR         Map the console, timer and disk registers at page ADDR (e.g. 0xFE00)\n");
+    printf("  --disk FILE       Back the --io block device with FILE (512-byte blocks)\n");
+    printf("  --record JOURNAL  Save every byte the --io console reads to JOURNAL\n");
+    printf("  --replay JOURNAL  Read the --io console's input from JOURNAL instead of stdin\n");
+    printf("  --cache DIR       Reuse results of identical --cycles runs stored in DIR\n");
+    printf("  --cache-size N    Size limit of the cache in bytes (default: 67108864)\n");
+    printf("  --serve SOCKET    Serve emulation jobs on a Unix domain socket\n");
+    printf("  --workers N       Worker threads for --serve (default: one per CPU)\n");
+    printf("  --job-cycles N    Cycle limit per binary job in --serve (default: 100000000)\n");
+    printf("  --job-lines N     Line limit per BASIC job in --serve (default: 10000000)\n");
+    printf("  --slice-cycles N  Cycles a binary job runs before the next job's turn (default: 100000)\n");
+    printf("  --slice-lines N   Lines a BASIC job runs before the next job's turn (default: 1000)\n");
+    printf("  --stats FILE      Publish live counters in FILE while running; read them with 6502stat\n");
+    printf("  --debug           Debug interactively, with stepping and continuing backwards\n");
+    printf("  --history-size N  Memory for --debug's execution history in bytes (default: 67108864)\n");
+    printf("  --checkpoint-interval N\n");
+    printf("                    Instructions between --debug's checkpoints (default: 100000)\n");
     printf("  --help            Display this help message\n");
     printf("\nExamples:\n");
     printf("  %s --load program.bin\n", program_name);
     printf("  %s --load program.bin --offset 0x2000\n", program_name);
+    printf("  %s --load rom.manifest --reset --cycles 100000000\n", program_name);
+    printf("  %s --load game.prg --labels game.lbl --cycles 10000000 --profile --break game_over\n", program_name);
+    printf("  %s --load test.bin --start 0x0400 --cycles 100000000 --cpu 65c02\n", program_name);
+    printf("  %s --load os.bin --offset 0x0200 --cycles 100000000 --io 0xFE00 --disk disk.img\n", program_name);
+    printf("  %s --load sweep.bin --cycles 1000000 --lanes 256 --vary 0x00F0\n", program_name);
+    printf("  %s --load game.prg --labels game.lbl --debug --break game_over\n", program_name);
+    printf("  %s --serve /tmp/6502emu.sock --workers 8\n", program_name);
     printf("  %s (runs built-in test program)\n", program_name);
 }
 
@@ -43,51 +96,333 @@ int parse_offset(const char *str, uint16_t *offset) {
     return 1;
 }
 
-int load_binary_file(const char *filename, uint16_t offset) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        fprintf(stderr, "Error: Cannot open file '%s': %s\n", filename, strerror(errno));
+int parse_cycles(const char *str, uint64_t *cycles) {
+    char *endptr;
+    unsigned long long value = strtoull(str, &endptr, 0);
+    
+    if (*endptr != '\0' || endptr == str || value == 0) {
         return 0;
     }
     
-    // Get file size
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    if (size < 0) {
-        fprintf(stderr, "Error: Cannot determine file size for '%s'\n", filename);
-        fclose(f);
+    *cycles = value;
+    return 1;
+}
+
+int parse_cpu_model(const char *str, CpuModel *model) {
+    if (strcmp(str, "6502") == 0) {
+        *model = CPU_6502;
+    } else if (strcmp(str, "65c02") == 0 || strcmp(str, "65C02") == 0) {
+        *model = CPU_65C02;
+    } else {
         return 0;
     }
-    
-    if (size == 0) {
-        fprintf(stderr, "Error: File '%s' is empty\n", filename);
-        fclose(f);
+    return 1;
+}
+
+int parse_illegal_policy(const char *str, IllegalPolicy *policy) {
+    if (strcmp(str, "halt") == 0) {
+        *policy = ILLEGAL_HALT;
+    } else if (strcmp(str, "nop") == 0) {
+        *policy = ILLEGAL_NOP;
+    } else {
         return 0;
     }
+    return 1;
+}
+
+void print_state(const CPU *cpu) {
+    printf("PC: 0x%04X  A: 0x%02X  X: 0x%02X  Y: 0x%02X  SP: 0x%02X  Status: 0x%02X  Cycles: %lu\n",
+           cpu->PC, cpu->A, cpu->X, cpu->Y, cpu->SP, cpu->status, cpu->cycles);
+}
+
+// A jump or branch to itself, the trap the functional test suites end in
+int is_trap(uint16_t pc) {
+    uint8_t opcode = memory_read(pc);
+    if (opcode == 0x4C) return memory_read_word(pc + 1) == pc;
+    if ((opcode & 0x1F) == 0x10 || opcode == 0x80) return memory_read(pc + 1) == 0xFE;
+    return 0;
+}
+
+// Symbols, breakpoints and profile counters for the traced and --cycles runs
+typedef struct {
+    SymbolTable *symbols;               // NULL without --labels
+    uint64_t breakpoints[MEMORY_SIZE / 64];
+    int has_breakpoints;
+    uint64_t *profile_cycles;           // Per PC, NULL without --profile
+    uint64_t *profile_count;
+} Inspect;
+
+int is_breakpoint(const Inspect *inspect, uint16_t pc) {
+    return inspect->breakpoints[pc >> 6] >> (pc & 63) & 1;
+}
+
+// " (name+$off)" for address, or "" if no symbol covers it
+const char *symbol_suffix(const Inspect *inspect, uint16_t address, char *buf, size_t size) {
+    char name[256];
+    if (!symbols_format(inspect->symbols, address, name, sizeof(name))) return "";
+    snprintf(buf, size, " (%s)", name);
+    return buf;
+}
+
+// Add what cpu ran since *counted to the counters file
+void count_cpu(const CPU *cpu, CPU *counted) {
+    counters_add(COUNTER_INSTRUCTIONS, cpu->instructions - counted->instructions);
+    counters_add(COUNTER_CYCLES, cpu->cycles - counted->cycles);
+    counters_add(COUNTER_IDLE_CYCLES, cpu->idle_cycles - counted->idle_cycles);
+    *counted = *cpu;
+}
+
+// cpu_execute one instruction at a time, for breakpoints and profiling.
+// Returns 1 if it stopped at a breakpoint (never the one it started on).
+int run_inspected(CPU *cpu, uint64_t max_cycles, Inspect *inspect) {
+    uint64_t limit = max_cycles > UINT64_MAX - cpu->cycles ? UINT64_MAX : cpu->cycles + max_cycles;
+    int first = 1;
+    CPU counted = *cpu;
+    while (cpu->cycles < limit && !cpu->halted) {
+        uint16_t pc = cpu->PC;
+        if (!first && inspect->has_breakpoints && is_breakpoint(inspect, pc)) {
+            count_cpu(cpu, &counted);
+            return 1;
+        }
+        first = 0;
+        uint64_t before = cpu->cycles;
+        cpu_step(cpu);
+        if (inspect->profile_cycles) {
+            inspect->profile_cycles[pc] += cpu->cycles - before;
+            inspect->profile_count[pc]++;
+        }
+        if (cpu->cycles - counted.cycles >= COUNTERS_UPDATE_CYCLES) count_cpu(cpu, &counted);
+    }
+    count_cpu(cpu, &counted);
+    return 0;
+}
+
+// cpu_execute (or aot_execute with a compiled module), in slices that keep
+// the counters file current if there is one
+void run_counted(CPU *cpu, uint64_t max_cycles, const AotModule *aot) {
+    uint64_t limit = max_cycles > UINT64_MAX - cpu->cycles ? UINT64_MAX : cpu->cycles + max_cycles;
+    uint64_t slice = counters_active() ? COUNTERS_UPDATE_CYCLES : UINT64_MAX;
+    while (cpu->cycles < limit && !cpu->halted) {
+        CPU counted = *cpu;
+        uint64_t cycles = limit - cpu->cycles < slice ? limit - cpu->cycles : slice;
+        if (aot) {
+            aot_execute(aot, cpu, cycles);
+        } else {
+            cpu_execute(cpu, cycles);
+        }
+        count_cpu(cpu, &counted);
+    }
+}
+
+typedef struct {
+    uint64_t cycles;
+    uint64_t count;
+    int location;           // Symbol index, or the PC without symbols; -1 for no symbol
+} ProfileEntry;
+
+int compare_profile(const void *a, const void *b) {
+    const ProfileEntry *x = a, *y = b;
+    return x->cycles < y->cycles ? 1 : x->cycles > y->cycles ? -1 : 0;
+}
+
+// The busiest symbols (or PCs, without --labels) of a --profile run
+void print_profile(const Inspect *inspect) {
+    SymbolTable *symbols = inspect->symbols;
+    int slots = symbols ? symbols_count(symbols) + 1 : MEMORY_SIZE;
+    ProfileEntry *entries = calloc(slots, sizeof(ProfileEntry));
+    if (!entries) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return;
+    }
+    uint64_t total = 0;
+    for (int i = 0; i < slots; i++) entries[i].location = symbols && i == slots - 1 ? -1 : i;
+    for (int pc = 0; pc < MEMORY_SIZE; pc++) {
+        if (!inspect->profile_count[pc]) continue;
+        int slot = pc;
+        if (symbols) {
+            slot = symbols_find(symbols, (uint16_t)pc);
+            if (slot < 0) slot = slots - 1;
+        }
+        entries[slot].cycles += inspect->profile_cycles[pc];
+        entries[slot].count += inspect->profile_count[pc];
+        total += inspect->profile_cycles[pc];
+    }
+    qsort(entries, slots, sizeof(ProfileEntry), compare_profile);
+
+    printf("\nProfile (%s by cycles):\n", symbols ? "symbols" : "addresses");
+    printf("        Cycles       %%   Instructions  Location\n");
+    for (int i = 0; i < slots && i < 20 && entries[i].cycles; i++) {
+        char location[256];
+        if (!symbols) snprintf(location, sizeof(location), "0x%04X", entries[i].location);
+        else if (entries[i].location < 0) snprintf(location, sizeof(location), "(no symbol)");
+        else snprintf(location, sizeof(location), "%s (0x%04X)", symbols_name(symbols, entries[i].location),
+                      symbols_address(symbols, entries[i].location));
+        printf("  %12lu  %5.1f%%  %13lu  %s\n", entries[i].cycles, 100.0 * entries[i].cycles / total,
+               entries[i].count, location);
+    }
+    free(entries);
+}
+
+// Outcome of a --cycles run, and what the result cache stores for it
+typedef struct {
+    uint8_t A, X, Y, SP, status;
+    uint8_t halted;
+    uint8_t opcode;         // At the final PC
+    uint8_t trapped;        // Final PC is a jump/branch to itself
+    uint16_t PC;
+    uint64_t cycles;
+    uint64_t idle_skips;
+    uint64_t idle_cycles;
+    uint64_t memory_hash;
+} BatchResult;
+
+// Everything that determines a --cycles run: emulator build, initial CPU
+// state and the whole memory image (which covers the load offset)
+Hash128 batch_key(const CPU *cpu, uint64_t max_cycles) {
+    Hasher h;
+    hash_init(&h, 0);
+    hash_update(&h, "6502emu --cycles", 16);
+    cache_hash_build(&h);
+
+    uint8_t state[] = { cpu->A, cpu->X, cpu->Y, cpu->SP, cpu->status, cpu->PC & 0xFF, cpu->PC >> 8,
+                        cpu->model, cpu->illegal_policy, cpu->idle_skip };
+    hash_update(&h, state, sizeof(state));
+    hash_u64(&h, cpu->cycles);
+    hash_u64(&h, max_cycles);
+
+    uint8_t page[MEMORY_PAGE_SIZE];
+    for (int base = 0; base < MEMORY_SIZE; base += MEMORY_PAGE_SIZE) {
+        for (int i = 0; i < MEMORY_PAGE_SIZE; i++) page[i] = memory_read((uint16_t)(base + i));
+        hash_update(&h, page, sizeof(page));
+    }
+    return hash_final(&h);
+}
+
+// Run without tracing until the cycle budget runs out, a BRK, a halt or a
+// breakpoint. With a cache, an identical earlier run's result is reported
+// instead.
+void run_batch(CPU *cpu, uint64_t max_cycles, ResultCache *cache, Inspect *inspect, const AotModule *aot) {
+    BatchResult result;
+    Hash128 key;
+    int cached = 0;
+    int at_breakpoint = 0;
     
-    // Check if file fits in memory at given offset
-    if ((uint32_t)offset + (uint32_t)size > 0x10000) {
-        fprintf(stderr, "Error: File size (%ld bytes) at offset 0x%04X exceeds memory bounds\n", 
-                size, offset);
-        fclose(f);
-        return 0;
+    cpu->halt_on_brk = 1;
+    if (cache) {
+        key = batch_key(cpu, max_cycles);
+        size_t size;
+        void *data = cache_lookup(cache, key, &size);
+        if (data && size == sizeof(result)) {
+            memcpy(&result, data, sizeof(result));
+            cached = 1;
+        }
+        free(data);
     }
     
-    // Read file into memory
-    for (long i = 0; i < size; i++) {
-        int byte = fgetc(f);
-        if (byte == EOF) {
-            fprintf(stderr, "Error: Unexpected end of file while reading '%s'\n", filename);
-            fclose(f);
-            return 0;
+    if (!cached) {
+        if (inspect->has_breakpoints || inspect->profile_cycles) {
+            at_breakpoint = run_inspected(cpu, max_cycles, inspect);
+        } else {
+            run_counted(cpu, max_cycles, aot);
         }
-        memory_write((uint16_t)(offset + i), (uint8_t)byte);
+        memset(&result, 0, sizeof(result));
+        result.A = cpu->A;
+        result.X = cpu->X;
+        result.Y = cpu->Y;
+        result.SP = cpu->SP;
+        result.status = cpu->status;
+        result.halted = cpu->halted;
+        result.opcode = memory_read(cpu->PC);
+        result.trapped = is_trap(cpu->PC);
+        result.PC = cpu->PC;
+        result.cycles = cpu->cycles;
+        result.idle_skips = cpu->idle_skips;
+        result.idle_cycles = cpu->idle_cycles;
+        result.memory_hash = memory_hash();
+        if (cache) cache_store(cache, key, &result, sizeof(result));
+    } else {
+        cpu->A = result.A;
+        cpu->X = result.X;
+        cpu->Y = result.Y;
+        cpu->SP = result.SP;
+        cpu->status = result.status;
+        cpu->halted = result.halted;
+        cpu->PC = result.PC;
+        cpu->cycles = result.cycles;
     }
     
-    fclose(f);
-    printf("Loaded %ld bytes from '%s' at address 0x%04X\n", size, filename, offset);
+    char suffix[300];
+    if (at_breakpoint) {
+        printf("\nStopped at breakpoint 0x%04X%s\n", result.PC, symbol_suffix(inspect, result.PC, suffix, sizeof(suffix)));
+    } else if (result.halted && result.opcode == 0x00) {
+        printf("\nProgram terminated (BRK instruction at 0x%04X)\n", result.PC);
+    } else if (result.halted) {
+        printf("\nCPU halted (opcode 0x%02X %s at 0x%04X)\n", result.opcode,
+               opcode_info(cpu->model, result.opcode)->mnemonic, result.PC);
+    } else if (result.trapped) {
+        printf("\nTrapped at 0x%04X\n", result.PC);
+    } else {
+        printf("\nCycle budget exhausted\n");
+    }
+    if (result.idle_skips) {
+        printf("Idle loops fast-forwarded: %lu (%lu cycles)\n", result.idle_skips, result.idle_cycles);
+    }
+    if (cached) {
+        printf("Result taken from cache\n");
+    }
+    printf("Final state:\n");
+    print_state(cpu);
+    printf("Memory hash: 0x%016lX\n", result.memory_hash);
+    if (inspect->profile_cycles) print_profile(inspect);
+}
+
+// Run lanes copies of the loaded program on the batch core, each with its
+// lane number stored at vary (if given), and print every lane's final state
+int run_sweep(const CPU *cpu, int lanes, int vary, uint64_t max_cycles) {
+    CpuBatch *batch = batch_create(lanes, cpu->model);
+    if (!batch) {
+        fprintf(stderr, "Error: Cannot allocate %d lanes\n", lanes);
+        return 0;
+    }
+    batch->config = *cpu;
+    batch->config.halt_on_brk = 1;
+    Memory *image = memory_bind(NULL);
+    memory_bind(image);
+    for (int i = 0; i < lanes; i++) {
+        memcpy(batch->mem[i], image, sizeof(Memory));
+        if (vary >= 0) {
+            memory_write_to(batch->mem[i], (uint16_t)vary, i & 0xFF);
+            memory_write_to(batch->mem[i], (uint16_t)(vary + 1), i >> 8);
+        }
+        batch_set_lane(batch, i, &batch->config);
+    }
+
+    clock_t start = clock();
+    batch_execute(batch, max_cycles);
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    uint64_t total_cycles = 0;
+    printf("\n");
+    for (int i = 0; i < lanes; i++) {
+        CPU lane = batch->config;
+        batch_get_lane(batch, i, &lane);
+        total_cycles += lane.cycles - cpu->cycles;
+        memory_bind(batch->mem[i]);
+        const char *stop = !lane.halted ? "budget" : memory_read(lane.PC) == 0x00 ? "BRK" : "halted";
+        printf("Lane %4d  %-6s  ", i, stop);
+        print_state(&lane);
+        printf("           Memory hash: 0x%016lX\n", memory_hash());
+    }
+    memory_bind(image);
+
+    uint64_t steps = batch->vector_steps + batch->scalar_steps;
+    counters_add(COUNTER_INSTRUCTIONS, steps);
+    counters_add(COUNTER_CYCLES, total_cycles);
+    printf("\n%d lanes, %lu cycles in %.3f s (%.1f M cycles/s)\n", lanes, total_cycles, seconds,
+           seconds > 0 ? total_cycles / seconds / 1e6 : 0.0);
+    printf("Instructions run in lockstep: %lu of %lu (%.1f%%)\n", batch->vector_steps, steps,
+           steps ? 100.0 * batch->vector_steps / steps : 0.0);
+    batch_destroy(batch);
     return 1;
 }
 
@@ -118,11 +453,279 @@ void run_default_program(CPU *cpu) {
     printf("\nResult at $10: 0x%02X (should be 0x08)\n", memory_read(0x10));
 }
 
+// The --debug monitor
+typedef struct {
+    CPU *cpu;
+    Inspect *inspect;
+    History *history;
+    size_t history_size;
+    uint64_t watches[MEMORY_SIZE / 64];
+    int has_watches;
+} Debugger;
+
+// Instructions run between checks for Ctrl-C
+#define DEBUG_SLICE 1000000
+
+static volatile sig_atomic_t interrupted;
+
+void on_interrupt(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+HistoryStops debug_stops(const Debugger *dbg) {
+    HistoryStops stops = { dbg->inspect->has_breakpoints ? dbg->inspect->breakpoints : NULL,
+                           dbg->has_watches ? dbg->watches : NULL };
+    return stops;
+}
+
+// The instruction about to run and the registers
+void debug_show(const Debugger *dbg) {
+    const CPU *cpu = dbg->cpu;
+    uint8_t code[3];
+    char text[DISASM_MAX];
+    char suffix[300];
+    memory_copy_out(cpu->PC, code, sizeof(code));
+    disassemble(cpu->model, cpu->PC, code, text, sizeof(text));
+    printf("#%lu  %04X%s  %-15s A: 0x%02X  X: 0x%02X  Y: 0x%02X  SP: 0x%02X  Status: 0x%02X  Cycles: %lu\n",
+           cpu->instructions, cpu->PC, symbol_suffix(dbg->inspect, cpu->PC, suffix, sizeof(suffix)), text,
+           cpu->A, cpu->X, cpu->Y, cpu->SP, cpu->status, cpu->cycles);
+}
+
+// Say why a run forwards or backwards stopped
+void debug_report(const Debugger *dbg, HistoryEvent event, uint32_t change, int backwards) {
+    const CPU *cpu = dbg->cpu;
+    char suffix[300];
+    uint16_t address = (uint16_t)(change >> 8);
+    switch (event) {
+    case HISTORY_BREAKPOINT:
+        printf("Stopped at breakpoint 0x%04X%s\n", cpu->PC, symbol_suffix(dbg->inspect, cpu->PC, suffix, sizeof(suffix)));
+        break;
+    case HISTORY_WATCH:
+        if (backwards) {
+            printf("Watched 0x%04X%s is changed by the next instruction (now 0x%02X)\n", address,
+                   symbol_suffix(dbg->inspect, address, suffix, sizeof(suffix)), memory_read(address));
+        } else {
+            printf("Watched 0x%04X%s changed: 0x%02X -> 0x%02X\n", address,
+                   symbol_suffix(dbg->inspect, address, suffix, sizeof(suffix)), (uint8_t)change, memory_read(address));
+        }
+        break;
+    case HISTORY_HALTED:
+        printf("CPU halted (%s at 0x%04X); rstep or rcontinue to go back\n",
+               opcode_info(cpu->model, memory_read(cpu->PC))->mnemonic, cpu->PC);
+        break;
+    case HISTORY_START:
+        printf("Reached the start of the history\n");
+        break;
+    case HISTORY_COUNT:
+        break;
+    }
+}
+
+// Run up to count instructions, stopping at a breakpoint (but not the one
+// it starts at), a change to a watched byte, a halt or Ctrl-C
+void debug_forward(Debugger *dbg, uint64_t count) {
+    CPU *cpu = dbg->cpu;
+    HistoryStops stops = debug_stops(dbg);
+    HistoryStops first = { NULL, stops.watches };
+    uint32_t change = 0;
+    interrupted = 0;
+    void (*previous)(int) = signal(SIGINT, on_interrupt);
+    HistoryEvent event = history_run(dbg->history, 1, &first, &change);
+    count--;
+    while (event == HISTORY_COUNT && count && !interrupted) {
+        uint64_t start = cpu->instructions;
+        event = history_run(dbg->history, count < DEBUG_SLICE ? count : DEBUG_SLICE, &stops, &change);
+        count -= cpu->instructions - start;
+    }
+    signal(SIGINT, previous);
+    if (event == HISTORY_COUNT && count) printf("Interrupted\n");
+    debug_report(dbg, event, change, 0);
+}
+
+// Parse an address or label argument of command, with a message if missing or invalid
+int debug_address(const Debugger *dbg, const char *command, const char *arg, uint16_t *address) {
+    if (!arg) {
+        printf("%s requires an address\n", command);
+        return 0;
+    }
+    if (!symbols_resolve(dbg->inspect->symbols, arg, address)) {
+        printf("Invalid address '%s' (must be 0x0000-0xFFFF or a label)\n", arg);
+        return 0;
+    }
+    return 1;
+}
+
+// Parse an optional count argument; 1 without
+int debug_count(const char *arg, uint64_t *count) {
+    *count = 1;
+    if (arg && !parse_cycles(arg, count)) {
+        printf("Invalid count '%s'\n", arg);
+        return 0;
+    }
+    return 1;
+}
+
+void debug_list(const Debugger *dbg, const char *title, const uint64_t *bits) {
+    char suffix[300];
+    printf("%s:", title);
+    int any = 0;
+    for (uint32_t address = 0; address < MEMORY_SIZE; address++) {
+        if (bits[address >> 6] >> (address & 63) & 1) {
+            printf(" 0x%04X%s", address, symbol_suffix(dbg->inspect, (uint16_t)address, suffix, sizeof(suffix)));
+            any = 1;
+        }
+    }
+    printf(any ? "\n" : " none\n");
+}
+
+void debug_help(void) {
+    printf("Commands:\n");
+    printf("  step, s [N]       Run N instructions (default 1)\n");
+    printf("  continue, c       Run until a breakpoint, a change to a watched byte, a halt or Ctrl-C\n");
+    printf("  rstep, rs [N]     Go back N instructions (default 1)\n");
+    printf("  rcontinue, rc     Go back to the last breakpoint or change to a watched byte\n");
+    printf("  break, b ADDR     Stop before running the instruction at ADDR\n");
+    printf("  watch, w ADDR     Stop when a write changes the byte at ADDR\n");
+    printf("  delete, d [ADDR]  Remove the breakpoint and watch at ADDR, or all\n");
+    printf("  regs, r           Show the registers and the next instruction\n");
+    printf("  mem, m ADDR [N]   Show N bytes at ADDR (default 16)\n");
+    printf("  info, i           Show the breakpoints, watches and history\n");
+    printf("  quit, q           Leave the debugger\n");
+}
+
+// Read and run debugger commands from stdin until quit or end of input.
+// Returns 0 if the history cannot be allocated.
+int run_debugger(CPU *cpu, Inspect *inspect, uint64_t checkpoint_interval, size_t history_size) {
+    static Debugger dbg;
+    dbg.cpu = cpu;
+    dbg.inspect = inspect;
+    dbg.history_size = history_size;
+    if (!(dbg.history = history_create(cpu, checkpoint_interval, history_size))) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 0;
+    }
+    
+    printf("\nDebugging; type help for commands\n");
+    debug_show(&dbg);
+    char line[256];
+    for (;;) {
+        printf("(6502) ");
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin)) {
+            printf("\n");
+            break;
+        }
+        char *command = strtok(line, " \t\r\n");
+        char *arg = strtok(NULL, " \t\r\n");
+        char *arg2 = strtok(NULL, " \t\r\n");
+        if (!command) continue;
+        uint16_t address;
+        uint64_t count;
+        
+        if (strcmp(command, "step") == 0 || strcmp(command, "s") == 0) {
+            if (!debug_count(arg, &count)) continue;
+            debug_forward(&dbg, count);
+            debug_show(&dbg);
+        } else if (strcmp(command, "continue") == 0 || strcmp(command, "c") == 0) {
+            debug_forward(&dbg, UINT64_MAX);
+            debug_show(&dbg);
+        } else if (strcmp(command, "rstep") == 0 || strcmp(command, "rs") == 0) {
+            if (!debug_count(arg, &count)) continue;
+            uint64_t start = history_start(dbg.history);
+            uint64_t target = cpu->instructions - start > count ? cpu->instructions - count : start;
+            history_seek(dbg.history, target);
+            debug_report(&dbg, target == start ? HISTORY_START : HISTORY_COUNT, 0, 1);
+            debug_show(&dbg);
+        } else if (strcmp(command, "rcontinue") == 0 || strcmp(command, "rc") == 0) {
+            HistoryStops stops = debug_stops(&dbg);
+            uint32_t change = 0;
+            HistoryEvent event = history_reverse_continue(dbg.history, &stops, &change);
+            debug_report(&dbg, event, change, 1);
+            debug_show(&dbg);
+        } else if (strcmp(command, "break") == 0 || strcmp(command, "b") == 0) {
+            if (!debug_address(&dbg, "break", arg, &address)) continue;
+            inspect->breakpoints[address >> 6] |= 1ULL << (address & 63);
+            inspect->has_breakpoints = 1;
+        } else if (strcmp(command, "watch") == 0 || strcmp(command, "w") == 0) {
+            if (!debug_address(&dbg, "watch", arg, &address)) continue;
+            dbg.watches[address >> 6] |= 1ULL << (address & 63);
+            dbg.has_watches = 1;
+        } else if (strcmp(command, "delete") == 0 || strcmp(command, "d") == 0) {
+            if (!arg) {
+                memset(inspect->breakpoints, 0, sizeof(inspect->breakpoints));
+                memset(dbg.watches, 0, sizeof(dbg.watches));
+                inspect->has_breakpoints = 0;
+                dbg.has_watches = 0;
+                continue;
+            }
+            if (!debug_address(&dbg, "delete", arg, &address)) continue;
+            inspect->breakpoints[address >> 6] &= ~(1ULL << (address & 63));
+            dbg.watches[address >> 6] &= ~(1ULL << (address & 63));
+        } else if (strcmp(command, "regs") == 0 || strcmp(command, "r") == 0) {
+            debug_show(&dbg);
+        } else if (strcmp(command, "mem") == 0 || strcmp(command, "m") == 0) {
+            if (!debug_address(&dbg, "mem", arg, &address)) continue;
+            count = 16;
+            if (arg2 && (!parse_cycles(arg2, &count) || count > MEMORY_SIZE)) {
+                printf("Invalid length '%s'\n", arg2);
+                continue;
+            }
+            for (uint64_t i = 0; i < count; i++) {
+                if (i % 16 == 0) printf(i ? "\n%04X:" : "%04X:", (uint16_t)(address + i));
+                printf(" %02X", memory_read((uint16_t)(address + i)));
+            }
+            printf("\n");
+        } else if (strcmp(command, "info") == 0 || strcmp(command, "i") == 0) {
+            debug_list(&dbg, "Breakpoints", inspect->breakpoints);
+            debug_list(&dbg, "Watches", dbg.watches);
+            printf("History: instructions %lu-%lu, %zu of %zu bytes\n", history_start(dbg.history),
+                   cpu->instructions, history_bytes(dbg.history), dbg.history_size);
+        } else if (strcmp(command, "help") == 0 || strcmp(command, "h") == 0) {
+            debug_help();
+        } else if (strcmp(command, "quit") == 0 || strcmp(command, "q") == 0) {
+            break;
+        } else {
+            printf("Unknown command '%s'; type help for commands\n", command);
+        }
+    }
+    
+    history_free(dbg.history);
+    return 1;
+}
+
 int main(int argc, char *argv[]) {
     CPU cpu;
     const char *load_file = NULL;
     uint16_t offset = 0x0000;
     int offset_specified = 0;
+    IllegalPolicy illegal_policy = ILLEGAL_HALT;
+    CpuModel model = CPU_6502;
+    uint16_t start = 0x0000;
+    const char *start_arg = NULL;
+    const char *label_files[16];
+    int label_count = 0;
+    const char *break_args[64];
+    int break_count = 0;
+    int profile = 0;
+    int reset = 0;
+    ImageFormat format = IMAGE_AUTO;
+    uint64_t max_cycles = 0;
+    int idle_skip = 1;
+    const char *aot_file = NULL;
+    ServerConfig serve = { NULL, 0, 100000000, 10000000, 0, 0 };
+    const char *cache_dir = NULL;
+    uint64_t cache_size = 64 * 1024 * 1024;
+    uint64_t lanes = 0;
+    int vary = -1;
+    int io_page = -1;
+    const char *disk_file = NULL;
+    const char *journal_path = NULL;
+    JournalMode journal_mode = JOURNAL_OFF;
+    const char *stats_file = NULL;
+    int debug = 0;
+    uint64_t history_size = 64 * 1024 * 1024;
+    uint64_t checkpoint_interval = 100000;
     
     // Parse command-line arguments
     for (int i = 1; i < argc; i++) {
@@ -147,6 +750,224 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             offset_specified = 1;
+        } else if (strcmp(argv[i], "--start") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --start requires an address argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            start_arg = argv[++i];      // Resolved once the labels are loaded
+        } else if (strcmp(argv[i], "--labels") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --labels requires a filename argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (label_count == (int)(sizeof(label_files) / sizeof(label_files[0]))) {
+                fprintf(stderr, "Error: Too many --labels files\n");
+                return 1;
+            }
+            label_files[label_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--break") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --break requires an address argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (break_count == (int)(sizeof(break_args) / sizeof(break_args[0]))) {
+                fprintf(stderr, "Error: Too many breakpoints\n");
+                return 1;
+            }
+            break_args[break_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = 1;
+        } else if (strcmp(argv[i], "--reset") == 0) {
+            reset = 1;
+        } else if (strcmp(argv[i], "--format") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --format requires a format argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!image_parse_format(argv[++i], &format)) {
+                fprintf(stderr, "Error: Invalid image format '%s' (must be raw, hex, prg or manifest)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cycles") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --cycles requires a count argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!parse_cycles(argv[++i], &max_cycles)) {
+                fprintf(stderr, "Error: Invalid cycle count '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --cpu requires a model argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!parse_cpu_model(argv[++i], &model)) {
+                fprintf(stderr, "Error: Invalid CPU model '%s' (must be 6502 or 65c02)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--no-idle-skip") == 0) {
+            idle_skip = 0;
+        } else if (strcmp(argv[i], "--aot") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --aot requires a module argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            aot_file = argv[++i];
+        } else if (strcmp(argv[i], "--illegal") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --illegal requires a policy argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!parse_illegal_policy(argv[++i], &illegal_policy)) {
+                fprintf(stderr, "Error: Invalid illegal opcode policy '%s' (must be halt or nop)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--lanes") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --lanes requires a count argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!parse_cycles(argv[++i], &lanes) || lanes == 0 || lanes > 65536) {
+                fprintf(stderr, "Error: Invalid lane count '%s' (must be 1-65536)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--vary") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --vary requires an address argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            uint16_t address;
+            if (!parse_offset(argv[++i], &address)) {
+                fprintf(stderr, "Error: Invalid address '%s' (must be 0x0000-0xFFFF)\n", argv[i]);
+                return 1;
+            }
+            vary = address;
+        } else if (strcmp(argv[i], "--io") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --io requires an address argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            uint16_t address;
+            if (!parse_offset(argv[++i], &address) || (address & 0xFF)) {
+                fprintf(stderr, "Error: Invalid I/O page '%s' (must be a multiple of 0x100)\n", argv[i]);
+                return 1;
+            }
+            io_page = address >> 8;
+        } else if (strcmp(argv[i], "--disk") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --disk requires a filename argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            disk_file = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires a journal file argument\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            journal_mode = strcmp(argv[i], "--record") == 0 ? JOURNAL_RECORD : JOURNAL_REPLAY;
+            journal_path = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stats requires a filename argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            stats_file = argv[++i];
+        } else if (strcmp(argv[i], "--debug") == 0) {
+            debug = 1;
+        } else if (strcmp(argv[i], "--history-size") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --history-size requires a byte count argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!parse_cycles(argv[++i], &history_size) || history_size < 65536 || history_size > SIZE_MAX) {
+                fprintf(stderr, "Error: Invalid history size '%s' (must be at least 65536)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--checkpoint-interval") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --checkpoint-interval requires a count argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!parse_cycles(argv[++i], &checkpoint_interval)) {
+                fprintf(stderr, "Error: Invalid checkpoint interval '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --cache requires a directory argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--cache-size") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --cache-size requires a byte count argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!parse_cycles(argv[++i], &cache_size)) {
+                fprintf(stderr, "Error: Invalid cache size '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --serve requires a socket path argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            serve.socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --workers requires a count argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            uint64_t workers;
+            if (!parse_cycles(argv[++i], &workers) || workers > 1024) {
+                fprintf(stderr, "Error: Invalid worker count '%s'\n", argv[i]);
+                return 1;
+            }
+            serve.workers = (int)workers;
+        } else if (strcmp(argv[i], "--job-cycles") == 0 || strcmp(argv[i], "--job-lines") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires a count argument\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            uint64_t *limit = strcmp(argv[i], "--job-cycles") == 0 ? &serve.max_cycles : &serve.max_lines;
+            if (!parse_cycles(argv[++i], limit)) {
+                fprintf(stderr, "Error: Invalid count '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--slice-cycles") == 0 || strcmp(argv[i], "--slice-lines") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires a count argument\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            uint64_t *quantum = strcmp(argv[i], "--slice-cycles") == 0 ? &serve.slice_cycles : &serve.slice_lines;
+            if (!parse_cycles(argv[++i], quantum) || *quantum == 0) {
+                fprintf(stderr, "Error: Invalid count '%s'\n", argv[i]);
+                return 1;
+            }
         } else {
             fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
             print_usage(argv[0]);
@@ -154,43 +975,194 @@ int main(int argc, char *argv[]) {
         }
     }
     
+    if (stats_file) {
+        if (!counters_open(stats_file, "6502emu")) return 1;
+        atexit(counters_close);
+    }
+    if (serve.socket_path) {
+        return server_run(&serve);
+    }
+    if (reset && start_arg) {
+        fprintf(stderr, "Error: --reset and --start cannot be combined\n");
+        return 1;
+    }
+    if (disk_file && io_page < 0) {
+        fprintf(stderr, "Error: --disk requires --io\n");
+        return 1;
+    }
+    if (journal_path && io_page < 0) {
+        fprintf(stderr, "Error: --record and --replay require --io\n");
+        return 1;
+    }
+    if (io_page >= 0 && lanes) {
+        fprintf(stderr, "Error: --io cannot be combined with --lanes\n");
+        return 1;
+    }
+    if (debug && !load_file) {
+        fprintf(stderr, "Error: --debug requires --load\n");
+        return 1;
+    }
+    if (debug && max_cycles) {
+        fprintf(stderr, "Error: --debug cannot be combined with --cycles\n");
+        return 1;
+    }
+    // Going back replays from a checkpoint, which would repeat console
+    // reads and alarm and disk commands: neither the device registers nor
+    // the journal position nor the disk file are part of a checkpoint
+    if (debug && io_page >= 0) {
+        fprintf(stderr, "Error: --debug cannot be combined with --io\n");
+        return 1;
+    }
+    // Breakpoints and profiles need every instruction stepped
+    if (aot_file && (!max_cycles || lanes || break_count || profile)) {
+        fprintf(stderr, "Error: --aot requires --cycles and cannot be combined with --lanes, --break or --profile\n");
+        return 1;
+    }
+    const AotModule *aot = NULL;
+    if (aot_file) {
+        if (!(aot = aot_load(aot_file, "aot_module"))) return 1;
+        if (aot->model != model) {
+            fprintf(stderr, "Error: '%s' was compiled for the other CPU model\n", aot_file);
+            return 1;
+        }
+    }
+    
+    // Labels first, so that addresses can be given by name
+    static Inspect inspect;
+    if (label_count) {
+        if (!(inspect.symbols = symbols_create())) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        for (int i = 0; i < label_count; i++) {
+            if (!symbols_load(inspect.symbols, label_files[i])) return 1;
+        }
+    }
+    if (start_arg && !symbols_resolve(inspect.symbols, start_arg, &start)) {
+        fprintf(stderr, "Error: Invalid start address '%s' (must be 0x0000-0xFFFF or a label)\n", start_arg);
+        return 1;
+    }
+    for (int i = 0; i < break_count; i++) {
+        uint16_t address;
+        if (!symbols_resolve(inspect.symbols, break_args[i], &address)) {
+            fprintf(stderr, "Error: Invalid breakpoint '%s' (must be 0x0000-0xFFFF or a label)\n", break_args[i]);
+            return 1;
+        }
+        inspect.breakpoints[address >> 6] |= 1ULL << (address & 63);
+        inspect.has_breakpoints = 1;
+    }
+    if (profile) {
+        inspect.profile_cycles = calloc(MEMORY_SIZE, sizeof(uint64_t));
+        inspect.profile_count = calloc(MEMORY_SIZE, sizeof(uint64_t));
+        if (!inspect.profile_cycles || !inspect.profile_count) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+    }
+    
     // Initialize emulator
     memory_init();
     cpu_init(&cpu);
+    cpu_set_model(&cpu, model);
+    cpu.idle_skip = idle_skip;
+    cpu_set_illegal_policy(&cpu, illegal_policy, NULL, NULL);
     
     if (load_file) {
         // Load binary file
-        if (!load_binary_file(load_file, offset)) {
+        uint16_t entry;
+        if (!image_load(load_file, format, offset, &entry)) {
             return 1;
         }
         
-        // Set PC to start execution at the load offset
-        cpu.PC = offset;
-        printf("Starting execution at address 0x%04X\n", cpu.PC);
+        // Start at the image's start address, --start or the reset vector.
+        // The vector is read before devices are mapped, so an I/O page over
+        // it does not hide the ROM's.
+        if (reset) {
+            cpu_reset(&cpu);
+        } else {
+            cpu.PC = start_arg ? start : entry;
+        }
+        
+        // Devices are mapped after loading, so the image can fill RAM under them
+        Devices *devices = NULL;
+        Journal *journal = NULL;
+        if (io_page >= 0) {
+            if (journal_path && !(journal = journal_open(journal_path, journal_mode))) return 1;
+            if (!(devices = devices_open(&cpu, disk_file, journal))) return 1;
+            devices_map(devices, (uint8_t)io_page);
+        }
+        
+        char suffix[300];
+        printf("Starting execution at address 0x%04X%s\n", cpu.PC, symbol_suffix(&inspect, cpu.PC, suffix, sizeof(suffix)));
         
         // Execute program
         printf("\nInitial state:\n");
         printf("PC: 0x%04X  A: 0x%02X  X: 0x%02X  Y: 0x%02X  SP: 0x%02X  Status: 0x%02X\n",
                cpu.PC, cpu.A, cpu.X, cpu.Y, cpu.SP, cpu.status);
         
+        if (debug) {
+            // BRK stops the program, as in a trace
+            cpu.halt_on_brk = 1;
+            return run_debugger(&cpu, &inspect, checkpoint_interval, (size_t)history_size) ? 0 : 1;
+        }
+        if (max_cycles && lanes) {
+            return run_sweep(&cpu, (int)lanes, vary, max_cycles) ? 0 : 1;
+        }
+        if (max_cycles) {
+            // A run with devices depends on its input and disk, and one with
+            // breakpoints or a profile reports more than the cache stores,
+            // so they are never cached
+            int cacheable = !devices && !inspect.has_breakpoints && !profile;
+            ResultCache *cache = NULL;
+            if (cache_dir && cacheable && !(cache = cache_open(cache_dir, cache_size))) return 1;
+            run_batch(&cpu, max_cycles, cache, &inspect, aot);
+            cache_close(cache);
+            devices_close(devices);
+            journal_close(journal);
+            return 0;
+        }
+        
         // Run for a reasonable number of instructions (or until BRK)
         for (int i = 0; i < 1000; i++) {
+            if (i > 0 && inspect.has_breakpoints && is_breakpoint(&inspect, cpu.PC)) {
+                printf("\nStopped at breakpoint 0x%04X%s\n", cpu.PC, symbol_suffix(&inspect, cpu.PC, suffix, sizeof(suffix)));
+                break;
+            }
+            // The instruction about to run, read from RAM so that device
+            // registers are left untouched
+            uint8_t code[3];
+            char text[DISASM_MAX];
+            uint16_t pc = cpu.PC;
+            memory_copy_out(pc, code, sizeof(code));
+            disassemble(cpu.model, pc, code, text, sizeof(text));
             uint8_t opcode = memory_read(cpu.PC);
             cpu_step(&cpu);
-            printf("PC: 0x%04X  A: 0x%02X  X: 0x%02X  Y: 0x%02X  SP: 0x%02X  Status: 0x%02X  Cycles: %lu\n",
-                   cpu.PC, cpu.A, cpu.X, cpu.Y, cpu.SP, cpu.status, cpu.cycles);
+            printf("%04X  %-15s PC: 0x%04X%s  A: 0x%02X  X: 0x%02X  Y: 0x%02X  SP: 0x%02X  Status: 0x%02X  Cycles: %lu\n",
+                   pc, text, cpu.PC, symbol_suffix(&inspect, cpu.PC, suffix, sizeof(suffix)),
+                   cpu.A, cpu.X, cpu.Y, cpu.SP, cpu.status, cpu.cycles);
             
             // Stop on BRK instruction (0x00)
             if (opcode == 0x00) {
                 printf("\nProgram terminated (BRK instruction)\n");
                 break;
             }
+            
+            if (cpu.halted) {
+                printf("\nCPU halted (illegal opcode 0x%02X %s at 0x%04X)\n", opcode,
+                       opcode_info(cpu.model, opcode)->mnemonic, cpu.PC);
+                break;
+            }
         }
+        devices_close(devices);
+        journal_close(journal);
     } else {
         // Run default test program
         if (offset_specified) {
             fprintf(stderr, "Warning: --offset specified without --load, ignoring offset\n");
         }
+        if (io_page >= 0) {
+            fprintf(stderr, "Warning: --io specified without --load, ignoring devices\n");
+        }
         run_default_program(&cpu);
     }
     
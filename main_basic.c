@@ -1,56 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
 #include "basic.h"
+#include "memory.h"
+#include "cache.h"
+#include "counters.h"
 
-const char *test_program = 
-"10 PRINT \"6502 BASIC INTERPRETER\"\n"
-"20 PRINT \"======================\"\n"
-"30 PRINT\n"
-"40 LET A = 10\n"
-"50 LET B = 20\n"
-"60 PRINT \"A = \"; A\n"
-"70 PRINT \"B = \"; B\n"
-"80 LET C = A + B\n"
-"90 PRINT \"A + B = \"; C\n"
-"100 PRINT\n"
-"110 PRINT \"Counting from 1 to 5:\"\n"
-"120 FOR I = 1 TO 5\n"
-"130 PRINT I\n"
-"140 NEXT I\n"
-"150 PRINT\n"
-"160 PRINT \"Testing conditionals:\"\n"
-"170 LET X = 15\n"
-"180 IF X > 10 THEN PRINT \"X is greater than 10\"\n"
-"190 IF X < 10 THEN PRINT \"X is less than 10\"\n"
-"200 PRINT\n"
-"210 PRINT \"Fibonacci sequence:\"\n"
-"220 LET F = 0\n"
-"230 LET G = 1\n"
-"240 FOR J = 1 TO 10\n"
-"250 PRINT F; \" \";\n"
-"260 LET H = F + G\n"
-"270 LET F = G\n"
-"280 LET G = H\n"
-"290 NEXT J\n"
-"300 PRINT\n"
-"310 PRINT\n"
-"320 PRINT \"Done!\"\n"
-"330 END\n";
-
-const char *interactive_program =
-"10 PRINT \"ENTER YOUR NAME:\"\n"
-"20 INPUT N\n"
-"30 PRINT \"HELLO USER\"; N\n"
-"40 PRINT \"ENTER A NUMBER:\"\n"
-"50 INPUT A\n"
-"60 PRINT \"ENTER ANOTHER NUMBER:\"\n"
-"70 INPUT B\n"
-"80 PRINT \"THE SUM IS: \"; A + B\n"
-"90 PRINT \"THE PRODUCT IS: \"; A * B\n"
-"100 END\n";
-
-char* load_file(const char *filename) {
+// Reads filename whole, NUL terminated; size, if given, is set to its length
+char* load_file(const char *filename, size_t *size_out) {
     FILE *f = fopen(filename, "r");
     if (!f) {
         printf("Error: Could not open file '%s'\n", filename);
@@ -71,63 +31,596 @@ char* load_file(const char *filename) {
     fread(buffer, 1, size, f);
     buffer[size] = 0;
     fclose(f);
+    if (size_out) *size_out = size;
     
     return buffer;
 }
 
-void print_menu() {
-    printf("\n6502 BASIC INTERPRETER\n");
-    printf("======================\n");
-    printf("1. Run demo program\n");
-    printf("2. Run interactive program\n");
-    printf("3. Exit\n");
-    printf("\nSelect option: ");
+// Program output, echoed to stdout and kept for the result cache
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} OutputLog;
+
+static void log_output(void *ctx, const char *text, int len) {
+    OutputLog *log = ctx;
+    if (log->len + len > log->cap) {
+        size_t cap = log->cap ? log->cap * 2 : 4096;
+        while (cap < log->len + len) cap *= 2;
+        char *data = realloc(log->data, cap);
+        if (!data) return;
+        log->data = data;
+        log->cap = cap;
+    }
+    memcpy(log->data + log->len, text, len);
+    log->len += len;
+    counters_add(COUNTER_OUTPUT_BYTES, len);
+}
+
+static void tee_output(void *ctx, const char *text, int len) {
+    fwrite(text, 1, len, stdout);
+    log_output(ctx, text, len);
+}
+
+static void print_output(void *ctx, const char *text, int len) {
+    (void)ctx;
+    fwrite(text, 1, len, stdout);
+    counters_add(COUNTER_OUTPUT_BYTES, len);
+}
+
+typedef struct {
+    Journal *journal;
+    int lines;
+} InputLog;
+
+static int counted_input(void *ctx, uint16_t line_num, char *buf, int size) {
+    InputLog *log = ctx;
+    log->lines++;
+    int result = journal_read_line(log->journal, "INPUT", line_num, buf, size);
+    if (result > 0) counters_add(COUNTER_INPUT_BYTES, strlen(buf));
+    return result;
+}
+
+// basic_continue to the end, in slices that keep the counters file current
+// if there is one
+static BasicStatus run_counted(BasicInterp *bi) {
+    uint64_t slice = counters_active() ? COUNTERS_UPDATE_LINES : 0;
+    BasicStatus status;
+    do {
+        uint64_t before = basic_lines_executed(bi);
+        status = basic_continue(bi, slice);
+        counters_add(COUNTER_BASIC_LINES, basic_lines_executed(bi) - before);
+    } while (status == BASIC_RUNNING);
+    return status;
+}
+
+// Whether path holds a compiled image rather than source
+static int is_image(const char *path) {
+    char magic[8];
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    int image = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                memcmp(magic, BASIC_IMAGE_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return image;
+}
+
+// Compile the source in path, or map it if it is an image
+static BasicProgram *load_program(const char *path, BasicMode mode) {
+    if (is_image(path)) return basic_program_map(path);
+    char *source = load_file(path, NULL);
+    if (!source) return NULL;
+    BasicProgram *prog = basic_compile(source, mode);
+    if (!prog) fprintf(stderr, "Error: Out of memory\n");
+    free(source);
+    return prog;
+}
+
+// Run program (program_len bytes of source, or of the image at image_path),
+// or print the output of an identical earlier run. The key covers the
+// emulator build, the program and, when replaying, the journal. Input typed
+// at the keyboard is not known up front, so runs that read any are not stored.
+void run_cached(const char *program, size_t program_len, const char *image_path, BasicMode mode,
+                Journal *journal, const char *replay_path, ResultCache *cache) {
+    Hasher h;
+    hash_init(&h, 0);
+    hash_update(&h, "6502basic", 9);
+    cache_hash_build(&h);
+    hash_u64(&h, mode);
+    hash_u64(&h, program_len);
+    hash_update(&h, program, program_len);
+    if (replay_path) {
+        char *input = load_file(replay_path, NULL);
+        if (!input) return;
+        hash_u64(&h, strlen(input));
+        hash_update(&h, input, strlen(input));
+        free(input);
+    } else {
+        hash_u64(&h, UINT64_MAX); // No journal
+    }
+    Hash128 key = hash_final(&h);
+    
+    // Stored as the final memory hash followed by the output text
+    size_t size;
+    char *data = cache_lookup(cache, key, &size);
+    if (data && size >= sizeof(uint64_t)) {
+        fwrite(data + sizeof(uint64_t), 1, size - sizeof(uint64_t), stdout);
+        free(data);
+        return;
+    }
+    free(data);
+    
+    OutputLog output = { NULL, 0, 0 };
+    InputLog input = { journal, 0 };
+    BasicInterp *bi = basic_create();
+    if (!bi) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    memory_init();
+    basic_set_output(bi, tee_output, &output);
+    basic_set_input(bi, counted_input, &input);
+    basic_set_numeric_mode(bi, mode);
+    if (image_path) {
+        if (!basic_map_image(bi, image_path)) {
+            basic_destroy(bi);
+            return;
+        }
+    } else {
+        basic_load(bi, program);
+    }
+    basic_start(bi);
+    run_counted(bi);
+    basic_destroy(bi);
+    
+    if (replay_path || input.lines == 0) {
+        char *entry = malloc(sizeof(uint64_t) + output.len);
+        if (entry) {
+            uint64_t hash = memory_hash();
+            memcpy(entry, &hash, sizeof(hash));
+            if (output.len) memcpy(entry + sizeof(hash), output.data, output.len);
+            cache_store(cache, key, entry, sizeof(hash) + output.len);
+            free(entry);
+        }
+    }
+    free(output.data);
+}
+
+// Run program (source, or the image at image_path) with INPUT from journal
+void run_program(const char *program, const char *image_path, BasicMode mode, Journal *journal) {
+    InputLog input = { journal, 0 };
+    BasicInterp *bi = basic_create();
+    if (!bi) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    memory_init();
+    basic_set_output(bi, print_output, NULL);
+    basic_set_input(bi, counted_input, &input);
+    basic_set_numeric_mode(bi, mode);
+    if (image_path) {
+        if (!basic_map_image(bi, image_path)) {
+            basic_destroy(bi);
+            return;
+        }
+    } else {
+        basic_load(bi, program);
+    }
+    basic_start(bi);
+    run_counted(bi);
+    basic_destroy(bi);
+}
+
+// --parallel: every line of the inputs file is one run of the program, with
+// the answers to its INPUT statements separated by commas
+typedef struct {
+    const char *answers;
+    OutputLog output;
+} ParallelRun;
+
+typedef struct {
+    const BasicProgram *prog;
+    ParallelRun *runs;
+    int run_count;
+    pthread_mutex_t lock;   // Protects next
+    int next;               // First run not yet taken by a worker
+} ParallelJob;
+
+// Supplies a run's answers one at a time; the line ends its input
+static int next_answer(void *ctx, uint16_t line_num, char *buf, int size) {
+    const char **answers = ctx;
+    (void)line_num;
+    if (!*answers) return 0;
+    const char *end = strchr(*answers, ',');
+    int len = end ? (int)(end - *answers) : (int)strlen(*answers);
+    snprintf(buf, size, "%.*s", len, *answers);
+    *answers = end ? end + 1 : NULL;
+    counters_add(COUNTER_INPUT_BYTES, strlen(buf));
+    return 1;
+}
+
+// Each worker has its own interpreter and address space; the program is shared
+static void *parallel_worker(void *arg) {
+    ParallelJob *job = arg;
+    Memory *mem = memory_create(1);
+    BasicInterp *bi = basic_create();
+    if (!mem || !bi) {
+        fprintf(stderr, "Error: Out of memory\n");
+        memory_free(mem);
+        basic_destroy(bi);
+        return NULL;
+    }
+    memory_bind(mem);
+
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->run_count) break;
+
+        ParallelRun *run = &job->runs[i];
+        const char *answers = run->answers;
+        memory_init();
+        basic_reset(bi);
+        basic_set_output(bi, log_output, &run->output);
+        basic_set_input(bi, next_answer, &answers);
+        basic_attach(bi, job->prog);
+        basic_start(bi);
+        run_counted(bi);
+    }
+
+    basic_destroy(bi);
+    memory_bind(NULL);
+    memory_free(mem);
+    return NULL;
+}
+
+// Run prog once per line of inputs on threads workers, then print each run's
+// output in input order
+void run_parallel(const BasicProgram *prog, char *inputs, int threads) {
+    ParallelJob job = { prog, NULL, 0, PTHREAD_MUTEX_INITIALIZER, 0 };
+    int cap = 0;
+    for (char *line = inputs; *line; ) {
+        char *end = strchr(line, '\n');
+        if (end) *end = 0;
+        if (end > line && end[-1] == '\r') end[-1] = 0;
+        if (job.run_count == cap) {
+            cap = cap ? cap * 2 : 64;
+            ParallelRun *runs = realloc(job.runs, cap * sizeof(ParallelRun));
+            if (!runs) {
+                fprintf(stderr, "Error: Out of memory\n");
+                free(job.runs);
+                return;
+            }
+            job.runs = runs;
+        }
+        ParallelRun *run = &job.runs[job.run_count++];
+        run->answers = line;
+        memset(&run->output, 0, sizeof(run->output));
+        if (!end) break;
+        line = end + 1;
+    }
+
+    if (threads > job.run_count) threads = job.run_count;
+    pthread_t *workers = malloc(threads * sizeof(pthread_t) + 1);
+    int started = 0;
+    while (workers && started < threads &&
+           pthread_create(&workers[started], NULL, parallel_worker, &job) == 0) {
+        started++;
+    }
+    if (started == 0 && job.run_count > 0) {
+        fprintf(stderr, "Error: Cannot start worker threads\n");
+    }
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    free(workers);
+
+    for (int i = 0; i < job.run_count && started > 0; i++) {
+        ParallelRun *run = &job.runs[i];
+        printf("Run %d: %s\n", i + 1, run->answers);
+        fwrite(run->output.data, 1, run->output.len, stdout);
+    }
+    for (int i = 0; i < job.run_count; i++) free(job.runs[i].output.data);
+    free(job.runs);
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS] [FILE]\n", program_name);
+    printf("\nRuns the BASIC program in FILE, or without FILE starts immediate mode,\n");
+    printf("where numbered lines edit a program and LIST, RUN, NEW, LOAD, SAVE and\n");
+    printf("BYE work as commands. FILE may be source or an image written by --compile.\n");
+    printf("\nOptions:\n");
+    printf("  --record JOURNAL  Save every line of input read to JOURNAL\n");
+    printf("  --replay JOURNAL  Read input from JOURNAL instead of the keyboard\n");
+    printf("  --cache DIR       Reuse the output of identical runs of FILE stored in DIR\n");
+    printf("  --classic         Classic 6502 BASIC numbers: A-Z are reals, A%%-Z%% 16-bit\n");
+    printf("                    integers, and / divides exactly\n");
+    printf("  --compile IMAGE   Compile FILE to IMAGE, which later runs start without parsing\n");
+    printf("  --parallel N      Run FILE once per line of --inputs on N threads\n");
+    printf("  --inputs FILE     One line per run: answers to its INPUTs, separated by commas\n");
+    printf("  --stats FILE      Publish live counters in FILE while running; read them with 6502stat\n");
+    printf("  --help            Display this help message\n");
+}
+
+// Immediate mode commands
+static void list_program(const BasicSource *src, char *args) {
+    // LIST, LIST N, LIST N-, LIST -M or LIST N-M
+    int from = 0, to = BASIC_MAX_LINE_NUM;
+    char *end = args;
+    if (isdigit((unsigned char)*args)) from = to = (int)strtol(args, &end, 10);
+    while (*end == ' ') end++;
+    if (*end == '-') {
+        args = end + 1;
+        while (*args == ' ') args++;
+        to = isdigit((unsigned char)*args) ? (int)strtol(args, NULL, 10) : BASIC_MAX_LINE_NUM;
+    }
+
+    int line_num;
+    for (uint32_t i = basic_source_find(src, from); ; i++) {
+        const char *text = basic_source_line(src, i, &line_num);
+        if (!text || line_num > to) break;
+        printf("%d %s\n", line_num, text);
+    }
+}
+
+static void save_program(const BasicSource *src, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("Error: Could not create file '%s'\n", path);
+        return;
+    }
+    int line_num;
+    const char *text;
+    for (uint32_t i = 0; (text = basic_source_line(src, i, &line_num)); i++) {
+        fprintf(f, "%d %s\n", line_num, text);
+    }
+    if (fclose(f) != 0) printf("Error: Could not write file '%s'\n", path);
+}
+
+static void load_source(BasicSource *src, const char *path) {
+    if (is_image(path)) {
+        printf("Error: '%s' is a compiled image; LOAD needs source\n", path);
+        return;
+    }
+    char *text = load_file(path, NULL);
+    if (!text) return;
+    basic_source_clear(src);
+    if (basic_source_merge(src, text) != 0) printf("Error: Could not load all of '%s'\n", path);
+    free(text);
+}
+
+// The argument of LOAD or SAVE, with or without quotes
+static char *file_argument(char *args) {
+    if (*args == '"') {
+        args++;
+        args[strcspn(args, "\"")] = 0;
+    }
+    return *args ? args : NULL;
+}
+
+// Whether line starts with command, in any case, followed by args
+static int is_command(char *line, const char *command, char **args) {
+    size_t len = strlen(command);
+    if (strncasecmp(line, command, len) != 0 || isalnum((unsigned char)line[len])) return 0;
+    *args = line + len;
+    while (**args == ' ') (*args)++;
+    return 1;
+}
+
+// Numbered lines change the program one line at a time; RUN and direct
+// statements compile it with the lines as they stand. Variables carry over
+// from one direct statement to the next, and RUN clears them.
+void immediate_mode(Journal *journal, BasicMode mode) {
+    BasicSource *src = basic_source_create(mode);
+    BasicInterp *bi = basic_create();
+    if (!src || !bi) {
+        fprintf(stderr, "Error: Out of memory\n");
+        basic_source_free(src);
+        basic_destroy(bi);
+        return;
+    }
+    memory_init();
+    InputLog input_log = { journal, 0 };
+    basic_set_output(bi, print_output, NULL);
+    basic_set_input(bi, counted_input, &input_log);
+    BasicProgram *prog = NULL;
+
+    printf("6502 BASIC\nREADY.\n");
+    char input[256];
+    // Typed lines go through the journal too, so whole sessions replay
+    while (journal_read_line(journal, "LINE", 0, input, sizeof(input))) {
+        char *line = input;
+        while (*line == ' ') line++;
+        if (!*line) continue;
+
+        char *args;
+        if (isdigit((unsigned char)*line)) {
+            char *text;
+            long line_num = strtol(line, &text, 10);
+            if (line_num > BASIC_MAX_LINE_NUM || basic_source_set_line(src, (int)line_num, text) != 0) {
+                printf("Error: Line numbers go from 0 to %d\n", BASIC_MAX_LINE_NUM);
+            }
+            continue;
+        } else if (is_command(line, "BYE", &args)) {
+            break;
+        } else if (is_command(line, "LIST", &args)) {
+            list_program(src, args);
+        } else if (is_command(line, "NEW", &args)) {
+            basic_source_clear(src);
+            basic_reset(bi);
+        } else if (is_command(line, "LOAD", &args) || is_command(line, "SAVE", &args)) {
+            char *path = file_argument(args);
+            if (!path) printf("Error: %.4s needs a file name\n", line);
+            else if (toupper((unsigned char)*line) == 'L') load_source(src, path);
+            else save_program(src, path);
+        } else {
+            // RUN [LINE] or a direct statement: compile, then carry on from
+            // where the variables are
+            int run = is_command(line, "RUN", &args);
+            BasicProgram *next = basic_source_compile(src, run ? NULL : line);
+            if (!next) {
+                fprintf(stderr, "Error: Out of memory\n");
+                continue;
+            }
+            if (run) basic_reset(bi);
+            basic_attach(bi, next);
+            basic_program_free(prog);
+            prog = next;
+            int line_num = run ? (*args ? atoi(args) : -1) : BASIC_DIRECT_LINE;
+            if (line_num < 0) {
+                basic_start(bi);
+                run_counted(bi);
+            } else if (basic_start_at(bi, line_num)) {
+                run_counted(bi);
+            } else {
+                printf("Line %d not found\n", line_num);
+            }
+        }
+        printf("READY.\n");
+    }
+
+    basic_destroy(bi);
+    basic_program_free(prog);
+    basic_source_free(src);
 }
 
 int main(int argc, char *argv[]) {
-    // If filename provided, run it directly
-    if (argc > 1) {
-        char *program = load_file(argv[1]);
-        if (program) {
-            basic_init();
-            basic_load_program(program);
-            basic_run();
-            free(program);
+    const char *filename = NULL;
+    const char *journal_path = NULL;
+    JournalMode journal_mode = JOURNAL_OFF;
+    const char *cache_dir = NULL;
+    BasicMode mode = BASIC_MODE_INTEGER;
+    const char *compile_path = NULL;
+    int threads = 0;
+    const char *inputs_path = NULL;
+    const char *stats_file = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires a journal file argument\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            journal_mode = strcmp(argv[i], "--record") == 0 ? JOURNAL_RECORD : JOURNAL_REPLAY;
+            journal_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --cache requires a directory argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stats requires a filename argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            stats_file = argv[++i];
+        } else if (strcmp(argv[i], "--classic") == 0) {
+            mode = BASIC_MODE_CLASSIC;
+        } else if (strcmp(argv[i], "--compile") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --compile requires an image file argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            compile_path = argv[++i];
+        } else if (strcmp(argv[i], "--parallel") == 0) {
+            threads = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+            if (threads < 1) {
+                fprintf(stderr, "Error: --parallel requires a thread count of at least 1\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--inputs") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --inputs requires a file argument\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            inputs_path = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            filename = argv[i];
         }
-        return 0;
     }
     
-    // Otherwise, show menu
-    char choice[10];
+    if (stats_file) {
+        if (!counters_open(stats_file, "6502basic")) return 1;
+        atexit(counters_close);
+    }
     
-    while (1) {
-        print_menu();
-        if (!fgets(choice, sizeof(choice), stdin)) break;
-        
-        switch (choice[0]) {
-            case '1':
-                printf("\n");
-                basic_init();
-                basic_load_program(test_program);
-                basic_run();
-                break;
-                
-            case '2':
-                printf("\n");
-                basic_init();
-                basic_load_program(interactive_program);
-                basic_run();
-                break;
-                
-            case '3':
-                printf("Goodbye!\n");
-                return 0;
-                
-            default:
-                printf("Invalid option\n");
-                break;
+    if (compile_path) {
+        if (!filename) {
+            fprintf(stderr, "Error: --compile requires a FILE to compile\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        BasicProgram *prog = load_program(filename, mode);
+        int ok = prog && basic_program_save(prog, compile_path);
+        basic_program_free(prog);
+        return ok ? 0 : 1;
+    }
+    
+    if (threads || inputs_path) {
+        if (!threads || !inputs_path || !filename) {
+            fprintf(stderr, "Error: --parallel and --inputs go together, with a FILE to run\n");
+            print_usage(argv[0]);
+            return 1;
         }
+        if (journal_mode != JOURNAL_OFF || cache_dir) {
+            fprintf(stderr, "Error: --parallel runs take input from --inputs only, uncached\n");
+            return 1;
+        }
+        BasicProgram *prog = load_program(filename, mode);
+        char *inputs = prog ? load_file(inputs_path, NULL) : NULL;
+        if (inputs) run_parallel(prog, inputs, threads);
+        free(inputs);
+        basic_program_free(prog);
+        return prog && inputs ? 0 : 1;
+    }
+    
+    Journal *journal = NULL;
+    if (journal_mode != JOURNAL_OFF) {
+        journal = journal_open(journal_path, journal_mode);
+        if (!journal) return 1;
+    }
+    
+    // If filename provided, run it directly
+    if (filename) {
+        // Images are mapped, not read, unless their bytes are needed for the cache key
+        int image = is_image(filename);
+        // Recording needs the program to actually read its input
+        int cached = cache_dir && journal_mode != JOURNAL_RECORD;
+        size_t program_len = 0;
+        char *program = image && !cached ? NULL : load_file(filename, &program_len);
+        ResultCache *cache = NULL;
+        if (program && cached) {
+            cache = cache_open(cache_dir, 64 * 1024 * 1024);
+        }
+        if (program && cache) {
+            run_cached(program, program_len, image ? filename : NULL, mode, journal,
+                       journal_mode == JOURNAL_REPLAY ? journal_path : NULL, cache);
+            cache_close(cache);
+            free(program);
+        } else if (image || program) {
+            run_program(program, image ? filename : NULL, mode, journal);
+            free(program);
+        }
+        journal_close(journal);
+        return 0;
     }
     
+    immediate_mode(journal, mode);
+    journal_close(journal);
     return 0;
 }
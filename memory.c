@@ -1,22 +1,414 @@
 #include "memory.h"
+#include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <pthread.h>
 
-#define MEMORY_SIZE 65536
+// The binding is per thread so independent emulators can run concurrently.
+// initial-exec keeps memory_read a plain %fs-relative load in the shared
+// library too.
+static Memory default_memory;
+static __thread Memory *active __attribute__((tls_model("initial-exec"))) = &default_memory;
 
-static uint8_t memory[MEMORY_SIZE];
+// Hash of each page when it holds only zeros, and of all of them, computed
+// on first use
+static uint64_t zero_page_hash[MEMORY_PAGES];
+static uint64_t zero_hash;
+static pthread_once_t zero_hashes_once = PTHREAD_ONCE_INIT;
+
+// What every unwritten page of a sparse address space points to. Never
+// written: writes give the page one of its own first.
+static MemoryPage zero_page;
+
+// Free pages of sparse address spaces, per thread, up to MAX_FREE_PAGES;
+// the rest go back to malloc. A thread's list is freed when it exits.
+#define MAX_FREE_PAGES 1024
+static __thread MemoryPage *free_pages;
+static __thread int free_page_count;
+static pthread_key_t free_pages_key;
+static pthread_once_t free_pages_once = PTHREAD_ONCE_INIT;
+
+// The hash of a page is the sum of mix(address, value) over its bytes, so a
+// write updates it by subtracting the old term and adding the new one
+static inline uint64_t mix(uint16_t address, uint8_t value) {
+    // MurmurHash3 finalizer
+    uint64_t h = ((uint64_t)address << 8 | value) + 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t hash_bytes(const uint8_t *bytes, int page) {
+    uint64_t hash = 0;
+    for (int i = 0; i < MEMORY_PAGE_SIZE; i++) {
+        hash += mix((uint16_t)(page * MEMORY_PAGE_SIZE + i), bytes[i]);
+    }
+    return hash;
+}
+
+// RAM of a page, for reading
+static const uint8_t *page_bytes(const Memory *mem, int page) {
+    return mem->sparse ? mem->page[page]->bytes : &mem->ram[page * MEMORY_PAGE_SIZE];
+}
+
+static uint64_t *page_hash(Memory *mem, int page) {
+    if (!mem->sparse) return &mem->page_hash[page];
+    // Only asked of the zero page by readers
+    return mem->page[page] == &zero_page ? &zero_page_hash[page] : &mem->page[page]->hash;
+}
+
+static MemoryDevice **devices(Memory *mem) {
+    return mem->sparse ? mem->sparse_device : mem->device;
+}
+
+static void free_page_list(void *unused) {
+    (void)unused;
+    while (free_pages) {
+        MemoryPage *next = free_pages->next;
+        free(free_pages);
+        free_pages = next;
+    }
+    free_page_count = 0;
+}
+
+static void create_free_pages_key(void) {
+    pthread_key_create(&free_pages_key, free_page_list);
+}
+
+static void release_page(MemoryPage *page) {
+    if (free_page_count >= MAX_FREE_PAGES) {
+        free(page);
+        return;
+    }
+    if (!free_pages) {
+        // Any non-NULL value makes the key's destructor run at thread exit
+        pthread_once(&free_pages_once, create_free_pages_key);
+        pthread_setspecific(free_pages_key, &free_pages);
+    }
+    page->next = free_pages;
+    free_pages = page;
+    free_page_count++;
+}
+
+// Give page of a sparse address space RAM of its own; 0 if out of memory
+static int own_page(Memory *mem, int page) {
+    if (mem->page[page] != &zero_page) return 1;
+    MemoryPage *p = free_pages;
+    if (p) {
+        free_pages = p->next;
+        free_page_count--;
+    } else {
+        p = malloc(sizeof(MemoryPage));
+        if (!p) return 0;
+    }
+    memset(p->bytes, 0, sizeof(p->bytes));
+    p->hash = zero_page_hash[page];
+    mem->page[page] = p;
+    return 1;
+}
+
+static void mark_dirty(Memory *mem, uint8_t page) {
+    uint64_t bit = 1ULL << (page & 63);
+    if (!(mem->dirty[page >> 6] & bit)) {
+        mem->dirty[page >> 6] |= bit;
+        mem->dirty_list[mem->dirty_count++] = page;
+    }
+}
+
+static int is_stale(const Memory *mem, uint8_t page) {
+    return mem->stale[page >> 6] >> (page & 63) & 1;
+}
+
+static void update_slow(Memory *mem) {
+    uint64_t stale = 0;
+    for (int i = 0; i < MEMORY_PAGES / 64; i++) stale |= mem->stale[i];
+    mem->read_slow = mem->sparse || mem->device_pages != 0;
+    mem->slow = mem->read_slow || stale != 0 || mem->undo != NULL;
+}
+
+// Bring the hashes of the pages memory_copy_in wrote up to date
+static void refresh_hashes(Memory *mem) {
+    for (int i = 0; i < MEMORY_PAGES / 64; i++) {
+        while (mem->stale[i]) {
+            int page = i * 64 + __builtin_ctzll(mem->stale[i]);
+            mem->stale[i] &= mem->stale[i] - 1;
+            uint64_t hash = hash_bytes(page_bytes(mem, page), page);
+            uint64_t *old = page_hash(mem, page);
+            mem->hash += hash - *old;
+            *old = hash;
+        }
+    }
+    update_slow(mem);
+}
+
+static void compute_zero_hashes(void) {
+    static const uint8_t zeros[MEMORY_PAGE_SIZE];
+    for (int page = 0; page < MEMORY_PAGES; page++) {
+        zero_page_hash[page] = hash_bytes(zeros, page);
+        zero_hash += zero_page_hash[page];
+    }
+}
+
+static void init_memory(Memory *mem) {
+    pthread_once(&zero_hashes_once, compute_zero_hashes);
+
+    if (mem->sparse) {
+        // Only the pages written are touched
+        for (int page = 0; page < MEMORY_PAGES; page++) {
+            if (mem->page[page] != &zero_page) release_page(mem->page[page]);
+            mem->page[page] = &zero_page;
+        }
+        free(mem->sparse_device);
+        mem->sparse_device = NULL;
+    } else {
+        memset(mem->ram, 0, MEMORY_SIZE);
+        memcpy(mem->page_hash, zero_page_hash, sizeof(zero_page_hash));
+        memset(mem->device, 0, sizeof(mem->device));
+    }
+    mem->hash = zero_hash;
+    memset(mem->dirty, 0, sizeof(mem->dirty));
+    mem->dirty_count = 0;
+    memset(mem->stale, 0, sizeof(mem->stale));
+    mem->device_pages = 0;
+    mem->undo = NULL;
+    update_slow(mem);
+}
 
 void memory_init(void) {
-    memset(memory, 0, MEMORY_SIZE);
+    init_memory(active);
+}
+
+Memory *memory_create(int sparse) {
+    Memory *mem = sparse ? calloc(1, offsetof(Memory, page_hash)) : calloc(1, sizeof(Memory));
+    if (!mem) return NULL;
+    mem->sparse = sparse != 0;
+    for (int page = 0; page < MEMORY_PAGES; page++) mem->page[page] = &zero_page;
+    init_memory(mem);
+    return mem;
+}
+
+void memory_free(Memory *mem) {
+    if (!mem) return;
+    if (mem->sparse) {
+        for (int page = 0; page < MEMORY_PAGES; page++) {
+            if (mem->page[page] != &zero_page) release_page(mem->page[page]);
+        }
+        free(mem->sparse_device);
+    }
+    free(mem);
+}
+
+// memory_read for address spaces with devices or sparse RAM
+static uint8_t read_slow(Memory *mem, uint16_t address) {
+    if (mem->device_pages) {
+        MemoryDevice *device = devices(mem)[address >> 8];
+        if (device) {
+            if (!device->stable || !device->stable(device, address)) mem->unstable_reads++;
+            return device->read(device, address);
+        }
+    }
+    if (mem->sparse) return mem->page[address >> 8]->bytes[address & 0xFF];
+    return mem->ram[address];
 }
 
 uint8_t memory_read(uint16_t address) {
-    return memory[address];
+    Memory *mem = active;
+    if (__builtin_expect(mem->read_slow != 0, 0)) return read_slow(mem, address);
+    return mem->ram[address];
 }
 
 void memory_write(uint16_t address, uint8_t value) {
-    memory[address] = value;
+    memory_write_to(active, address, value);
+}
+
+static void log_undo(MemoryUndoLog *log, uint16_t address, uint8_t old) {
+    if (log->count == log->cap) {
+        log->overflow = 1;
+        return;
+    }
+    log->entries[log->count++] = (uint32_t)address << 8 | old;
+}
+
+// memory_write_to for address spaces with devices, stale hashes, sparse RAM
+// or an undo log
+static void write_slow(Memory *mem, uint16_t address, uint8_t value) {
+    uint8_t page = address >> 8;
+    if (mem->device_pages) {
+        MemoryDevice *device = devices(mem)[page];
+        if (device) {
+            device->write(device, address, value);
+            return;
+        }
+    }
+    uint8_t *bytes;
+    if (mem->sparse) {
+        if (mem->page[page]->bytes[address & 0xFF] == value) return;
+        // A write the host has no memory for is dropped
+        if (!own_page(mem, page)) return;
+        bytes = &mem->page[page]->bytes[address & 0xFF];
+    } else {
+        bytes = &mem->ram[address];
+    }
+    uint8_t old = *bytes;
+    if (old == value) return;
+
+    if (mem->undo) log_undo(mem->undo, address, old);
+    *bytes = value;
+    mark_dirty(mem, page);
+    if (is_stale(mem, page)) return;
+    uint64_t delta = mix(address, value) - mix(address, old);
+    *page_hash(mem, page) += delta;
+    mem->hash += delta;
+}
+
+void memory_write_to(Memory *mem, uint16_t address, uint8_t value) {
+    if (__builtin_expect(mem->slow != 0, 0)) {
+        write_slow(mem, address, value);
+        return;
+    }
+    uint8_t old = mem->ram[address];
+    if (old == value) return;
+
+    mem->ram[address] = value;
+    uint64_t delta = mix(address, value) - mix(address, old);
+    mem->page_hash[address >> 8] += delta;
+    mem->hash += delta;
+    mark_dirty(mem, address >> 8);
 }
 
 uint16_t memory_read_word(uint16_t address) {
-    return memory[address] | (memory[address + 1] << 8);
+    Memory *mem = active;
+    if (mem->read_slow) {
+        return read_slow(mem, address) | (read_slow(mem, (uint16_t)(address + 1)) << 8);
+    }
+    return mem->ram[address] | (mem->ram[(uint16_t)(address + 1)] << 8);
+}
+
+void memory_map(uint8_t first, int count, MemoryDevice *device) {
+    Memory *mem = active;
+    if (mem->sparse && !mem->sparse_device) {
+        if (!device) return;
+        mem->sparse_device = calloc(MEMORY_PAGES, sizeof(MemoryDevice *));
+        if (!mem->sparse_device) return;
+    }
+    MemoryDevice **table = devices(mem);
+    for (int page = first; page < first + count && page < MEMORY_PAGES; page++) {
+        mem->device_pages += (device != NULL) - (table[page] != NULL);
+        table[page] = device;
+    }
+    update_slow(mem);
+}
+
+int memory_has_devices(void) {
+    return active->device_pages != 0;
+}
+
+uint32_t memory_unstable_reads(void) {
+    return active->unstable_reads;
+}
+
+void memory_copy_in(uint16_t address, const void *data, size_t length) {
+    Memory *mem = active;
+    const uint8_t *src = data;
+    while (length > 0) {
+        size_t room = mem->sparse ? (size_t)(MEMORY_PAGE_SIZE - (address & 0xFF)) : MEMORY_SIZE - (size_t)address;
+        size_t chunk = room < length ? room : length;
+        uint8_t *dst;
+        if (mem->sparse) {
+            if (!own_page(mem, address >> 8)) return;
+            dst = &mem->page[address >> 8]->bytes[address & 0xFF];
+        } else {
+            dst = mem->ram + address;
+        }
+        if (mem->undo) {
+            for (size_t i = 0; i < chunk; i++) {
+                if (dst[i] != src[i]) log_undo(mem->undo, (uint16_t)(address + i), dst[i]);
+            }
+        }
+        memcpy(dst, src, chunk);
+        for (size_t page = address >> 8; page <= (address + chunk - 1) >> 8; page++) {
+            mark_dirty(mem, (uint8_t)page);
+            mem->stale[page >> 6] |= 1ULL << (page & 63);
+        }
+        mem->slow = 1;
+        src += chunk;
+        length -= chunk;
+        address = (uint16_t)(address + chunk);
+    }
+}
+
+void memory_copy_out(uint16_t address, void *data, size_t length) {
+    Memory *mem = active;
+    uint8_t *dst = data;
+    while (length > 0) {
+        size_t room = mem->sparse ? (size_t)(MEMORY_PAGE_SIZE - (address & 0xFF)) : MEMORY_SIZE - (size_t)address;
+        size_t chunk = room < length ? room : length;
+        memcpy(dst, page_bytes(mem, address >> 8) + (address & 0xFF), chunk);
+        dst += chunk;
+        length -= chunk;
+        address = (uint16_t)(address + chunk);
+    }
+}
+
+Memory *memory_bind(Memory *mem) {
+    Memory *previous = active;
+    active = mem ? mem : &default_memory;
+    return previous;
+}
+
+uint64_t memory_hash(void) {
+    refresh_hashes(active);
+    return active->hash;
+}
+
+uint64_t memory_page_hash(uint8_t page) {
+    refresh_hashes(active);
+    return *page_hash(active, page);
+}
+
+int memory_dirty_pages(uint8_t *pages) {
+    memcpy(pages, active->dirty_list, active->dirty_count);
+    return active->dirty_count;
+}
+
+void memory_clear_dirty(void) {
+    for (int i = 0; i < active->dirty_count; i++) {
+        uint8_t page = active->dirty_list[i];
+        active->dirty[page >> 6] &= ~(1ULL << (page & 63));
+    }
+    active->dirty_count = 0;
+}
+
+void memory_set_undo_log(MemoryUndoLog *log) {
+    active->undo = log;
+    update_slow(active);
+}
+
+void memory_undo(MemoryUndoLog *log, size_t count) {
+    Memory *mem = active;
+    MemoryUndoLog *logging = mem->undo;
+    mem->undo = NULL;
+    update_slow(mem);
+    while (log->count > count) {
+        uint32_t entry = log->entries[--log->count];
+        memory_write_to(mem, (uint16_t)(entry >> 8), (uint8_t)entry);
+    }
+    mem->undo = logging;
+    update_slow(mem);
+}
+
+void memory_rehash(void) {
+    Memory *mem = active;
+    memset(mem->stale, 0, sizeof(mem->stale));
+    update_slow(mem);
+    mem->hash = 0;
+    for (int page = 0; page < MEMORY_PAGES; page++) {
+        if (!mem->sparse || mem->page[page] != &zero_page) {
+            *page_hash(mem, page) = hash_bytes(page_bytes(mem, page), page);
+        }
+        mem->hash += *page_hash(mem, page);
+    }
 }
@@ -1,11 +1,131 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#define MEMORY_SIZE 65536
+#define MEMORY_PAGE_SIZE 256
+#define MEMORY_PAGES (MEMORY_SIZE / MEMORY_PAGE_SIZE)
+
+// A memory-mapped device. Reads and writes of the pages it is mapped over
+// call read and write with the full address instead of touching ram[].
+// stable, if set, returns nonzero for the registers whose reads have no side
+// effects and return the same value until the CPU's next_event; reads of the
+// others are counted in memory_unstable_reads.
+typedef struct MemoryDevice {
+    uint8_t (*read)(struct MemoryDevice *device, uint16_t address);
+    void (*write)(struct MemoryDevice *device, uint16_t address, uint8_t value);
+    int (*stable)(struct MemoryDevice *device, uint16_t address);
+} MemoryDevice;
+
+// A page of a sparse address space
+typedef struct MemoryPage {
+    uint8_t bytes[MEMORY_PAGE_SIZE];
+    uint64_t hash;
+    struct MemoryPage *next;             // In a free list
+} MemoryPage;
+
+// Old values of changes to RAM, oldest first, for stepping backwards. The
+// owner allocates entries; the log never grows past cap.
+typedef struct {
+    uint32_t *entries;                   // address << 8 | old value
+    size_t count;
+    size_t cap;
+    int overflow;                        // A change was not stored for lack of room
+} MemoryUndoLog;
+
+// One 64KB address space. The hashes are kept up to date by every write, so
+// comparing or caching states never needs a full-memory scan.
+//
+// A dense address space holds RAM in ram[]. A sparse one (memory_create)
+// is only allocated up to page_hash: each page[] entry points to one shared
+// page of zeros until the page is first written, and then to a page of its
+// own. Sparse address spaces must not be copied as structs or have the
+// dense-only fields read.
+typedef struct {
+    uint64_t hash;                       // Sum of the page hashes
+    uint8_t slow;                        // Devices mapped, hashes stale, RAM sparse or changes logged:
+                                         // writes take the slow path
+    uint8_t read_slow;                   // Devices mapped or RAM sparse: reads take the slow path
+    uint8_t sparse;
+    uint16_t dirty_count;
+    uint16_t device_pages;               // Number of pages with a device
+    uint32_t unstable_reads;             // Device reads whose value may change by itself
+    uint64_t dirty[MEMORY_PAGES / 64];   // Bitmap of pages changed since the last clear
+    uint8_t dirty_list[MEMORY_PAGES];    // The same pages, in the order they were first changed
+    uint64_t stale[MEMORY_PAGES / 64];   // Pages whose hashes memory_copy_in left to recompute
+    MemoryPage *page[MEMORY_PAGES];      // Sparse: each page's RAM
+    MemoryDevice **sparse_device;        // Sparse: device table, allocated by the first memory_map
+    MemoryUndoLog *undo;                 // Logs every change to RAM, or NULL
+
+    // Dense only
+    uint64_t page_hash[MEMORY_PAGES];    // Hash of each 256-byte page
+    MemoryDevice *device[MEMORY_PAGES];  // Device mapped over each page, or NULL
+    uint8_t ram[MEMORY_SIZE];
+} Memory;
+
+// Allocate an address space, zeroed and with no devices; NULL if out of
+// memory. A sparse one takes under 3KB until pages are written, and
+// memory_init on it hands its pages back instead of clearing 64KB; pages
+// are recycled through a free list per thread. Reads and writes of sparse
+// RAM take the slow path.
+Memory *memory_create(int sparse);
+void memory_free(Memory *mem);
+
+// Zero the address space and unmap all devices
 void memory_init(void);
 uint8_t memory_read(uint16_t address);
 void memory_write(uint16_t address, uint8_t value);
 uint16_t memory_read_word(uint16_t address);
 
+// memory_write into a given address space without binding it, for code that
+// drives many address spaces at once
+void memory_write_to(Memory *mem, uint16_t address, uint8_t value);
+
+// Make mem the address space the functions above operate on for the calling
+// thread (NULL selects the built-in one, shared by all threads). Returns the
+// previously bound address space.
+Memory *memory_bind(Memory *mem);
+
+// Map device over pages [first, first + count) of the bound address space,
+// or unmap them if device is NULL. ram[] under a device is left alone.
+void memory_map(uint8_t first, int count, MemoryDevice *device);
+
+// Nonzero if the bound address space has any device mapped
+int memory_has_devices(void);
+
+// Reads so far of device registers that are not stable (see MemoryDevice)
+uint32_t memory_unstable_reads(void);
+
+// Copy between host memory and the bound address space at memcpy speed,
+// wrapping at the top of memory and bypassing devices. The hashes of the
+// pages written are recomputed the next time they are asked for.
+void memory_copy_in(uint16_t address, const void *data, size_t length);
+void memory_copy_out(uint16_t address, void *data, size_t length);
+
+// Hash of the whole address space and of one page, both O(1) unless
+// memory_copy_in left pages to rehash
+uint64_t memory_hash(void);
+uint64_t memory_page_hash(uint8_t page);
+
+// Copy the numbers of the pages changed since the last memory_clear_dirty()
+// into pages (room for MEMORY_PAGES entries) and return how many there are.
+// Both functions are O(dirty pages).
+int memory_dirty_pages(uint8_t *pages);
+void memory_clear_dirty(void);
+
+// Append the old value of every change to the bound address space's RAM to
+// log (NULL: stop logging). Writes take the slow path while a log is set.
+// memory_init stops logging.
+void memory_set_undo_log(MemoryUndoLog *log);
+
+// Put back the old values of the entries of log after the first count,
+// newest first, and drop them
+void memory_undo(MemoryUndoLog *log, size_t count);
+
+// Recompute all hashes after ram[] of a dense address space was modified
+// directly
+void memory_rehash(void);
+
 #endif
@@ -0,0 +1,631 @@
+#include "opcodes.h"
+
+// Shorthand for the tables below
+#define IMP MODE_IMPLIED
+#define ACC MODE_ACCUMULATOR
+#define IMM MODE_IMMEDIATE
+#define ZP  MODE_ZEROPAGE
+#define ZPX MODE_ZEROPAGE_X
+#define ZPY MODE_ZEROPAGE_Y
+#define ABS MODE_ABSOLUTE
+#define ABX MODE_ABSOLUTE_X
+#define ABY MODE_ABSOLUTE_Y
+#define IND MODE_INDIRECT
+#define INX MODE_INDIRECT_X
+#define INY MODE_INDIRECT_Y
+#define ZPI MODE_ZEROPAGE_INDIRECT
+#define AIX MODE_ABSOLUTE_INDIRECT_X
+#define REL MODE_RELATIVE
+#define ZPR MODE_ZEROPAGE_RELATIVE
+
+#define F_NZ   (FLAG_N | FLAG_Z)
+#define F_NZC  (FLAG_N | FLAG_Z | FLAG_C)
+#define F_NVZ  (FLAG_N | FLAG_V | FLAG_Z)
+#define F_NVZC (FLAG_N | FLAG_V | FLAG_Z | FLAG_C)
+#define F_Z    FLAG_Z
+#define F_C    FLAG_C
+#define F_I    FLAG_I
+#define F_V    FLAG_V
+#define F_D    FLAG_D
+#define F_ID   (FLAG_I | FLAG_D)
+#define F_ALL  (FLAG_N | FLAG_V | FLAG_D | FLAG_I | FLAG_Z | FLAG_C)
+
+#define RD OP_READ
+#define WR OP_WRITE
+#define ST OP_STACK
+#define BR OP_BRANCH
+#define JP OP_JUMP
+#define HT OP_HALT
+#define UD OP_UNDOCUMENTED
+#define IL OP_ILLEGAL
+#define PG OP_PAGE_CYCLE
+
+#define MODE_LENGTH(mode) \
+    ((mode) == IMP || (mode) == ACC ? 1 : \
+     (mode) == ABS || (mode) == ABX || (mode) == ABY || (mode) == IND || \
+     (mode) == AIX || (mode) == ZPR ? 3 : 2)
+
+#define OP(mnemonic, mode, cycles, flags, effects) \
+    { mnemonic, mode, MODE_LENGTH(mode), cycles, flags, effects }
+
+// The cycles of the unstable and JAM opcodes are what the chip takes; the
+// CPU never charges them, since it hands those opcodes to its IllegalPolicy
+const OpcodeInfo opcode_table[2][256] = {
+    [CPU_6502] = {
+        [0x00] = OP("BRK", IMP, 7, F_I, ST | JP),
+        [0x01] = OP("ORA", INX, 6, F_NZ, RD),
+        [0x02] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0x03] = OP("SLO", INX, 8, F_NZC, RD | WR | UD),
+        [0x04] = OP("NOP", ZP, 3, 0, UD),
+        [0x05] = OP("ORA", ZP, 3, F_NZ, RD),
+        [0x06] = OP("ASL", ZP, 5, F_NZC, RD | WR),
+        [0x07] = OP("SLO", ZP, 5, F_NZC, RD | WR | UD),
+        [0x08] = OP("PHP", IMP, 3, 0, ST),
+        [0x09] = OP("ORA", IMM, 2, F_NZ, 0),
+        [0x0A] = OP("ASL", ACC, 2, F_NZC, 0),
+        [0x0B] = OP("ANC", IMM, 2, F_NZC, UD),
+        [0x0C] = OP("NOP", ABS, 4, 0, UD),
+        [0x0D] = OP("ORA", ABS, 4, F_NZ, RD),
+        [0x0E] = OP("ASL", ABS, 6, F_NZC, RD | WR),
+        [0x0F] = OP("SLO", ABS, 6, F_NZC, RD | WR | UD),
+        [0x10] = OP("BPL", REL, 2, 0, BR),
+        [0x11] = OP("ORA", INY, 5, F_NZ, RD | PG),
+        [0x12] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0x13] = OP("SLO", INY, 8, F_NZC, RD | WR | UD),
+        [0x14] = OP("NOP", ZPX, 4, 0, UD),
+        [0x15] = OP("ORA", ZPX, 4, F_NZ, RD),
+        [0x16] = OP("ASL", ZPX, 6, F_NZC, RD | WR),
+        [0x17] = OP("SLO", ZPX, 6, F_NZC, RD | WR | UD),
+        [0x18] = OP("CLC", IMP, 2, F_C, 0),
+        [0x19] = OP("ORA", ABY, 4, F_NZ, RD | PG),
+        [0x1A] = OP("NOP", IMP, 2, 0, UD),
+        [0x1B] = OP("SLO", ABY, 7, F_NZC, RD | WR | UD),
+        [0x1C] = OP("NOP", ABX, 4, 0, UD | PG),
+        [0x1D] = OP("ORA", ABX, 4, F_NZ, RD | PG),
+        [0x1E] = OP("ASL", ABX, 7, F_NZC, RD | WR),
+        [0x1F] = OP("SLO", ABX, 7, F_NZC, RD | WR | UD),
+        [0x20] = OP("JSR", ABS, 6, 0, ST | JP),
+        [0x21] = OP("AND", INX, 6, F_NZ, RD),
+        [0x22] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0x23] = OP("RLA", INX, 8, F_NZC, RD | WR | UD),
+        [0x24] = OP("BIT", ZP, 3, F_NVZ, RD),
+        [0x25] = OP("AND", ZP, 3, F_NZ, RD),
+        [0x26] = OP("ROL", ZP, 5, F_NZC, RD | WR),
+        [0x27] = OP("RLA", ZP, 5, F_NZC, RD | WR | UD),
+        [0x28] = OP("PLP", IMP, 4, F_ALL, ST),
+        [0x29] = OP("AND", IMM, 2, F_NZ, 0),
+        [0x2A] = OP("ROL", ACC, 2, F_NZC, 0),
+        [0x2B] = OP("ANC", IMM, 2, F_NZC, UD),
+        [0x2C] = OP("BIT", ABS, 4, F_NVZ, RD),
+        [0x2D] = OP("AND", ABS, 4, F_NZ, RD),
+        [0x2E] = OP("ROL", ABS, 6, F_NZC, RD | WR),
+        [0x2F] = OP("RLA", ABS, 6, F_NZC, RD | WR | UD),
+        [0x30] = OP("BMI", REL, 2, 0, BR),
+        [0x31] = OP("AND", INY, 5, F_NZ, RD | PG),
+        [0x32] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0x33] = OP("RLA", INY, 8, F_NZC, RD | WR | UD),
+        [0x34] = OP("NOP", ZPX, 4, 0, UD),
+        [0x35] = OP("AND", ZPX, 4, F_NZ, RD),
+        [0x36] = OP("ROL", ZPX, 6, F_NZC, RD | WR),
+        [0x37] = OP("RLA", ZPX, 6, F_NZC, RD | WR | UD),
+        [0x38] = OP("SEC", IMP, 2, F_C, 0),
+        [0x39] = OP("AND", ABY, 4, F_NZ, RD | PG),
+        [0x3A] = OP("NOP", IMP, 2, 0, UD),
+        [0x3B] = OP("RLA", ABY, 7, F_NZC, RD | WR | UD),
+        [0x3C] = OP("NOP", ABX, 4, 0, UD | PG),
+        [0x3D] = OP("AND", ABX, 4, F_NZ, RD | PG),
+        [0x3E] = OP("ROL", ABX, 7, F_NZC, RD | WR),
+        [0x3F] = OP("RLA", ABX, 7, F_NZC, RD | WR | UD),
+        [0x40] = OP("RTI", IMP, 6, F_ALL, ST | JP),
+        [0x41] = OP("EOR", INX, 6, F_NZ, RD),
+        [0x42] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0x43] = OP("SRE", INX, 8, F_NZC, RD | WR | UD),
+        [0x44] = OP("NOP", ZP, 3, 0, UD),
+        [0x45] = OP("EOR", ZP, 3, F_NZ, RD),
+        [0x46] = OP("LSR", ZP, 5, F_NZC, RD | WR),
+        [0x47] = OP("SRE", ZP, 5, F_NZC, RD | WR | UD),
+        [0x48] = OP("PHA", IMP, 3, 0, ST),
+        [0x49] = OP("EOR", IMM, 2, F_NZ, 0),
+        [0x4A] = OP("LSR", ACC, 2, F_NZC, 0),
+        [0x4B] = OP("ALR", IMM, 2, F_NZC, UD),
+        [0x4C] = OP("JMP", ABS, 3, 0, JP),
+        [0x4D] = OP("EOR", ABS, 4, F_NZ, RD),
+        [0x4E] = OP("LSR", ABS, 6, F_NZC, RD | WR),
+        [0x4F] = OP("SRE", ABS, 6, F_NZC, RD | WR | UD),
+        [0x50] = OP("BVC", REL, 2, 0, BR),
+        [0x51] = OP("EOR", INY, 5, F_NZ, RD | PG),
+        [0x52] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0x53] = OP("SRE", INY, 8, F_NZC, RD | WR | UD),
+        [0x54] = OP("NOP", ZPX, 4, 0, UD),
+        [0x55] = OP("EOR", ZPX, 4, F_NZ, RD),
+        [0x56] = OP("LSR", ZPX, 6, F_NZC, RD | WR),
+        [0x57] = OP("SRE", ZPX, 6, F_NZC, RD | WR | UD),
+        [0x58] = OP("CLI", IMP, 2, F_I, 0),
+        [0x59] = OP("EOR", ABY, 4, F_NZ, RD | PG),
+        [0x5A] = OP("NOP", IMP, 2, 0, UD),
+        [0x5B] = OP("SRE", ABY, 7, F_NZC, RD | WR | UD),
+        [0x5C] = OP("NOP", ABX, 4, 0, UD | PG),
+        [0x5D] = OP("EOR", ABX, 4, F_NZ, RD | PG),
+        [0x5E] = OP("LSR", ABX, 7, F_NZC, RD | WR),
+        [0x5F] = OP("SRE", ABX, 7, F_NZC, RD | WR | UD),
+        [0x60] = OP("RTS", IMP, 6, 0, ST | JP),
+        [0x61] = OP("ADC", INX, 6, F_NVZC, RD),
+        [0x62] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0x63] = OP("RRA", INX, 8, F_NVZC, RD | WR | UD),
+        [0x64] = OP("NOP", ZP, 3, 0, UD),
+        [0x65] = OP("ADC", ZP, 3, F_NVZC, RD),
+        [0x66] = OP("ROR", ZP, 5, F_NZC, RD | WR),
+        [0x67] = OP("RRA", ZP, 5, F_NVZC, RD | WR | UD),
+        [0x68] = OP("PLA", IMP, 4, F_NZ, ST),
+        [0x69] = OP("ADC", IMM, 2, F_NVZC, 0),
+        [0x6A] = OP("ROR", ACC, 2, F_NZC, 0),
+        [0x6B] = OP("ARR", IMM, 2, F_NVZC, UD),
+        [0x6C] = OP("JMP", IND, 5, 0, JP),
+        [0x6D] = OP("ADC", ABS, 4, F_NVZC, RD),
+        [0x6E] = OP("ROR", ABS, 6, F_NZC, RD | WR),
+        [0x6F] = OP("RRA", ABS, 6, F_NVZC, RD | WR | UD),
+        [0x70] = OP("BVS", REL, 2, 0, BR),
+        [0x71] = OP("ADC", INY, 5, F_NVZC, RD | PG),
+        [0x72] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0x73] = OP("RRA", INY, 8, F_NVZC, RD | WR | UD),
+        [0x74] = OP("NOP", ZPX, 4, 0, UD),
+        [0x75] = OP("ADC", ZPX, 4, F_NVZC, RD),
+        [0x76] = OP("ROR", ZPX, 6, F_NZC, RD | WR),
+        [0x77] = OP("RRA", ZPX, 6, F_NVZC, RD | WR | UD),
+        [0x78] = OP("SEI", IMP, 2, F_I, 0),
+        [0x79] = OP("ADC", ABY, 4, F_NVZC, RD | PG),
+        [0x7A] = OP("NOP", IMP, 2, 0, UD),
+        [0x7B] = OP("RRA", ABY, 7, F_NVZC, RD | WR | UD),
+        [0x7C] = OP("NOP", ABX, 4, 0, UD | PG),
+        [0x7D] = OP("ADC", ABX, 4, F_NVZC, RD | PG),
+        [0x7E] = OP("ROR", ABX, 7, F_NZC, RD | WR),
+        [0x7F] = OP("RRA", ABX, 7, F_NVZC, RD | WR | UD),
+        [0x80] = OP("NOP", IMM, 2, 0, UD),
+        [0x81] = OP("STA", INX, 6, 0, WR),
+        [0x82] = OP("NOP", IMM, 2, 0, UD),
+        [0x83] = OP("SAX", INX, 6, 0, WR | UD),
+        [0x84] = OP("STY", ZP, 3, 0, WR),
+        [0x85] = OP("STA", ZP, 3, 0, WR),
+        [0x86] = OP("STX", ZP, 3, 0, WR),
+        [0x87] = OP("SAX", ZP, 3, 0, WR | UD),
+        [0x88] = OP("DEY", IMP, 2, F_NZ, 0),
+        [0x89] = OP("NOP", IMM, 2, 0, UD),
+        [0x8A] = OP("TXA", IMP, 2, F_NZ, 0),
+        [0x8B] = OP("ANE", IMM, 2, F_NZ, UD | IL),
+        [0x8C] = OP("STY", ABS, 4, 0, WR),
+        [0x8D] = OP("STA", ABS, 4, 0, WR),
+        [0x8E] = OP("STX", ABS, 4, 0, WR),
+        [0x8F] = OP("SAX", ABS, 4, 0, WR | UD),
+        [0x90] = OP("BCC", REL, 2, 0, BR),
+        [0x91] = OP("STA", INY, 6, 0, WR),
+        [0x92] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0x93] = OP("SHA", INY, 6, 0, WR | UD | IL),
+        [0x94] = OP("STY", ZPX, 4, 0, WR),
+        [0x95] = OP("STA", ZPX, 4, 0, WR),
+        [0x96] = OP("STX", ZPY, 4, 0, WR),
+        [0x97] = OP("SAX", ZPY, 4, 0, WR | UD),
+        [0x98] = OP("TYA", IMP, 2, F_NZ, 0),
+        [0x99] = OP("STA", ABY, 5, 0, WR),
+        [0x9A] = OP("TXS", IMP, 2, 0, 0),
+        [0x9B] = OP("TAS", ABY, 5, 0, WR | UD | IL),
+        [0x9C] = OP("SHY", ABX, 5, 0, WR | UD | IL),
+        [0x9D] = OP("STA", ABX, 5, 0, WR),
+        [0x9E] = OP("SHX", ABY, 5, 0, WR | UD | IL),
+        [0x9F] = OP("SHA", ABY, 5, 0, WR | UD | IL),
+        [0xA0] = OP("LDY", IMM, 2, F_NZ, 0),
+        [0xA1] = OP("LDA", INX, 6, F_NZ, RD),
+        [0xA2] = OP("LDX", IMM, 2, F_NZ, 0),
+        [0xA3] = OP("LAX", INX, 6, F_NZ, RD | UD),
+        [0xA4] = OP("LDY", ZP, 3, F_NZ, RD),
+        [0xA5] = OP("LDA", ZP, 3, F_NZ, RD),
+        [0xA6] = OP("LDX", ZP, 3, F_NZ, RD),
+        [0xA7] = OP("LAX", ZP, 3, F_NZ, RD | UD),
+        [0xA8] = OP("TAY", IMP, 2, F_NZ, 0),
+        [0xA9] = OP("LDA", IMM, 2, F_NZ, 0),
+        [0xAA] = OP("TAX", IMP, 2, F_NZ, 0),
+        [0xAB] = OP("LXA", IMM, 2, F_NZ, UD | IL),
+        [0xAC] = OP("LDY", ABS, 4, F_NZ, RD),
+        [0xAD] = OP("LDA", ABS, 4, F_NZ, RD),
+        [0xAE] = OP("LDX", ABS, 4, F_NZ, RD),
+        [0xAF] = OP("LAX", ABS, 4, F_NZ, RD | UD),
+        [0xB0] = OP("BCS", REL, 2, 0, BR),
+        [0xB1] = OP("LDA", INY, 5, F_NZ, RD | PG),
+        [0xB2] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0xB3] = OP("LAX", INY, 5, F_NZ, RD | UD | PG),
+        [0xB4] = OP("LDY", ZPX, 4, F_NZ, RD),
+        [0xB5] = OP("LDA", ZPX, 4, F_NZ, RD),
+        [0xB6] = OP("LDX", ZPY, 4, F_NZ, RD),
+        [0xB7] = OP("LAX", ZPY, 4, F_NZ, RD | UD),
+        [0xB8] = OP("CLV", IMP, 2, F_V, 0),
+        [0xB9] = OP("LDA", ABY, 4, F_NZ, RD | PG),
+        [0xBA] = OP("TSX", IMP, 2, F_NZ, 0),
+        [0xBB] = OP("LAS", ABY, 4, F_NZ, RD | UD | PG),
+        [0xBC] = OP("LDY", ABX, 4, F_NZ, RD | PG),
+        [0xBD] = OP("LDA", ABX, 4, F_NZ, RD | PG),
+        [0xBE] = OP("LDX", ABY, 4, F_NZ, RD | PG),
+        [0xBF] = OP("LAX", ABY, 4, F_NZ, RD | UD | PG),
+        [0xC0] = OP("CPY", IMM, 2, F_NZC, 0),
+        [0xC1] = OP("CMP", INX, 6, F_NZC, RD),
+        [0xC2] = OP("NOP", IMM, 2, 0, UD),
+        [0xC3] = OP("DCP", INX, 8, F_NZC, RD | WR | UD),
+        [0xC4] = OP("CPY", ZP, 3, F_NZC, RD),
+        [0xC5] = OP("CMP", ZP, 3, F_NZC, RD),
+        [0xC6] = OP("DEC", ZP, 5, F_NZ, RD | WR),
+        [0xC7] = OP("DCP", ZP, 5, F_NZC, RD | WR | UD),
+        [0xC8] = OP("INY", IMP, 2, F_NZ, 0),
+        [0xC9] = OP("CMP", IMM, 2, F_NZC, 0),
+        [0xCA] = OP("DEX", IMP, 2, F_NZ, 0),
+        [0xCB] = OP("SBX", IMM, 2, F_NZC, UD),
+        [0xCC] = OP("CPY", ABS, 4, F_NZC, RD),
+        [0xCD] = OP("CMP", ABS, 4, F_NZC, RD),
+        [0xCE] = OP("DEC", ABS, 6, F_NZ, RD | WR),
+        [0xCF] = OP("DCP", ABS, 6, F_NZC, RD | WR | UD),
+        [0xD0] = OP("BNE", REL, 2, 0, BR),
+        [0xD1] = OP("CMP", INY, 5, F_NZC, RD | PG),
+        [0xD2] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0xD3] = OP("DCP", INY, 8, F_NZC, RD | WR | UD),
+        [0xD4] = OP("NOP", ZPX, 4, 0, UD),
+        [0xD5] = OP("CMP", ZPX, 4, F_NZC, RD),
+        [0xD6] = OP("DEC", ZPX, 6, F_NZ, RD | WR),
+        [0xD7] = OP("DCP", ZPX, 6, F_NZC, RD | WR | UD),
+        [0xD8] = OP("CLD", IMP, 2, F_D, 0),
+        [0xD9] = OP("CMP", ABY, 4, F_NZC, RD | PG),
+        [0xDA] = OP("NOP", IMP, 2, 0, UD),
+        [0xDB] = OP("DCP", ABY, 7, F_NZC, RD | WR | UD),
+        [0xDC] = OP("NOP", ABX, 4, 0, UD | PG),
+        [0xDD] = OP("CMP", ABX, 4, F_NZC, RD | PG),
+        [0xDE] = OP("DEC", ABX, 7, F_NZ, RD | WR),
+        [0xDF] = OP("DCP", ABX, 7, F_NZC, RD | WR | UD),
+        [0xE0] = OP("CPX", IMM, 2, F_NZC, 0),
+        [0xE1] = OP("SBC", INX, 6, F_NVZC, RD),
+        [0xE2] = OP("NOP", IMM, 2, 0, UD),
+        [0xE3] = OP("ISC", INX, 8, F_NVZC, RD | WR | UD),
+        [0xE4] = OP("CPX", ZP, 3, F_NZC, RD),
+        [0xE5] = OP("SBC", ZP, 3, F_NVZC, RD),
+        [0xE6] = OP("INC", ZP, 5, F_NZ, RD | WR),
+        [0xE7] = OP("ISC", ZP, 5, F_NVZC, RD | WR | UD),
+        [0xE8] = OP("INX", IMP, 2, F_NZ, 0),
+        [0xE9] = OP("SBC", IMM, 2, F_NVZC, 0),
+        [0xEA] = OP("NOP", IMP, 2, 0, 0),
+        [0xEB] = OP("SBC", IMM, 2, F_NVZC, UD),
+        [0xEC] = OP("CPX", ABS, 4, F_NZC, RD),
+        [0xED] = OP("SBC", ABS, 4, F_NVZC, RD),
+        [0xEE] = OP("INC", ABS, 6, F_NZ, RD | WR),
+        [0xEF] = OP("ISC", ABS, 6, F_NVZC, RD | WR | UD),
+        [0xF0] = OP("BEQ", REL, 2, 0, BR),
+        [0xF1] = OP("SBC", INY, 5, F_NVZC, RD | PG),
+        [0xF2] = OP("JAM", IMP, 0, 0, HT | UD | IL),
+        [0xF3] = OP("ISC", INY, 8, F_NVZC, RD | WR | UD),
+        [0xF4] = OP("NOP", ZPX, 4, 0, UD),
+        [0xF5] = OP("SBC", ZPX, 4, F_NVZC, RD),
+        [0xF6] = OP("INC", ZPX, 6, F_NZ, RD | WR),
+        [0xF7] = OP("ISC", ZPX, 6, F_NVZC, RD | WR | UD),
+        [0xF8] = OP("SED", IMP, 2, F_D, 0),
+        [0xF9] = OP("SBC", ABY, 4, F_NVZC, RD | PG),
+        [0xFA] = OP("NOP", IMP, 2, 0, UD),
+        [0xFB] = OP("ISC", ABY, 7, F_NVZC, RD | WR | UD),
+        [0xFC] = OP("NOP", ABX, 4, 0, UD | PG),
+        [0xFD] = OP("SBC", ABX, 4, F_NVZC, RD | PG),
+        [0xFE] = OP("INC", ABX, 7, F_NZ, RD | WR),
+        [0xFF] = OP("ISC", ABX, 7, F_NVZC, RD | WR | UD),
+    },
+    [CPU_65C02] = {
+        [0x00] = OP("BRK", IMP, 7, F_ID, ST | JP),
+        [0x01] = OP("ORA", INX, 6, F_NZ, RD),
+        [0x02] = OP("NOP", IMM, 2, 0, UD),
+        [0x03] = OP("NOP", IMP, 1, 0, UD),
+        [0x04] = OP("TSB", ZP, 5, F_Z, RD | WR),
+        [0x05] = OP("ORA", ZP, 3, F_NZ, RD),
+        [0x06] = OP("ASL", ZP, 5, F_NZC, RD | WR),
+        [0x07] = OP("RMB0", ZP, 5, 0, RD | WR),
+        [0x08] = OP("PHP", IMP, 3, 0, ST),
+        [0x09] = OP("ORA", IMM, 2, F_NZ, 0),
+        [0x0A] = OP("ASL", ACC, 2, F_NZC, 0),
+        [0x0B] = OP("NOP", IMP, 1, 0, UD),
+        [0x0C] = OP("TSB", ABS, 6, F_Z, RD | WR),
+        [0x0D] = OP("ORA", ABS, 4, F_NZ, RD),
+        [0x0E] = OP("ASL", ABS, 6, F_NZC, RD | WR),
+        [0x0F] = OP("BBR0", ZPR, 5, 0, RD | BR),
+        [0x10] = OP("BPL", REL, 2, 0, BR),
+        [0x11] = OP("ORA", INY, 5, F_NZ, RD | PG),
+        [0x12] = OP("ORA", ZPI, 5, F_NZ, RD),
+        [0x13] = OP("NOP", IMP, 1, 0, UD),
+        [0x14] = OP("TRB", ZP, 5, F_Z, RD | WR),
+        [0x15] = OP("ORA", ZPX, 4, F_NZ, RD),
+        [0x16] = OP("ASL", ZPX, 6, F_NZC, RD | WR),
+        [0x17] = OP("RMB1", ZP, 5, 0, RD | WR),
+        [0x18] = OP("CLC", IMP, 2, F_C, 0),
+        [0x19] = OP("ORA", ABY, 4, F_NZ, RD | PG),
+        [0x1A] = OP("INC", ACC, 2, F_NZ, 0),
+        [0x1B] = OP("NOP", IMP, 1, 0, UD),
+        [0x1C] = OP("TRB", ABS, 6, F_Z, RD | WR),
+        [0x1D] = OP("ORA", ABX, 4, F_NZ, RD | PG),
+        [0x1E] = OP("ASL", ABX, 6, F_NZC, RD | WR | PG),
+        [0x1F] = OP("BBR1", ZPR, 5, 0, RD | BR),
+        [0x20] = OP("JSR", ABS, 6, 0, ST | JP),
+        [0x21] = OP("AND", INX, 6, F_NZ, RD),
+        [0x22] = OP("NOP", IMM, 2, 0, UD),
+        [0x23] = OP("NOP", IMP, 1, 0, UD),
+        [0x24] = OP("BIT", ZP, 3, F_NVZ, RD),
+        [0x25] = OP("AND", ZP, 3, F_NZ, RD),
+        [0x26] = OP("ROL", ZP, 5, F_NZC, RD | WR),
+        [0x27] = OP("RMB2", ZP, 5, 0, RD | WR),
+        [0x28] = OP("PLP", IMP, 4, F_ALL, ST),
+        [0x29] = OP("AND", IMM, 2, F_NZ, 0),
+        [0x2A] = OP("ROL", ACC, 2, F_NZC, 0),
+        [0x2B] = OP("NOP", IMP, 1, 0, UD),
+        [0x2C] = OP("BIT", ABS, 4, F_NVZ, RD),
+        [0x2D] = OP("AND", ABS, 4, F_NZ, RD),
+        [0x2E] = OP("ROL", ABS, 6, F_NZC, RD | WR),
+        [0x2F] = OP("BBR2", ZPR, 5, 0, RD | BR),
+        [0x30] = OP("BMI", REL, 2, 0, BR),
+        [0x31] = OP("AND", INY, 5, F_NZ, RD | PG),
+        [0x32] = OP("AND", ZPI, 5, F_NZ, RD),
+        [0x33] = OP("NOP", IMP, 1, 0, UD),
+        [0x34] = OP("BIT", ZPX, 4, F_NVZ, RD),
+        [0x35] = OP("AND", ZPX, 4, F_NZ, RD),
+        [0x36] = OP("ROL", ZPX, 6, F_NZC, RD | WR),
+        [0x37] = OP("RMB3", ZP, 5, 0, RD | WR),
+        [0x38] = OP("SEC", IMP, 2, F_C, 0),
+        [0x39] = OP("AND", ABY, 4, F_NZ, RD | PG),
+        [0x3A] = OP("DEC", ACC, 2, F_NZ, 0),
+        [0x3B] = OP("NOP", IMP, 1, 0, UD),
+        [0x3C] = OP("BIT", ABX, 4, F_NVZ, RD | PG),
+        [0x3D] = OP("AND", ABX, 4, F_NZ, RD | PG),
+        [0x3E] = OP("ROL", ABX, 6, F_NZC, RD | WR | PG),
+        [0x3F] = OP("BBR3", ZPR, 5, 0, RD | BR),
+        [0x40] = OP("RTI", IMP, 6, F_ALL, ST | JP),
+        [0x41] = OP("EOR", INX, 6, F_NZ, RD),
+        [0x42] = OP("NOP", IMM, 2, 0, UD),
+        [0x43] = OP("NOP", IMP, 1, 0, UD),
+        [0x44] = OP("NOP", ZP, 3, 0, UD),
+        [0x45] = OP("EOR", ZP, 3, F_NZ, RD),
+        [0x46] = OP("LSR", ZP, 5, F_NZC, RD | WR),
+        [0x47] = OP("RMB4", ZP, 5, 0, RD | WR),
+        [0x48] = OP("PHA", IMP, 3, 0, ST),
+        [0x49] = OP("EOR", IMM, 2, F_NZ, 0),
+        [0x4A] = OP("LSR", ACC, 2, F_NZC, 0),
+        [0x4B] = OP("NOP", IMP, 1, 0, UD),
+        [0x4C] = OP("JMP", ABS, 3, 0, JP),
+        [0x4D] = OP("EOR", ABS, 4, F_NZ, RD),
+        [0x4E] = OP("LSR", ABS, 6, F_NZC, RD | WR),
+        [0x4F] = OP("BBR4", ZPR, 5, 0, RD | BR),
+        [0x50] = OP("BVC", REL, 2, 0, BR),
+        [0x51] = OP("EOR", INY, 5, F_NZ, RD | PG),
+        [0x52] = OP("EOR", ZPI, 5, F_NZ, RD),
+        [0x53] = OP("NOP", IMP, 1, 0, UD),
+        [0x54] = OP("NOP", ZPX, 4, 0, UD),
+        [0x55] = OP("EOR", ZPX, 4, F_NZ, RD),
+        [0x56] = OP("LSR", ZPX, 6, F_NZC, RD | WR),
+        [0x57] = OP("RMB5", ZP, 5, 0, RD | WR),
+        [0x58] = OP("CLI", IMP, 2, F_I, 0),
+        [0x59] = OP("EOR", ABY, 4, F_NZ, RD | PG),
+        [0x5A] = OP("PHY", IMP, 3, 0, ST),
+        [0x5B] = OP("NOP", IMP, 1, 0, UD),
+        [0x5C] = OP("NOP", ABS, 8, 0, UD),
+        [0x5D] = OP("EOR", ABX, 4, F_NZ, RD | PG),
+        [0x5E] = OP("LSR", ABX, 6, F_NZC, RD | WR | PG),
+        [0x5F] = OP("BBR5", ZPR, 5, 0, RD | BR),
+        [0x60] = OP("RTS", IMP, 6, 0, ST | JP),
+        [0x61] = OP("ADC", INX, 6, F_NVZC, RD),
+        [0x62] = OP("NOP", IMM, 2, 0, UD),
+        [0x63] = OP("NOP", IMP, 1, 0, UD),
+        [0x64] = OP("STZ", ZP, 3, 0, WR),
+        [0x65] = OP("ADC", ZP, 3, F_NVZC, RD),
+        [0x66] = OP("ROR", ZP, 5, F_NZC, RD | WR),
+        [0x67] = OP("RMB6", ZP, 5, 0, RD | WR),
+        [0x68] = OP("PLA", IMP, 4, F_NZ, ST),
+        [0x69] = OP("ADC", IMM, 2, F_NVZC, 0),
+        [0x6A] = OP("ROR", ACC, 2, F_NZC, 0),
+        [0x6B] = OP("NOP", IMP, 1, 0, UD),
+        [0x6C] = OP("JMP", IND, 6, 0, JP),
+        [0x6D] = OP("ADC", ABS, 4, F_NVZC, RD),
+        [0x6E] = OP("ROR", ABS, 6, F_NZC, RD | WR),
+        [0x6F] = OP("BBR6", ZPR, 5, 0, RD | BR),
+        [0x70] = OP("BVS", REL, 2, 0, BR),
+        [0x71] = OP("ADC", INY, 5, F_NVZC, RD | PG),
+        [0x72] = OP("ADC", ZPI, 5, F_NVZC, RD),
+        [0x73] = OP("NOP", IMP, 1, 0, UD),
+        [0x74] = OP("STZ", ZPX, 4, 0, WR),
+        [0x75] = OP("ADC", ZPX, 4, F_NVZC, RD),
+        [0x76] = OP("ROR", ZPX, 6, F_NZC, RD | WR),
+        [0x77] = OP("RMB7", ZP, 5, 0, RD | WR),
+        [0x78] = OP("SEI", IMP, 2, F_I, 0),
+        [0x79] = OP("ADC", ABY, 4, F_NVZC, RD | PG),
+        [0x7A] = OP("PLY", IMP, 4, F_NZ, ST),
+        [0x7B] = OP("NOP", IMP, 1, 0, UD),
+        [0x7C] = OP("JMP", AIX, 6, 0, JP),
+        [0x7D] = OP("ADC", ABX, 4, F_NVZC, RD | PG),
+        [0x7E] = OP("ROR", ABX, 6, F_NZC, RD | WR | PG),
+        [0x7F] = OP("BBR7", ZPR, 5, 0, RD | BR),
+        [0x80] = OP("BRA", REL, 2, 0, BR),
+        [0x81] = OP("STA", INX, 6, 0, WR),
+        [0x82] = OP("NOP", IMM, 2, 0, UD),
+        [0x83] = OP("NOP", IMP, 1, 0, UD),
+        [0x84] = OP("STY", ZP, 3, 0, WR),
+        [0x85] = OP("STA", ZP, 3, 0, WR),
+        [0x86] = OP("STX", ZP, 3, 0, WR),
+        [0x87] = OP("SMB0", ZP, 5, 0, RD | WR),
+        [0x88] = OP("DEY", IMP, 2, F_NZ, 0),
+        [0x89] = OP("BIT", IMM, 2, F_Z, 0),
+        [0x8A] = OP("TXA", IMP, 2, F_NZ, 0),
+        [0x8B] = OP("NOP", IMP, 1, 0, UD),
+        [0x8C] = OP("STY", ABS, 4, 0, WR),
+        [0x8D] = OP("STA", ABS, 4, 0, WR),
+        [0x8E] = OP("STX", ABS, 4, 0, WR),
+        [0x8F] = OP("BBS0", ZPR, 5, 0, RD | BR),
+        [0x90] = OP("BCC", REL, 2, 0, BR),
+        [0x91] = OP("STA", INY, 6, 0, WR),
+        [0x92] = OP("STA", ZPI, 5, 0, WR),
+        [0x93] = OP("NOP", IMP, 1, 0, UD),
+        [0x94] = OP("STY", ZPX, 4, 0, WR),
+        [0x95] = OP("STA", ZPX, 4, 0, WR),
+        [0x96] = OP("STX", ZPY, 4, 0, WR),
+        [0x97] = OP("SMB1", ZP, 5, 0, RD | WR),
+        [0x98] = OP("TYA", IMP, 2, F_NZ, 0),
+        [0x99] = OP("STA", ABY, 5, 0, WR),
+        [0x9A] = OP("TXS", IMP, 2, 0, 0),
+        [0x9B] = OP("NOP", IMP, 1, 0, UD),
+        [0x9C] = OP("STZ", ABS, 4, 0, WR),
+        [0x9D] = OP("STA", ABX, 5, 0, WR),
+        [0x9E] = OP("STZ", ABX, 5, 0, WR),
+        [0x9F] = OP("BBS1", ZPR, 5, 0, RD | BR),
+        [0xA0] = OP("LDY", IMM, 2, F_NZ, 0),
+        [0xA1] = OP("LDA", INX, 6, F_NZ, RD),
+        [0xA2] = OP("LDX", IMM, 2, F_NZ, 0),
+        [0xA3] = OP("NOP", IMP, 1, 0, UD),
+        [0xA4] = OP("LDY", ZP, 3, F_NZ, RD),
+        [0xA5] = OP("LDA", ZP, 3, F_NZ, RD),
+        [0xA6] = OP("LDX", ZP, 3, F_NZ, RD),
+        [0xA7] = OP("SMB2", ZP, 5, 0, RD | WR),
+        [0xA8] = OP("TAY", IMP, 2, F_NZ, 0),
+        [0xA9] = OP("LDA", IMM, 2, F_NZ, 0),
+        [0xAA] = OP("TAX", IMP, 2, F_NZ, 0),
+        [0xAB] = OP("NOP", IMP, 1, 0, UD),
+        [0xAC] = OP("LDY", ABS, 4, F_NZ, RD),
+        [0xAD] = OP("LDA", ABS, 4, F_NZ, RD),
+        [0xAE] = OP("LDX", ABS, 4, F_NZ, RD),
+        [0xAF] = OP("BBS2", ZPR, 5, 0, RD | BR),
+        [0xB0] = OP("BCS", REL, 2, 0, BR),
+        [0xB1] = OP("LDA", INY, 5, F_NZ, RD | PG),
+        [0xB2] = OP("LDA", ZPI, 5, F_NZ, RD),
+        [0xB3] = OP("NOP", IMP, 1, 0, UD),
+        [0xB4] = OP("LDY", ZPX, 4, F_NZ, RD),
+        [0xB5] = OP("LDA", ZPX, 4, F_NZ, RD),
+        [0xB6] = OP("LDX", ZPY, 4, F_NZ, RD),
+        [0xB7] = OP("SMB3", ZP, 5, 0, RD | WR),
+        [0xB8] = OP("CLV", IMP, 2, F_V, 0),
+        [0xB9] = OP("LDA", ABY, 4, F_NZ, RD | PG),
+        [0xBA] = OP("TSX", IMP, 2, F_NZ, 0),
+        [0xBB] = OP("NOP", IMP, 1, 0, UD),
+        [0xBC] = OP("LDY", ABX, 4, F_NZ, RD | PG),
+        [0xBD] = OP("LDA", ABX, 4, F_NZ, RD | PG),
+        [0xBE] = OP("LDX", ABY, 4, F_NZ, RD | PG),
+        [0xBF] = OP("BBS3", ZPR, 5, 0, RD | BR),
+        [0xC0] = OP("CPY", IMM, 2, F_NZC, 0),
+        [0xC1] = OP("CMP", INX, 6, F_NZC, RD),
+        [0xC2] = OP("NOP", IMM, 2, 0, UD),
+        [0xC3] = OP("NOP", IMP, 1, 0, UD),
+        [0xC4] = OP("CPY", ZP, 3, F_NZC, RD),
+        [0xC5] = OP("CMP", ZP, 3, F_NZC, RD),
+        [0xC6] = OP("DEC", ZP, 5, F_NZ, RD | WR),
+        [0xC7] = OP("SMB4", ZP, 5, 0, RD | WR),
+        [0xC8] = OP("INY", IMP, 2, F_NZ, 0),
+        [0xC9] = OP("CMP", IMM, 2, F_NZC, 0),
+        [0xCA] = OP("DEX", IMP, 2, F_NZ, 0),
+        [0xCB] = OP("WAI", IMP, 3, 0, HT),
+        [0xCC] = OP("CPY", ABS, 4, F_NZC, RD),
+        [0xCD] = OP("CMP", ABS, 4, F_NZC, RD),
+        [0xCE] = OP("DEC", ABS, 6, F_NZ, RD | WR),
+        [0xCF] = OP("BBS4", ZPR, 5, 0, RD | BR),
+        [0xD0] = OP("BNE", REL, 2, 0, BR),
+        [0xD1] = OP("CMP", INY, 5, F_NZC, RD | PG),
+        [0xD2] = OP("CMP", ZPI, 5, F_NZC, RD),
+        [0xD3] = OP("NOP", IMP, 1, 0, UD),
+        [0xD4] = OP("NOP", ZPX, 4, 0, UD),
+        [0xD5] = OP("CMP", ZPX, 4, F_NZC, RD),
+        [0xD6] = OP("DEC", ZPX, 6, F_NZ, RD | WR),
+        [0xD7] = OP("SMB5", ZP, 5, 0, RD | WR),
+        [0xD8] = OP("CLD", IMP, 2, F_D, 0),
+        [0xD9] = OP("CMP", ABY, 4, F_NZC, RD | PG),
+        [0xDA] = OP("PHX", IMP, 3, 0, ST),
+        [0xDB] = OP("STP", IMP, 3, 0, HT),
+        [0xDC] = OP("NOP", ABS, 4, 0, UD),
+        [0xDD] = OP("CMP", ABX, 4, F_NZC, RD | PG),
+        [0xDE] = OP("DEC", ABX, 7, F_NZ, RD | WR),
+        [0xDF] = OP("BBS5", ZPR, 5, 0, RD | BR),
+        [0xE0] = OP("CPX", IMM, 2, F_NZC, 0),
+        [0xE1] = OP("SBC", INX, 6, F_NVZC, RD),
+        [0xE2] = OP("NOP", IMM, 2, 0, UD),
+        [0xE3] = OP("NOP", IMP, 1, 0, UD),
+        [0xE4] = OP("CPX", ZP, 3, F_NZC, RD),
+        [0xE5] = OP("SBC", ZP, 3, F_NVZC, RD),
+        [0xE6] = OP("INC", ZP, 5, F_NZ, RD | WR),
+        [0xE7] = OP("SMB6", ZP, 5, 0, RD | WR),
+        [0xE8] = OP("INX", IMP, 2, F_NZ, 0),
+        [0xE9] = OP("SBC", IMM, 2, F_NVZC, 0),
+        [0xEA] = OP("NOP", IMP, 2, 0, 0),
+        [0xEB] = OP("NOP", IMP, 1, 0, UD),
+        [0xEC] = OP("CPX", ABS, 4, F_NZC, RD),
+        [0xED] = OP("SBC", ABS, 4, F_NVZC, RD),
+        [0xEE] = OP("INC", ABS, 6, F_NZ, RD | WR),
+        [0xEF] = OP("BBS6", ZPR, 5, 0, RD | BR),
+        [0xF0] = OP("BEQ", REL, 2, 0, BR),
+        [0xF1] = OP("SBC", INY, 5, F_NVZC, RD | PG),
+        [0xF2] = OP("SBC", ZPI, 5, F_NVZC, RD),
+        [0xF3] = OP("NOP", IMP, 1, 0, UD),
+        [0xF4] = OP("NOP", ZPX, 4, 0, UD),
+        [0xF5] = OP("SBC", ZPX, 4, F_NVZC, RD),
+        [0xF6] = OP("INC", ZPX, 6, F_NZ, RD | WR),
+        [0xF7] = OP("SMB7", ZP, 5, 0, RD | WR),
+        [0xF8] = OP("SED", IMP, 2, F_D, 0),
+        [0xF9] = OP("SBC", ABY, 4, F_NVZC, RD | PG),
+        [0xFA] = OP("PLX", IMP, 4, F_NZ, ST),
+        [0xFB] = OP("NOP", IMP, 1, 0, UD),
+        [0xFC] = OP("NOP", ABS, 4, 0, UD),
+        [0xFD] = OP("SBC", ABX, 4, F_NVZC, RD | PG),
+        [0xFE] = OP("INC", ABX, 7, F_NZ, RD | WR),
+        [0xFF] = OP("BBS7", ZPR, 5, 0, RD | BR),
+    },
+};
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+// Appends to a caller's buffer, dropping what does not fit
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t used;
+} Text;
+
+static void put_char(Text *t, char c) {
+    if (t->used + 1 < t->size) t->buf[t->used] = c;
+    t->used++;
+}
+
+static void put_string(Text *t, const char *s) {
+    while (*s) put_char(t, *s++);
+}
+
+static void put_hex(Text *t, unsigned value, int digits) {
+    put_char(t, '$');
+    for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+        put_char(t, hex_digits[(value >> shift) & 0xF]);
+    }
+}
+
+int disassemble(CpuModel model, uint16_t pc, const uint8_t *code, char *buf, size_t size) {
+    const OpcodeInfo *op = opcode_info(model, code[0]);
+    Text t = { buf, size, 0 };
+    uint8_t zp = op->length > 1 ? code[1] : 0;
+    uint16_t word = op->length > 2 ? (uint16_t)(code[1] | code[2] << 8) : zp;
+
+    put_string(&t, op->mnemonic);
+    if (op->mode != MODE_IMPLIED) put_char(&t, ' ');
+    switch (op->mode) {
+        case MODE_IMPLIED: break;
+        case MODE_ACCUMULATOR: put_char(&t, 'A'); break;
+        case MODE_IMMEDIATE: put_char(&t, '#'); put_hex(&t, zp, 2); break;
+        case MODE_ZEROPAGE: put_hex(&t, zp, 2); break;
+        case MODE_ZEROPAGE_X: put_hex(&t, zp, 2); put_string(&t, ",X"); break;
+        case MODE_ZEROPAGE_Y: put_hex(&t, zp, 2); put_string(&t, ",Y"); break;
+        case MODE_ABSOLUTE: put_hex(&t, word, 4); break;
+        case MODE_ABSOLUTE_X: put_hex(&t, word, 4); put_string(&t, ",X"); break;
+        case MODE_ABSOLUTE_Y: put_hex(&t, word, 4); put_string(&t, ",Y"); break;
+        case MODE_INDIRECT: put_char(&t, '('); put_hex(&t, word, 4); put_char(&t, ')'); break;
+        case MODE_INDIRECT_X: put_char(&t, '('); put_hex(&t, zp, 2); put_string(&t, ",X)"); break;
+        case MODE_INDIRECT_Y: put_char(&t, '('); put_hex(&t, zp, 2); put_string(&t, "),Y"); break;
+        case MODE_ZEROPAGE_INDIRECT: put_char(&t, '('); put_hex(&t, zp, 2); put_char(&t, ')'); break;
+        case MODE_ABSOLUTE_INDIRECT_X: put_char(&t, '('); put_hex(&t, word, 4); put_string(&t, ",X)"); break;
+        case MODE_RELATIVE:
+            put_hex(&t, (uint16_t)(pc + 2 + (int8_t)zp), 4);
+            break;
+        case MODE_ZEROPAGE_RELATIVE:
+            put_hex(&t, zp, 2);
+            put_char(&t, ',');
+            put_hex(&t, (uint16_t)(pc + 3 + (int8_t)code[2]), 4);
+            break;
+    }
+    if (size > 0) buf[t.used < size ? t.used : size - 1] = '\0';
+    return op->length;
+}
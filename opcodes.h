@@ -0,0 +1,68 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+// What every opcode of each CPU model is: the one table the decoder takes
+// its base cycles from and the batch core, idle loop detection, tracing and
+// the disassembler take lengths, timing and side effects from.
+
+typedef enum {
+    MODE_IMPLIED,
+    MODE_ACCUMULATOR,
+    MODE_IMMEDIATE,             // #$nn
+    MODE_ZEROPAGE,              // $nn
+    MODE_ZEROPAGE_X,            // $nn,X
+    MODE_ZEROPAGE_Y,            // $nn,Y
+    MODE_ABSOLUTE,              // $nnnn
+    MODE_ABSOLUTE_X,            // $nnnn,X
+    MODE_ABSOLUTE_Y,            // $nnnn,Y
+    MODE_INDIRECT,              // ($nnnn), JMP only
+    MODE_INDIRECT_X,            // ($nn,X)
+    MODE_INDIRECT_Y,            // ($nn),Y
+    MODE_ZEROPAGE_INDIRECT,     // ($nn), 65C02
+    MODE_ABSOLUTE_INDIRECT_X,   // ($nnnn,X), 65C02 JMP
+    MODE_RELATIVE,              // Branch offset
+    MODE_ZEROPAGE_RELATIVE      // $nn,offset: 65C02 BBR/BBS
+} AddressMode;
+
+// Side effects
+#define OP_READ         0x0001  // Reads memory through its operand
+#define OP_WRITE        0x0002  // Writes memory through its operand
+#define OP_STACK        0x0004  // Pushes or pulls
+#define OP_BRANCH       0x0008  // Conditional (or BRA) relative branch
+#define OP_JUMP         0x0010  // Always leaves the PC somewhere other than the next instruction
+#define OP_HALT         0x0020  // Stops the CPU (JAM, WAI, STP)
+#define OP_UNDOCUMENTED 0x0040
+#define OP_ILLEGAL      0x0080  // Handled by the CPU's IllegalPolicy (unstable and JAM opcodes)
+#define OP_PAGE_CYCLE   0x0100  // One more cycle when indexing crosses a page
+
+typedef struct {
+    char mnemonic[5];
+    uint8_t mode;               // AddressMode
+    uint8_t length;             // Bytes, including the opcode
+    uint8_t cycles;             // Base cycles; page crossings, taken branches and
+                                // 65C02 decimal arithmetic add more
+    uint8_t flags;              // FLAG_* bits the instruction may change
+    uint16_t effects;           // OP_* bits
+} OpcodeInfo;
+
+// Indexed by CpuModel, then by opcode
+extern const OpcodeInfo opcode_table[2][256];
+
+static inline const OpcodeInfo *opcode_info(CpuModel model, uint8_t opcode) {
+    return &opcode_table[model][opcode];
+}
+
+// Longest text disassemble writes, with its terminator ("BBR0 $12,$1234")
+#define DISASM_MAX 16
+
+// Write the instruction at pc, whose bytes start at code (opcode_info's
+// length of them are read), as assembler text into buf: "LDA ($12),Y",
+// "BNE $0207". Branch targets are resolved. Never allocates; the text is
+// truncated to size. Returns the instruction length.
+int disassemble(CpuModel model, uint16_t pc, const uint8_t *code, char *buf, size_t size);
+
+#endif
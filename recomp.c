@@ -0,0 +1,837 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "cpu.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "loader.h"
+#include "symbols.h"
+
+// Ahead-of-time recompiler: finds the code of an image by recursive descent
+// from its entry points and writes it out as C for aot.h. Every routine
+// (entry point or JSR target) becomes one function, with the routine's
+// branches and jumps as gotos between labels and the 6502 registers in
+// locals. JSR, RTS and jumps to other routines leave the function with the
+// new PC, and the module's run function dispatches on it.
+//
+// Code is cut into blocks at every label the dispatcher can enter and after
+// every branch. Each block starts by checking that the most cycles it can
+// take still fit below the limit, so compiled code stops on exactly the
+// instruction cpu_execute would; the interpreter does the last few.
+
+static uint8_t image[MEMORY_SIZE];
+static CpuModel model;
+static SymbolTable *symbols;
+
+// The code found from the entry points
+static uint8_t reached[MEMORY_SIZE];        // Instruction starts
+static uint8_t is_entry[MEMORY_SIZE];       // Entry points and JSR targets
+static uint8_t native_code[MEMORY_SIZE];    // Bytes of instructions compiled to C
+static int owner[MEMORY_SIZE];              // Routine the dispatcher enters at a block start, or -1
+static uint16_t routines[MEMORY_SIZE];
+static int routine_count;
+
+// The routine being compiled
+static uint8_t in_body[MEMORY_SIZE];
+static uint8_t block_start[MEMORY_SIZE];
+static uint8_t referenced[MEMORY_SIZE];     // Needs a label
+static uint16_t body[MEMORY_SIZE];
+static int body_count;
+static uint16_t work[MEMORY_SIZE * 3];
+
+// Code pages, in address order
+static int16_t page_index[MEMORY_PAGES];
+static int page_count;
+
+// Instructions compiled to C; everything else is left to cpu_step
+static const char *const native_mnemonics[] = {
+    "LDA", "LDX", "LDY", "STA", "STX", "STY", "STZ",
+    "ADC", "SBC", "AND", "ORA", "EOR", "CMP", "CPX", "CPY", "BIT", "TSB", "TRB",
+    "INC", "DEC", "ASL", "LSR", "ROL", "ROR", "INX", "INY", "DEX", "DEY",
+    "TAX", "TAY", "TXA", "TYA", "TSX", "TXS",
+    "PHA", "PHP", "PHX", "PHY", "PLA", "PLP", "PLX", "PLY",
+    "CLC", "SEC", "CLI", "SEI", "CLV", "CLD", "SED", "NOP",
+    "BCC", "BCS", "BEQ", "BNE", "BMI", "BPL", "BVC", "BVS", "BRA",
+    "JMP", "JSR", "RTS"
+};
+
+static const OpcodeInfo *info_at(uint16_t a) {
+    return opcode_info(model, image[a]);
+}
+
+static int is(const OpcodeInfo *op, const char *mnemonic) {
+    return strcmp(op->mnemonic, mnemonic) == 0;
+}
+
+static uint16_t operand_word(uint16_t a) {
+    return (uint16_t)(image[(uint16_t)(a + 1)] | image[(uint16_t)(a + 2)] << 8);
+}
+
+static uint16_t branch_target(uint16_t a) {
+    const OpcodeInfo *op = info_at(a);
+    return (uint16_t)(a + op->length + (int8_t)image[(uint16_t)(a + op->length - 1)]);
+}
+
+// Instructions running into the top of memory are left to the interpreter
+static int fits(uint16_t a) {
+    return a + info_at(a)->length < MEMORY_SIZE;
+}
+
+static int is_native(uint16_t a) {
+    const OpcodeInfo *op = info_at(a);
+    if ((op->effects & (OP_UNDOCUMENTED | OP_ILLEGAL | OP_HALT)) || !fits(a)) return 0;
+    if (is(op, "JMP") && op->mode != MODE_ABSOLUTE) return 0;
+    for (size_t i = 0; i < sizeof(native_mnemonics) / sizeof(native_mnemonics[0]); i++) {
+        if (is(op, native_mnemonics[i])) return 1;
+    }
+    return 0;
+}
+
+// Where execution can go on after the instruction at a, into next; returns
+// how many places. A JSR's target goes into *call instead.
+static int successors(uint16_t a, uint16_t *next, int *call) {
+    const OpcodeInfo *op = info_at(a);
+    uint16_t after = (uint16_t)(a + op->length);
+    *call = -1;
+    if (!fits(a) || (op->effects & (OP_HALT | OP_ILLEGAL)) || is(op, "RTS") || is(op, "RTI") || is(op, "BRK")) {
+        return 0;
+    }
+    if (is(op, "JMP")) {
+        if (op->mode != MODE_ABSOLUTE) return 0;
+        next[0] = operand_word(a);
+        return 1;
+    }
+    if (is(op, "JSR")) {
+        *call = operand_word(a);
+        next[0] = after;
+        return 1;
+    }
+    if (is(op, "BRA")) {
+        next[0] = branch_target(a);
+        return 1;
+    }
+    if (op->effects & OP_BRANCH) {
+        next[0] = branch_target(a);
+        next[1] = after;
+        return 2;
+    }
+    next[0] = after;
+    return 1;
+}
+
+// Walk all the code reachable from the entry points
+static void find_code(void) {
+    int top = 0;
+    for (int i = 0; i < routine_count; i++) {
+        if (!reached[routines[i]]) {
+            reached[routines[i]] = 1;
+            work[top++] = routines[i];
+        }
+    }
+    while (top) {
+        uint16_t a = work[--top];
+        uint16_t next[2];
+        int call;
+        int count = successors(a, next, &call);
+        if (call >= 0 && !is_entry[call]) {
+            is_entry[call] = 1;
+            routines[routine_count++] = (uint16_t)call;
+        }
+        if (call >= 0) next[count++] = (uint16_t)call;
+        for (int i = 0; i < count; i++) {
+            if (!reached[next[i]]) {
+                reached[next[i]] = 1;
+                work[top++] = next[i];
+            }
+        }
+        if (is_native(a)) memset(&native_code[a], 1, info_at(a)->length);
+    }
+}
+
+static int compare_address(const void *x, const void *y) {
+    return *(const uint16_t *)x - *(const uint16_t *)y;
+}
+
+// Collect the body of the routine at entry: what it reaches without calling
+// or jumping to another routine
+static void walk_routine(uint16_t entry) {
+    for (int i = 0; i < body_count; i++) {
+        in_body[body[i]] = block_start[body[i]] = referenced[body[i]] = 0;
+    }
+    body_count = 0;
+    int top = 0;
+    work[top++] = entry;
+    block_start[entry] = 1;
+    while (top) {
+        uint16_t a = work[--top];
+        if (in_body[a]) continue;
+        in_body[a] = 1;
+        body[body_count++] = a;
+        const OpcodeInfo *op = info_at(a);
+        uint16_t next[2];
+        int call;
+        int count = successors(a, next, &call);
+        for (int i = 0; i < count; i++) {
+            uint16_t to = next[i];
+            if (!is_native(a)) {
+                // The interpreter runs this one; resume after it
+                block_start[to] = 1;
+            } else if (is(op, "JMP")) {
+                if (is_entry[to] && to != entry) continue;
+                block_start[to] = 1;
+            } else if (call >= 0 || (op->effects & OP_BRANCH) || is(op, "ADC") || is(op, "SBC")) {
+                // After a JSR returns, either way out of a branch, and after
+                // ADC or SBC the interpreter ran in decimal mode
+                block_start[to] = 1;
+            }
+            if (!in_body[to]) work[top++] = to;
+        }
+    }
+    qsort(body, body_count, sizeof(uint16_t), compare_address);
+}
+
+// Whether the instruction at a, compiled, can go on to the next one
+static int falls_through(uint16_t a) {
+    const OpcodeInfo *op = info_at(a);
+    if (!is_native(a)) return 0;
+    if (is(op, "JMP") || is(op, "JSR") || is(op, "RTS") || is(op, "BRA")) return 0;
+    return 1;
+}
+
+// Most cycles the instruction at a takes in compiled code
+static int max_cycles(uint16_t a) {
+    const OpcodeInfo *op = info_at(a);
+    return op->cycles + ((op->effects & OP_PAGE_CYCLE) ? 1 : 0) + ((op->effects & OP_BRANCH) ? 2 : 0);
+}
+
+// Most cycles from block start a to the end of its block
+static int block_cycles(uint16_t a) {
+    int total = 0;
+    for (;;) {
+        if (!is_native(a)) return total;
+        total += max_cycles(a);
+        if (!falls_through(a) || (info_at(a)->effects & OP_BRANCH)) return total;
+        a = (uint16_t)(a + info_at(a)->length);
+        if (block_start[a]) return total;
+    }
+}
+
+// Page the computed address is known to be in, or -1
+static int ea_page;
+
+typedef struct {
+    int check;          // Whether a write hit compiled code: 0 no, 1 yes, -1 check ea
+} Store;
+
+// The C for writing value to ea (or the constant address), noting in store
+// whether the function must be left after the instruction
+static void emit_write(FILE *out, int address, const char *value, Store *store, int stack) {
+    if (address >= 0) {
+        fprintf(out, "aot_write(cpu, c, 0x%04X, %s); ", address, value);
+    } else {
+        fprintf(out, "aot_write(cpu, c, ea, %s); ", value);
+    }
+    int page = stack ? 1 : ea_page;
+    int check;
+    if (address >= 0) {
+        check = native_code[address];
+    } else if (page >= 0) {
+        check = page_index[page] >= 0 ? -1 : 0;
+    } else {
+        check = page_count ? -1 : 0;
+    }
+    if (check == 1 || (check < 0 && store->check == 0)) store->check = check;
+}
+
+// Compute the effective address into ea (or *address for a constant one)
+static void emit_address(FILE *out, uint16_t a, int *address) {
+    const OpcodeInfo *op = info_at(a);
+    uint8_t zp = image[(uint16_t)(a + 1)];
+    uint16_t abs = operand_word(a);
+    int page = (op->effects & OP_PAGE_CYCLE) != 0;
+    *address = -1;
+    ea_page = op->mode == MODE_ZEROPAGE_X || op->mode == MODE_ZEROPAGE_Y ? 0 : -1;
+    switch (op->mode) {
+    case MODE_ZEROPAGE:
+        *address = zp;
+        break;
+    case MODE_ZEROPAGE_X:
+        fprintf(out, "uint16_t ea = (uint8_t)(0x%02X + X); ", zp);
+        break;
+    case MODE_ZEROPAGE_Y:
+        fprintf(out, "uint16_t ea = (uint8_t)(0x%02X + Y); ", zp);
+        break;
+    case MODE_ABSOLUTE:
+        *address = abs;
+        break;
+    case MODE_ABSOLUTE_X:
+    case MODE_ABSOLUTE_Y:
+        fprintf(out, "uint16_t ea = (uint16_t)(0x%04X + %c); ", abs, op->mode == MODE_ABSOLUTE_X ? 'X' : 'Y');
+        if (page) fprintf(out, "if (ea >> 8 != 0x%02X) c++; ", abs >> 8);
+        break;
+    case MODE_INDIRECT_X:
+        fprintf(out, "uint8_t z = (uint8_t)(0x%02X + X); uint16_t ea = aot_read(cpu, c, z); "
+                "ea |= aot_read(cpu, c, (uint8_t)(z + 1)) << 8; ", zp);
+        break;
+    case MODE_INDIRECT_Y:
+    case MODE_ZEROPAGE_INDIRECT:
+        fprintf(out, "uint16_t base = aot_read(cpu, c, 0x%02X); base |= aot_read(cpu, c, 0x%02X) << 8; ",
+                zp, (uint8_t)(zp + 1));
+        if (op->mode == MODE_ZEROPAGE_INDIRECT) {
+            fprintf(out, "uint16_t ea = base; ");
+        } else {
+            fprintf(out, "uint16_t ea = (uint16_t)(base + Y); ");
+            if (page) fprintf(out, "if ((base ^ ea) & 0xFF00) c++; ");
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// The operand's value into v
+static void emit_value(FILE *out, uint16_t a, int address) {
+    const OpcodeInfo *op = info_at(a);
+    if (op->mode == MODE_IMMEDIATE) {
+        fprintf(out, "uint8_t v = 0x%02X; ", image[(uint16_t)(a + 1)]);
+    } else if (address >= 0) {
+        fprintf(out, "uint8_t v = aot_read(cpu, c, 0x%04X); ", address);
+    } else {
+        fprintf(out, "uint8_t v = aot_read(cpu, c, ea); ");
+    }
+}
+
+static void emit_goto(FILE *out, uint16_t target) {
+    fprintf(out, "goto L%04X;", target);
+}
+
+static void emit_exit(FILE *out, uint16_t pc, int more) {
+    fprintf(out, "pc = 0x%04X; goto %s;", pc, more ? "leave" : "stop");
+}
+
+static int uses_leave;
+static int uses_page_index;
+
+// The C for the native instruction at a, in the routine at entry
+static void emit_instruction(FILE *out, uint16_t a, uint16_t entry) {
+    const OpcodeInfo *op = info_at(a);
+    const char *m = op->mnemonic;
+    char reg = m[2];
+    uint16_t next = (uint16_t)(a + op->length);
+    int address = -1;
+    Store store = { 0 };
+
+    fprintf(out, "    ");
+    if (is(op, "ADC") || is(op, "SBC")) {
+        fprintf(out, "if (P & FLAG_D) { ");
+        emit_exit(out, a, 0);
+        fprintf(out, " }\n    ");
+    }
+    fprintf(out, "{ ");
+    if (op->mode != MODE_IMPLIED && op->mode != MODE_ACCUMULATOR && op->mode != MODE_IMMEDIATE &&
+        op->mode != MODE_RELATIVE && !is(op, "JMP") && !is(op, "JSR")) {
+        emit_address(out, a, &address);
+    }
+
+    if (is(op, "LDA") || is(op, "LDX") || is(op, "LDY")) {
+        emit_value(out, a, address);
+        fprintf(out, "%c = v; P = aot_zn(P, %c); ", reg, reg);
+    } else if (is(op, "STA") || is(op, "STX") || is(op, "STY") || is(op, "STZ")) {
+        emit_write(out, address, reg == 'Z' ? "0" : (char[]){ reg, 0 }, &store, 0);
+    } else if (is(op, "ADC") || is(op, "SBC")) {
+        emit_value(out, a, address);
+        fprintf(out, "A = aot_%s(&P, A, v); ", is(op, "ADC") ? "adc" : "sbc");
+    } else if (is(op, "AND") || is(op, "ORA") || is(op, "EOR")) {
+        emit_value(out, a, address);
+        fprintf(out, "A %s= v; P = aot_zn(P, A); ", is(op, "AND") ? "&" : is(op, "ORA") ? "|" : "^");
+    } else if (is(op, "CMP") || is(op, "CPX") || is(op, "CPY")) {
+        emit_value(out, a, address);
+        fprintf(out, "P = aot_compare(P, %c, v); ", is(op, "CMP") ? 'A' : reg);
+    } else if (is(op, "BIT")) {
+        emit_value(out, a, address);
+        if (op->mode == MODE_IMMEDIATE) {
+            // BIT # only sets Z
+            fprintf(out, "P = (A & v) ? P & ~FLAG_Z : P | FLAG_Z; ");
+        } else {
+            fprintf(out, "P = aot_bit(P, A, v); ");
+        }
+    } else if (is(op, "TSB") || is(op, "TRB")) {
+        emit_value(out, a, address);
+        fprintf(out, "P = (A & v) ? P & ~FLAG_Z : P | FLAG_Z; ");
+        emit_write(out, address, is(op, "TSB") ? "v | A" : "v & ~A", &store, 0);
+    } else if ((is(op, "INC") || is(op, "DEC")) && op->mode == MODE_ACCUMULATOR) {
+        fprintf(out, "A%s; P = aot_zn(P, A); ", is(op, "INC") ? "++" : "--");
+    } else if (is(op, "INC") || is(op, "DEC")) {
+        emit_value(out, a, address);
+        fprintf(out, "v%s; ", is(op, "INC") ? "++" : "--");
+        emit_write(out, address, "v", &store, 0);
+        fprintf(out, "P = aot_zn(P, v); ");
+    } else if (is(op, "ASL") || is(op, "LSR") || is(op, "ROL") || is(op, "ROR")) {
+        int acc = op->mode == MODE_ACCUMULATOR;
+        if (acc) {
+            fprintf(out, "uint8_t v = A; ");
+        } else {
+            emit_value(out, a, address);
+        }
+        if (m[0] == 'A' || (m[1] == 'O' && m[2] == 'L')) {
+            fprintf(out, "uint8_t carry = %s; P = (uint8_t)((P & ~FLAG_C) | v >> 7); v = (uint8_t)(v << 1 | carry); ",
+                    is(op, "ROL") ? "P & FLAG_C" : "0");
+        } else {
+            fprintf(out, "uint8_t carry = %s; P = (uint8_t)((P & ~FLAG_C) | (v & 1)); v = (uint8_t)(v >> 1 | carry); ",
+                    is(op, "ROR") ? "(P & FLAG_C) << 7" : "0");
+        }
+        if (acc) {
+            fprintf(out, "A = v; ");
+        } else {
+            emit_write(out, address, "v", &store, 0);
+        }
+        fprintf(out, "P = aot_zn(P, v); ");
+    } else if (is(op, "INX") || is(op, "INY") || is(op, "DEX") || is(op, "DEY")) {
+        fprintf(out, "%c%s; P = aot_zn(P, %c); ", reg, m[0] == 'I' ? "++" : "--", reg);
+    } else if (m[0] == 'T' && op->mode == MODE_IMPLIED) {
+        // TAX, TAY, TXA, TYA, TSX, TXS
+        char from = m[1] == 'S' ? 'S' : m[1];
+        char to = m[2] == 'S' ? 'S' : m[2];
+        fprintf(out, "%c = %c; ", to, from);
+        if (to != 'S') fprintf(out, "P = aot_zn(P, %c); ", to);
+    } else if (m[0] == 'P' && m[1] == 'H') {
+        char value[32];
+        if (reg == 'P') {
+            snprintf(value, sizeof(value), "P | FLAG_B | FLAG_U");
+        } else {
+            snprintf(value, sizeof(value), "%c", reg);
+        }
+        fprintf(out, "uint16_t ea = 0x100 | S--; ");
+        emit_write(out, -1, value, &store, 1);
+    } else if (m[0] == 'P' && m[1] == 'L') {
+        fprintf(out, "uint8_t v = aot_read(cpu, c, 0x100 | ++S); ");
+        if (reg == 'P') {
+            fprintf(out, "P = v | FLAG_U; ");
+        } else {
+            fprintf(out, "%c = v; P = aot_zn(P, v); ", reg);
+        }
+    } else if (m[0] == 'C' && m[1] == 'L') {
+        fprintf(out, "P &= ~FLAG_%c; ", m[2]);
+    } else if (m[0] == 'S' && m[1] == 'E') {
+        fprintf(out, "P |= FLAG_%c; ", m[2]);
+    } else if (is(op, "NOP")) {
+        // Nothing
+    } else if (op->effects & OP_BRANCH) {
+        static const char *const conditions[] = {
+            "BCC", "!(P & FLAG_C)", "BCS", "P & FLAG_C", "BEQ", "P & FLAG_Z", "BNE", "!(P & FLAG_Z)",
+            "BMI", "P & FLAG_N", "BPL", "!(P & FLAG_N)", "BVC", "!(P & FLAG_V)", "BVS", "P & FLAG_V",
+            "BRA", "1"
+        };
+        uint16_t target = branch_target(a);
+        const char *condition = "1";
+        for (size_t i = 0; i < sizeof(conditions) / sizeof(conditions[0]); i += 2) {
+            if (is(op, conditions[i])) condition = conditions[i + 1];
+        }
+        fprintf(out, "c += %d; n++; ", op->cycles);
+        int taken = ((next ^ target) & 0xFF00) ? 2 : 1;
+        if (is(op, "BRA")) {
+            fprintf(out, "c += %d; ", taken);
+            emit_goto(out, target);
+            fprintf(out, " }\n");
+            return;
+        }
+        fprintf(out, "if (%s) { c += %d; ", condition, taken);
+        emit_goto(out, target);
+        fprintf(out, " } }\n");
+        return;
+    } else if (is(op, "JMP")) {
+        uint16_t target = operand_word(a);
+        fprintf(out, "c += %d; n++; ", op->cycles);
+        if (is_entry[target] && target != entry) {
+            emit_exit(out, target, 1);
+            uses_leave = 1;
+        } else {
+            emit_goto(out, target);
+        }
+        fprintf(out, " }\n");
+        return;
+    } else if (is(op, "JSR")) {
+        // The function is left anyway, and whatever is entered next checks its pages
+        uint16_t back = (uint16_t)(a + 2);
+        fprintf(out, "aot_write(cpu, c, 0x100 | S--, 0x%02X); aot_write(cpu, c, 0x100 | S--, 0x%02X); c += %d; n++; ",
+                back >> 8, back & 0xFF, op->cycles);
+        emit_exit(out, operand_word(a), 1);
+        fprintf(out, " }\n");
+        uses_leave = 1;
+        return;
+    } else if (is(op, "RTS")) {
+        fprintf(out, "uint16_t to = aot_read(cpu, c, 0x100 | ++S); to |= aot_read(cpu, c, 0x100 | ++S) << 8; "
+                "c += %d; n++; pc = (uint16_t)(to + 1); goto leave; }\n", op->cycles);
+        uses_leave = 1;
+        return;
+    }
+
+    fprintf(out, "c += %d; n++; ", op->cycles);
+    if (store.check == 1) {
+        emit_exit(out, next, 0);
+        fprintf(out, " ");
+    } else if (store.check < 0) {
+        uses_page_index = 1;
+        fprintf(out, "if (aot_is_code(pages, page_index, ea)) { ");
+        emit_exit(out, next, 0);
+        fprintf(out, " } ");
+    }
+    fprintf(out, "}\n");
+}
+
+// The function for routine number r
+static void emit_routine(FILE *out, int r) {
+    uint16_t entry = routines[r];
+    walk_routine(entry);
+
+    // Labels: dispatcher entries, goto targets and fall-throughs that are
+    // not next in address order
+    for (int i = 0; i < body_count; i++) {
+        uint16_t a = body[i];
+        const OpcodeInfo *op = info_at(a);
+        if (owner[a] == r) referenced[a] = 1;
+        if (!is_native(a)) continue;
+        if (op->effects & OP_BRANCH) referenced[branch_target(a)] = 1;
+        if (is(op, "JMP") && !(is_entry[operand_word(a)] && operand_word(a) != entry)) {
+            referenced[operand_word(a)] = 1;
+        }
+        uint16_t next = (uint16_t)(a + op->length);
+        if (falls_through(a) && (i + 1 == body_count || body[i + 1] != next)) referenced[next] = 1;
+    }
+
+    char name[256];
+    if (symbols_format(symbols, entry, name, sizeof(name)) && !strchr(name, '+')) {
+        fprintf(out, "// %s\n", name);
+    }
+    fprintf(out, "static int r%04X(CPU *cpu, uint64_t limit) {\n", entry);
+    // Every page with code of the routine's must still hold it
+    int last = -1;
+    for (int i = 0; i < body_count; i++) {
+        uint16_t a = body[i];
+        if (!is_native(a)) continue;
+        for (int b = a; b < a + info_at(a)->length; b++) {
+            int index = page_index[b >> 8];
+            if (index > last) {
+                fprintf(out, "    if (!aot_page_ok(&pages[%d], &checked[%d])) return 0;\n", index, index);
+                last = index;
+            }
+        }
+    }
+    fprintf(out, "    uint8_t A = cpu->A, X = cpu->X, Y = cpu->Y, S = cpu->SP, P = cpu->status;\n");
+    fprintf(out, "    uint64_t c = cpu->cycles, n = cpu->instructions;\n");
+    fprintf(out, "    uint16_t pc = cpu->PC;\n");
+    fprintf(out, "    int more = 1;\n");
+    fprintf(out, "    switch (pc) {\n");
+    for (int i = 0; i < body_count; i++) {
+        if (owner[body[i]] == r) fprintf(out, "    case 0x%04X: goto L%04X;\n", body[i], body[i]);
+    }
+    fprintf(out, "    default: return 0;\n    }\n");
+
+    uses_leave = 0;
+    for (int i = 0; i < body_count; i++) {
+        uint16_t a = body[i];
+        const OpcodeInfo *op = info_at(a);
+        uint8_t code[3];
+        char text[DISASM_MAX];
+        for (int k = 0; k < 3; k++) code[k] = image[(uint16_t)(a + k)];
+        disassemble(model, a, code, text, sizeof(text));
+        if (referenced[a]) fprintf(out, "L%04X:\n", a);
+        if (symbols_format(symbols, a, name, sizeof(name)) && !strchr(name, '+') && a != entry) {
+            fprintf(out, "    // %s\n", name);
+        }
+        fprintf(out, "    // %04X  %s\n", a, text);
+        if (!is_native(a)) {
+            fprintf(out, "    ");
+            emit_exit(out, a, 0);
+            fprintf(out, "\n");
+            continue;
+        }
+        if (block_start[a]) {
+            fprintf(out, "    if (limit - c < %d) { ", block_cycles(a));
+            emit_exit(out, a, 0);
+            fprintf(out, " }\n");
+        }
+        emit_instruction(out, a, entry);
+        uint16_t next = (uint16_t)(a + op->length);
+        if (falls_through(a) && (i + 1 == body_count || body[i + 1] != next)) {
+            fprintf(out, "    ");
+            emit_goto(out, next);
+            fprintf(out, "\n");
+        }
+    }
+    fprintf(out, "stop:\n    more = 0;\n");
+    if (uses_leave) fprintf(out, "leave:\n");
+    fprintf(out, "    cpu->A = A; cpu->X = X; cpu->Y = Y; cpu->SP = S; cpu->status = P;\n");
+    fprintf(out, "    cpu->PC = pc; cpu->cycles = c; cpu->instructions = n;\n");
+    fprintf(out, "    return more;\n}\n\n");
+}
+
+// The page table, the dispatcher and the module description
+static int emit_module(FILE *out, const char *load_file, const char *name) {
+    static const char *const model_names[] = { "CPU_6502", "CPU_65C02" };
+
+    // The functions go first into memory, as whether the tables they use
+    // are needed is only known after
+    char *functions;
+    size_t size;
+    FILE *code = open_memstream(&functions, &size);
+    if (!code) return 0;
+    // A routine the dispatcher never enters (one that is all code left to
+    // the interpreter, or shares all its blocks with earlier ones) gets no
+    // function
+    static uint8_t owns[MEMORY_SIZE];
+    for (int a = 0; a < MEMORY_SIZE; a++) {
+        if (owner[a] >= 0) owns[owner[a]] = 1;
+    }
+    int emitted = 0;
+    for (int r = 0; r < routine_count; r++) {
+        if (owns[r]) {
+            emit_routine(code, r);
+            emitted++;
+        }
+    }
+    if (fclose(code) != 0) return 0;
+
+    fprintf(out, "// Compiled from %s by 6502recomp for aot.h; do not edit\n", load_file);
+    fprintf(out, "#include \"aot.h\"\n\n");
+    if (emitted) {
+        fprintf(out, "static const AotPage pages[%d] = {\n", page_count);
+        for (int page = 0; page < MEMORY_PAGES; page++) {
+            if (page_index[page] < 0) continue;
+            fprintf(out, "    { 0x%02X,\n      {", page);
+            for (int i = 0; i < MEMORY_PAGE_SIZE / 8; i++) {
+                uint8_t bits = 0;
+                for (int b = 0; b < 8; b++) bits |= native_code[page * MEMORY_PAGE_SIZE + i * 8 + b] << b;
+                fprintf(out, "%s0x%02X", i ? "," : "", bits);
+            }
+            fprintf(out, "},\n      {");
+            for (int i = 0; i < MEMORY_PAGE_SIZE; i++) {
+                int address = page * MEMORY_PAGE_SIZE + i;
+                fprintf(out, "%s%s0x%02X", i ? "," : "", i && i % 16 == 0 ? "\n       " : "",
+                        native_code[address] ? image[address] : 0);
+            }
+            fprintf(out, "} },\n");
+        }
+        fprintf(out, "};\n\n");
+        fprintf(out, "// Hash each page was last found intact with, per thread\n");
+        fprintf(out, "static __thread uint64_t checked[%d];\n\n", page_count);
+    }
+    if (uses_page_index) {
+        fprintf(out, "static const int16_t page_index[%d] = {", MEMORY_PAGES);
+        for (int page = 0; page < MEMORY_PAGES; page++) {
+            fprintf(out, "%s%s%d", page ? "," : "", page && page % 16 == 0 ? "\n   " : "", page_index[page]);
+        }
+        fprintf(out, "\n};\n\n");
+    }
+    fwrite(functions, 1, size, out);
+    free(functions);
+
+    fprintf(out, "static void run(CPU *cpu, uint64_t limit) {\n");
+    fprintf(out, "    int more = 1;\n");
+    fprintf(out, "    while (more) {\n");
+    fprintf(out, "        switch (cpu->PC) {\n");
+    for (int r = 0; r < routine_count; r++) {
+        int cases = 0;
+        for (int a = 0; a < MEMORY_SIZE; a++) {
+            if (owner[a] != r) continue;
+            fprintf(out, "%s0x%04X:", cases % 6 ? " case " : cases ? "\n        case " : "        case ", a);
+            cases++;
+        }
+        if (cases) fprintf(out, "\n            more = r%04X(cpu, limit);\n            break;\n", routines[r]);
+    }
+    fprintf(out, "        default:\n%s            return;\n        }\n    }\n}\n\n",
+            emitted ? "" : "            (void)limit;\n");
+
+    fprintf(out, "const AotModule %s = { AOT_ABI, sizeof(CPU), %s, \"", name, model_names[model]);
+    for (const char *p = load_file; *p; p++) {
+        fprintf(out, *p == '"' || *p == '\\' ? "\\%c" : "%c", *p);
+    }
+    fprintf(out, "\", %d, run };\n", emitted);
+    return 1;
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s --load FILE --output FILE.c [OPTIONS]\n", program_name);
+    printf("\nCompiles the code of an image to C, to build into a module that 6502emu --aot\n");
+    printf("(or any program calling aot_execute) runs in place of the interpreter.\n");
+    printf("\nOptions:\n");
+    printf("  --load FILE       Image: raw binary, Intel HEX, PRG or manifest\n");
+    printf("  --format FORMAT   Image format instead of guessing from the extension\n");
+    printf("  --offset OFFSET   Load a raw file at OFFSET (default: 0x0000)\n");
+    printf("  --entry ADDR      Where code starts (repeatable; default: the image's start address)\n");
+    printf("  --vectors         Also start from the NMI, reset and IRQ vectors\n");
+    printf("  --labels FILE     Load assembler labels: names for addresses and comments\n");
+    printf("  --cpu MODEL       CPU model: 6502 (default) or 65c02\n");
+    printf("  --name NAME       Name of the module symbol (default: aot_module)\n");
+    printf("  --output FILE     Write the C here\n");
+    printf("  --help            Display this help message\n");
+    printf("\nExample:\n");
+    printf("  %s --load rom.bin --offset 0xC000 --vectors --output rom.c\n", program_name);
+    printf("  make rom.so\n");
+    printf("  ./6502emu --load rom.bin --offset 0xC000 --reset --aot ./rom.so --cycles 100000000\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *load_file = NULL;
+    ImageFormat format = IMAGE_AUTO;
+    uint16_t offset = 0;
+    const char *entry_args[64];
+    int entry_count = 0;
+    int vectors = 0;
+    const char *label_files[16];
+    int label_count = 0;
+    const char *name = "aot_module";
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "--vectors") == 0) {
+            vectors = 1;
+        } else if (i + 1 >= argc) {
+            fprintf(stderr, "Error: %s requires an argument\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else if (strcmp(argv[i], "--load") == 0) {
+            load_file = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0) {
+            if (!image_parse_format(argv[++i], &format)) {
+                fprintf(stderr, "Error: Invalid image format '%s' (must be raw, hex, prg or manifest)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--offset") == 0) {
+            if (!symbols_resolve(NULL, argv[++i], &offset)) {
+                fprintf(stderr, "Error: Invalid offset '%s' (must be 0x0000-0xFFFF)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--entry") == 0) {
+            if (entry_count == (int)(sizeof(entry_args) / sizeof(entry_args[0]))) {
+                fprintf(stderr, "Error: Too many --entry addresses\n");
+                return 1;
+            }
+            entry_args[entry_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--labels") == 0) {
+            if (label_count == (int)(sizeof(label_files) / sizeof(label_files[0]))) {
+                fprintf(stderr, "Error: Too many --labels files\n");
+                return 1;
+            }
+            label_files[label_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            i++;
+            if (strcmp(argv[i], "6502") == 0) {
+                model = CPU_6502;
+            } else if (strcmp(argv[i], "65c02") == 0 || strcmp(argv[i], "65C02") == 0) {
+                model = CPU_65C02;
+            } else {
+                fprintf(stderr, "Error: Invalid CPU model '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--name") == 0) {
+            name = argv[++i];
+            int valid = (name[0] < '0' || name[0] > '9');
+            for (const char *p = name; *p; p++) {
+                if (!(*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9'))) {
+                    valid = 0;
+                }
+            }
+            if (!valid || !name[0]) {
+                fprintf(stderr, "Error: Invalid module name '%s' (must be a C identifier)\n", name);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 || strcmp(argv[i], "-o") == 0) {
+            output = argv[++i];
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!load_file || !output) {
+        fprintf(stderr, "Error: --load and --output are required\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (label_count) {
+        if (!(symbols = symbols_create())) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        for (int i = 0; i < label_count; i++) {
+            if (!symbols_load(symbols, label_files[i])) return 1;
+        }
+    }
+    memory_init();
+    uint16_t start;
+    if (!image_load(load_file, format, offset, &start)) return 1;
+    memory_copy_out(0, image, MEMORY_SIZE);
+
+    // The entry points are the first routines
+    for (int i = 0; i < entry_count; i++) {
+        uint16_t address;
+        if (!symbols_resolve(symbols, entry_args[i], &address)) {
+            fprintf(stderr, "Error: Invalid entry point '%s' (must be 0x0000-0xFFFF or a label)\n", entry_args[i]);
+            return 1;
+        }
+        if (!is_entry[address]) routines[routine_count++] = address;
+        is_entry[address] = 1;
+    }
+    if (!entry_count) {
+        routines[routine_count++] = start;
+        is_entry[start] = 1;
+    }
+    for (int v = vectors ? 0xFFFA : MEMORY_SIZE; v < MEMORY_SIZE; v += 2) {
+        uint16_t address = (uint16_t)(image[v] | image[v + 1] << 8);
+        if (!is_entry[address]) routines[routine_count++] = address;
+        is_entry[address] = 1;
+    }
+    find_code();
+
+    for (int page = 0; page < MEMORY_PAGES; page++) {
+        page_index[page] = -1;
+        for (int i = 0; i < MEMORY_PAGE_SIZE; i++) {
+            if (native_code[page * MEMORY_PAGE_SIZE + i]) {
+                page_index[page] = (int16_t)page_count++;
+                break;
+            }
+        }
+    }
+
+    // Each block start the dispatcher can enter goes to one routine: its
+    // own for an entry, else the first whose body has it
+    for (int a = 0; a < MEMORY_SIZE; a++) owner[a] = -1;
+    for (int r = 0; r < routine_count; r++) {
+        if (is_native(routines[r])) owner[routines[r]] = r;
+    }
+    int instructions = 0, interpreted = 0;
+    for (int r = 0; r < routine_count; r++) {
+        walk_routine(routines[r]);
+        for (int i = 0; i < body_count; i++) {
+            uint16_t a = body[i];
+            if (block_start[a] && owner[a] < 0 && is_native(a)) owner[a] = r;
+        }
+    }
+    for (int a = 0; a < MEMORY_SIZE; a++) {
+        if (reached[a]) {
+            instructions++;
+            if (!is_native((uint16_t)a)) interpreted++;
+        }
+    }
+
+    FILE *out = fopen(output, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot create '%s': %s\n", output, strerror(errno));
+        return 1;
+    }
+    int written = emit_module(out, load_file, name);
+    if (fclose(out) != 0 || !written) {
+        fprintf(stderr, "Error: Cannot write '%s': %s\n", output, strerror(errno));
+        return 1;
+    }
+    printf("Compiled %d routines, %d instructions (%d left to the interpreter), into %s\n",
+           routine_count, instructions, interpreted, output);
+    return 0;
+}
@@ -0,0 +1,337 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sched.h"
+#include "counters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+enum {
+    TASK_READY,     // On a run queue or inbox
+    TASK_RUNNING,
+    TASK_PARKED,
+    TASK_ENDED      // Takes no more input
+};
+
+typedef struct {
+    SchedTask *head;
+    SchedTask *tail;
+} TaskQueue;
+
+// Totals of the tasks a worker has finished
+typedef struct {
+    uint64_t tasks;
+    uint64_t slices;
+    uint64_t parks;
+    uint64_t ready_ns;
+    uint64_t max_ready_ns;
+    uint64_t max_task_ready_ns;
+} WorkerStats;
+
+typedef struct {
+    Scheduler *s;
+    int index;
+    pthread_t thread;
+    TaskQueue run;          // Only touched by the worker's thread
+
+    pthread_mutex_t lock;   // Protects everything below and the state of its tasks
+    pthread_cond_t wake;
+    TaskQueue inbox;        // Submitted or woken, not yet on the run queue
+    int stopping;
+    WorkerStats stats;
+} Worker;
+
+struct Scheduler {
+    SchedConfig config;
+    Worker *workers;
+    int worker_count;
+    pthread_mutex_t lock;   // Protects next_worker
+    int next_worker;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void queue_append(TaskQueue *q, SchedTask *task) {
+    task->next = NULL;
+    if (q->tail) q->tail->next = task;
+    else q->head = task;
+    q->tail = task;
+}
+
+static SchedTask *queue_pop(TaskQueue *q) {
+    SchedTask *task = q->head;
+    if (task) {
+        q->head = task->next;
+        if (!q->head) q->tail = NULL;
+    }
+    return task;
+}
+
+static void queue_concat(TaskQueue *q, TaskQueue *other) {
+    if (!other->head) return;
+    if (q->tail) q->tail->next = other->head;
+    else q->head = other->head;
+    q->tail = other->tail;
+    other->head = other->tail = NULL;
+}
+
+// Hand input held during a slice to the machine; called with the worker's
+// lock held. Returns 1 if there was any.
+static int deliver_input(SchedTask *task) {
+    if (!task->input_len && !task->input_end) return 0;
+    emu6502_append_input(task->machine, task->input, task->input_len);
+    if (task->input_end) emu6502_end_input(task->machine);
+    task->input_len = 0;
+    task->input_end = 0;
+    return 1;
+}
+
+// Make a task runnable on its worker; called with the worker's lock held
+static void make_ready(Worker *w, SchedTask *task, uint64_t now) {
+    task->state = TASK_READY;
+    task->since_ns = now;
+    int was_empty = w->inbox.head == NULL;
+    queue_append(&w->inbox, task);
+    if (was_empty) pthread_cond_signal(&w->wake);
+}
+
+static void finish(Worker *w, SchedTask *task) {
+    SchedTaskStats *st = &task->stats;
+    uint64_t mean_ready = st->slices ? st->ready_ns / st->slices : 0;
+
+    pthread_mutex_lock(&w->lock);
+    w->stats.tasks++;
+    w->stats.slices += st->slices;
+    w->stats.parks += st->parks;
+    w->stats.ready_ns += st->ready_ns;
+    if (st->max_ready_ns > w->stats.max_ready_ns) w->stats.max_ready_ns = st->max_ready_ns;
+    if (mean_ready > w->stats.max_task_ready_ns) w->stats.max_task_ready_ns = mean_ready;
+    pthread_mutex_unlock(&w->lock);
+
+    if (w->s->config.done) w->s->config.done(task, w->s->config.ctx);
+}
+
+// Run one quantum of task; returns its status
+static int run_slice(Scheduler *s, SchedTask *task) {
+    Emu6502Machine *m = task->machine;
+    uint64_t quantum = task->kind == SCHED_BASIC ? s->config.quantum_lines : s->config.quantum_cycles;
+    if (task->budget && task->budget - task->used < quantum) quantum = task->budget - task->used;
+
+    int status;
+    if (task->kind == SCHED_BASIC) {
+        uint64_t before = emu6502_basic_lines(m);
+        status = emu6502_basic_run(m, quantum);
+        uint64_t lines = emu6502_basic_lines(m) - before;
+        task->used += lines;
+        counters_add(COUNTER_BASIC_LINES, lines);
+    } else {
+        Emu6502Regs regs;
+        emu6502_get_regs(m, &regs);
+        uint64_t before = regs.cycles;
+        uint64_t instructions = emu6502_instructions(m);
+        uint64_t idle = emu6502_idle_cycles(m);
+        status = emu6502_run(m, quantum);
+        emu6502_get_regs(m, &regs);
+        task->used += regs.cycles - before;
+        counters_add(COUNTER_CYCLES, regs.cycles - before);
+        counters_add(COUNTER_INSTRUCTIONS, emu6502_instructions(m) - instructions);
+        counters_add(COUNTER_IDLE_CYCLES, emu6502_idle_cycles(m) - idle);
+    }
+    return status;
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    Scheduler *s = w->s;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        queue_concat(&w->run, &w->inbox);
+        if (w->stopping) break;
+        SchedTask *task = queue_pop(&w->run);
+        if (!task) {
+            pthread_cond_wait(&w->wake, &w->lock);
+            continue;
+        }
+        task->state = TASK_RUNNING;
+        pthread_mutex_unlock(&w->lock);
+
+        uint64_t start = now_ns();
+        uint64_t waited = start - task->since_ns;
+        task->stats.ready_ns += waited;
+        if (waited > task->stats.max_ready_ns) task->stats.max_ready_ns = waited;
+
+        int status, ended;
+        if (task->stats.slices == 0 && s->config.start && !s->config.start(task, s->config.ctx)) {
+            status = task->status;
+            ended = 1;
+        } else {
+            status = run_slice(s, task);
+            task->stats.slices++;
+            ended = status != EMU6502_BUDGET && status != EMU6502_WAITING;
+            if (status == EMU6502_BUDGET && task->budget && task->used >= task->budget) ended = 1;
+        }
+        uint64_t end = now_ns();
+        task->stats.run_ns += end - start;
+
+        if (ended) {
+            task->status = status;
+            pthread_mutex_lock(&w->lock);
+            task->state = TASK_ENDED;
+            pthread_mutex_unlock(&w->lock);
+            sched_task_free(task);
+            finish(w, task);
+            pthread_mutex_lock(&w->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        if (!deliver_input(task) && status == EMU6502_WAITING) {
+            task->state = TASK_PARKED;
+            task->since_ns = end;
+            task->stats.parks++;
+        } else {
+            task->state = TASK_READY;
+            task->since_ns = end;
+            queue_append(&w->run, task);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+Scheduler *sched_create(const SchedConfig *config) {
+    Scheduler *s = calloc(1, sizeof(Scheduler));
+    if (!s) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    s->config = *config;
+    if (!s->config.quantum_cycles) s->config.quantum_cycles = SCHED_DEFAULT_CYCLES;
+    if (!s->config.quantum_lines) s->config.quantum_lines = SCHED_DEFAULT_LINES;
+    int count = config->workers;
+    if (count <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        count = cpus > 0 ? (int)cpus : 1;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    s->workers = calloc(count, sizeof(Worker));
+    if (!s->workers) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(s);
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        Worker *w = &s->workers[i];
+        w->s = s;
+        w->index = i;
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->wake, NULL);
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            fprintf(stderr, "Error: Cannot start worker threads\n");
+            sched_destroy(s);
+            return NULL;
+        }
+        s->worker_count++;
+    }
+    return s;
+}
+
+void sched_destroy(Scheduler *s) {
+    if (!s) return;
+    for (int i = 0; i < s->worker_count; i++) {
+        Worker *w = &s->workers[i];
+        pthread_mutex_lock(&w->lock);
+        w->stopping = 1;
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+    for (int i = 0; i < s->worker_count; i++) pthread_join(s->workers[i].thread, NULL);
+    free(s->workers);
+    free(s);
+}
+
+void sched_submit(Scheduler *s, SchedTask *task) {
+    pthread_mutex_lock(&s->lock);
+    int index = s->next_worker;
+    s->next_worker = (index + 1) % s->worker_count;
+    pthread_mutex_unlock(&s->lock);
+
+    memset(&task->stats, 0, sizeof(task->stats));
+    task->worker = index;
+    task->used = 0;
+    task->input = NULL;
+    task->input_len = 0;
+    task->input_end = 0;
+    Worker *w = &s->workers[index];
+    pthread_mutex_lock(&w->lock);
+    make_ready(w, task, now_ns());
+    pthread_mutex_unlock(&w->lock);
+}
+
+int sched_input(Scheduler *s, SchedTask *task, const char *text, size_t len, int end) {
+    Worker *w = &s->workers[task->worker];
+    int result = 0;
+    pthread_mutex_lock(&w->lock);
+    if (task->state == TASK_ENDED) {
+        result = -1;
+    } else if (task->state == TASK_RUNNING || !task->machine) {
+        // The worker delivers it once the slice is over
+        char *input = realloc(task->input, task->input_len + len + 1);
+        if (input) {
+            memcpy(input + task->input_len, text, len);
+            task->input = input;
+            task->input_len += len;
+            if (end) task->input_end = 1;
+        } else {
+            result = -1;
+        }
+    } else {
+        // Between slices nothing else touches the machine
+        result = emu6502_append_input(task->machine, text, len);
+        if (end) emu6502_end_input(task->machine);
+        if (task->state == TASK_PARKED) {
+            uint64_t now = now_ns();
+            task->stats.parked_ns += now - task->since_ns;
+            make_ready(w, task, now);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return result;
+}
+
+void sched_task_free(SchedTask *task) {
+    free(task->input);
+    task->input = NULL;
+    task->input_len = 0;
+}
+
+void sched_get_stats(Scheduler *s, SchedStats *stats) {
+    WorkerStats total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < s->worker_count; i++) {
+        Worker *w = &s->workers[i];
+        pthread_mutex_lock(&w->lock);
+        total.tasks += w->stats.tasks;
+        total.slices += w->stats.slices;
+        total.parks += w->stats.parks;
+        total.ready_ns += w->stats.ready_ns;
+        if (w->stats.max_ready_ns > total.max_ready_ns) total.max_ready_ns = w->stats.max_ready_ns;
+        if (w->stats.max_task_ready_ns > total.max_task_ready_ns) {
+            total.max_task_ready_ns = w->stats.max_task_ready_ns;
+        }
+        pthread_mutex_unlock(&w->lock);
+    }
+    stats->tasks = total.tasks;
+    stats->slices = total.slices;
+    stats->parks = total.parks;
+    stats->max_ready_ns = total.max_ready_ns;
+    stats->mean_ready_ns = total.slices ? total.ready_ns / total.slices : 0;
+    stats->max_task_ready_ns = total.max_task_ready_ns;
+}
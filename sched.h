@@ -0,0 +1,102 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include "emu6502.h"
+
+// Cooperative scheduler: time-slices many machines on a few worker threads.
+// Each worker owns a run queue of tasks and runs the one at its head for a
+// quantum (cycles of machine code or lines of BASIC), then moves it to the
+// tail, so switching machines only moves a pointer. A task stays on the
+// worker it was given to. One whose machine returns EMU6502_WAITING is
+// parked off the queue and uses no CPU time until sched_input gives it more.
+
+#define SCHED_DEFAULT_CYCLES 100000
+#define SCHED_DEFAULT_LINES 1000
+
+typedef enum {
+    SCHED_BINARY,   // emu6502_run
+    SCHED_BASIC     // emu6502_basic_run
+} SchedKind;
+
+// Where a task's wall time went, in nanoseconds
+typedef struct {
+    uint64_t slices;        // Quanta run
+    uint64_t parks;         // Times it waited for input
+    uint64_t run_ns;        // Running on its worker
+    uint64_t ready_ns;      // Runnable, waiting for its turn
+    uint64_t parked_ns;     // Waiting for input
+    uint64_t max_ready_ns;  // Longest single wait for a turn
+} SchedTaskStats;
+
+typedef struct SchedTask {
+    // Set by the caller before sched_submit
+    Emu6502Machine *machine;    // May be left NULL for the start callback to fill in
+    SchedKind kind;
+    uint64_t budget;            // Cycles or lines before the task stops (0: no limit)
+    void *ctx;
+
+    // Set by the scheduler
+    int status;                 // Emu6502Status the task ended with
+    int worker;                 // Worker it runs on, from 0
+    SchedTaskStats stats;
+
+    struct SchedTask *next;     // Run queue link
+    int state;
+    char *input;                // From sched_input while it was running
+    size_t input_len;
+    int input_end;
+    uint64_t used;              // Cycles or lines run
+    uint64_t since_ns;          // When it last became runnable or parked
+} SchedTask;
+
+typedef struct {
+    int workers;                // Worker threads (0: one per CPU)
+    uint64_t quantum_cycles;    // 0: SCHED_DEFAULT_CYCLES
+    uint64_t quantum_lines;     // 0: SCHED_DEFAULT_LINES
+    // Called on the task's worker before its first quantum; returns 0 to end
+    // the task at once, with status set by the callback. May be NULL.
+    int (*start)(SchedTask *task, void *ctx);
+    // Called on the task's worker once it has ended
+    void (*done)(SchedTask *task, void *ctx);
+    void *ctx;
+} SchedConfig;
+
+// Over the tasks that have ended
+typedef struct {
+    uint64_t tasks;
+    uint64_t slices;
+    uint64_t parks;
+    uint64_t max_ready_ns;      // Longest wait for a turn by any task
+    uint64_t mean_ready_ns;     // Mean wait for a turn per slice
+    // Highest mean wait for a turn of any one task: close to mean_ready_ns
+    // when the workers shared out their time evenly, far above it when some
+    // tasks were kept waiting longer than the rest
+    uint64_t max_task_ready_ns;
+} SchedStats;
+
+typedef struct Scheduler Scheduler;
+
+// Starts the workers; returns NULL (with a message on stderr) on failure
+Scheduler *sched_create(const SchedConfig *config);
+
+// Stops the workers. Tasks that have not ended are dropped without a done
+// call; free their input with sched_task_free.
+void sched_destroy(Scheduler *s);
+
+// Queue a task, from any thread. Its machine has been loaded and started.
+void sched_submit(Scheduler *s, SchedTask *task);
+
+// Append input for a task's machine (emu6502_append_input, then
+// emu6502_end_input if end is set) and make it runnable again if it parked.
+// Safe from any thread while the task is still queued (its done callback
+// has not returned); input that arrives during a slice is held until the
+// slice is over. Returns 0 on success, -1 if out of memory or the task has
+// already ended.
+int sched_input(Scheduler *s, SchedTask *task, const char *text, size_t len, int end);
+
+void sched_task_free(SchedTask *task);
+
+void sched_get_stats(Scheduler *s, SchedStats *stats);
+
+#endif
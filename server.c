@@ -0,0 +1,901 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "emu6502.h"
+#include "sched.h"
+#include "counters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define MAX_EVENTS 64
+#define MAX_INFLIGHT 256            // Jobs per connection before we stop reading from it
+#define MAX_OUTPUT (1024 * 1024)    // Output kept per job; the rest is dropped
+#define READ_CHUNK 65536
+
+// Growable byte buffer
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} Buf;
+
+static void buf_reserve(Buf *b, size_t extra) {
+    if (b->len + extra <= b->cap) return;
+    size_t cap = b->cap ? b->cap : 256;
+    while (cap < b->len + extra) cap *= 2;
+    uint8_t *data = realloc(b->data, cap);
+    if (!data) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    b->data = data;
+    b->cap = cap;
+}
+
+static void buf_put(Buf *b, const void *data, size_t len) {
+    if (len == 0) return;
+    buf_reserve(b, len);
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void buf_u8(Buf *b, uint8_t v) {
+    buf_put(b, &v, 1);
+}
+
+static void buf_u16(Buf *b, uint16_t v) {
+    uint8_t bytes[2] = { v, v >> 8 };
+    buf_put(b, bytes, 2);
+}
+
+static void buf_u32(Buf *b, uint32_t v) {
+    uint8_t bytes[4] = { v, v >> 8, v >> 16, v >> 24 };
+    buf_put(b, bytes, 4);
+}
+
+static void buf_u64(Buf *b, uint64_t v) {
+    buf_u32(b, (uint32_t)v);
+    buf_u32(b, (uint32_t)(v >> 32));
+}
+
+static void set_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+typedef struct Job {
+    struct Job *next;
+    struct Job *prev_live;  // In server.live while the scheduler has it
+    struct Job *next_live;
+    int fd;                 // Connection the job came from; conn_id tells a
+    uint64_t conn_id;       // reused fd apart from the original connection
+    uint32_t job_id;        // Kept apart from the request, which job_done frees
+    int stream_input;       // SERVER_FLAG_STREAM_INPUT
+    uint8_t *request;       // Request payload
+    uint32_t request_len;
+    uint8_t want;
+    Buf output;             // Captured program output
+    Buf response;           // Complete response frame
+    SchedTask task;
+} Job;
+
+// Idle machines of one worker, reused by its next jobs
+typedef struct {
+    Emu6502Machine **machines;
+    int count;
+    int cap;
+} MachinePool;
+
+typedef struct {
+    Job *head;
+    Job *tail;
+} JobList;
+
+// Jobs by job_id: open addressing with linear probing
+typedef struct {
+    Job **slots;
+    uint32_t cap;           // A power of two, or 0
+    uint32_t used;
+} JobMap;
+
+typedef struct Conn {
+    struct Conn *next_closed;
+    int fd;                 // -1 once closed
+    uint64_t id;
+    Buf in;
+    Buf out;
+    size_t out_pos;         // Bytes of out already sent
+    int inflight;           // Jobs queued or running
+    JobMap streams;         // Of them, the ones that stream their input
+    int eof;                // Client finished sending; close once answered
+    uint32_t events;        // Events registered with epoll
+} Conn;
+
+static struct {
+    const ServerConfig *config;
+    int epoll_fd;
+    int listen_fd;
+    int wake_fd;            // eventfd the workers use to report finished jobs
+    Conn **conns;           // Indexed by fd
+    Conn *closed;           // Freed after the current batch of events
+    int conns_size;
+    uint64_t next_conn_id;
+    uint64_t jobs_done;
+
+    Scheduler *sched;
+    MachinePool *pools;     // Indexed by worker; each only used on its worker's thread
+    int workers;
+
+    pthread_mutex_t lock;   // Protects everything below
+    JobList finished;
+    Job *live;              // Submitted, not yet finished
+} server;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void list_append(JobList *list, Job *job) {
+    job->next = NULL;
+    if (list->tail) list->tail->next = job;
+    else list->head = job;
+    list->tail = job;
+}
+
+static void job_free(Job *job) {
+    free(job->request);
+    free(job->output.data);
+    free(job->response.data);
+    free(job);
+}
+
+// Worker side
+
+static void capture_output(void *ctx, const char *text, size_t len) {
+    Buf *out = ctx;
+    if (out->len >= MAX_OUTPUT) return;
+    if (len > MAX_OUTPUT - out->len) len = MAX_OUTPUT - out->len;
+    buf_put(out, text, len);
+}
+
+// Append a complete ERROR response frame to r
+static void put_error(Buf *r, uint32_t job_id, const char *message) {
+    buf_u32(r, 12 + strlen(message));
+    buf_u32(r, job_id);
+    buf_u8(r, SERVER_STATUS_ERROR);
+    buf_u8(r, SERVER_WANT_OUTPUT);
+    buf_u16(r, 0);
+    buf_u32(r, strlen(message));
+    buf_put(r, message, strlen(message));
+}
+
+static void respond_error(Job *job, uint32_t job_id, const char *message) {
+    job->response.len = 0;
+    put_error(&job->response, job_id, message);
+}
+
+static Emu6502Machine *machine_get(int worker) {
+    MachinePool *pool = &server.pools[worker];
+    if (pool->count) return pool->machines[--pool->count];
+    return emu6502_create_sparse(EMU6502_MODEL_6502);
+}
+
+static void machine_put(int worker, Emu6502Machine *m) {
+    MachinePool *pool = &server.pools[worker];
+    if (pool->count == pool->cap) {
+        int cap = pool->cap ? pool->cap * 2 : 16;
+        Emu6502Machine **machines = realloc(pool->machines, cap * sizeof(Emu6502Machine *));
+        if (!machines) {
+            emu6502_destroy(m);
+            return;
+        }
+        pool->machines = machines;
+        pool->cap = cap;
+    }
+    pool->machines[pool->count++] = m;
+}
+
+// Check the request and load it into a machine of the worker; returns 0 with
+// an error response built if the job is refused
+static int job_start(SchedTask *task, void *ctx) {
+    Job *job = task->ctx;
+    const uint8_t *req = job->request;
+    (void)ctx;
+    task->status = SERVER_STATUS_ERROR;
+    job->response.len = 0;
+    if (job->request_len < SERVER_REQUEST_HEADER) {
+        respond_error(job, job->request_len >= 4 ? get_u32(req) : 0, "Request too short");
+        return 0;
+    }
+
+    uint32_t job_id = get_u32(req);
+    uint8_t type = req[4];
+    uint8_t model = req[5];
+    uint8_t want = req[6];
+    uint8_t console_page = req[7];
+    uint16_t load_addr = get_u16(req + 8);
+    uint16_t start_addr = get_u16(req + 10);
+    uint16_t dump_addr = get_u16(req + 12);
+    uint8_t flags = req[14];
+    uint32_t dump_len = get_u32(req + 16);
+    uint64_t budget = get_u64(req + 20);
+    uint32_t code_len = get_u32(req + 28);
+    uint32_t input_len = get_u32(req + 32);
+    const uint8_t *code = req + SERVER_REQUEST_HEADER;
+    const uint8_t *input = code + code_len;
+
+    if ((uint64_t)SERVER_REQUEST_HEADER + code_len + input_len != job->request_len) {
+        respond_error(job, job_id, "Code and input lengths do not match the frame");
+        return 0;
+    }
+    if (type != SERVER_JOB_BINARY && type != SERVER_JOB_BASIC) {
+        respond_error(job, job_id, "Unknown job type");
+        return 0;
+    }
+    if (model > 1) {
+        respond_error(job, job_id, "Unknown CPU model");
+        return 0;
+    }
+    if (type == SERVER_JOB_BINARY && (input_len || (flags & SERVER_FLAG_STREAM_INPUT)) && !console_page) {
+        respond_error(job, job_id, "Input needs a console page");
+        return 0;
+    }
+    if ((want & SERVER_WANT_MEMORY) && (uint64_t)dump_addr + dump_len > 65536) {
+        respond_error(job, job_id, "Memory dump runs past $FFFF");
+        return 0;
+    }
+
+    Emu6502Machine *m = machine_get(task->worker);
+    if (!m) {
+        respond_error(job, job_id, "Out of memory");
+        return 0;
+    }
+    task->machine = m;
+    job->want = want;
+    // Pooled machines keep the console of their last job
+    emu6502_map_console(m, type == SERVER_JOB_BINARY && console_page ? console_page : -1);
+    emu6502_power_on(m);
+    emu6502_set_model(m, model == 1 ? EMU6502_MODEL_65C02 : EMU6502_MODEL_6502);
+    emu6502_set_output(m, capture_output, &job->output);
+
+    if (type == SERVER_JOB_BINARY) {
+        if (budget == 0 || budget > server.config->max_cycles) budget = server.config->max_cycles;
+        if (emu6502_write_block(m, load_addr, code, code_len) != 0) {
+            respond_error(job, job_id, "Code runs past $FFFF");
+            return 0;
+        }
+        Emu6502Regs regs;
+        emu6502_get_regs(m, &regs);
+        regs.pc = start_addr;
+        emu6502_set_regs(m, &regs);
+        if (emu6502_append_input(m, (const char *)input, input_len) != 0) {
+            respond_error(job, job_id, "Out of memory");
+            return 0;
+        }
+        if (!job->stream_input) emu6502_end_input(m);
+        task->kind = SCHED_BINARY;
+    } else {
+        if (budget == 0 || budget > server.config->max_lines) budget = server.config->max_lines;
+        char *source = malloc(code_len + 1);
+        if (!source) {
+            respond_error(job, job_id, "Out of memory");
+            return 0;
+        }
+        memcpy(source, code, code_len);
+        source[code_len] = 0;
+        emu6502_basic_load(m, source);
+        free(source);
+        // A streamed input stays open until an input frame ends it
+        int result = job->stream_input ? emu6502_append_input(m, (const char *)input, input_len)
+                                       : emu6502_basic_set_input(m, (const char *)input, input_len);
+        if (result != 0) {
+            respond_error(job, job_id, "Out of memory");
+            return 0;
+        }
+        emu6502_basic_start(m);
+        task->kind = SCHED_BASIC;
+    }
+    task->budget = budget;
+    counters_add(COUNTER_INPUT_BYTES, input_len);
+    return 1;
+}
+
+static void respond(Job *job) {
+    const uint8_t *req = job->request;
+    Emu6502Machine *m = job->task.machine;
+    uint8_t want = job->want;
+    uint16_t dump_addr = get_u16(req + 12);
+    uint32_t dump_len = get_u32(req + 16);
+
+    Buf *r = &job->response;
+    r->len = 0;
+    buf_u32(r, 0); // Frame length, filled in by job_done
+    buf_u32(r, get_u32(req));
+    buf_u8(r, job->task.status);
+    buf_u8(r, want & (SERVER_WANT_REGS | SERVER_WANT_HASH | SERVER_WANT_OUTPUT |
+                      SERVER_WANT_MEMORY | SERVER_WANT_STATS));
+    buf_u16(r, 0);
+    if (want & SERVER_WANT_REGS) {
+        Emu6502Regs regs;
+        emu6502_get_regs(m, &regs);
+        uint8_t bytes[6] = { regs.a, regs.x, regs.y, regs.sp, regs.status, 0 };
+        buf_put(r, bytes, sizeof(bytes));
+        buf_u16(r, regs.pc);
+        buf_u64(r, regs.cycles);
+    }
+    if (want & SERVER_WANT_HASH) {
+        buf_u64(r, emu6502_memory_hash(m));
+    }
+    if (want & SERVER_WANT_OUTPUT) {
+        buf_u32(r, job->output.len);
+        buf_put(r, job->output.data, job->output.len);
+    }
+    if (want & SERVER_WANT_MEMORY) {
+        buf_u32(r, dump_len);
+        buf_reserve(r, dump_len);
+        emu6502_read_block(m, dump_addr, r->data + r->len, dump_len);
+        r->len += dump_len;
+    }
+    if (want & SERVER_WANT_STATS) {
+        buf_u64(r, job->task.stats.slices);
+        buf_u64(r, job->task.stats.run_ns);
+        buf_u64(r, job->task.stats.ready_ns);
+        buf_u64(r, job->task.stats.max_ready_ns);
+        buf_u64(r, job->task.stats.parks);
+        buf_u64(r, job->task.stats.parked_ns);
+    }
+}
+
+// Runs on the job's worker once the scheduler is done with it
+static void job_done(SchedTask *task, void *ctx) {
+    Job *job = task->ctx;
+    (void)ctx;
+    if (!job->response.len) respond(job); // Not refused by job_start
+    if (task->machine) {
+        machine_put(task->worker, task->machine);
+        task->machine = NULL;
+    }
+    set_u32(job->response.data, job->response.len - 4);
+    counters_add(COUNTER_JOBS, 1);
+    counters_add(COUNTER_OUTPUT_BYTES, job->output.len);
+    free(job->request);
+    job->request = NULL;
+    free(job->output.data);
+    job->output.data = NULL;
+
+    pthread_mutex_lock(&server.lock);
+    if (job->prev_live) job->prev_live->next_live = job->next_live;
+    else server.live = job->next_live;
+    if (job->next_live) job->next_live->prev_live = job->prev_live;
+    int was_empty = server.finished.head == NULL;
+    list_append(&server.finished, job);
+    if (was_empty) {
+        // The event loop drains the whole list per wakeup, so only the
+        // first finished job needs to wake it
+        uint64_t one = 1;
+        if (write(server.wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("eventfd write");
+        }
+    }
+    pthread_mutex_unlock(&server.lock);
+}
+
+// Event loop side
+
+static uint32_t job_slot(const JobMap *map, uint32_t job_id) {
+    return job_id * 2654435761u & (map->cap - 1);
+}
+
+static Job *jobmap_find(const JobMap *map, uint32_t job_id) {
+    if (!map->cap) return NULL;
+    for (uint32_t i = job_slot(map, job_id); map->slots[i]; i = (i + 1) & (map->cap - 1)) {
+        if (map->slots[i]->job_id == job_id) return map->slots[i];
+    }
+    return NULL;
+}
+
+// job_id must not be in the map yet
+static void jobmap_put(JobMap *map, Job *job) {
+    if ((map->used + 1) * 2 > map->cap) {
+        JobMap grown = { calloc(map->cap ? map->cap * 2 : 16, sizeof(Job *)), map->cap ? map->cap * 2 : 16, 0 };
+        if (!grown.slots) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i < map->cap; i++) {
+            if (map->slots[i]) jobmap_put(&grown, map->slots[i]);
+        }
+        free(map->slots);
+        *map = grown;
+    }
+    uint32_t i = job_slot(map, job->job_id);
+    while (map->slots[i]) i = (i + 1) & (map->cap - 1);
+    map->slots[i] = job;
+    map->used++;
+}
+
+static void jobmap_remove(JobMap *map, const Job *job) {
+    if (!map->cap) return;
+    uint32_t mask = map->cap - 1;
+    uint32_t i = job_slot(map, job->job_id);
+    while (map->slots[i] && map->slots[i] != job) i = (i + 1) & mask;
+    if (!map->slots[i]) return;
+    // Move later entries of the probe sequence up into the hole, unless
+    // that would put them before their own slot
+    map->slots[i] = NULL;
+    for (uint32_t j = (i + 1) & mask; map->slots[j]; j = (j + 1) & mask) {
+        uint32_t home = job_slot(map, map->slots[j]->job_id);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            map->slots[i] = map->slots[j];
+            map->slots[j] = NULL;
+            i = j;
+        }
+    }
+    map->used--;
+}
+
+// The client can send no more input: end the input of its jobs that
+// stream it, so that none waits for it forever
+static void end_streams(Conn *c) {
+    pthread_mutex_lock(&server.lock);
+    for (uint32_t i = 0; i < c->streams.cap; i++) {
+        if (c->streams.slots[i]) sched_input(server.sched, &c->streams.slots[i]->task, "", 0, 1);
+    }
+    pthread_mutex_unlock(&server.lock);
+}
+
+// Later events in the same epoll batch may still point at c, so it is only
+// freed by free_closed() once the batch is done
+static void conn_close(Conn *c) {
+    end_streams(c);
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    server.conns[c->fd] = NULL;
+    c->fd = -1;
+    c->next_closed = server.closed;
+    server.closed = c;
+}
+
+static void free_closed(void) {
+    while (server.closed) {
+        Conn *c = server.closed;
+        server.closed = c->next_closed;
+        free(c->in.data);
+        free(c->out.data);
+        free(c->streams.slots);
+        free(c);
+    }
+}
+
+static void conn_update_events(Conn *c) {
+    if (c->fd < 0) return;
+    if (c->eof && c->inflight == 0 && c->out_pos == c->out.len) {
+        conn_close(c);
+        return;
+    }
+    uint32_t events = 0;
+    // Jobs waiting for input must be able to get it past the limit
+    if ((c->inflight < MAX_INFLIGHT || c->streams.used) && !c->eof) events |= EPOLLIN;
+    if (c->out_pos < c->out.len) events |= EPOLLOUT;
+    if (events != c->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = c };
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+}
+
+// Returns 0 if the connection failed and was closed
+static int conn_flush(Conn *c) {
+    if (c->fd < 0) return 0;
+    while (c->out_pos < c->out.len) {
+        ssize_t n = send(c->fd, c->out.data + c->out_pos, c->out.len - c->out_pos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            conn_close(c);
+            return 0;
+        }
+        c->out_pos += n;
+    }
+    if (c->out_pos == c->out.len) {
+        c->out.len = 0;
+        c->out_pos = 0;
+    }
+    return 1;
+}
+
+// Hand the jobs parsed from c to the scheduler. Input frames name their
+// job by job_id, so one that streams its input must not share it with
+// another of the connection's.
+static void submit_jobs(Conn *c, JobList *jobs) {
+    JobList accepted = { NULL, NULL };
+    while (jobs->head) {
+        Job *job = jobs->head;
+        jobs->head = job->next;
+        if (job->stream_input) {
+            if (jobmap_find(&c->streams, job->job_id)) {
+                put_error(&c->out, job->job_id, "Job id already streams its input");
+                job_free(job);
+                continue;
+            }
+            jobmap_put(&c->streams, job);
+        }
+        list_append(&accepted, job);
+        c->inflight++;
+    }
+    jobs->tail = NULL;
+    if (!accepted.head) return;
+
+    pthread_mutex_lock(&server.lock);
+    for (Job *job = accepted.head; job; job = job->next) {
+        job->prev_live = NULL;
+        job->next_live = server.live;
+        if (server.live) server.live->prev_live = job;
+        server.live = job;
+    }
+    pthread_mutex_unlock(&server.lock);
+    while (accepted.head) {
+        Job *job = accepted.head;
+        accepted.head = job->next;
+        job->task.ctx = job;
+        sched_submit(server.sched, &job->task);
+    }
+}
+
+// Pass an input frame on to its job, or queue an error response
+static void stream_input(Conn *c, const uint8_t *payload, uint32_t len) {
+    uint32_t job_id = get_u32(payload);
+    const char *error = NULL;
+    if (len < SERVER_INPUT_HEADER) {
+        error = "Input frame too short";
+    } else {
+        pthread_mutex_lock(&server.lock);
+        Job *job = jobmap_find(&c->streams, job_id);
+        if (!job) {
+            error = "No such job streaming its input";
+        } else {
+            // Input for a job that has just ended is dropped: its response
+            // is on the way
+            sched_input(server.sched, &job->task, (const char *)payload + SERVER_INPUT_HEADER,
+                        len - SERVER_INPUT_HEADER, payload[5] & SERVER_INPUT_END);
+            counters_add(COUNTER_INPUT_BYTES, len - SERVER_INPUT_HEADER);
+        }
+        pthread_mutex_unlock(&server.lock);
+    }
+    if (error) put_error(&c->out, job_id, error);
+}
+
+// Split complete frames off the input buffer and queue them as jobs, or
+// pass them on to their jobs if they are input frames. Returns 0 if the
+// connection sent garbage and was closed.
+static int conn_parse(Conn *c) {
+    JobList jobs = { NULL, NULL };
+    size_t pos = 0;
+
+    while (c->in.len - pos >= 4) {
+        uint32_t len = get_u32(c->in.data + pos);
+        if (len > SERVER_MAX_FRAME) {
+            fprintf(stderr, "Error: Oversized frame (%u bytes); closing connection\n", len);
+            conn_close(c);
+            while (jobs.head) {
+                Job *next = jobs.head->next;
+                job_free(jobs.head);
+                jobs.head = next;
+            }
+            return 0;
+        }
+        if (c->in.len - pos - 4 < len) break;
+
+        const uint8_t *payload = c->in.data + pos + 4;
+        if (len >= 5 && payload[4] == SERVER_INPUT) {
+            // Its job may be among the ones just parsed
+            submit_jobs(c, &jobs);
+            stream_input(c, payload, len);
+            pos += 4 + len;
+            continue;
+        }
+
+        Job *job = calloc(1, sizeof(Job));
+        uint8_t *request = malloc(len ? len : 1);
+        if (!job || !request) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+        memcpy(request, payload, len);
+        job->fd = c->fd;
+        job->conn_id = c->id;
+        job->job_id = len >= 4 ? get_u32(request) : 0;
+        job->stream_input = len >= SERVER_REQUEST_HEADER && (request[14] & SERVER_FLAG_STREAM_INPUT);
+        job->request = request;
+        job->request_len = len;
+        list_append(&jobs, job);
+        pos += 4 + len;
+    }
+
+    if (pos) {
+        memmove(c->in.data, c->in.data + pos, c->in.len - pos);
+        c->in.len -= pos;
+    }
+    submit_jobs(c, &jobs);
+    return 1;
+}
+
+static void conn_readable(Conn *c) {
+    for (;;) {
+        buf_reserve(&c->in, READ_CHUNK);
+        ssize_t n = recv(c->fd, c->in.data + c->in.len, c->in.cap - c->in.len, 0);
+        if (n > 0) {
+            c->in.len += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0) {
+            // Anything still running for this client is dropped when it finishes
+            conn_close(c);
+            return;
+        }
+        // EOF: the client may only have shut down its sending side, so the
+        // requests it sent are still run and answered
+        c->eof = 1;
+        break;
+    }
+    // Parsed first: the last frames may still be input for the jobs
+    if (!conn_parse(c)) return;
+    if (c->eof) end_streams(c);
+    conn_update_events(c);
+}
+
+static void accept_clients(void) {
+    for (;;) {
+        int fd = accept4(server.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+            return;
+        }
+        if (fd >= server.conns_size) {
+            int size = server.conns_size ? server.conns_size : 64;
+            while (size <= fd) size *= 2;
+            Conn **conns = realloc(server.conns, size * sizeof(Conn *));
+            if (!conns) {
+                fprintf(stderr, "Error: Out of memory\n");
+                exit(1);
+            }
+            memset(conns + server.conns_size, 0, (size - server.conns_size) * sizeof(Conn *));
+            server.conns = conns;
+            server.conns_size = size;
+        }
+
+        Conn *c = calloc(1, sizeof(Conn));
+        if (!c) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+        c->fd = fd;
+        c->id = ++server.next_conn_id;
+        c->events = EPOLLIN;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(fd);
+            free(c);
+            continue;
+        }
+        server.conns[fd] = c;
+    }
+}
+
+static void deliver_finished(void) {
+    uint64_t count;
+    if (read(server.wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("eventfd read");
+    }
+
+    pthread_mutex_lock(&server.lock);
+    Job *job = server.finished.head;
+    server.finished.head = server.finished.tail = NULL;
+    pthread_mutex_unlock(&server.lock);
+
+    // Append every response first and flush each connection once
+    Conn *touched[MAX_EVENTS];
+    int touched_count = 0;
+    while (job) {
+        Job *next = job->next;
+        Conn *c = job->fd < server.conns_size ? server.conns[job->fd] : NULL;
+        if (c && c->id == job->conn_id) {
+            buf_put(&c->out, job->response.data, job->response.len);
+            c->inflight--;
+            if (job->stream_input) jobmap_remove(&c->streams, job);
+            int seen = 0;
+            for (int i = 0; i < touched_count; i++) {
+                if (touched[i] == c) seen = 1;
+            }
+            if (!seen) {
+                if (touched_count == MAX_EVENTS) {
+                    if (conn_flush(touched[0])) conn_update_events(touched[0]);
+                    touched[0] = touched[--touched_count];
+                }
+                touched[touched_count++] = c;
+            }
+        }
+        server.jobs_done++;
+        job_free(job);
+        job = next;
+    }
+    for (int i = 0; i < touched_count; i++) {
+        if (conn_flush(touched[i])) conn_update_events(touched[i]);
+    }
+}
+
+static int open_listener(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path); // A stale socket from an earlier run
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "Error: Cannot listen on '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int server_run(const ServerConfig *config) {
+    int workers = config->workers;
+    if (workers <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (int)cpus : 1;
+    }
+
+    memset(&server, 0, sizeof(server));
+    server.config = config;
+    server.workers = workers;
+    pthread_mutex_init(&server.lock, NULL);
+
+    server.listen_fd = open_listener(config->socket_path);
+    if (server.listen_fd < 0) return 1;
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server.epoll_fd < 0 || server.wake_fd < 0) {
+        perror("epoll/eventfd");
+        return 1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &server.listen_fd };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev);
+    ev.data.ptr = &server.wake_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wake_fd, &ev);
+
+    // SIGINT/SIGTERM are blocked everywhere except inside epoll_pwait, so
+    // the workers never see them and the loop cannot miss one
+    sigset_t stop_signals, wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &wait_mask);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Every worker time-slices all the jobs it has been given
+    server.pools = calloc(workers, sizeof(MachinePool));
+    SchedConfig sched_config = {
+        workers, config->slice_cycles, config->slice_lines, job_start, job_done, NULL
+    };
+    server.sched = server.pools ? sched_create(&sched_config) : NULL;
+    if (!server.sched) {
+        fprintf(stderr, "Error: Cannot start worker threads\n");
+        return 1;
+    }
+
+    printf("Serving on %s with %d workers (limits: %lu cycles, %lu BASIC lines per job)\n",
+           config->socket_path, workers, config->max_cycles, config->max_lines);
+    fflush(stdout);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!stop_requested) {
+        int n = epoll_pwait(server.epoll_fd, events, MAX_EVENTS, -1, &wait_mask);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &server.listen_fd) {
+                accept_clients();
+            } else if (ptr == &server.wake_fd) {
+                deliver_finished();
+            } else {
+                Conn *c = ptr;
+                if (c->fd < 0) continue; // Closed earlier in this batch
+                if (events[i].events & EPOLLOUT) {
+                    if (!conn_flush(c)) continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    conn_readable(c);
+                } else {
+                    conn_update_events(c);
+                }
+            }
+        }
+        free_closed();
+    }
+
+    SchedStats stats;
+    sched_get_stats(server.sched, &stats);
+    sched_destroy(server.sched);
+
+    // Jobs still being run were dropped with the workers
+    while (server.live) {
+        Job *next = server.live->next_live;
+        emu6502_destroy(server.live->task.machine);
+        sched_task_free(&server.live->task);
+        job_free(server.live);
+        server.live = next;
+    }
+    while (server.finished.head) {
+        Job *next = server.finished.head->next;
+        job_free(server.finished.head);
+        server.finished.head = next;
+    }
+    for (int i = 0; i < workers; i++) {
+        MachinePool *pool = &server.pools[i];
+        for (int j = 0; j < pool->count; j++) emu6502_destroy(pool->machines[j]);
+        free(pool->machines);
+    }
+    free(server.pools);
+    for (int fd = 0; fd < server.conns_size; fd++) {
+        if (server.conns[fd]) conn_close(server.conns[fd]);
+    }
+    free_closed();
+    free(server.conns);
+    close(server.wake_fd);
+    close(server.epoll_fd);
+    close(server.listen_fd);
+    unlink(config->socket_path);
+
+    printf("Server stopped after %lu jobs\n", server.jobs_done);
+    printf("Scheduler: %lu slices, %lu waits for input, mean wait for a slice %.3f ms "
+           "(worst job's mean %.3f ms), longest %.3f ms\n",
+           stats.slices, stats.parks, stats.mean_ready_ns / 1e6, stats.max_task_ready_ns / 1e6,
+           stats.max_ready_ns / 1e6);
+    return 0;
+}
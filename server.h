@@ -0,0 +1,105 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+// Job server: runs emulation jobs sent over a Unix domain socket. Every job
+// gets a machine of its own, and each worker thread time-slices all the jobs
+// it has been given (see sched.h), so long jobs do not hold up short ones.
+//
+// Every message is a frame: a u32 payload length followed by the payload.
+// All integers are little-endian. A client may send any number of requests
+// on one connection without waiting; each produces one response frame as
+// soon as its job finishes, so responses can arrive out of order and are
+// matched up by job_id. A job that streams its input takes more of it in
+// input frames, and waits off its worker's queue, using no CPU time,
+// whenever it runs out.
+//
+// Request payload:
+//   0  u32  job_id        Echoed in the response
+//   4  u8   type          SERVER_JOB_BINARY or SERVER_JOB_BASIC (SERVER_INPUT:
+//                         an input frame, below)
+//   5  u8   model         0 = 6502, 1 = 65C02
+//   6  u8   want          SERVER_WANT_* bits: sections to return
+//   7  u8   console_page  Binary: page of a console with the registers of
+//                         6502emu --io, reading the input and writing to
+//                         OUTPUT; 0 for none (and no input)
+//   8  u16  load_addr     Where binary code is loaded
+//  10  u16  start_addr    Initial PC for binary code
+//  12  u16  dump_addr     Memory range returned with SERVER_WANT_MEMORY
+//  14  u8   flags         SERVER_FLAG_* bits
+//  15  u8   reserved
+//  16  u32  dump_len
+//  20  u64  budget        Cycles (binary) or program lines (BASIC) before the
+//                         job is stopped; 0 or more than the server limit
+//                         means the server limit
+//  28  u32  code_len
+//  32  u32  input_len
+//  36  code (machine code or BASIC source), then input (lines for INPUT, or
+//      the bytes the console reads)
+//
+// Input frame payload, for a job of the same connection that has
+// SERVER_FLAG_STREAM_INPUT and has not finished:
+//   0  u32  job_id
+//   4  u8   type          SERVER_INPUT
+//   5  u8   flags         SERVER_INPUT_END: no input follows this
+//   6  u16  reserved
+//   8  input
+// It gets no response of its own unless it is refused (no job of that id
+// streams its input): then an ERROR response with its job_id. A request
+// with SERVER_FLAG_STREAM_INPUT is refused the same way while another job
+// of the connection with the same job_id streams its input.
+// A connection that is closed or shut down for sending ends the input of
+// its jobs.
+//
+// Response payload:
+//   0  u32  job_id
+//   4  u8   status        SERVER_STATUS_*
+//   5  u8   want          Sections that follow, in this order:
+//   6  u16  reserved
+//   8  REGS    u8 A, X, Y, SP, P, pad; u16 PC; u64 cycles   (16 bytes)
+//      HASH    u64 memory hash
+//      OUTPUT  u32 length, then the text (for errors: the error message)
+//      MEMORY  u32 length, then the bytes
+//      STATS   u64 slices run, u64 ns running, u64 ns waiting for a slice,
+//              u64 ns of the longest wait for one, u64 times it waited
+//              for input, u64 ns waiting for input
+
+#define SERVER_REQUEST_HEADER 36
+#define SERVER_INPUT_HEADER 8
+#define SERVER_MAX_FRAME (4 * 1024 * 1024)
+
+#define SERVER_JOB_BINARY 0
+#define SERVER_JOB_BASIC  1
+#define SERVER_INPUT      2
+
+// Input stays open after the request's: more comes in input frames
+#define SERVER_FLAG_STREAM_INPUT 0x01
+
+#define SERVER_INPUT_END 0x01
+
+#define SERVER_WANT_REGS   0x01
+#define SERVER_WANT_HASH   0x02
+#define SERVER_WANT_OUTPUT 0x04
+#define SERVER_WANT_MEMORY 0x08
+#define SERVER_WANT_STATS  0x10
+
+#define SERVER_STATUS_BUDGET 0     // Budget used up (the job's timeout)
+#define SERVER_STATUS_BRK    1     // Binary stopped at BRK
+#define SERVER_STATUS_HALTED 2     // Binary hit JAM, STP/WAI or an illegal opcode
+#define SERVER_STATUS_DONE   3     // BASIC program finished
+#define SERVER_STATUS_ERROR  0xFF  // Malformed request
+
+typedef struct {
+    const char *socket_path;
+    int workers;            // Worker threads (0: one per CPU)
+    uint64_t max_cycles;    // Budget limit for binary jobs
+    uint64_t max_lines;     // Budget limit for BASIC jobs
+    uint64_t slice_cycles;  // Quantum of binary jobs (0: SCHED_DEFAULT_CYCLES)
+    uint64_t slice_lines;   // Quantum of BASIC jobs (0: SCHED_DEFAULT_LINES)
+} ServerConfig;
+
+// Serve until SIGINT or SIGTERM. Returns the process exit status.
+int server_run(const ServerConfig *config);
+
+#endif
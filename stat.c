@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "counters.h"
+
+// 6502stat: reports the counters a running 6502emu or 6502basic publishes
+// with --stats, in the manner of vmstat. The first line covers the time since
+// the run started; each later one the DELAY seconds before it.
+
+typedef struct {
+    uint64_t ns;
+    uint64_t value[COUNTER_COUNT];
+} Sample;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// When the writer finished, or 0 while it runs. One killed before it could
+// say so ended some time before now.
+static uint64_t writer_end(const CountersFile *f, uint64_t now) {
+    uint64_t end = __atomic_load_n(&f->end_ns, __ATOMIC_ACQUIRE);
+    if (end) return end;
+    return kill((pid_t)f->pid, 0) < 0 && errno == ESRCH ? now : 0;
+}
+
+// Values now, or at the writer's end if it has ended; returns whether it has
+static int take_sample(const CountersFile *f, Sample *s) {
+    uint64_t now = now_ns();
+    uint64_t end = writer_end(f, now);
+    s->ns = end ? end : now;
+    for (int i = 0; i < COUNTER_COUNT; i++) s->value[i] = __atomic_load_n(&f->value[i], __ATOMIC_RELAXED);
+    return end != 0;
+}
+
+static void print_header(void) {
+    printf("     MHz  Minstr/s  idle%%    lines/s     in B/s    out B/s   disk B/s  hits/s  miss/s  jobs/s\n");
+}
+
+static void print_rates(const Sample *from, const Sample *to) {
+    double seconds = (to->ns - from->ns) / 1e9;
+    if (seconds <= 0) seconds = 1e-9;
+    uint64_t d[COUNTER_COUNT];
+    for (int i = 0; i < COUNTER_COUNT; i++) d[i] = to->value[i] - from->value[i];
+    printf("%8.2f %9.2f %6.1f %10.0f %10.0f %10.0f %10.0f %7.0f %7.0f %7.0f\n",
+           d[COUNTER_CYCLES] / seconds / 1e6,
+           d[COUNTER_INSTRUCTIONS] / seconds / 1e6,
+           d[COUNTER_CYCLES] ? 100.0 * d[COUNTER_IDLE_CYCLES] / d[COUNTER_CYCLES] : 0.0,
+           d[COUNTER_BASIC_LINES] / seconds,
+           d[COUNTER_INPUT_BYTES] / seconds,
+           d[COUNTER_OUTPUT_BYTES] / seconds,
+           d[COUNTER_DISK_BYTES] / seconds,
+           d[COUNTER_CACHE_HITS] / seconds,
+           d[COUNTER_CACHE_MISSES] / seconds,
+           d[COUNTER_JOBS] / seconds);
+    fflush(stdout);
+}
+
+// Map the counters file at path read-only; NULL (with a message) on failure
+static const CountersFile *open_counters(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open counters file '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CountersFile)) {
+        fprintf(stderr, "Error: '%s' is not a counters file\n", path);
+        close(fd);
+        return NULL;
+    }
+    const CountersFile *f = mmap(NULL, sizeof(CountersFile), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (f == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map counters file '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (memcmp(f->magic, COUNTERS_MAGIC, sizeof(COUNTERS_MAGIC)) != 0) {
+        fprintf(stderr, "Error: '%s' is not a counters file\n", path);
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (f->version != COUNTERS_VERSION || f->count < COUNTER_COUNT) {
+        fprintf(stderr, "Error: '%s' was written by an incompatible version (%u)\n", path, f->version);
+        return NULL;
+    }
+    return f;
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS] FILE [DELAY [COUNT]]\n", program_name);
+    printf("\nReports the counters that 6502emu or 6502basic --stats FILE publishes while\n");
+    printf("it runs. The first line averages over the whole run so far; with DELAY,\n");
+    printf("another follows every DELAY seconds, COUNT times or until the run ends.\n");
+    printf("\nOptions:\n");
+    printf("  --totals          Print the value of every counter instead of rates\n");
+    printf("  --help            Display this help message\n");
+    printf("\nColumns:\n");
+    printf("  MHz               Emulated CPU cycles per microsecond\n");
+    printf("  Minstr/s          Millions of instructions per second\n");
+    printf("  idle%%             Share of the cycles spent in fast-forwarded idle loops\n");
+    printf("  lines/s           BASIC lines per second\n");
+    printf("  in, out B/s       Console and BASIC INPUT/PRINT text\n");
+    printf("  disk B/s          Block device transfers\n");
+    printf("  hits, miss/s      Result cache lookups\n");
+    printf("  jobs/s            Job server jobs finished\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    double delay = 0;
+    long count = -1;
+    int totals = 0;
+    int positional = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "--totals") == 0) {
+            totals = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else if (positional == 0) {
+            path = argv[i];
+            positional++;
+        } else if (positional == 1) {
+            char *end;
+            delay = strtod(argv[i], &end);
+            if (*end || !(delay > 0)) {
+                fprintf(stderr, "Error: Invalid delay '%s'\n", argv[i]);
+                return 1;
+            }
+            positional++;
+        } else if (positional == 2) {
+            char *end;
+            count = strtol(argv[i], &end, 10);
+            if (*end || count < 1) {
+                fprintf(stderr, "Error: Invalid count '%s'\n", argv[i]);
+                return 1;
+            }
+            positional++;
+        } else {
+            fprintf(stderr, "Error: Unexpected argument '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const CountersFile *f = open_counters(path);
+    if (!f) return 1;
+
+    Sample prev, cur;
+    int ended = take_sample(f, &cur);
+    printf("%.*s (pid %lld), %s, %.1f s\n", (int)sizeof(f->program), f->program, (long long)f->pid,
+           ended ? "ended" : "running", (cur.ns - f->start_ns) / 1e9);
+
+    if (totals) {
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            printf("%-14s %20llu\n", counters_name((Counter)i), (unsigned long long)cur.value[i]);
+        }
+        return 0;
+    }
+
+    // The run so far
+    memset(&prev, 0, sizeof(prev));
+    prev.ns = f->start_ns;
+    print_header();
+    print_rates(&prev, &cur);
+    if (delay <= 0 || ended) return 0;
+
+    struct timespec interval = { (time_t)delay, (long)((delay - (time_t)delay) * 1e9) };
+    for (long n = 1; count < 0 || n < count; n++) {
+        prev = cur;
+        nanosleep(&interval, NULL);
+        ended = take_sample(f, &cur);
+        print_rates(&prev, &cur);
+        if (ended) {
+            printf("%.*s ended\n", (int)sizeof(f->program), f->program);
+            break;
+        }
+    }
+    return 0;
+}
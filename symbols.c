@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 200809L
+#include "symbols.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+typedef struct {
+    uint16_t address;
+    uint32_t name;          // Offset into the name pool
+    uint32_t order;         // Position in the files, so the first of several labels at an address wins
+} Symbol;
+
+struct SymbolTable {
+    Symbol *symbols;        // Every label, for looking names up
+    int count;
+    int capacity;
+    char *names;
+    size_t names_used;
+    size_t names_capacity;
+
+    // The interval index: one entry per distinct address, sorted, built
+    // when the first lookup comes after a load
+    int sorted;
+    uint16_t *starts;       // Packed, so a binary search touches few cache lines
+    uint32_t *start_names;
+    int start_count;
+    int last;               // Symbol found by the previous lookup, -1 if none
+};
+
+SymbolTable *symbols_create(void) {
+    SymbolTable *table = calloc(1, sizeof(SymbolTable));
+    if (table) table->last = -1;
+    return table;
+}
+
+void symbols_free(SymbolTable *table) {
+    if (!table) return;
+    free(table->symbols);
+    free(table->names);
+    free(table->starts);
+    free(table->start_names);
+    free(table);
+}
+
+static int add_symbol(SymbolTable *table, uint16_t address, const char *name) {
+    size_t length = strlen(name) + 1;
+    if (table->names_used + length > table->names_capacity) {
+        size_t capacity = table->names_capacity ? table->names_capacity * 2 : 4096;
+        while (capacity < table->names_used + length) capacity *= 2;
+        char *names = realloc(table->names, capacity);
+        if (!names) return 0;
+        table->names = names;
+        table->names_capacity = capacity;
+    }
+    if (table->count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 256;
+        Symbol *symbols = realloc(table->symbols, capacity * sizeof(Symbol));
+        if (!symbols) return 0;
+        table->symbols = symbols;
+        table->capacity = capacity;
+    }
+    memcpy(table->names + table->names_used, name, length);
+    table->symbols[table->count].address = address;
+    table->symbols[table->count].name = (uint32_t)table->names_used;
+    table->symbols[table->count].order = (uint32_t)table->count;
+    table->count++;
+    table->names_used += length;
+    table->sorted = 0;
+    return 1;
+}
+
+static int parse_hex_address(const char *text, uint16_t *address) {
+    if (text[0] == 'C' && text[1] == ':') text += 2;    // VICE memory space prefix
+    if (text[0] == '$') text++;
+    else if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) text += 2;
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(text, &end, 16);
+    if (errno || *end || end == text || value > 0xFFFF) return 0;
+    *address = (uint16_t)value;
+    return 1;
+}
+
+int symbols_load(SymbolTable *table, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open label file '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    char line[1024];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_number++;
+        char *words[3];
+        int count = 0;
+        char *saved;
+        for (char *word = strtok_r(line, " \t\r\n", &saved); word && count < 3;
+             word = strtok_r(NULL, " \t\r\n", &saved)) {
+            words[count++] = word;
+        }
+        if (count == 0) continue;
+
+        // "al ADDR .name" (VICE) or "ADDR name"
+        uint16_t address;
+        const char *name;
+        if (strcmp(words[0], "al") == 0) {
+            if (count != 3 || !parse_hex_address(words[1], &address)) {
+                fprintf(stderr, "Error: %s:%d: Expected 'al ADDRESS .name'\n", path, line_number);
+                fclose(f);
+                return 0;
+            }
+            name = words[2];
+        } else if (count == 2 && parse_hex_address(words[0], &address)) {
+            name = words[1];
+        } else if (isalpha((unsigned char)words[0][0])) {
+            continue;       // Some other VICE monitor command
+        } else {
+            fprintf(stderr, "Error: %s:%d: Expected 'al ADDRESS .name'\n", path, line_number);
+            fclose(f);
+            return 0;
+        }
+        if (name[0] == '.') name++;
+        if (!*name) {
+            fprintf(stderr, "Error: %s:%d: Empty label name\n", path, line_number);
+            fclose(f);
+            return 0;
+        }
+        if (!add_symbol(table, address, name)) {
+            fprintf(stderr, "Error: Out of memory\n");
+            fclose(f);
+            return 0;
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    const Symbol *x = a, *y = b;
+    if (x->address != y->address) return x->address < y->address ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void build_index(SymbolTable *table) {
+    if (table->sorted) return;
+    qsort(table->symbols, table->count, sizeof(Symbol), compare_symbols);
+    free(table->starts);
+    free(table->start_names);
+    table->starts = malloc((table->count + 1) * sizeof(uint16_t));
+    table->start_names = malloc((table->count + 1) * sizeof(uint32_t));
+    table->start_count = 0;
+    table->last = -1;
+    if (!table->starts || !table->start_names) return;   // Lookups then find nothing
+    for (int i = 0; i < table->count; i++) {
+        if (i > 0 && table->symbols[i].address == table->symbols[i - 1].address) continue;
+        table->starts[table->start_count] = table->symbols[i].address;
+        table->start_names[table->start_count] = table->symbols[i].name;
+        table->start_count++;
+    }
+    table->sorted = 1;
+}
+
+int symbols_count(SymbolTable *table) {
+    if (!table) return 0;
+    build_index(table);
+    return table->start_count;
+}
+
+const char *symbols_name(SymbolTable *table, int index) {
+    return table->names + table->start_names[index];
+}
+
+uint16_t symbols_address(SymbolTable *table, int index) {
+    return table->starts[index];
+}
+
+int symbols_find(SymbolTable *table, uint16_t address) {
+    if (!table) return -1;
+    build_index(table);
+    int last = table->last;
+    if (last >= 0 && table->starts[last] <= address &&
+        (last + 1 == table->start_count || address < table->starts[last + 1])) {
+        return last;
+    }
+
+    // The last start at or below address
+    int low = 0, high = table->start_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (table->starts[mid] <= address) low = mid + 1;
+        else high = mid;
+    }
+    table->last = low - 1;
+    return low - 1;
+}
+
+int symbols_format(SymbolTable *table, uint16_t address, char *buf, size_t size) {
+    int index = symbols_find(table, address);
+    if (index < 0) {
+        if (size > 0) buf[0] = '\0';
+        return 0;
+    }
+    uint16_t offset = address - table->starts[index];
+    if (offset == 0) return snprintf(buf, size, "%s", symbols_name(table, index));
+    return snprintf(buf, size, "%s+$%X", symbols_name(table, index), offset);
+}
+
+int symbols_resolve(SymbolTable *table, const char *text, uint16_t *address) {
+    char *end;
+    long value;
+    errno = 0;
+    if (text[0] == '$') {
+        value = strtol(text + 1, &end, 16);
+        if (end == text + 1) return 0;
+    } else {
+        value = strtol(text, &end, 0);
+    }
+    if (end != text && !*end) {
+        if (errno || value < 0 || value > 0xFFFF) return 0;
+        *address = (uint16_t)value;
+        return 1;
+    }
+
+    // name or name+offset
+    if (!table) return 0;
+    const char *plus = strchr(text, '+');
+    size_t length = plus ? (size_t)(plus - text) : strlen(text);
+    uint16_t offset = 0;
+    if (plus && !symbols_resolve(NULL, plus + 1, &offset)) return 0;
+    for (int i = 0; i < table->count; i++) {
+        const char *name = table->names + table->symbols[i].name;
+        if (strncmp(name, text, length) == 0 && name[length] == '\0') {
+            *address = (uint16_t)(table->symbols[i].address + offset);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Assembler labels, for showing and accepting addresses by name. A symbol
+// covers the addresses from its own up to the next symbol's, so any PC maps
+// to the closest label at or below it.
+//
+// Label files are in the VICE format ld65 writes with -Ln
+// ("al C:080D .start"); lines of the form "080D start" are accepted too.
+// Other VICE monitor commands are ignored.
+
+typedef struct SymbolTable SymbolTable;
+
+SymbolTable *symbols_create(void);
+void symbols_free(SymbolTable *table);
+
+// Add the labels in path. Returns 0 (with a message on stderr) on failure.
+int symbols_load(SymbolTable *table, const char *path);
+
+int symbols_count(SymbolTable *table);
+const char *symbols_name(SymbolTable *table, int index);
+uint16_t symbols_address(SymbolTable *table, int index);
+
+// Index of the symbol covering address, or -1 if it is below every symbol
+// (or table is NULL). A binary search over a packed array of addresses,
+// skipped when address is still in the symbol found last time.
+int symbols_find(SymbolTable *table, uint16_t address);
+
+// Write "name" or "name+$off" for address into buf, or an empty string if no
+// symbol covers it. Returns the length written.
+int symbols_format(SymbolTable *table, uint16_t address, char *buf, size_t size);
+
+// Parse a number (hex with 0x or $, or decimal), a symbol name, or
+// name+number. Returns 0 if the text is none of these.
+int symbols_resolve(SymbolTable *table, const char *text, uint16_t *address);
+
+#endif
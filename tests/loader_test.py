@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+# Image loader tests for 6502emu. Usage: loader_test.py [path/to/6502emu]
+import os, subprocess, sys, tempfile
+
+EMU = sys.argv[1] if len(sys.argv) > 1 else './6502emu'
+
+
+def record(type, address, data):
+    body = bytes([len(data), address >> 8, address & 0xFF, type]) + data
+    return ':' + (body + bytes([-sum(body) & 0xFF])).hex().upper() + '\n'
+
+
+def load(name, text):
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, name)
+        with open(path, 'w') as f:
+            f.write(text)
+        return subprocess.run([EMU, '--load', path], capture_output=True, text=True)
+
+
+def test_hex_loads():
+    result = load('ok.hex', record(0, 0x0200, bytes([0xA9, 0x05, 0x00])) + record(1, 0, b''))
+    assert result.returncode == 0, result.stderr
+    assert 'Program terminated (BRK instruction)' in result.stdout, result.stdout
+
+
+def test_hex_linear_base_wrapping_past_64k():
+    # Base 0xFFFF0000 plus 0xFFF0 plus 32 bytes wraps to 0x10 in 32 bits
+    text = record(4, 0, bytes([0xFF, 0xFF])) + record(0, 0xFFF0, bytes(32)) + record(1, 0, b'')
+    result = load('wrap.hex', text)
+    assert result.returncode == 1, (result.returncode, result.stdout)
+    assert 'beyond 64KB' in result.stderr, result.stderr
+
+
+def test_hex_data_running_past_64k():
+    text = record(0, 0xFFF0, bytes(32)) + record(1, 0, b'')
+    result = load('past.hex', text)
+    assert result.returncode == 1, (result.returncode, result.stdout)
+    assert 'beyond 64KB' in result.stderr, result.stderr
+
+
+def main():
+    for name, fn in sorted(globals().items()):
+        if name.startswith('test_'):
+            fn()
+            print('ok', name)
+
+
+if __name__ == '__main__':
+    main()
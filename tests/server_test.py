@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+# Protocol tests for 6502emu --serve. Usage: server_test.py [path/to/6502emu]
+import os, random, socket, struct, subprocess, sys, tempfile, time
+
+EMU = sys.argv[1] if len(sys.argv) > 1 else './6502emu'
+
+JOB_BINARY, JOB_BASIC, INPUT = 0, 1, 2
+FLAG_STREAM_INPUT, INPUT_END = 0x01, 0x01
+WANT_OUTPUT, WANT_STATS = 0x04, 0x10
+STATUS_BRK, STATUS_DONE, STATUS_ERROR = 1, 3, 0xFF
+CONSOLE_PAGE = 0xFE
+
+# Copy the console's input to its output until the input ends, then BRK
+ECHO = bytes([
+    0xAD, 0x01, 0xFE,   # loop: LDA $FE01
+    0x30, 0x05,         #       BMI read
+    0x29, 0x40,         #       AND #$40
+    0xF0, 0xF7,         #       BEQ loop
+    0x00,               #       BRK
+    0xAD, 0x00, 0xFE,   # read: LDA $FE00
+    0x8D, 0x00, 0xFE,   #       STA $FE00
+    0x4C, 0x00, 0x02,   #       JMP loop
+])
+
+
+def request(job_id, code, input=b'', type=JOB_BINARY, want=WANT_OUTPUT, console_page=0, flags=0):
+    body = struct.pack('<IBBBBHHHBBIQII', job_id, type, 0, want, console_page,
+                       0x0200, 0x0200, 0, flags, 0, 0, 0, len(code), len(input))
+    body += code + input
+    return struct.pack('<I', len(body)) + body
+
+
+def input_frame(job_id, text, end=False):
+    body = struct.pack('<IBBH', job_id, INPUT, INPUT_END if end else 0, 0) + text
+    return struct.pack('<I', len(body)) + body
+
+
+def recv_exact(s, n):
+    data = b''
+    while len(data) < n:
+        chunk = s.recv(n - len(data))
+        if not chunk:
+            raise EOFError('server closed the connection')
+        data += chunk
+    return data
+
+
+# Returns (job_id, status, output) of a response with OUTPUT, and the STATS
+# section as a tuple if there is one
+def response(s, stats=False):
+    length, = struct.unpack('<I', recv_exact(s, 4))
+    payload = recv_exact(s, length)
+    job_id, status, want = struct.unpack_from('<IBB', payload)
+    assert want & WANT_OUTPUT, want
+    size, = struct.unpack_from('<I', payload, 8)
+    result = (job_id, status, payload[12:12 + size])
+    if stats:
+        assert want & WANT_STATS, want
+        result += (struct.unpack_from('<6Q', payload, 12 + size),)
+    return result
+
+
+def nothing_received(s, seconds=0.3):
+    s.settimeout(seconds)
+    try:
+        return not s.recv(1, socket.MSG_PEEK)
+    except socket.timeout:
+        return True
+    finally:
+        s.settimeout(None)
+
+
+def test_binary_echo(path):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(request(1, ECHO, b'hello, console\n', console_page=CONSOLE_PAGE))
+    assert response(s) == (1, STATUS_BRK, b'hello, console\n')
+    s.close()
+
+
+def test_binary_input_without_console(path):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(request(2, ECHO, b'lost\n'))
+    job_id, status, message = response(s)
+    assert (job_id, status) == (2, STATUS_ERROR), (job_id, status)
+    assert b'console' in message, message
+    s.close()
+
+
+def test_binary_job_parks_for_streamed_input(path):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(request(3, ECHO, b'ab', want=WANT_OUTPUT | WANT_STATS,
+                      console_page=CONSOLE_PAGE, flags=FLAG_STREAM_INPUT))
+    # It has echoed its first input and now waits, parked, for more
+    assert nothing_received(s)
+    s.sendall(input_frame(3, b'cd'))
+    assert nothing_received(s)
+    s.sendall(input_frame(3, b'ef\n', end=True))
+    job_id, status, output, stats = response(s, stats=True)
+    assert (job_id, status, output) == (3, STATUS_BRK, b'abcdef\n'), (job_id, status, output)
+    slices, run_ns, ready_ns, max_ready_ns, parks, parked_ns = stats
+    assert parks >= 2, parks
+    assert parked_ns >= 500000000, parked_ns
+    s.close()
+
+
+def test_basic_job_parks_for_streamed_input(path):
+    program = b'10 INPUT A\n20 INPUT B\n30 PRINT A + B\n'
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(request(4, program, b'40\n', type=JOB_BASIC, flags=FLAG_STREAM_INPUT))
+    assert nothing_received(s)
+    s.sendall(input_frame(4, b'2\n'))
+    job_id, status, output = response(s)
+    assert (job_id, status) == (4, STATUS_DONE), (job_id, status)
+    assert b'42' in output, output
+    s.close()
+
+
+def test_basic_input_resumes_mid_statement(path):
+    # The job waits between A and B: resuming must neither print the
+    # prompt again nor read A again
+    program = b'10 INPUT "VALUES"; A, B\n20 PRINT A; " "; B\n'
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(request(7, program, b'1\n', type=JOB_BASIC, flags=FLAG_STREAM_INPUT))
+    assert nothing_received(s)
+    s.sendall(input_frame(7, b'2\n', end=True))
+    job_id, status, output = response(s)
+    assert (job_id, status) == (7, STATUS_DONE), (job_id, status)
+    assert output.count(b'VALUES') == 1, output
+    assert b'1 2' in output, output
+    s.close()
+
+
+def test_many_streaming_jobs_on_one_connection(path):
+    # Enough to grow the connection's job map several times; ending them in
+    # shuffled order takes them out of it in every position
+    ids = list(range(100, 300))
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(b''.join(request(i, ECHO, b'%d:' % i, console_page=CONSOLE_PAGE,
+                               flags=FLAG_STREAM_INPUT) for i in ids))
+    random.Random(1).shuffle(ids)
+    s.sendall(b''.join(input_frame(i, b'%d\n' % (i * 3), end=True) for i in ids))
+    outputs = {}
+    for _ in ids:
+        job_id, status, output = response(s)
+        assert status == STATUS_BRK, (job_id, status, output)
+        outputs[job_id] = output
+    assert outputs == {i: b'%d:%d\n' % (i, i * 3) for i in ids}
+    s.close()
+
+
+def test_duplicate_streaming_job_id(path):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(request(8, ECHO, b'first', console_page=CONSOLE_PAGE, flags=FLAG_STREAM_INPUT) +
+              request(8, ECHO, b'second', console_page=CONSOLE_PAGE, flags=FLAG_STREAM_INPUT))
+    job_id, status, message = response(s)
+    assert (job_id, status) == (8, STATUS_ERROR), (job_id, status)
+    assert b'already streams' in message, message
+    s.sendall(input_frame(8, b'!', end=True))
+    assert response(s) == (8, STATUS_BRK, b'first!')
+    s.close()
+
+
+def test_shutdown_ends_streamed_input(path):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(request(5, ECHO, b'xy', console_page=CONSOLE_PAGE, flags=FLAG_STREAM_INPUT))
+    s.shutdown(socket.SHUT_WR)
+    assert response(s) == (5, STATUS_BRK, b'xy')
+    s.close()
+
+
+def test_input_for_unknown_job(path):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    s.sendall(input_frame(6, b'nobody\n', end=True))
+    job_id, status, message = response(s)
+    assert (job_id, status) == (6, STATUS_ERROR), (job_id, status)
+    assert b'No such job' in message, message
+    s.close()
+
+
+def main():
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'emu.sock')
+        server = subprocess.Popen([EMU, '--serve', path, '--workers', '2'],
+                                  stdout=subprocess.DEVNULL)
+        try:
+            for _ in range(100):
+                if os.path.exists(path):
+                    break
+                time.sleep(0.05)
+            tests = [(name, fn) for name, fn in sorted(globals().items()) if name.startswith('test_')]
+            for name, fn in tests:
+                fn(path)
+                print('ok', name)
+        finally:
+            server.terminate()
+            server.wait()
+
+
+if __name__ == '__main__':
+    main()